@@ -0,0 +1,110 @@
+// Renders a fixed scene without the GUI and reports ray throughput. Built twice, once per
+// precision mode (zengine_bench_float and zengine_bench_double), so the two can be compared
+// on the same machine:
+//
+//     zengine_bench_float [width] [height] [samples]
+//     zengine_bench_double [width] [height] [samples]
+//
+// ZENGINE_ISA=<scalar|sse42|avx2|avx512> pins the SIMD kernels to compare them.
+
+#include "../src/hittable.h"
+#include "../src/sphere.h"
+#include "../src/quad.h"
+#include "../src/objects.h"
+#include "../src/render_world.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+hittable_list build_scene() {
+    hittable_list world;
+    auto ground = make_shared<lambertian>(make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9)));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000));
+    world.objects.back()->set_material(ground);
+
+    for (int a = -8; a < 8; a++) {
+        for (int b = -8; b < 8; b++) {
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+            double choose = random_double();
+            shared_ptr<material> mat;
+            if (choose < 0.7) mat = make_shared<lambertian>(make_shared<solid_color>(randomVec3() * randomVec3()));
+            else if (choose < 0.9) mat = make_shared<metal>(make_shared<solid_color>(randomVec3(0.5, 1)), random_double(0, 0.5));
+            else mat = make_shared<dielectric>(1.5);
+
+            shared_ptr<hittable> obj;
+            if ((a + b) % 3 == 0) obj = make_shared<quad>(center, vec3(0.3, 0, 0), vec3(0, 0.3, 0.1));
+            else obj = make_shared<sphere>(center, 0.2);
+            obj->set_material(mat);
+            world.add(obj);
+        }
+    }
+
+    auto light = make_shared<diffuse_light>(make_shared<solid_color>(color(4, 4, 4)));
+    world.add(make_shared<quad>(point3(-2, 4, -2), vec3(4, 0, 0), vec3(0, 0, 4)));
+    world.objects.back()->set_material(light);
+    auto torus_obj = make_shared<torus>(point3(0, 1, 0), 1.0, 0.3);
+    torus_obj->set_material(make_shared<metal>(make_shared<solid_color>(color(0.8, 0.6, 0.2)), 0.1));
+    world.add(torus_obj);
+    return world;
+}
+
+color trace(const ray& r, int depth, const hittable& world, long long& rays) {
+    if (depth <= 0) return color(0, 0, 0);
+    rays++;
+    hit_record rec;
+    if (!world.hit(r, interval(real(0.001), infinity), rec))
+        return color(0.7, 0.8, 1.0);
+
+    ray scattered;
+    color attenuation;
+    color emitted = rec.mat->emitted(rec.u, rec.v, rec.p);
+    if (!rec.mat->scatter(r, rec, attenuation, scattered))
+        return emitted;
+    return emitted + attenuation * trace(scattered, depth - 1, world, rays);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int width = argc > 1 ? std::atoi(argv[1]) : 320;
+    int height = argc > 2 ? std::atoi(argv[2]) : 180;
+    int samples = argc > 3 ? std::atoi(argv[3]) : 8;
+    simd_isa isa = simd_init();
+
+    hittable_list list = build_scene();
+    render_world world(list.objects);
+
+    point3 lookfrom(13, 2, 3), lookat(0, 0, 0);
+    vec3 w = unit_vector(lookfrom - lookat);
+    vec3 u = unit_vector(cross(vec3(0, 1, 0), w));
+    vec3 v = cross(w, u);
+    real viewport_height = 2 * std::tan(degrees_to_radians(20) / 2) * 10;
+    real viewport_width = viewport_height * real(width) / height;
+    vec3 pixel_u = viewport_width * u / real(width);
+    vec3 pixel_v = viewport_height * -v / real(height);
+    point3 upper_left = lookfrom - real(10) * w - viewport_width * u / real(2) + viewport_height * v / real(2);
+
+    long long rays = 0;
+    color sum(0, 0, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            for (int s = 0; s < samples; s++) {
+                point3 target = upper_left + (i + real(random_double())) * pixel_u + (j + real(random_double())) * pixel_v;
+                sum += trace(ray(lookfrom, target - lookfrom), 10, world, rays);
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    color mean = sum / real(double(width) * height * samples);
+    std::printf("precision: %s\n", sizeof(real) == sizeof(float) ? "float" : "double");
+    std::printf("kernels: %s\n", simd_isa_name(isa));
+    std::printf("image: %dx%d, %d spp\n", width, height, samples);
+    std::printf("rays: %lld in %.3f s (%.2f Mrays/s)\n", rays, seconds, rays / seconds * 1e-6);
+    std::printf("mean color: %.4f %.4f %.4f\n", double(mean.x), double(mean.y), double(mean.z));
+    return 0;
+}
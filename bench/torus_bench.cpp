@@ -0,0 +1,174 @@
+// Compares torus::hit with the hit it replaced, solve_quartic (Ferrari's method on the quartic
+// of the whole ray, no bounding test) followed by the same normal and (u, v), for speed and for
+// rays that come out wrong:
+//
+//     zengine_bench_torus [rays] [minor_radius]
+//
+// Each ray is checked against a reference found by sampling the quartic densely along the
+// ray in long double, extrema included. Rays start close to the torus, then far from it, where the quartic of the
+// whole ray loses most of its precision. They are aimed at the torus's bounding box, where
+// every ray needs a solve, and then at a frame three times wider, where the torus covers
+// about as much of the view as it would in a scene.
+
+#include "../src/objects.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+struct bench_ray {
+    point3 origin;
+    vec3 direction;
+};
+
+// The quartic in ray parameter t, coefficients from t^0 up
+template <typename T>
+void torus_quartic(const bench_ray& r, T R, T r0, T c[5]) {
+    T ox = r.origin.x, oy = r.origin.y, oz = r.origin.z;
+    T dx = r.direction.x, dy = r.direction.y, dz = r.direction.z;
+    T dd = dx * dx + dy * dy + dz * dz;
+    T n = ox * dx + oy * dy + oz * dz;
+    T m = ox * ox + oy * oy + oz * oz;
+    T k = m + R * R - r0 * r0;
+    c[0] = k * k - 4 * R * R * (m - oy * oy);
+    c[1] = 4 * n * k - 8 * R * R * (n - oy * dy);
+    c[2] = 4 * n * n + 2 * k * dd - 4 * R * R * (dd - dy * dy);
+    c[3] = 4 * n * dd;
+    c[4] = dd * dd;
+}
+
+// Nearest root after t_min, or -1
+double reference_hit(const bench_ray& r, double R, double r0, double t_min) {
+    long double c[5];
+    torus_quartic<long double>(r, R, r0, c);
+    auto f = [&](long double t) { return (((c[4] * t + c[3]) * t + c[2]) * t + c[1]) * t + c[0]; };
+
+    // Only the span inside the bounding sphere can hold roots
+    long double ox = r.origin.x, oy = r.origin.y, oz = r.origin.z;
+    long double dx = r.direction.x, dy = r.direction.y, dz = r.direction.z;
+    long double dd = dx * dx + dy * dy + dz * dz;
+    long double b = (ox * dx + oy * dy + oz * dz) / dd;
+    long double disc = b * b - (ox * ox + oy * oy + oz * oz - (R + r0) * (R + r0)) / dd;
+    if (disc < 0) return -1;
+    // Widened a little: the torus touches the sphere along its outer equator, where the quartic
+    // at the entry point is only rounding noise.
+    long double margin = 0.01L * std::sqrt(disc);
+    long double lo = std::max<long double>(-b - std::sqrt(disc) - margin, t_min), hi = -b + std::sqrt(disc) + margin;
+    if (lo > hi) return -1;
+
+    // Samples, plus the extrema between them, where a grazing ray's pair of roots can hide
+    auto df = [&](long double t) { return ((4 * c[4] * t + 3 * c[3]) * t + 2 * c[2]) * t + c[1]; };
+    auto bisect = [](auto&& g, long double a, long double z, bool negative_at_a) {
+        for (int j = 0; j < 80; j++) {
+            long double mid = 0.5L * (a + z);
+            if ((g(mid) < 0) == negative_at_a) a = mid;
+            else z = mid;
+        }
+        return 0.5L * (a + z);
+    };
+    const int steps = 1 << 14;
+    long double prev_t = lo, prev_f = f(lo), prev_df = df(lo);
+    for (int i = 1; i <= steps; i++) {
+        long double t = lo + (hi - lo) * i / steps, ft = f(t), dft = df(t);
+        if ((dft < 0) != (prev_df < 0)) {
+            long double extremum = bisect(df, prev_t, t, prev_df < 0);
+            if ((f(extremum) < 0) != (prev_f < 0)) return double(bisect(f, prev_t, extremum, prev_f < 0));
+        }
+        if ((ft < 0) != (prev_f < 0)) return double(bisect(f, prev_t, t, prev_f < 0));
+        prev_t = t;
+        prev_f = ft;
+        prev_df = dft;
+    }
+    return -1;
+}
+
+// The previous torus::hit: the solve, then the hit record it filled in on a hit
+double legacy_hit(const bench_ray& r, double R, double r0, double t_min, hit_record& rec) {
+    double c[5];
+    torus_quartic<double>(r, R, r0, c);
+    double roots[4];
+    int count = solve_quartic(c[4], c[3], c[2], c[1], c[0], roots);
+    double t = -1;
+    for (int i = 0; i < count; i++) {
+        if (roots[i] > t_min && (t < 0 || roots[i] < t)) t = roots[i];
+    }
+    if (t < 0) return t;
+
+    rec.t = real(t);
+    rec.p = r.origin + rec.t * r.direction;
+    real s = std::sqrt(rec.p.x * rec.p.x + rec.p.z * rec.p.z);
+    rec.set_face_normal(ray(r.origin, r.direction),
+                        unit_vector(vec3(rec.p.x * (1 - real(R) / s), rec.p.y, rec.p.z * (1 - real(R) / s))));
+    rec.u = (std::atan2(rec.p.z, rec.p.x) + pi) / (2 * pi);
+    rec.v = (std::atan2(rec.p.y, s - real(R)) + pi) / (2 * pi);
+    return t;
+}
+
+struct tally {
+    long long hits = 0, misses = 0, false_hits = 0, off = 0;
+    double seconds = 0;
+};
+
+void score(tally& s, double t, double t_ref, double r0) {
+    bool hit = t >= 0, ref = t_ref >= 0;
+    s.hits += hit;
+    if (ref && !hit) s.misses++;
+    else if (hit && !ref) s.false_hits++;
+    else if (hit && std::fabs(t - t_ref) > 1e-5 * t_ref + 1e-3 * r0) s.off++;
+}
+
+void report(const char* name, const tally& s, size_t n) {
+    std::printf("  %-8s %7.1f ns/ray  hits %lld  missed %lld  false %lld  off %lld (%.3f%% wrong)\n", name,
+                s.seconds * 1e9 / n, s.hits, s.misses, s.false_hits, s.off,
+                100.0 * double(s.misses + s.false_hits + s.off) / n);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::atoi(argv[1]) : 200000;
+    double r0 = argc > 2 ? std::atof(argv[2]) : 0.3;
+    const double R = 1.0, t_min = 0.001;
+    torus shape(point3(0, 0, 0), R, r0);
+
+    std::printf("torus R=%g r=%g, %zu rays per run\n", R, r0, count);
+    for (double spread : { 1.0, 3.0 }) {
+        for (double distance : { 4.0, 40.0, 1000.0 }) {
+            std::vector<bench_ray> rays(count);
+            for (auto& r : rays) {
+                vec3 target(random_double(-1, 1) * (R + r0), random_double(-1, 1) * r0, random_double(-1, 1) * (R + r0));
+                r.origin = distance * unit_vector(randomVec3(-1, 1));
+                r.direction = real(spread) * target - r.origin;
+            }
+
+            std::vector<double> reference(count);
+            for (size_t i = 0; i < count; i++) reference[i] = reference_hit(rays[i], R, r0, t_min);
+
+            tally legacy, current;
+            std::vector<double> t(count);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < count; i++) {
+                hit_record rec;
+                t[i] = legacy_hit(rays[i], R, r0, t_min, rec);
+            }
+            legacy.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            for (size_t i = 0; i < count; i++) score(legacy, t[i], reference[i], r0);
+
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < count; i++) {
+                hit_record rec;
+                t[i] = shape.hit(ray(rays[i].origin, rays[i].direction), interval(real(t_min), infinity), rec) ? rec.t : -1;
+            }
+            current.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            for (size_t i = 0; i < count; i++) score(current, t[i], reference[i], r0);
+
+            std::printf("%s, distance %g:\n", spread == 1 ? "aimed at the bounds" : "wide frame", distance);
+            report("ferrari", legacy, count);
+            report("torus", current, count);
+        }
+    }
+    return 0;
+}
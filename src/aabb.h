@@ -5,31 +5,31 @@
 
 class interval {
   public:
-    double min, max;
+    real min, max;
 
     interval() : min(+infinity), max(-infinity) {} // Default interval is empty
 
-    interval(double min, double max) : min(min), max(max) {}
+    interval(real min, real max) : min(min), max(max) {}
 
-    double size() const {
+    real size() const {
         return max - min;
     }
 
-    bool contains(double x) const {
+    bool contains(real x) const {
         return min <= x && x <= max;
     }
 
-    bool surrounds(double x) const {
+    bool surrounds(real x) const {
         return min < x && x < max;
     }
 
-    double clamp(double x) const {
+    real clamp(real x) const {
         if (x < min) return min;
         if (x > max) return max;
         return x;
     }
 
-    interval expand(double delta) const {
+    interval expand(real delta) const {
         auto padding = delta/2;
         return interval(min - padding, max + padding);
     }
@@ -46,18 +46,18 @@ class interval {
 const interval interval::empty    = interval(+infinity, -infinity);
 const interval interval::universe = interval(-infinity, +infinity);
 
-interval operator+(const interval& ival, double displacement) {
+interval operator+(const interval& ival, real displacement) {
     return interval(ival.min + displacement, ival.max + displacement);
 }
 
-interval operator+(double displacement, const interval& ival) {
+interval operator+(real displacement, const interval& ival) {
     return ival + displacement;
 }
 
 
 using color = vec3;
 
-inline double linear_to_gamma(double linear_component)
+inline real linear_to_gamma(real linear_component)
 {
     if (linear_component > 0)
         return std::sqrt(linear_component);
@@ -120,7 +120,7 @@ class aabb {
 
         for (int axis = 0; axis < 3; axis++) {
             const interval& ax = axis_interval(axis);
-            const double adinv = 1.0 / ray_dir[axis]; // Speed or sort of, but it's for unit of time,  like (neccesary distance) / (distance of one unit) 
+            const real adinv = real(1) / ray_dir[axis]; // Speed or sort of, but it's for unit of time,  like (neccesary distance) / (distance of one unit) 
 
             auto t0 = (ax.min - ray_orig[axis]) * adinv;
             auto t1 = (ax.max - ray_orig[axis]) * adinv;
@@ -133,12 +133,11 @@ class aabb {
                 if (t0 < ray_t.max) ray_t.max = t0;
             }
 
-            return true;
             if (ray_t.max <= ray_t.min)
                 return false;
         }
 
-        return false;
+        return true;
     }
 
     int longest_axis() const {
@@ -153,7 +152,7 @@ class aabb {
     void pad_to_minimums() {
         // Adjust the AABB so that no side is narrower than some delta, padding if necessary.
 
-        double delta = 0.0001;
+        real delta = 0.0001;
         if (x.size() < delta) x = x.expand(delta);
         if (y.size() < delta) y = y.expand(delta);
         if (z.size() < delta) z = z.expand(delta);
@@ -0,0 +1,280 @@
+#ifndef BATCH_KERNELS_H
+#define BATCH_KERNELS_H
+
+#include "simd/simd.h"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+// Batched intersection of one ray against a run of same-type primitives stored in SoA form.
+// Each kernel returns the index of the nearest primitive hit in [begin, begin + count) and
+// shortens t_max to it, or returns -1. Only plain arrays cross this interface, so the kernels
+// do not depend on the rest of the engine.
+//
+// The arrays must stay readable up to batch_padding elements past the last primitive: the
+// SIMD versions load whole vectors and mask off the lanes past the end of the run.
+
+constexpr uint32_t batch_padding = 8;
+
+// Scalar kernels, used for double precision and as the reference for the SIMD versions.
+
+template <typename T>
+int sphere_batch_hit_scalar(const sphere_batch<T>& s, uint32_t begin, uint32_t count,
+                            const batch_ray<T>& r, T t_min, T& t_max) {
+    int best = -1;
+    T a = r.dx * r.dx + r.dy * r.dy + r.dz * r.dz;
+    for (uint32_t i = begin; i < begin + count; i++) {
+        T ocx = s.cx[i] + r.time * s.vx[i] - r.ox;
+        T ocy = s.cy[i] + r.time * s.vy[i] - r.oy;
+        T ocz = s.cz[i] + r.time * s.vz[i] - r.oz;
+        T h = r.dx * ocx + r.dy * ocy + r.dz * ocz;
+        T c = ocx * ocx + ocy * ocy + ocz * ocz - s.radius[i] * s.radius[i];
+        T discriminant = h * h - a * c;
+        if (discriminant < 0) continue;
+
+        T sqrtd = std::sqrt(discriminant);
+        T root = (h - sqrtd) / a;
+        if (!(t_min < root && root < t_max)) {
+            root = (h + sqrtd) / a;
+            if (!(t_min < root && root < t_max)) continue;
+        }
+        t_max = root;
+        best = static_cast<int>(i);
+    }
+    return best;
+}
+
+// Regular polygon with the given number of sides inscribed in the circle of diameter 1 around
+// (0.5, 0.5), with a corner at (1, 0.5). Only points between its inscribed and circumscribed
+// circles need the angle, folded into the sector of the nearest edge.
+template <typename T>
+bool planar_polygon_test(T a, T b, T sides) {
+    T x = a - T(0.5), y = b - T(0.5);
+    T r_squared = x * x + y * y;
+    if (!(r_squared <= T(0.25)) || sides < 3) return false;
+    T half_angle = T(3.14159265358979323846) / std::floor(sides);
+    T apothem = T(0.5) * std::cos(half_angle);
+    if (r_squared <= apothem * apothem) return true;
+    T phi = std::atan2(y, x);
+    T offset = phi - (std::floor(phi / (2 * half_angle)) * 2 + 1) * half_angle;
+    return std::sqrt(r_squared) * std::cos(offset) <= apothem;
+}
+
+template <typename T>
+bool planar_shape_test(int32_t shape, T a, T b, T p0, T p1) {
+    switch (shape) {
+        case batch_shape_parallelogram: return a >= 0 && a <= 1 && b >= 0 && b <= 1;
+        case batch_shape_triangle: return a >= 0 && b >= 0 && a + b <= 1;
+        case batch_shape_disk: {
+            T dx = a - p0, dy = b - p0;
+            return dx * dx + dy * dy <= p0 * p0;
+        }
+        case batch_shape_ring: {
+            T x = a - T(0.5), y = b - T(0.5);
+            T r_squared = x * x + y * y;
+            return r_squared <= p1 * p1 * T(0.25) && r_squared >= p0 * p0 * T(0.25);
+        }
+        case batch_shape_ellipse: {
+            T x = (a - T(0.5)) / T(0.5), y = (b - T(0.5)) / T(0.4);
+            return x * x + y * y <= 1;
+        }
+        case batch_shape_polygon: return planar_polygon_test(a, b, p0);
+    }
+    return false;
+}
+
+// Also returns the plane coordinates (a, b) of the nearest hit.
+template <typename T>
+int planar_batch_hit_scalar(const planar_batch<T>& q, uint32_t begin, uint32_t count,
+                            const batch_ray<T>& r, T t_min, T& t_max, T& hit_a, T& hit_b) {
+    int best = -1;
+    for (uint32_t i = begin; i < begin + count; i++) {
+        T denom = q.nx[i] * r.dx + q.ny[i] * r.dy + q.nz[i] * r.dz;
+        if (std::fabs(denom) < T(1e-8)) continue;
+
+        T t = (q.d[i] - (q.nx[i] * r.ox + q.ny[i] * r.oy + q.nz[i] * r.oz)) / denom;
+        if (!(t_min <= t && t <= t_max)) continue;
+
+        T px = r.ox + t * r.dx - q.qx[i];
+        T py = r.oy + t * r.dy - q.qy[i];
+        T pz = r.oz + t * r.dz - q.qz[i];
+        // a = w . (p x v), b = w . (u x p)
+        T a = q.wx[i] * (py * q.vz[i] - pz * q.vy[i])
+            + q.wy[i] * (pz * q.vx[i] - px * q.vz[i])
+            + q.wz[i] * (px * q.vy[i] - py * q.vx[i]);
+        T b = q.wx[i] * (q.uy[i] * pz - q.uz[i] * py)
+            + q.wy[i] * (q.uz[i] * px - q.ux[i] * pz)
+            + q.wz[i] * (q.ux[i] * py - q.uy[i] * px);
+        if (!planar_shape_test(q.shape[i], a, b, q.p0[i], q.p1[i])) continue;
+
+        t_max = t;
+        hit_a = a;
+        hit_b = b;
+        best = static_cast<int>(i);
+    }
+    return best;
+}
+
+// Also returns which part of the nearest quadric was hit, see quadric_batch. The min/max
+// selections are written the way the vector instructions behave, so NaN roots are dropped
+// the same way as in the SIMD versions.
+template <typename T>
+int quadric_batch_hit_scalar(const quadric_batch<T>& q, uint32_t begin, uint32_t count,
+                             const batch_ray<T>& r, T t_min, T& t_max, int32_t& part) {
+    int best = -1;
+    for (uint32_t i = begin; i < begin + count; i++) {
+        T ox = r.ox - q.cx[i], oy = r.oy - q.cy[i], oz = r.oz - q.cz[i];
+
+        // A d and A o + b give every coefficient of f(o + t d) = a t^2 + 2 h t + c.
+        T adx = q.xx[i] * r.dx + q.xy[i] * r.dy + q.xz[i] * r.dz;
+        T ady = q.xy[i] * r.dx + q.yy[i] * r.dy + q.yz[i] * r.dz;
+        T adz = q.xz[i] * r.dx + q.yz[i] * r.dy + q.zz[i] * r.dz;
+        T gx = q.xx[i] * ox + q.xy[i] * oy + q.xz[i] * oz + q.bx[i];
+        T gy = q.xy[i] * ox + q.yy[i] * oy + q.yz[i] * oz + q.by[i];
+        T gz = q.xz[i] * ox + q.yz[i] * oy + q.zz[i] * oz + q.bz[i];
+        T a = adx * r.dx + ady * r.dy + adz * r.dz;
+        T h = gx * r.dx + gy * r.dy + gz * r.dz;
+        T c = gx * ox + gy * oy + gz * oz + (q.bx[i] * ox + q.by[i] * oy + q.bz[i] * oz) + q.c[i];
+        T s_o = q.sx[i] * ox + q.sy[i] * oy + q.sz[i] * oz;
+        T s_d = q.sx[i] * r.dx + q.sy[i] * r.dy + q.sz[i] * r.dz;
+
+        T t_hit = std::numeric_limits<T>::infinity();
+        int32_t hit_part = quadric_part_surface;
+        T discriminant = h * h - a * c;
+        if (discriminant >= 0) {
+            // Roots as k / a and c / k: no cancellation when a is close to zero, as it is for
+            // rays along the axis of a cylinder or paraboloid.
+            T k = -(h + std::copysign(std::sqrt(discriminant), h));
+            T t0 = k / a, t1 = c / k;
+            T near_root = t0 < t1 ? t0 : t1;
+            T far_root = t0 > t1 ? t0 : t1;
+            T s_near = s_o + near_root * s_d, s_far = s_o + far_root * s_d;
+            if (t_min < near_root && near_root < t_max && q.slab_min[i] <= s_near && s_near <= q.slab_max[i])
+                t_hit = near_root;
+            else if (t_min < far_root && far_root < t_max && q.slab_min[i] <= s_far && s_far <= q.slab_max[i])
+                t_hit = far_root;
+        }
+
+        if (q.capped[i]) {
+            for (int side = 0; side < 2; side++) {
+                T limit = t_hit < t_max ? t_hit : t_max;
+                T t = ((side ? q.slab_max[i] : q.slab_min[i]) - s_o) / s_d;
+                if (!(t_min < t && t < limit)) continue;
+
+                // Inside the cross-section when f <= 0 there
+                T px = ox + t * r.dx, py = oy + t * r.dy, pz = oz + t * r.dz;
+                T fx = q.xx[i] * px + q.xy[i] * py + q.xz[i] * pz + 2 * q.bx[i];
+                T fy = q.xy[i] * px + q.yy[i] * py + q.yz[i] * pz + 2 * q.by[i];
+                T fz = q.xz[i] * px + q.yz[i] * py + q.zz[i] * pz + 2 * q.bz[i];
+                if (!(fx * px + fy * py + fz * pz + q.c[i] <= 0)) continue;
+                t_hit = t;
+                hit_part = side ? quadric_part_cap_max : quadric_part_cap_min;
+            }
+        }
+
+        if (!(t_hit < t_max)) continue;
+        t_max = t_hit;
+        part = hit_part;
+        best = static_cast<int>(i);
+    }
+    return best;
+}
+
+template <typename T, int P>
+uint32_t sphere_packet_hit_scalar(const sphere_batch<T>& s, uint32_t begin, uint32_t count,
+                                  const batch_packet<T, P>& r, uint32_t lanes, T t_min, T t_max[P], int32_t best[P]) {
+    uint32_t improved = 0;
+    for (int l = 0; l < P; l++) {
+        if (!(lanes & (1u << l))) continue;
+        batch_ray<T> ray{ r.ox[l], r.oy[l], r.oz[l], r.dx[l], r.dy[l], r.dz[l], r.time[l] };
+        int k = sphere_batch_hit_scalar(s, begin, count, ray, t_min, t_max[l]);
+        if (k < 0) continue;
+        best[l] = k;
+        improved |= 1u << l;
+    }
+    return improved;
+}
+
+template <typename T, int P>
+uint32_t planar_packet_hit_scalar(const planar_batch<T>& q, uint32_t begin, uint32_t count,
+                                  const batch_packet<T, P>& r, uint32_t lanes, T t_min, T t_max[P], int32_t best[P],
+                                  T hit_a[P], T hit_b[P]) {
+    uint32_t improved = 0;
+    for (int l = 0; l < P; l++) {
+        if (!(lanes & (1u << l))) continue;
+        batch_ray<T> ray{ r.ox[l], r.oy[l], r.oz[l], r.dx[l], r.dy[l], r.dz[l], r.time[l] };
+        int k = planar_batch_hit_scalar(q, begin, count, ray, t_min, t_max[l], hit_a[l], hit_b[l]);
+        if (k < 0) continue;
+        best[l] = k;
+        improved |= 1u << l;
+    }
+    return improved;
+}
+
+// Single precision goes through the kernels selected for this CPU; double precision has no
+// SIMD path.
+
+template <typename T>
+int sphere_batch_hit(const sphere_batch<T>& s, uint32_t begin, uint32_t count,
+                     const batch_ray<T>& r, T t_min, T& t_max) {
+    if constexpr (std::is_same_v<T, float>) return simd_active.sphere_hit(s, begin, count, r, t_min, t_max);
+    return sphere_batch_hit_scalar(s, begin, count, r, t_min, t_max);
+}
+
+template <typename T>
+int planar_batch_hit(const planar_batch<T>& q, uint32_t begin, uint32_t count,
+                     const batch_ray<T>& r, T t_min, T& t_max, T& hit_a, T& hit_b) {
+    if constexpr (std::is_same_v<T, float>) return simd_active.planar_hit(q, begin, count, r, t_min, t_max, hit_a, hit_b);
+    return planar_batch_hit_scalar(q, begin, count, r, t_min, t_max, hit_a, hit_b);
+}
+
+template <typename T>
+int quadric_batch_hit(const quadric_batch<T>& q, uint32_t begin, uint32_t count,
+                      const batch_ray<T>& r, T t_min, T& t_max, int32_t& part) {
+    if constexpr (std::is_same_v<T, float>) return simd_active.quadric_hit(q, begin, count, r, t_min, t_max, part);
+    return quadric_batch_hit_scalar(q, begin, count, r, t_min, t_max, part);
+}
+
+// Packet kernels the same way, for packets of 8 rays.
+
+template <typename T, int P>
+uint32_t sphere_packet_hit(const sphere_batch<T>& s, uint32_t begin, uint32_t count,
+                           const batch_packet<T, P>& r, uint32_t lanes, T t_min, T t_max[P], int32_t best[P]) {
+    if constexpr (std::is_same_v<T, float>) {
+        static_assert(P == 8, "the packet kernels handle packets of 8 rays");
+        return simd_active.sphere_packet_hit(s, begin, count, r, lanes, t_min, t_max, best);
+    }
+    return sphere_packet_hit_scalar(s, begin, count, r, lanes, t_min, t_max, best);
+}
+
+template <typename T, int P>
+uint32_t planar_packet_hit(const planar_batch<T>& q, uint32_t begin, uint32_t count,
+                           const batch_packet<T, P>& r, uint32_t lanes, T t_min, T t_max[P], int32_t best[P],
+                           T hit_a[P], T hit_b[P]) {
+    if constexpr (std::is_same_v<T, float>) {
+        static_assert(P == 8, "the packet kernels handle packets of 8 rays");
+        return simd_active.planar_packet_hit(q, begin, count, r, lanes, t_min, t_max, best, hit_a, hit_b);
+    }
+    return planar_packet_hit_scalar(q, begin, count, r, lanes, t_min, t_max, best, hit_a, hit_b);
+}
+
+// Quadrics have no packet kernel: each lane goes through the per-ray kernel, which is already
+// vectorized across the quadrics of the run.
+template <typename T, int P>
+uint32_t quadric_packet_hit(const quadric_batch<T>& q, uint32_t begin, uint32_t count,
+                            const batch_packet<T, P>& r, uint32_t lanes, T t_min, T t_max[P], int32_t best[P],
+                            int32_t part[P]) {
+    uint32_t improved = 0;
+    for (int l = 0; l < P; l++) {
+        if (!(lanes & (1u << l))) continue;
+        batch_ray<T> ray{ r.ox[l], r.oy[l], r.oz[l], r.dx[l], r.dy[l], r.dz[l], r.time[l] };
+        int k = quadric_batch_hit(q, begin, count, ray, t_min, t_max[l], part[l]);
+        if (k < 0) continue;
+        best[l] = k;
+        improved |= 1u << l;
+    }
+    return improved;
+}
+
+#endif
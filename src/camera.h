@@ -17,84 +17,14 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include "thread_pool.h"
+#include "wavefront.h"
 #include <../external/tinyfiledialogs.h>
 
 
 struct Tile {
     int x0, x1, y0, y1;
 };
-class ThreadPool {
-public:
-    ThreadPool(size_t num_threads) : stop(false) {
-        for (size_t i = 0; i < num_threads; ++i) {
-            workers.emplace_back([this] {
-                while (true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(queue_mutex);
-                        condition.wait(lock, [this] { return stop || !tasks.empty(); });
-                        if (stop && tasks.empty()) return;
-                        task = std::move(tasks.front());
-                        tasks.pop();
-                    }
-                    task();
-                    notify_task_completion();
-                }
-            });
-        }
-    }
-
-    ~ThreadPool() {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            stop = true;
-        }
-        condition.notify_all();
-        for (std::thread& worker : workers) {
-            worker.join();
-        }
-    }
-
-    void enqueue(std::function<void()> task) {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            tasks.push(std::move(task));
-            total_tasks++;
-        }
-        condition.notify_one();
-    }
-
-    void wait_for_completion() {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        completion_condition.wait(lock, [this] { return tasks_completed >= total_tasks; });
-    }
-
-
-    void notify_task_completion() {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            tasks_completed++;
-        }
-        completion_condition.notify_one();
-    }
-
-    void reset_completion() {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        tasks_completed = 0;
-        total_tasks = 0;
-    }
-
-private:
-    std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    std::condition_variable completion_condition;
-    bool stop;
-    size_t tasks_completed;
-    size_t total_tasks = 0;
-};
-
 
 class camera {
 public:
@@ -183,31 +113,45 @@ public:
 
             completed_rows = 0;
             std::fill(pixel_buffer.begin(), pixel_buffer.end(), color(0, 0, 0));
-            for (int start_row = 0; start_row < render_height; start_row += rows_per_task) {
-                int end_row = std::min(start_row + rows_per_task, render_height);
-                thread_pool.enqueue([this, &sc, start_row, end_row, &format, &completed_rows]() {
-                    for (int j = start_row; j < end_row; ++j) {
-                        for (int i = 0; i < render_width; ++i) {
-                            int idx = j * render_width + i;
-                            for (int _ = 0; _ < samples_per_pixel; ++_) {
-                                ray r = get_ray(i, j);
-                                this->pixel_buffer[idx] += ray_color(r, max_depth, sc);
-                            }
-
-                            color c = this->pixel_buffer[idx] * pixel_samples_scale;
-                            c = color(sqrt(c.x), sqrt(c.y), sqrt(c.z));
-                            this->pixel_data[idx] = SDL_MapRGBA(
-                                format,
-                                Uint8(clamp(c.x, 0.0, 1.0) * 255.99),
-                                Uint8(clamp(c.y, 0.0, 1.0) * 255.99),
-                                Uint8(clamp(c.z, 0.0, 1.0) * 255.99),
-                                255
-                            );
-
-                        }
+            if (gui::use_wavefront && max_depth > 0) {
+                wavefront.render(sc.get_world(), thread_pool, render_width, render_height, samples_per_pixel, max_depth, threshold,
+                    [this](int i, int j) { return get_ray(i, j); },
+                    [this, &sc](const ray& r) { return miss_color(r, sc); },
+                    pixel_buffer);
+                thread_pool.parallel_for(render_height, rows_per_task, [this, &format, &completed_rows](size_t begin, size_t end) {
+                    for (size_t j = begin; j < end; ++j) {
+                        display_row(int(j), format);
                         completed_rows++;
                     }
                 });
+            } else {
+                for (int start_row = 0; start_row < render_height; start_row += rows_per_task) {
+                    int end_row = std::min(start_row + rows_per_task, render_height);
+                    thread_pool.enqueue([this, &sc, start_row, end_row, &format, &completed_rows]() {
+                        ray_packet packet;
+                        hit_record recs[ray_packet_size];
+                        const render_world& world = sc.get_world();
+                        for (int j0 = start_row; j0 < end_row; j0 += ray_packet_height) {
+                            for (int i0 = 0; i0 < render_width && max_depth > 0; i0 += ray_packet_width) {
+                                for (int _ = 0; _ < samples_per_pixel; ++_) {
+                                    get_ray_packet(i0, j0, end_row, packet);
+                                    uint32_t hits = world.hit_packet(packet, interval(threshold, infinity), recs);
+                                    for (int l = 0; l < ray_packet_size; l++) {
+                                        if (!(packet.active & (1u << l))) continue;
+                                        int idx = (j0 + l / ray_packet_width) * render_width + i0 + l % ray_packet_width;
+                                        this->pixel_buffer[idx] += shade(packet.rays[l], hits & (1u << l), recs[l], max_depth, sc);
+                                    }
+                                }
+                            }
+
+                            int j_end = std::min(j0 + ray_packet_height, end_row);
+                            for (int j = j0; j < j_end; ++j) {
+                                display_row(j, format);
+                                completed_rows++;
+                            }
+                        }
+                    });
+                }
             }
 
             while (completed_rows < render_height) {
@@ -439,12 +383,12 @@ private:
     point3 pixel00_loc;
     vec3 pixel_delta_u;
     vec3 pixel_delta_v;
-    double pixel_samples_scale;
+    real pixel_samples_scale;
     vec3 u, v, w;
     vec3 defocus_disk_u;
     vec3 defocus_disk_v;
-    double viewport_width;
-    double viewport_height;
+    real viewport_width;
+    real viewport_height;
     SDL_GLContext gl_context;
     GLuint render_texture = 0;
     ImGuiIO io;
@@ -452,8 +396,9 @@ private:
     bool mouse_grabbed = false;
     bool object_grabbed = false;
     ThreadPool thread_pool;
+    wavefront_integrator wavefront;
     state st;
-    double threshold = 0.001;
+    real threshold = 0.001;
     std::vector<color> pixel_buffer;
     std::vector<Uint32> pixel_data;
     mutable std::mutex camera_mutex;
@@ -567,7 +512,7 @@ private:
         auto theta = degrees_to_radians(vfov);
         auto h = std::tan(theta / 2);
         viewport_height = 2 * h * focus_dist;
-        viewport_width = viewport_height * (double(render_width) / render_height);
+        viewport_width = viewport_height * (real(render_width) / render_height);
         vec3 viewport_u = viewport_width * u;
         vec3 viewport_v = viewport_height * -v;
         pixel_delta_u = viewport_u / render_width;
@@ -583,9 +528,15 @@ private:
         if (depth <= 0)
             return color(0, 0, 0);
 
-        const hittable& world = sc.get_world();
         hit_record rec;
-        if (world.hit(r, interval(threshold, infinity), rec)) {
+        bool hit = sc.get_world().hit(r, interval(threshold, infinity), rec);
+        return shade(r, hit, rec, depth, sc);
+    }
+
+    // Colour of a ray whose nearest hit has already been found, so primary rays traced as a
+    // packet share the shading of ray_color.
+    color shade(const ray& r, bool hit, const hit_record& rec, int depth, const scene& sc) const {
+        if (hit) {
             ray scattered;
             color attenuation;
             color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
@@ -594,8 +545,13 @@ private:
             return color_from_emission + attenuation * ray_color(scattered, depth - 1, sc);
         }
 
+        return miss_color(r, sc);
+    }
+
+    // Colour of a ray that leaves the scene: the grid if it is shown, else the background.
+    color miss_color(const ray& r, const scene& sc) const {
         if (sc.is_grid_shown() && std::abs(r.direction().y) > threshold) {
-            double t = -r.origin().y / r.direction().y;
+            real t = -r.origin().y / r.direction().y;
             if (t > threshold) {
                 point3 intersection = r.at(t);
                 color grid_color;
@@ -606,6 +562,33 @@ private:
         }
         return background;
     }
+
+    // Display values of row j of the accumulation buffer. In single precision the buffer is
+    // already the r, g, b float triples the tonemap kernel reads.
+    void display_row(int j, const SDL_PixelFormat* format) {
+        size_t first = size_t(j) * render_width;
+#ifndef ZENGINE_DOUBLE_PRECISION
+        static_assert(sizeof(color) == 3 * sizeof(float), "color must be three packed floats");
+        pixel_layout layout{ format->Rshift, format->Gshift, format->Bshift, format->Amask };
+        simd_active.tonemap(&pixel_buffer[first].x, render_width, pixel_samples_scale, layout, &pixel_data[first]);
+#else
+        for (int i = 0; i < render_width; ++i)
+            pixel_data[first + i] = display_pixel(pixel_buffer[first + i], format);
+#endif
+    }
+
+    // Gamma-corrected display value of an accumulated pixel.
+    Uint32 display_pixel(const color& sum, const SDL_PixelFormat* format) const {
+        color c = sum * pixel_samples_scale;
+        c = color(sqrt(c.x), sqrt(c.y), sqrt(c.z));
+        return SDL_MapRGBA(
+            format,
+            Uint8(clamp(c.x, 0.0, 1.0) * 255.99),
+            Uint8(clamp(c.y, 0.0, 1.0) * 255.99),
+            Uint8(clamp(c.z, 0.0, 1.0) * 255.99),
+            255
+        );
+    }
     
 
     ray get_ray(int i, int j, bool precise = false) const {
@@ -615,8 +598,49 @@ private:
                         + ((j + offset.y) * pixel_delta_v);
         auto ray_origin = (defocus_angle <= 0 || precise || !use_defocus) ? lookfrom : defocus_disk_sample();
         auto ray_direction = pixel_sample - ray_origin;
-        auto ray_time = precise ? 0.0 : random_double();
-        return ray(ray_origin, ray_direction, ray_time);
+        auto ray_time = precise ? real(0) : real(random_double());
+        ray r(ray_origin, ray_direction, ray_time);
+        // The neighbouring pixels' rays, through the same point of the lens
+        r.set_differentials(ray_origin, ray_direction + pixel_delta_u, ray_origin, ray_direction + pixel_delta_v);
+        return r;
+    }
+
+    // Jittered primary rays for the 4x2 block of pixels starting at (i0, j0), with rows at
+    // or past end_row left inactive. The arithmetic runs lane by lane over plain arrays so
+    // the compiler can vectorize it; only the random numbers are drawn one at a time.
+    void get_ray_packet(int i0, int j0, int end_row, ray_packet& packet) const {
+        real sx[ray_packet_size], sy[ray_packet_size];
+        real ox[ray_packet_size], oy[ray_packet_size], oz[ray_packet_size];
+        real dx[ray_packet_size], dy[ray_packet_size], dz[ray_packet_size];
+        real time[ray_packet_size];
+
+        packet.active = 0;
+        bool defocus = defocus_angle > 0 && use_defocus;
+        for (int l = 0; l < ray_packet_size; l++) {
+            int i = i0 + l % ray_packet_width;
+            int j = j0 + l / ray_packet_width;
+            if (i < render_width && j < end_row) packet.active |= 1u << l;
+            sx[l] = i + real(random_double()) - real(0.5);
+            sy[l] = j + real(random_double()) - real(0.5);
+            time[l] = real(random_double());
+            point3 origin = defocus ? defocus_disk_sample() : lookfrom;
+            ox[l] = origin.x;
+            oy[l] = origin.y;
+            oz[l] = origin.z;
+        }
+
+        for (int l = 0; l < ray_packet_size; l++) {
+            dx[l] = pixel00_loc.x + sx[l] * pixel_delta_u.x + sy[l] * pixel_delta_v.x - ox[l];
+            dy[l] = pixel00_loc.y + sx[l] * pixel_delta_u.y + sy[l] * pixel_delta_v.y - oy[l];
+            dz[l] = pixel00_loc.z + sx[l] * pixel_delta_u.z + sy[l] * pixel_delta_v.z - oz[l];
+        }
+
+        for (int l = 0; l < ray_packet_size; l++) {
+            point3 origin(ox[l], oy[l], oz[l]);
+            vec3 direction(dx[l], dy[l], dz[l]);
+            packet.rays[l] = ray(origin, direction, time[l]);
+            packet.rays[l].set_differentials(origin, direction + pixel_delta_u, origin, direction + pixel_delta_v);
+        }
     }
 
     point3 defocus_disk_sample() const {
@@ -628,7 +652,7 @@ private:
         return vec3(random_double() - 0.5, random_double() - 0.5, 0);
     }
 
-    double clamp(double x, double min, double max) const {
+    real clamp(real x, real min, real max) const {
         if (x < min) return min;
         if (x > max) return max;
         return x;
@@ -739,9 +763,9 @@ private:
                         
                         point3 selected_pos = sc.get_selected_position();
                         
-                        double plane_distance = dot(selected_pos - lookfrom, camera_forward);
+                        real plane_distance = dot(selected_pos - lookfrom, camera_forward);
                         
-                        double t = plane_distance / dot(r.direction(), camera_forward);
+                        real t = plane_distance / dot(r.direction(), camera_forward);
                         if (t > 0) {
                             point3 new_pos = r.at(t);
                             sc.move_selected(new_pos, 1);
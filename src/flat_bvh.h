@@ -0,0 +1,285 @@
+#ifndef FLAT_BVH_H
+#define FLAT_BVH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Node of a BVH stored in one contiguous array, depth first. An interior node keeps its left
+// child right after itself and the index of its right child in `offset`. A leaf keeps the
+// index of its first primitive in `offset` and the number of primitives in `count`.
+// Only indices are stored, so the array can be copied or written to disk as is.
+struct flat_bvh_node {
+    float bmin[3];
+    uint32_t offset;
+    float bmax[3];
+    uint16_t count; // 0 for interior nodes
+    uint16_t axis;  // Split axis, used to visit the nearest child first
+
+    bool is_leaf() const { return count != 0; }
+};
+
+static_assert(sizeof(flat_bvh_node) == 32, "flat_bvh_node must stay 32 bytes");
+
+// Primitive as seen by the builder: its bounds, its centroid and the index it had in the
+// caller's arrays. After the build, the entries are permuted into leaf order.
+struct flat_bvh_prim {
+    float bmin[3];
+    float bmax[3];
+    float centroid[3];
+    uint32_t index;
+};
+
+class flat_bvh_builder {
+  public:
+    explicit flat_bvh_builder(int max_leaf_size = 4) : max_leaf_size(std::max(1, max_leaf_size)) {}
+
+    // Builds the tree with a binned surface area heuristic. `prims` is reordered so that each
+    // leaf covers a contiguous range of it.
+    std::vector<flat_bvh_node> build(std::vector<flat_bvh_prim>& prims) const {
+        std::vector<flat_bvh_node> nodes;
+        if (prims.empty()) return nodes;
+        nodes.reserve(2 * prims.size() / max_leaf_size + 1);
+        build_recursive(nodes, prims, 0, static_cast<uint32_t>(prims.size()), 0);
+        return nodes;
+    }
+
+  private:
+    static constexpr int bin_count = 12;
+    static constexpr int max_sah_depth = 64;
+    int max_leaf_size;
+
+    struct bounds {
+        float bmin[3] = { infinity(), infinity(), infinity() };
+        float bmax[3] = { -infinity(), -infinity(), -infinity() };
+
+        void grow(const float* lo, const float* hi) {
+            for (int a = 0; a < 3; a++) {
+                bmin[a] = std::min(bmin[a], lo[a]);
+                bmax[a] = std::max(bmax[a], hi[a]);
+            }
+        }
+
+        float area() const {
+            float dx = bmax[0] - bmin[0], dy = bmax[1] - bmin[1], dz = bmax[2] - bmin[2];
+            if (dx < 0 || dy < 0 || dz < 0) return 0;
+            return dx * dy + dy * dz + dz * dx;
+        }
+    };
+
+    static float infinity() { return std::numeric_limits<float>::infinity(); }
+
+    uint32_t build_recursive(std::vector<flat_bvh_node>& nodes, std::vector<flat_bvh_prim>& prims,
+                             uint32_t start, uint32_t end, int depth) const {
+        bounds box, centroids;
+        for (uint32_t i = start; i < end; i++) {
+            box.grow(prims[i].bmin, prims[i].bmax);
+            centroids.grow(prims[i].centroid, prims[i].centroid);
+        }
+
+        uint32_t node_index = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(flat_bvh_node{});
+        auto set_bounds = [&](flat_bvh_node& n) {
+            for (int a = 0; a < 3; a++) {
+                n.bmin[a] = box.bmin[a];
+                n.bmax[a] = box.bmax[a];
+            }
+        };
+
+        uint32_t span = end - start;
+        int axis = -1;
+        uint32_t mid = start;
+        if (span > static_cast<uint32_t>(max_leaf_size) && depth < max_sah_depth)
+            axis = find_split(prims, start, end, centroids, mid);
+
+        // Past the SAH depth limit, and for unsplittable ranges too large for the 16-bit leaf
+        // count, fall back to median splits so the tree depth stays bounded.
+        if (axis < 0 && (span > 0xffff || (depth >= max_sah_depth && span > static_cast<uint32_t>(max_leaf_size)))) {
+            axis = longest_axis(centroids);
+            mid = start + span / 2;
+            std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+                [axis](const flat_bvh_prim& a, const flat_bvh_prim& b) {
+                    return a.centroid[axis] < b.centroid[axis];
+                });
+        }
+
+        if (axis < 0) {
+            flat_bvh_node& leaf = nodes[node_index];
+            set_bounds(leaf);
+            leaf.offset = start;
+            leaf.count = static_cast<uint16_t>(span);
+            leaf.axis = 0;
+            return node_index;
+        }
+
+        build_recursive(nodes, prims, start, mid, depth + 1);
+        uint32_t right = build_recursive(nodes, prims, mid, end, depth + 1);
+
+        flat_bvh_node& node = nodes[node_index];
+        set_bounds(node);
+        node.offset = right;
+        node.count = 0;
+        node.axis = static_cast<uint16_t>(axis);
+        return node_index;
+    }
+
+    static int longest_axis(const bounds& b) {
+        float ext[3] = { b.bmax[0] - b.bmin[0], b.bmax[1] - b.bmin[1], b.bmax[2] - b.bmin[2] };
+        if (ext[0] > ext[1]) return ext[0] > ext[2] ? 0 : 2;
+        return ext[1] > ext[2] ? 1 : 2;
+    }
+
+    // Returns the split axis and partitions prims around `mid`, or returns -1 when the
+    // centroids cannot be separated.
+    int find_split(std::vector<flat_bvh_prim>& prims, uint32_t start, uint32_t end,
+                   const bounds& centroids, uint32_t& mid) const {
+        float best_cost = infinity();
+        int best_axis = -1;
+        int best_bin = 0;
+
+        for (int axis = 0; axis < 3; axis++) {
+            float lo = centroids.bmin[axis];
+            float extent = centroids.bmax[axis] - lo;
+            if (!(extent > 0)) continue;
+
+            bounds bin_bounds[bin_count];
+            uint32_t bin_counts[bin_count] = {};
+            float scale = bin_count / extent;
+            for (uint32_t i = start; i < end; i++) {
+                int b = std::min(bin_count - 1, static_cast<int>((prims[i].centroid[axis] - lo) * scale));
+                bin_counts[b]++;
+                bin_bounds[b].grow(prims[i].bmin, prims[i].bmax);
+            }
+
+            // Sweep from the right to get the area and count of every right-hand side.
+            float right_area[bin_count - 1];
+            uint32_t right_count[bin_count - 1];
+            bounds acc;
+            uint32_t count = 0;
+            for (int b = bin_count - 1; b > 0; b--) {
+                acc.grow(bin_bounds[b].bmin, bin_bounds[b].bmax);
+                count += bin_counts[b];
+                right_area[b - 1] = acc.area();
+                right_count[b - 1] = count;
+            }
+
+            acc = bounds();
+            count = 0;
+            for (int b = 0; b < bin_count - 1; b++) {
+                acc.grow(bin_bounds[b].bmin, bin_bounds[b].bmax);
+                count += bin_counts[b];
+                if (count == 0 || right_count[b] == 0) continue;
+                float cost = acc.area() * count + right_area[b] * right_count[b];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        if (best_axis < 0) return -1;
+
+        float lo = centroids.bmin[best_axis];
+        float scale = bin_count / (centroids.bmax[best_axis] - lo);
+        auto split = std::partition(prims.begin() + start, prims.begin() + end,
+            [&](const flat_bvh_prim& p) {
+                int b = std::min(bin_count - 1, static_cast<int>((p.centroid[best_axis] - lo) * scale));
+                return b <= best_bin;
+            });
+        mid = static_cast<uint32_t>(split - prims.begin());
+        if (mid == start || mid == end) return -1;
+        return best_axis;
+    }
+};
+
+// Slab test of a ray against a node box. `inv_dir` is the componentwise inverse of the ray
+// direction. NaNs produced by 0 * inf compare false and leave the interval unchanged.
+inline bool flat_bvh_box_hit(const flat_bvh_node& node, const float org[3], const float inv_dir[3],
+                             float t_min, float t_max, float& t_entry) {
+    for (int a = 0; a < 3; a++) {
+        float t0 = (node.bmin[a] - org[a]) * inv_dir[a];
+        float t1 = (node.bmax[a] - org[a]) * inv_dir[a];
+        if (t0 > t1) std::swap(t0, t1);
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_max < t_min) return false;
+    }
+    t_entry = t_min;
+    return true;
+}
+
+// Entries in the traversal stack, which bounds how deep a tree may be
+constexpr int flat_bvh_stack_size = 128;
+
+// Whether nodes from outside, e.g. a file, form a tree flat_bvh_traverse can walk safely:
+// laid out depth first as the builder does, children in range, leaves within `prim_count`
+// primitives, split axes valid and no deeper than the traversal stack allows.
+inline bool flat_bvh_valid(const flat_bvh_node* nodes, size_t node_count, size_t prim_count) {
+    if (node_count == 0) return false;
+    uint32_t stack[flat_bvh_stack_size];
+    int top = 0;
+    stack[top++] = 0;
+    size_t expected = 0;
+    while (top > 0) {
+        uint32_t index = stack[--top];
+        if (index != expected++) return false;
+        const flat_bvh_node& node = nodes[index];
+        if (node.is_leaf()) {
+            if (uint64_t(node.offset) + node.count > prim_count) return false;
+            continue;
+        }
+        if (node.axis > 2 || node.offset <= index + 1 || node.offset >= node_count
+            || index + 1 >= node_count || top + 2 > flat_bvh_stack_size) {
+            return false;
+        }
+        stack[top++] = node.offset;
+        stack[top++] = index + 1;
+    }
+    return expected == node_count;
+}
+
+// Walks the tree front to back. `leaf` is called as leaf(first, count, t_max) for every
+// leaf whose box is reached before t_max; it returns true when it shortened t_max.
+template <typename LeafFn>
+bool flat_bvh_traverse(const flat_bvh_node* nodes, size_t node_count, const float org[3],
+                       const float dir[3], float t_min, float& t_max, LeafFn&& leaf) {
+    if (node_count == 0) return false;
+
+    float inv_dir[3] = { 1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2] };
+    bool dir_neg[3] = { dir[0] < 0, dir[1] < 0, dir[2] < 0 };
+
+    uint32_t stack[flat_bvh_stack_size];
+    int top = 0;
+    stack[top++] = 0;
+    bool hit_anything = false;
+
+    while (top > 0) {
+        const flat_bvh_node& node = nodes[stack[--top]];
+        float t_entry;
+        if (!flat_bvh_box_hit(node, org, inv_dir, t_min, t_max, t_entry))
+            continue;
+
+        if (node.is_leaf()) {
+            if (leaf(node.offset, node.count, t_max))
+                hit_anything = true;
+            continue;
+        }
+
+        uint32_t left = static_cast<uint32_t>(&node - nodes) + 1;
+        uint32_t right = node.offset;
+        // Push the far child first so the near one is popped next.
+        if (dir_neg[node.axis]) {
+            stack[top++] = left;
+            stack[top++] = right;
+        } else {
+            stack[top++] = right;
+            stack[top++] = left;
+        }
+    }
+    return hit_anything;
+}
+
+#endif
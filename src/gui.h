@@ -25,6 +25,7 @@ namespace gui {
     bool should_open_modal = false;
     bool should_open_delete = false;
     std::atomic<bool> savingPPM{false};
+    bool use_wavefront = false;
 
     std::string ExtractFilename(const std::string& path) {
         size_t last_slash = path.find_last_of("/\\");
@@ -164,6 +165,141 @@ namespace gui {
                 ImGui::InputFloat("Size", &st.size(), 0.01f, 0.1f, "%.2f");
                 break;
             }
+            case ObjectType::Mesh: {
+                char mesh_file_buffer[256];
+                strncpy(mesh_file_buffer, st.mesh_file.c_str(), sizeof(mesh_file_buffer) - 1);
+                mesh_file_buffer[sizeof(mesh_file_buffer) - 1] = '\0';
+                if (ImGui::InputText("Mesh File", mesh_file_buffer, sizeof(mesh_file_buffer))) {
+                    st.mesh_file = mesh_file_buffer;
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Browse##mesh")) {
+                    const char* filters[] = { "*.obj", "*.ply" };
+                    const char* path = tinyfd_openFileDialog(
+                        "Select Mesh",
+                        "",
+                        2,
+                        filters,
+                        "Mesh Files (*.obj, *.ply)",
+                        0
+                    );
+                    if (path) {
+                        st.mesh_file = path;
+                        std::clog << "Selected mesh: " << path << "\n";
+                    }
+                }
+                break;
+            }
+            case ObjectType::SphereCloud: {
+                char particle_file_buffer[256];
+                strncpy(particle_file_buffer, st.particle_file.c_str(), sizeof(particle_file_buffer) - 1);
+                particle_file_buffer[sizeof(particle_file_buffer) - 1] = '\0';
+                if (ImGui::InputText("Particle File", particle_file_buffer, sizeof(particle_file_buffer))) {
+                    st.particle_file = particle_file_buffer;
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Browse##particles")) {
+                    const char* filters[] = { "*.xyzr", "*.xyzrm" };
+                    const char* path = tinyfd_openFileDialog(
+                        "Select Particles",
+                        "",
+                        2,
+                        filters,
+                        "Particle Files (*.xyzr, *.xyzrm)",
+                        0
+                    );
+                    if (path) {
+                        st.particle_file = path;
+                        std::clog << "Selected particles: " << path << "\n";
+                    }
+                }
+                break;
+            }
+            case ObjectType::Heightfield: {
+                char heightmap_file_buffer[256];
+                strncpy(heightmap_file_buffer, st.heightmap_file.c_str(), sizeof(heightmap_file_buffer) - 1);
+                heightmap_file_buffer[sizeof(heightmap_file_buffer) - 1] = '\0';
+                if (ImGui::InputText("Heightmap", heightmap_file_buffer, sizeof(heightmap_file_buffer))) {
+                    st.heightmap_file = heightmap_file_buffer;
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Browse##heightmap")) {
+                    const char* filters[] = { "*.png", "*.jpg", "*.pgm" };
+                    const char* path = tinyfd_openFileDialog(
+                        "Select Heightmap",
+                        "",
+                        3,
+                        filters,
+                        "Grayscale Images (*.png, *.jpg, *.pgm)",
+                        0
+                    );
+                    if (path) {
+                        st.heightmap_file = path;
+                        std::clog << "Selected heightmap: " << path << "\n";
+                    }
+                }
+                ImGui::InputFloat3("Extent (x, height, z)", st.box_length());
+                break;
+            }
+            case ObjectType::VoxelGrid: {
+                char voxel_file_buffer[256];
+                strncpy(voxel_file_buffer, st.voxel_file.c_str(), sizeof(voxel_file_buffer) - 1);
+                voxel_file_buffer[sizeof(voxel_file_buffer) - 1] = '\0';
+                if (ImGui::InputText("Voxel File", voxel_file_buffer, sizeof(voxel_file_buffer))) {
+                    st.voxel_file = voxel_file_buffer;
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Browse##voxels")) {
+                    const char* filters[] = { "*.zvox" };
+                    const char* path = tinyfd_openFileDialog(
+                        "Select Voxels",
+                        "",
+                        1,
+                        filters,
+                        "Voxel Files (*.zvox)",
+                        0
+                    );
+                    if (path) {
+                        st.voxel_file = path;
+                        std::clog << "Selected voxels: " << path << "\n";
+                    }
+                }
+                ImGui::InputFloat("Voxel Size", &st.size(), 0.01f, 0.1f, "%.2f");
+                break;
+            }
+            case ObjectType::Volume: {
+                ImGui::InputFloat3("Box Length (x, y, z)", st.box_length());
+                ImGui::InputFloat("Density", &st.density(), 0.1f, 1.0f, "%.2f");
+                char volume_file_buffer[256];
+                strncpy(volume_file_buffer, st.volume_file.c_str(), sizeof(volume_file_buffer) - 1);
+                volume_file_buffer[sizeof(volume_file_buffer) - 1] = '\0';
+                if (ImGui::InputText("Density File", volume_file_buffer, sizeof(volume_file_buffer))) {
+                    st.volume_file = volume_file_buffer;
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Browse##volume")) {
+                    const char* filters[] = { "*.zvol" };
+                    const char* path = tinyfd_openFileDialog(
+                        "Select Density",
+                        "",
+                        1,
+                        filters,
+                        "Density Files (*.zvol)",
+                        0
+                    );
+                    if (path) {
+                        st.volume_file = path;
+                        std::clog << "Selected density: " << path << "\n";
+                    }
+                }
+                // Empty file: Perlin noise density
+                if (st.volume_file.empty()) {
+                    ImGui::SliderFloat("Noise Scale##volume", &st.noise_scale, 0.1f, 10.0f);
+                    int seed = int(st.noise_seed());
+                    if (ImGui::InputInt("Noise Seed##volume", &seed)) st.noise_seed() = float(std::max(seed, 0));
+                }
+                break;
+            }
         }
     }
     
@@ -271,13 +407,13 @@ namespace gui {
 
                     ImGui::SameLine();
                     if (ImGui::Button("Browse")) {
-                        const char* filters[] = { "*.jpg", "*.png", "*.bmp", "*.tga" }; // Supported image formats
+                        const char* filters[] = { "*.jpg", "*.png", "*.bmp", "*.tga", "*.hdr", "*.ztx" }; // Supported image formats
                         const char* path = tinyfd_openFileDialog(
                             "Select Image",
                             "", // Default path
-                            4,                       // Number of filters
+                            6,                       // Number of filters
                             filters,                 // Filter patterns
-                            "Image Files (*.jpg, *.png, *.bmp, *.tga)", // Filter description
+                            "Image Files (*.jpg, *.png, *.bmp, *.tga, *.hdr, *.ztx)", // Filter description
                             0                        // Single file selection
                         );
                         if (path) {
@@ -291,6 +427,11 @@ namespace gui {
                 }
                 else if (st.texture_type == TextureType::Noise) {
                     ImGui::SliderFloat("Noise Scale", &st.noise_scale, 0.1f, 10.0f);
+                    int seed = int(st.noise_seed());
+                    if (ImGui::InputInt("Noise Seed", &seed)) st.noise_seed() = float(std::max(seed, 0));
+                    // Bakes the noise over the object's box; 0 computes it at every hit
+                    int bake = int(st.noise_bake_resolution());
+                    if (ImGui::SliderInt("Bake Resolution", &bake, 0, 128)) st.noise_bake_resolution() = float(bake);
                 }else{ 
                     bool color1_changed = ImGui::ColorEdit3("Color", color1, ImGuiColorEditFlags_DisplayRGB | ImGuiColorEditFlags_Float);
                     if (color1_changed) {
@@ -463,7 +604,7 @@ namespace gui {
 
 
     void render_top_bar(scene& sc, bool& running, bool& use_defocus, float& vfov, float& focus_dist, int& max_depth, int& samples_per_pixel
-        , double& pixel_samples_scale, float& topbar_height, color& background) {
+        , real& pixel_samples_scale, float& topbar_height, color& background) {
         ImGuiIO& io = ImGui::GetIO(); 
 
         if (ImGui::BeginMainMenuBar()) {
@@ -594,6 +735,9 @@ namespace gui {
                     }
                     ImGui::SameLine(); HelpMarker("Best quality, slower rendering");
 
+                    ImGui::Checkbox("Wavefront Integrator", &use_wavefront);
+                    ImGui::SameLine(); HelpMarker("Traces all paths one bounce at a time and shades them grouped by material");
+
                     if (ImGui::TreeNode("Advanced Settings")) {
                         
                         if (ImGui::SliderInt("Max Ray Depth", &max_depth, 2, 50)) {
@@ -640,6 +784,41 @@ namespace gui {
                     }
                     ImGui::EndMenu();
                 }
+                if (ImGui::BeginMenu("Texture Cache")) {
+                    texture_cache& cache = texture_cache::instance();
+                    texture_cache::statistics stats = cache.get_stats();
+                    ImGui::Text("Hits: %zu  Misses: %zu  Evictions: %zu", stats.hits, stats.misses, stats.evictions);
+                    ImGui::Text("Kept: %zu images, %.1f MB", stats.retained_images, stats.retained_bytes / 1048576.0);
+                    int budget_mb = static_cast<int>(cache.get_budget() >> 20);
+                    if (ImGui::SliderInt("Budget (MB)", &budget_mb, 0, 4096)) {
+                        cache.set_budget(static_cast<size_t>(budget_mb) << 20);
+                    }
+                    if (ImGui::MenuItem("Clear")) {
+                        cache.clear();
+                        std::clog << "Menu action: Clear texture cache\n";
+                    }
+                    ImGui::EndMenu();
+                }
+                if (ImGui::BeginMenu("Virtual Textures")) {
+                    page_cache& pages = page_cache::instance();
+                    page_cache::statistics stats = pages.get_stats();
+                    ImGui::Text("Hits: %zu  Misses: %zu  Evictions: %zu", stats.hits, stats.misses, stats.evictions);
+                    ImGui::Text("Resident: %zu pages, %.1f MB  Queued: %zu", stats.resident_pages,
+                                stats.resident_bytes / 1048576.0, stats.queued);
+                    int budget_mb = static_cast<int>(pages.get_budget() >> 20);
+                    if (ImGui::SliderInt("Page Budget (MB)", &budget_mb, 16, 4096)) {
+                        pages.set_budget(static_cast<size_t>(budget_mb) << 20);
+                    }
+                    bool async = pages.is_async();
+                    if (ImGui::Checkbox("Load Pages in Background", &async)) {
+                        pages.set_async(async);
+                    }
+                    if (ImGui::MenuItem("Clear")) {
+                        pages.clear();
+                        std::clog << "Menu action: Clear page cache\n";
+                    }
+                    ImGui::EndMenu();
+                }
                 ImGui::EndMenu();
             }
             
@@ -0,0 +1,264 @@
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#include "hittable.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Terrain given by a grid of heights, two triangles per cell. Rays walk the cells with a 2D
+// DDA over a min-max pyramid: level k stores the lowest and highest height under each block
+// of 2^k x 2^k cells, so a block the ray passes entirely above or below is crossed in one
+// step, and only cells at the ray's height are tested. Heights and pyramid together take
+// under four floats per sample.
+struct heightfield_data {
+    std::string source;
+    std::vector<float> heights; // In [0, 1], row by row
+    int columns = 0, rows = 0;
+    // Interleaved min, max per block, row by row; the last level is a single block
+    std::vector<std::vector<float>> levels;
+    std::vector<int> level_columns;
+
+    heightfield_data(std::vector<float> values, int columns, int rows)
+      : heights(std::move(values)), columns(columns), rows(rows)
+    {
+        if (columns < 2 || rows < 2 || heights.size() != size_t(columns) * size_t(rows)) {
+            throw std::runtime_error("Heightfield needs at least 2 x 2 samples");
+        }
+        build_pyramid();
+    }
+
+    float height(int x, int z) const { return heights[size_t(z) * columns + x]; }
+
+    // Lowest and highest height under block (x, z) of a level
+    const float* range(int level, int x, int z) const {
+        return &levels[level][2 * (size_t(z) * level_columns[level] + x)];
+    }
+
+  private:
+    void build_pyramid() {
+        int w = columns - 1, h = rows - 1;
+        std::vector<float> base(2 * size_t(w) * h);
+        for (int z = 0; z < h; z++)
+            for (int x = 0; x < w; x++) {
+                float a = height(x, z), b = height(x + 1, z), c = height(x, z + 1), e = height(x + 1, z + 1);
+                base[2 * (size_t(z) * w + x)] = std::min(std::min(a, b), std::min(c, e));
+                base[2 * (size_t(z) * w + x) + 1] = std::max(std::max(a, b), std::max(c, e));
+            }
+        levels.push_back(std::move(base));
+        level_columns.push_back(w);
+
+        while (w > 1 || h > 1) {
+            int nw = (w + 1) / 2, nh = (h + 1) / 2;
+            const std::vector<float>& below = levels.back();
+            std::vector<float> next(2 * size_t(nw) * nh);
+            for (int z = 0; z < nh; z++)
+                for (int x = 0; x < nw; x++) {
+                    float lo = INFINITY, hi = -INFINITY;
+                    for (int k = 0; k < 4; k++) {
+                        int sx = 2 * x + (k & 1), sz = 2 * z + (k >> 1);
+                        if (sx >= w || sz >= h) continue;
+                        lo = std::min(lo, below[2 * (size_t(sz) * w + sx)]);
+                        hi = std::max(hi, below[2 * (size_t(sz) * w + sx) + 1]);
+                    }
+                    next[2 * (size_t(z) * nw + x)] = lo;
+                    next[2 * (size_t(z) * nw + x) + 1] = hi;
+                }
+            levels.push_back(std::move(next));
+            level_columns.push_back(nw);
+            w = nw;
+            h = nh;
+        }
+    }
+};
+
+// Heights from the gray levels of an image, black at 0 and white at 1. Goes through stb's
+// 16-bit loader, which keeps the full precision of 16-bit PNGs; rtw_image stores 8-bit sRGB
+// colors.
+inline shared_ptr<const heightfield_data> load_heightfield(const std::string& filename) {
+    static std::mutex library_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<const heightfield_data>> library;
+
+    std::lock_guard<std::mutex> lock(library_mutex);
+    auto it = library.find(filename);
+    if (it != library.end()) {
+        if (auto shared = it->second.lock()) return shared;
+    }
+
+    int columns, rows, n;
+    stbi_us* pixels = stbi_load_16(filename.c_str(), &columns, &rows, &n, 1);
+    if (pixels == nullptr) {
+        throw std::runtime_error("Failed to load heightfield image: " + filename);
+    }
+    std::vector<float> values(size_t(columns) * size_t(rows));
+    for (size_t i = 0; i < values.size(); i++) values[i] = pixels[i] / 65535.0f;
+    stbi_image_free(pixels);
+
+    auto data = make_shared<heightfield_data>(std::move(values), columns, rows);
+    data->source = filename;
+
+    std::clog << "Loaded heightfield " << filename << ": " << columns << "x" << rows << " samples, "
+              << data->levels.size() << " pyramid levels\n";
+
+    library[filename] = data;
+    return data;
+}
+
+class heightfield : public hittable {
+  public:
+    // The grid covers `extent.x` by `extent.z` from `corner`, and a height of 1 is `extent.y`
+    // above it.
+    heightfield(shared_ptr<const heightfield_data> data, const point3& corner, const vec3& extent)
+      : data(data), corner(corner), extent(extent)
+    {
+        if (!(extent.x > 0 && extent.y > 0 && extent.z > 0)) {
+            throw std::runtime_error("Heightfield extent must be positive");
+        }
+        set_bounding_box();
+    }
+
+    void set_bounding_box() override {
+        const float* top = data->levels.back().data();
+        bbox = aabb(corner + vec3(0, top[0] * extent.y, 0), corner + vec3(extent.x, top[1] * extent.y, extent.z));
+    }
+
+    void move_by(const point3& offset) override {
+        corner = corner + offset;
+        set_bounding_box();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Grid space: one unit per cell horizontally and heights in [0, 1]. The map is
+        // affine, so ray parameters are the same in both spaces.
+        const int cells_x = data->columns - 1, cells_z = data->rows - 1;
+        const vec3 scale(extent.x / cells_x, extent.y, extent.z / cells_z);
+        const vec3 o = (r.origin() - corner) / scale;
+        const vec3 d = r.direction() / scale;
+
+        // Clip to the grid's box
+        const float* top = data->levels.back().data();
+        real lo[3] = { 0, top[0], 0 }, hi[3] = { real(cells_x), top[1], real(cells_z) };
+        real t_start = ray_t.min, t_end = ray_t.max;
+        for (int a = 0; a < 3; a++) {
+            real inv = 1 / d[a];
+            real t0 = (lo[a] - o[a]) * inv, t1 = (hi[a] - o[a]) * inv;
+            if (inv < 0) std::swap(t0, t1);
+            t_start = t0 > t_start ? t0 : t_start;
+            t_end = t1 < t_end ? t1 : t_end;
+            if (t_end < t_start) return false;
+        }
+
+        // The ray's level-0 cell; the block holding it at level k is the cell shifted by k
+        const int step_x = d.x >= 0 ? 1 : -1, step_z = d.z >= 0 ? 1 : -1;
+        int cx = std::clamp(int(std::floor(o.x + t_start * d.x)), 0, cells_x - 1);
+        int cz = std::clamp(int(std::floor(o.z + t_start * d.z)), 0, cells_z - 1);
+        const int top_level = int(data->levels.size()) - 1;
+        int level = top_level;
+        real t = t_start;
+
+        while (true) {
+            int bx = cx >> level, bz = cz >> level;
+            int size = 1 << level;
+
+            // Where the ray leaves this block, and through which side
+            real t_exit_x = d.x != 0 ? ((step_x > 0 ? (bx + 1) * size : bx * size) - o.x) / d.x : infinity;
+            real t_exit_z = d.z != 0 ? ((step_z > 0 ? (bz + 1) * size : bz * size) - o.z) / d.z : infinity;
+            real t_exit = std::fmin(std::fmin(t_exit_x, t_exit_z), t_end);
+
+            // Heights the ray spans inside the block against the heights under it
+            real y0 = o.y + t * d.y, y1 = o.y + t_exit * d.y;
+            const float* range = data->range(level, bx, bz);
+            bool overlaps = std::fmin(y0, y1) <= range[1] && std::fmax(y0, y1) >= range[0];
+
+            if (overlaps && level > 0) {
+                level--;
+                continue;
+            }
+            if (overlaps && hit_cell(cx, cz, o, d, ray_t, rec)) {
+                rec.p = r.at(rec.t);
+                rec.set_face_normal(r, unit_vector(rec.normal / scale));
+                rec.mat = mat;
+                return true;
+            }
+
+            // Step into the next block across the side the ray leaves through
+            if (t_exit >= t_end) return false;
+            if (t_exit_x <= t_exit_z) {
+                cx = step_x > 0 ? (bx + 1) * size : bx * size - 1;
+                cz = std::clamp(int(std::floor(o.z + t_exit * d.z)), bz * size, (bz + 1) * size - 1);
+            } else {
+                cz = step_z > 0 ? (bz + 1) * size : bz * size - 1;
+                cx = std::clamp(int(std::floor(o.x + t_exit * d.x)), bx * size, (bx + 1) * size - 1);
+            }
+            if (cx < 0 || cx >= cells_x || cz < 0 || cz >= cells_z) return false;
+            t = t_exit;
+
+            // Back up while the step also left the enclosing blocks
+            while (level < top_level && ((cx >> (level + 1)) != (bx >> 1) || (cz >> (level + 1)) != (bz >> 1))) {
+                level++;
+                bx >>= 1;
+                bz >>= 1;
+            }
+        }
+    }
+
+    std::ostream& print(std::ostream& out) const override {
+        out << "Heightfield(file=" << data->source
+            << ", samples=" << data->columns << "x" << data->rows
+            << ", corner=" << corner << ", extent=" << extent << ")";
+        return out;
+    }
+
+    std::istream& write(std::istream& in) const override {
+        return in;
+    }
+
+  private:
+    shared_ptr<const heightfield_data> data;
+    point3 corner;
+    vec3 extent;
+
+    // The two triangles of a cell, split along its (0,0)-(1,1) diagonal, in grid space. Leaves
+    // the grid-space normal in rec.
+    bool hit_cell(int x, int z, const vec3& o, const vec3& d, interval ray_t, hit_record& rec) const {
+        const point3 p00(x, data->height(x, z), z), p10(x + 1, data->height(x + 1, z), z);
+        const point3 p01(x, data->height(x, z + 1), z + 1), p11(x + 1, data->height(x + 1, z + 1), z + 1);
+        bool found = false;
+        found |= hit_triangle(p00, p11, p10, o, d, ray_t, rec);
+        found |= hit_triangle(p00, p01, p11, o, d, ray_t, rec);
+        if (found) {
+            rec.u = (o.x + rec.t * d.x) / (data->columns - 1);
+            rec.v = (o.z + rec.t * d.z) / (data->rows - 1);
+        }
+        return found;
+    }
+
+    // Moller-Trumbore; shortens ray_t to the hit. Corners are ordered so the normal points up.
+    static bool hit_triangle(const point3& a, const point3& b, const point3& c, const vec3& o, const vec3& d,
+                             interval& ray_t, hit_record& rec) {
+        vec3 e1 = b - a, e2 = c - a;
+        vec3 pvec = cross(d, e2);
+        real det = dot(e1, pvec);
+        if (std::fabs(det) < real(1e-12)) return false;
+        real inv_det = 1 / det;
+        vec3 tvec = o - a;
+        real u = dot(tvec, pvec) * inv_det;
+        if (u < 0 || u > 1) return false;
+        vec3 qvec = cross(tvec, e1);
+        real v = dot(d, qvec) * inv_det;
+        if (v < 0 || u + v > 1) return false;
+        real t = dot(e2, qvec) * inv_det;
+        if (!ray_t.surrounds(t)) return false;
+        ray_t.max = t;
+        rec.t = t;
+        rec.normal = cross(e1, e2);
+        return true;
+    }
+};
+
+#endif
@@ -10,6 +10,16 @@ public:
     virtual ~hittable() = default;
 
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+    // For closed objects: where the ray's line enters and leaves it, at any t. Volumes use
+    // this; the default finds the two crossings with hit, and solids that can clip a ray in
+    // one pass override it.
+    virtual bool hit_span(const ray& r, interval& span) const {
+        hit_record rec1, rec2;
+        if (!hit(r, interval::universe, rec1)) return false;
+        if (!hit(r, interval(rec1.t + real(0.0001), infinity), rec2)) return false;
+        span = interval(rec1.t, rec2.t);
+        return true;
+    }
     virtual void set_bounding_box() {};
     virtual void move_by(const point3& offset) {};
     virtual int get_id() const { return id; } 
@@ -78,6 +88,7 @@ class hittable_list : public hittable {
     }
 
     void set_material(shared_ptr<material> mat)override{
+        hittable::set_material(mat); // Kept too, so get_material() answers for the whole list
         for(auto obj : objects)obj->set_material(mat);
     }
 
@@ -129,7 +140,7 @@ class translate : public hittable {
 
 class rotate_y : public hittable {
   public:
-        rotate_y(shared_ptr<hittable> object, double angle) : object(object) {
+        rotate_y(shared_ptr<hittable> object, real angle) : object(object) {
         auto radians = degrees_to_radians(angle);
         sin_theta = std::sin(radians);
         cos_theta = std::cos(radians);
@@ -199,6 +210,18 @@ class rotate_y : public hittable {
             (-sin_theta * rec.normal.x) + (cos_theta * rec.normal.z)
         );
 
+        rec.dpdu = vec3(
+            (cos_theta * rec.dpdu.x) + (sin_theta * rec.dpdu.z),
+            rec.dpdu.y,
+            (-sin_theta * rec.dpdu.x) + (cos_theta * rec.dpdu.z)
+        );
+
+        rec.dpdv = vec3(
+            (cos_theta * rec.dpdv.x) + (sin_theta * rec.dpdv.z),
+            rec.dpdv.y,
+            (-sin_theta * rec.dpdv.x) + (cos_theta * rec.dpdv.z)
+        );
+
         return true;
     }
 
@@ -212,49 +235,45 @@ class rotate_y : public hittable {
 
   private:
     shared_ptr<hittable> object;
-    double sin_theta;
-    double cos_theta;
+    real sin_theta;
+    real cos_theta;
 };
 
 
 class constant_medium : public hittable {
   public:
-    constant_medium(shared_ptr<hittable> boundary, double density, shared_ptr<texture> tex)
+    constant_medium(shared_ptr<hittable> boundary, real density, shared_ptr<texture> tex)
       : boundary(boundary), neg_inv_density(-1/density),
         phase_function(make_shared<isotropic>(tex))
     {}
 
-    constant_medium(shared_ptr<hittable> boundary, double density, const color& albedo)
+    constant_medium(shared_ptr<hittable> boundary, real density, const color& albedo)
       : boundary(boundary), neg_inv_density(-1/density),
         phase_function(make_shared<isotropic>(make_shared<solid_color>(albedo)))
     {}
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        hit_record rec1, rec2;
-
-        if (!boundary->hit(r, interval::universe, rec1))
-            return false;
-
-        if (!boundary->hit(r, interval(rec1.t+0.0001, infinity), rec2))
+        interval span;
+        if (!boundary->hit_span(r, span))
             return false;
 
-        if (rec1.t < ray_t.min) rec1.t = ray_t.min;
-        if (rec2.t > ray_t.max) rec2.t = ray_t.max;
+        if (span.min < ray_t.min) span.min = ray_t.min;
+        if (span.max > ray_t.max) span.max = ray_t.max;
 
-        if (rec1.t >= rec2.t)
+        if (span.min >= span.max)
             return false;
 
-        if (rec1.t < 0)
-            rec1.t = 0;
+        if (span.min < 0)
+            span.min = 0;
 
-        auto ray_length = r.direction().length();
-        auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
+        auto ray_length = glm::length(r.direction());
+        auto distance_inside_boundary = (span.max - span.min) * ray_length;
         auto hit_distance = neg_inv_density * std::log(random_double());
 
         if (hit_distance > distance_inside_boundary)
             return false;
 
-        rec.t = rec1.t + hit_distance / ray_length;
+        rec.t = span.min + hit_distance / ray_length;
         rec.p = r.at(rec.t);
 
         rec.normal = vec3(1,0,0);  // arbitrary
@@ -276,7 +295,7 @@ class constant_medium : public hittable {
     
   private:
     shared_ptr<hittable> boundary;
-    double neg_inv_density;
+    real neg_inv_density;
     shared_ptr<material> phase_function;
 };
 
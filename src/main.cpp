@@ -16,6 +16,9 @@
 #include "material.h"
 #include "quad.h"
 #include "sphere.h"
+#include "simd/simd.h"
+#include "virtual_texture.h"
+#include <cstring>
 #ifdef _WIN32
 #include <windows.h>
 #endif
@@ -36,6 +39,25 @@ int main(int argc, char* argv[]) {
     std::clog << "Console initialized" << std::endl;
     #endif
     
+    // --isa=<scalar|sse42|avx2|avx512> pins the SIMD kernels, for benchmarking; ZENGINE_ISA
+    // does the same from the environment.
+    // --make-ztx=<image> converts an image to a virtual texture next to it and exits, with
+    // its pages deflated unless --ztx-uncompressed is given.
+    const char* isa = nullptr;
+    const char* make_ztx = nullptr;
+    bool ztx_compress = true;
+    for (int i = 1; i < argc; i++) {
+        if (std::strncmp(argv[i], "--isa=", 6) == 0) isa = argv[i] + 6;
+        if (std::strncmp(argv[i], "--make-ztx=", 11) == 0) make_ztx = argv[i] + 11;
+        if (std::strcmp(argv[i], "--ztx-uncompressed") == 0) ztx_compress = false;
+    }
+    simd_init(isa);
+
+    if (make_ztx) {
+        std::string output = std::filesystem::path(make_ztx).replace_extension(".ztx").string();
+        return write_virtual_texture(make_ztx, output, ztx_compress) ? 0 : 1;
+    }
+
     render_scene();
     return 0;
 }
\ No newline at end of file
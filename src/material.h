@@ -1,191 +1,721 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include "simd/simd.h"
+#include "texture_cache.h"
+#include <algorithm>
+#include <array>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// Gradient noise tables: unit gradients and three permutations, drawn from their own
+// generator so the same seed always gives the same noise. The tables never change once made,
+// so textures share them through shared() instead of building their own.
 class perlin {
   public:
-    perlin() {
+    explicit perlin(uint32_t seed = 0) {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> component(-1.0f, 1.0f);
         for (int i = 0; i < point_count; i++) {
-            randvec[i] = unit_vector(randomVec3(-1,1));
+            float x, y, z, length;
+            do {
+                x = component(rng);
+                y = component(rng);
+                z = component(rng);
+                length = std::sqrt(x * x + y * y + z * z);
+            } while (length < 1e-3f);
+            grad_x[i] = x / length;
+            grad_y[i] = y / length;
+            grad_z[i] = z / length;
         }
 
-        perlin_generate_perm(perm_x);
-        perlin_generate_perm(perm_y);
-        perlin_generate_perm(perm_z);
+        perlin_generate_perm(perm_x, rng);
+        perlin_generate_perm(perm_y, rng);
+        perlin_generate_perm(perm_z, rng);
     }
 
-    double noise(const point3& p) const {
-        auto u = p.x - std::floor(p.x);
-        auto v = p.y - std::floor(p.y);
-        auto w = p.z - std::floor(p.z);
+    // The tables for a seed, made once and shared while anyone holds them
+    static shared_ptr<const perlin> shared(uint32_t seed) {
+        static std::mutex library_mutex;
+        static std::unordered_map<uint32_t, std::weak_ptr<const perlin>> library;
 
-
-        auto i = int(std::floor(p.x));
-        auto j = int(std::floor(p.y));
-        auto k = int(std::floor(p.z));
-        vec3 c[2][2][2];
-
-        for (int di=0; di < 2; di++)
-            for (int dj=0; dj < 2; dj++)
-                for (int dk=0; dk < 2; dk++)
-                    c[di][dj][dk] = randvec[
-                        perm_x[(i+di) & 255] ^
-                        perm_y[(j+dj) & 255] ^
-                        perm_z[(k+dk) & 255]
-                    ];
-
-        return perlin_interp(c, u, v, w);
+        std::lock_guard<std::mutex> lock(library_mutex);
+        auto it = library.find(seed);
+        if (it != library.end()) {
+            if (auto tables = it->second.lock()) return tables;
+        }
+        auto tables = make_shared<const perlin>(seed);
+        library[seed] = tables;
+        return tables;
     }
 
-    double turb(const point3& p, int depth) const {
-        auto accum = 0.0;
-        auto temp_p = p;
-        auto weight = 1.0;
+    // Gradient noise with Hermite smoothing, evaluated by the perlin_noise kernel.
+    real noise(const point3& p) const {
+        float x = static_cast<float>(p.x), y = static_cast<float>(p.y), z = static_cast<float>(p.z);
+        float result;
+        simd_active.perlin_noise(tables(), &x, &y, &z, 1, &result);
+        return result;
+    }
 
-        for (int i = 0; i < depth; i++) {
-            accum += weight * noise(temp_p);
-            weight *= 0.5;
-            temp_p *= 2;
+    // The octaves do not depend on each other, so they go to the kernel as one batch. They
+    // are scaled and summed in float in the order perlin_turbulence uses, so a point gives
+    // the same turbulence either way.
+    real turb(const point3& p, int depth) const {
+        constexpr int batch = 8;
+        float x[batch], y[batch], z[batch], octave[batch];
+        const float px = static_cast<float>(p.x), py = static_cast<float>(p.y), pz = static_cast<float>(p.z);
+        float accum = 0, weight = 1, scale = 1;
+
+        for (int first = 0; first < depth; first += batch) {
+            int count = std::min(depth - first, batch);
+            for (int i = 0; i < count; i++) {
+                x[i] = px * scale;
+                y[i] = py * scale;
+                z[i] = pz * scale;
+                scale *= 2.0f;
+            }
+            simd_active.perlin_noise(tables(), x, y, z, count, octave);
+            for (int i = 0; i < count; i++) {
+                accum += weight * octave[i];
+                weight *= 0.5f;
+            }
         }
 
         return std::fabs(accum);
     }
 
+    // Turbulence at n points, vectorized across the points
+    void turb(const float* x, const float* y, const float* z, size_t n, int depth, float* out) const {
+        simd_active.perlin_turbulence(tables(), x, y, z, n, depth, out);
+    }
 
   private:
-    static const int point_count = 256;
-    vec3 randvec[point_count];
-    int perm_x[point_count];
-    int perm_y[point_count];
-    int perm_z[point_count];
+    static const int point_count = perlin_point_count;
+    float grad_x[point_count], grad_y[point_count], grad_z[point_count];
+    int32_t perm_x[point_count];
+    int32_t perm_y[point_count];
+    int32_t perm_z[point_count];
+
+    perlin_tables tables() const {
+        return { grad_x, grad_y, grad_z, perm_x, perm_y, perm_z };
+    }
 
-    static void perlin_generate_perm(int* p) {
+    static void perlin_generate_perm(int32_t* p, std::mt19937& rng) {
         for (int i = 0; i < point_count; i++)
             p[i] = i;
 
-        permute(p, point_count);
+        permute(p, point_count, rng);
     }
 
-    static void permute(int* p, int n) {
+    static void permute(int32_t* p, int n, std::mt19937& rng) {
         for (int i = n-1; i > 0; i--) {
-            int target = random_int(0, i);
-            int tmp = p[i];
+            int target = std::uniform_int_distribution<int>(0, i)(rng);
+            int32_t tmp = p[i];
             p[i] = p[target];
             p[target] = tmp;
         }
     }
-    static double perlin_interp(const vec3 c[2][2][2], double u, double v, double w) {
-        // Hermitian cube to more smoothing as mach bands
-        auto uu = u*u*(3-2*u);
-        auto vv = v*v*(3-2*v);
-        auto ww = w*w*(3-2*w);
-        auto accum = 0.0;
-
-        for (int i=0; i < 2; i++)
-            for (int j=0; j < 2; j++)
-                for (int k=0; k < 2; k++) {
-                    vec3 weight_v(u-i, v-j, w-k);
-                    accum += (i*uu + (1-i)*(1-uu))
-                           * (j*vv + (1-j)*(1-vv))
-                           * (k*ww + (1-k)*(1-ww))
-                           * dot(c[i][j][k], weight_v);
-                }
+};
+
+class texture;
+struct baked_turbulence;
+
+// Shading points evaluated by texture_program together, one lane per point. Each lane's
+// result is written at the same index it is read from.
+struct texture_batch {
+    size_t size = 0;
+    const real* u = nullptr;
+    const real* v = nullptr;
+    const real* x = nullptr;
+    const real* y = nullptr;
+    const real* z = nullptr;
+    const real* footprint = nullptr; // Null when no point has one: sampled unfiltered
+    real* r = nullptr;
+    real* g = nullptr;
+    real* b = nullptr;
+};
+
+// A texture graph compiled into a flat array of ops, children ahead of their parents, and
+// evaluated by a switch over it instead of a chain of virtual calls through shared pointers.
+// Constants, checkers, images, noise, mixes and scales have ops of their own; any other
+// texture becomes an op that calls it.
+//
+// A batch runs each op once over all the points that reach it: checkers split the points
+// between their sides, images read the nearest texels of all unfiltered points in one kernel
+// call and noise computes the turbulence of all points off its baked grid in one
+// perlin_turbulence call. Each point gets the value it would get on its own.
+//
+// The program holds its own references to images and noise, but not to the textures it
+// calls, which the texture it was compiled from keeps alive. It reflects that texture as it
+// was when compiled; baking noise later, say, needs compiling again.
+class texture_program {
+  public:
+    texture_program() = default;
+
+    explicit texture_program(const texture& root_texture);
 
-        return accum;
+    bool empty() const { return ops.empty(); }
+
+    // The root texture's value at one point; `footprint` as for texture::filtered_value
+    color value(real u, real v, const point3& p, real footprint = 0) const {
+        return empty() ? color(0, 0, 0) : eval(root, u, v, p, footprint);
     }
 
-};
+    void value(const texture_batch& batch) const;
 
+    // Used by texture::compile; each appends one op and returns its index
+    uint32_t add_constant(const color& c) { return push({ op_kind::Constant, 0, 0, 0, 0, c }); }
+
+    uint32_t add_checker(real inv_scale, uint32_t even, uint32_t odd) {
+        return push({ op_kind::Checker, even, odd, 0, inv_scale });
+    }
+
+    uint32_t add_image(shared_ptr<const rtw_image> image) {
+        images.push_back(std::move(image));
+        return push({ op_kind::Image, 0, 0, uint32_t(images.size() - 1) });
+    }
+
+    uint32_t add_noise(shared_ptr<const perlin> noise, shared_ptr<const baked_turbulence> baked, real scale) {
+        noises.push_back({ std::move(noise), std::move(baked) });
+        return push({ op_kind::Noise, 0, 0, uint32_t(noises.size() - 1), scale });
+    }
+
+    uint32_t add_mix(uint32_t first, uint32_t second, real amount) {
+        return push({ op_kind::Mix, first, second, 0, amount });
+    }
+
+    uint32_t add_scale(uint32_t input, const color& factor) {
+        return push({ op_kind::Scale, input, 0, 0, 0, factor });
+    }
+
+    uint32_t add_call(const texture* tex) {
+        calls.push_back(tex);
+        return push({ op_kind::Call, 0, 0, uint32_t(calls.size() - 1) });
+    }
+
+  private:
+    enum class op_kind : uint8_t { Constant, Checker, Image, Noise, Mix, Scale, Call };
+
+    struct op {
+        op_kind kind;
+        uint32_t a = 0, b = 0;      // Inputs: checker even and odd, mix first and second, scale input
+        uint32_t resource = 0;      // Into images, noises or calls
+        real param = 0;             // Checker inverse scale, mix amount, noise scale
+        color c = color(0, 0, 0);   // Constant, scale factor
+    };
+
+    struct noise_source {
+        shared_ptr<const perlin> noise;
+        shared_ptr<const baked_turbulence> baked;
+    };
+
+    std::vector<op> ops;
+    std::vector<shared_ptr<const rtw_image>> images;
+    std::vector<noise_source> noises;
+    std::vector<const texture*> calls;
+    uint32_t root = 0;
+
+    uint32_t push(const op& o) {
+        ops.push_back(o);
+        return static_cast<uint32_t>(ops.size() - 1);
+    }
+
+    color eval(uint32_t index, real u, real v, const point3& p, real footprint) const;
+    void eval(uint32_t index, const texture_batch& batch, const uint32_t* lanes, size_t count) const;
+};
 
 class texture {
   public:
     virtual ~texture() = default;
 
-    virtual color value(double u, double v, const point3& p) const = 0;
+    virtual color value(real u, real v, const point3& p) const = 0;
+
+    // The value averaged over a pixel's footprint on the surface, `footprint` wide in texture
+    // coordinates, or 0 if the width is unknown. Textures that are not filtered ignore it.
+    virtual color filtered_value(real u, real v, const point3& p, real footprint) const {
+        return value(u, v, p);
+    }
+
+    // Appends this texture's ops to a program, inputs first, and returns the index of its
+    // result. Textures without ops of their own are called through filtered_value().
+    virtual uint32_t compile(texture_program& program) const {
+        return program.add_call(this);
+    }
 };
 
 class solid_color : public texture {
   public:
     solid_color(const color& albedo) : albedo(albedo) {}
 
-    solid_color(double red, double green, double blue) : solid_color(color(red,green,blue)) {}
+    solid_color(real red, real green, real blue) : solid_color(color(red,green,blue)) {}
 
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
         return albedo;
     }
 
+    uint32_t compile(texture_program& program) const override {
+        return program.add_constant(albedo);
+    }
+
   private:
     color albedo;
 };
 
 class checker_texture : public texture {
   public:
-    checker_texture(double scale, shared_ptr<texture> even, shared_ptr<texture> odd)
+    checker_texture(real scale, shared_ptr<texture> even, shared_ptr<texture> odd)
       : inv_scale(1.0 / scale), even(even), odd(odd) {}
 
-    checker_texture(double scale, const color& c1, const color& c2)
+    checker_texture(real scale, const color& c1, const color& c2)
       : checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
 
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
+        return is_even(inv_scale, p) ? even->value(u, v, p) : odd->value(u, v, p);
+    }
+
+    color filtered_value(real u, real v, const point3& p, real footprint) const override {
+        return is_even(inv_scale, p) ? even->filtered_value(u, v, p, footprint) : odd->filtered_value(u, v, p, footprint);
+    }
+
+    uint32_t compile(texture_program& program) const override {
+        uint32_t even_op = even->compile(program);
+        uint32_t odd_op = odd->compile(program);
+        return program.add_checker(inv_scale, even_op, odd_op);
+    }
+
+    static bool is_even(real inv_scale, const point3& p) {
         auto xInteger = int(std::floor(inv_scale * p.x));
         auto yInteger = int(std::floor(inv_scale * p.y));
         auto zInteger = int(std::floor(inv_scale * p.z));
 
-        bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
-
-        return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+        return (xInteger + yInteger + zInteger) % 2 == 0;
     }
 
   private:
-    double inv_scale;
+    real inv_scale;
     shared_ptr<texture> even;
     shared_ptr<texture> odd;
 };
 
 class image_texture : public texture {
   public:
-    image_texture(const char* filename) : image(filename) {}
+    // Images are shared through the texture cache, so this does not decode a file that is
+    // already loaded.
+    image_texture(const char* filename) : image(texture_cache::instance().get(filename)) {}
 
-    color value(double u, double v, const point3& p) const override {
+    color value(real u, real v, const point3& p) const override {
+        return nearest(*image, u, v);
+    }
+
+    color filtered_value(real u, real v, const point3& p, real footprint) const override {
+        return filtered(*image, u, v, footprint);
+    }
+
+    uint32_t compile(texture_program& program) const override {
+        return program.add_image(image);
+    }
+
+    static color nearest(const rtw_image& image, real u, real v) {
         // If we have no texture data, then return solid cyan as a debugging aid.
         if (image.height() <= 0) return color(0,1,1);
 
-        // Clamp input texture coordinates to [0,1] x [1,0]
-        u = interval(0,1).clamp(u);
-        v = 1.0 - interval(0,1).clamp(v);  // Flip V to image coordinates
+        // The kernel clamps the coordinates to [0,1] x [1,0] and flips V to image coordinates.
+        float fu = static_cast<float>(u), fv = static_cast<float>(v);
+        float r, g, b;
+        simd_active.image_sample(image.view(), &fu, &fv, 1, &r, &g, &b);
+        return color(r, g, b);
+    }
 
-        auto i = int(u * image.width());
-        auto j = int(v * image.height());
-        auto pixel = image.pixel_data(i,j);
+    // Mip level a footprint calls for, fractional; nothing above 0 means the image itself
+    static real level_of_detail(const rtw_image& image, real footprint) {
+        return std::log2(footprint * std::max(image.width(), image.height()));
+    }
 
-        auto color_scale = 1.0 / 255.0;
-        return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
+    // Trilinear filtering: the footprint picks a point between two mip levels, each sampled
+    // bilinearly, and the two are blended. Footprints no wider than a texel of the image
+    // itself take the single nearest texel, as value() does.
+    static color filtered(const rtw_image& image, real u, real v, real footprint) {
+        if (image.height() <= 0) return color(0,1,1);
+
+        real lod = level_of_detail(image, footprint);
+        if (!(lod > 0)) return nearest(image, u, v);
+
+        int last = image.mip_levels() - 1;
+        int level = std::min(int(lod), last);
+        real blend = level < last ? lod - level : 0;
+        color fine = bilinear(image, level, u, v);
+        if (blend <= 0) return fine;
+        return (1 - blend) * fine + blend * bilinear(image, level + 1, u, v);
     }
 
   private:
-    rtw_image image;
+    shared_ptr<const rtw_image> image;
+
+    // The four texels around (u, v) on one mip level go to the kernel as one batch, each
+    // addressed at its centre so the kernel's nearest lookup returns exactly that texel.
+    static color bilinear(const rtw_image& image, int level, real u, real v) {
+        image_view view = image.view(level);
+        real x = std::clamp(u, real(0), real(1)) * view.width - real(0.5);
+        real y = (1 - std::clamp(v, real(0), real(1))) * view.height - real(0.5);
+        real x0 = std::floor(x), y0 = std::floor(y);
+        float fx = static_cast<float>(x - x0), fy = static_cast<float>(y - y0);
+
+        float su[4], sv[4], r[4], g[4], b[4];
+        for (int k = 0; k < 4; k++) {
+            su[k] = static_cast<float>((x0 + (k & 1) + 0.5) / view.width);
+            sv[k] = static_cast<float>(1 - (y0 + (k >> 1) + 0.5) / view.height);
+        }
+        simd_active.image_sample(view, su, sv, 4, r, g, b);
+
+        float w[4] = { (1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy };
+        color c(0, 0, 0);
+        for (int k = 0; k < 4; k++) c += w[k] * color(r[k], g[k], b[k]);
+        return c;
+    }
+};
+
+// Turbulence sampled on a lattice of n^3 points spanning a box, for noise_texture::bake()
+struct baked_turbulence {
+    point3 lo, hi;
+    int n = 0;
+    std::vector<float> values; // x fastest
+
+    // Trilinear turbulence at p, or false if p lies outside the box
+    bool lookup(const point3& p, real& result) const {
+        real g[3];
+        int i[3];
+        real f[3];
+        for (int a = 0; a < 3; a++) {
+            g[a] = (p[a] - lo[a]) / (hi[a] - lo[a]) * (n - 1);
+            if (!(g[a] >= 0 && g[a] <= n - 1)) return false;
+            i[a] = std::min(int(g[a]), n - 2);
+            f[a] = g[a] - i[a];
+        }
+        auto at = [&](int x, int y, int z) { return real(values[(size_t(i[2] + z) * n + i[1] + y) * n + i[0] + x]); };
+        auto lerp = [](real a, real b, real t) { return a + (b - a) * t; };
+        real c00 = lerp(at(0, 0, 0), at(1, 0, 0), f[0]);
+        real c10 = lerp(at(0, 1, 0), at(1, 1, 0), f[0]);
+        real c01 = lerp(at(0, 0, 1), at(1, 0, 1), f[0]);
+        real c11 = lerp(at(0, 1, 1), at(1, 1, 1), f[0]);
+        result = lerp(lerp(c00, c10, f[1]), lerp(c01, c11, f[1]), f[2]);
+        return true;
+    }
 };
 
 class noise_texture : public texture {
   public:
-    noise_texture(double scale) : scale(scale) {}
+    static constexpr int depth = 7;
+
+    noise_texture(real scale, uint32_t seed = 0) : noise(perlin::shared(seed)), seed(seed), scale(scale) {}
+
+    // Samples the turbulence over the box once, `resolution` points along each axis, and
+    // interpolates it there from then on; points outside the box are still computed
+    // directly. The scale is applied afterwards, so grids are shared between textures of
+    // the same seed and box whatever their scale. Boxes that are empty or unbounded are
+    // left alone.
+    void bake(const point3& lo, const point3& hi, int resolution) {
+        if (!(hi.x > lo.x && hi.y > lo.y && hi.z > lo.z) || !std::isfinite(lo.x + lo.y + lo.z + hi.x + hi.y + hi.z))
+            return;
+        int n = std::clamp(resolution, 2, 256);
+
+        static std::mutex library_mutex;
+        static std::map<std::tuple<uint32_t, int, std::array<real, 6>>, std::weak_ptr<const baked_turbulence>> library;
+        auto key = std::make_tuple(seed, n, std::array<real, 6>{ lo.x, lo.y, lo.z, hi.x, hi.y, hi.z });
+
+        std::lock_guard<std::mutex> lock(library_mutex);
+        auto it = library.find(key);
+        if (it != library.end()) {
+            if ((baked = it->second.lock())) return;
+        }
+
+        auto grid = make_shared<baked_turbulence>();
+        grid->lo = lo;
+        grid->hi = hi;
+        grid->n = n;
+        grid->values.resize(size_t(n) * n * n);
+        // One slice of the lattice per kernel call
+        std::vector<float> x(size_t(n) * n), y(x.size()), z(x.size());
+        vec3 step = (hi - lo) / real(n - 1);
+        for (int k = 0; k < n; k++) {
+            for (int j = 0; j < n; j++)
+                for (int i = 0; i < n; i++) {
+                    size_t s = size_t(j) * n + i;
+                    x[s] = static_cast<float>(lo.x + i * step.x);
+                    y[s] = static_cast<float>(lo.y + j * step.y);
+                    z[s] = static_cast<float>(lo.z + k * step.z);
+                }
+            noise->turb(x.data(), y.data(), z.data(), x.size(), depth, &grid->values[size_t(k) * n * n]);
+        }
+        baked = grid;
+        library[key] = grid;
+    }
+
+    color value(real u, real v, const point3& p) const override {
+      // return color(1,1,1) * 0.5 * (1.0 + noise->noise(scale * p));
+      // return color(1,1,1) * noise->turb(p, depth);// Turbulence : more like a camouflage nest
+      return marble(scale, p, turbulence(*noise, baked.get(), p));
+    }
+
+    uint32_t compile(texture_program& program) const override {
+        return program.add_noise(noise, baked, scale);
+    }
+
+    // From the baked grid when there is one covering p
+    static real turbulence(const perlin& noise, const baked_turbulence* baked, const point3& p) {
+        real result;
+        if (!baked || !baked->lookup(p, result)) result = noise.turb(p, depth);
+        return result;
+    }
 
-    color value(double u, double v, const point3& p) const override {
-      // return color(1,1,1) * 0.5 * (1.0 + noise.noise(scale * p));
-      // return color(1,1,1) * noise.turb(p, 7);// Turbulence : more like a camouflage nest
-      return color(.5, .5, .5) * (1 + std::sin(scale * p.z + 10 * noise.turb(p, 7)));// Marble effect
+    static color marble(real scale, const point3& p, real turbulence) {
+        return color(.5, .5, .5) * (1 + std::sin(scale * p.z + 10 * turbulence));// Marble effect
     }
 
   private:
-    perlin noise;
-    double scale; // More meaning great frequence
+    shared_ptr<const perlin> noise;
+    shared_ptr<const baked_turbulence> baked;
+    uint32_t seed;
+    real scale; // More meaning great frequence
 };
 
+// Blend of two textures, `amount` of the way from the first to the second
+class mix_texture : public texture {
+  public:
+    mix_texture(shared_ptr<texture> first, shared_ptr<texture> second, real amount)
+      : first(first), second(second), amount(amount) {}
+
+    color value(real u, real v, const point3& p) const override {
+        return (1 - amount) * first->value(u, v, p) + amount * second->value(u, v, p);
+    }
+
+    color filtered_value(real u, real v, const point3& p, real footprint) const override {
+        return (1 - amount) * first->filtered_value(u, v, p, footprint) + amount * second->filtered_value(u, v, p, footprint);
+    }
+
+    uint32_t compile(texture_program& program) const override {
+        uint32_t first_op = first->compile(program);
+        uint32_t second_op = second->compile(program);
+        return program.add_mix(first_op, second_op, amount);
+    }
+
+  private:
+    shared_ptr<texture> first;
+    shared_ptr<texture> second;
+    real amount;
+};
+
+// A texture multiplied by a color
+class scale_texture : public texture {
+  public:
+    scale_texture(shared_ptr<texture> input, const color& factor) : input(input), factor(factor) {}
+
+    color value(real u, real v, const point3& p) const override {
+        return factor * input->value(u, v, p);
+    }
+
+    color filtered_value(real u, real v, const point3& p, real footprint) const override {
+        return factor * input->filtered_value(u, v, p, footprint);
+    }
+
+    uint32_t compile(texture_program& program) const override {
+        return program.add_scale(input->compile(program), factor);
+    }
+
+  private:
+    shared_ptr<texture> input;
+    color factor;
+};
+
+inline texture_program::texture_program(const texture& root_texture) {
+    root = root_texture.compile(*this);
+}
+
+inline color texture_program::eval(uint32_t index, real u, real v, const point3& p, real footprint) const {
+    const op& o = ops[index];
+    switch (o.kind) {
+        case op_kind::Constant:
+            return o.c;
+        case op_kind::Checker:
+            return eval(checker_texture::is_even(o.param, p) ? o.a : o.b, u, v, p, footprint);
+        case op_kind::Image:
+            return image_texture::filtered(*images[o.resource], u, v, footprint);
+        case op_kind::Noise: {
+            const noise_source& n = noises[o.resource];
+            return noise_texture::marble(o.param, p, noise_texture::turbulence(*n.noise, n.baked.get(), p));
+        }
+        case op_kind::Mix:
+            return (1 - o.param) * eval(o.a, u, v, p, footprint) + o.param * eval(o.b, u, v, p, footprint);
+        case op_kind::Scale:
+            return o.c * eval(o.a, u, v, p, footprint);
+        case op_kind::Call:
+            return calls[o.resource]->filtered_value(u, v, p, footprint);
+    }
+    return color(0, 0, 0);
+}
+
+inline void texture_program::value(const texture_batch& batch) const {
+    if (empty()) {
+        std::fill(batch.r, batch.r + batch.size, real(0));
+        std::fill(batch.g, batch.g + batch.size, real(0));
+        std::fill(batch.b, batch.b + batch.size, real(0));
+        return;
+    }
+    std::vector<uint32_t> lanes(batch.size);
+    std::iota(lanes.begin(), lanes.end(), 0u);
+    eval(root, batch, lanes.data(), lanes.size());
+}
+
+// Evaluates op `index` at the listed lanes of the batch only
+inline void texture_program::eval(uint32_t index, const texture_batch& batch, const uint32_t* lanes, size_t count) const {
+    if (count == 0) return;
+    auto point = [&](uint32_t l) { return point3(batch.x[l], batch.y[l], batch.z[l]); };
+    auto footprint = [&](uint32_t l) { return batch.footprint ? batch.footprint[l] : real(0); };
+    auto store = [&](uint32_t l, const color& c) {
+        batch.r[l] = c.x;
+        batch.g[l] = c.y;
+        batch.b[l] = c.z;
+    };
+
+    const op& o = ops[index];
+    switch (o.kind) {
+        case op_kind::Constant:
+            for (size_t k = 0; k < count; k++) store(lanes[k], o.c);
+            break;
+        case op_kind::Checker: {
+            // Even lanes from the front, odd ones from the back
+            std::vector<uint32_t> sides(count);
+            size_t even = 0, odd = count;
+            for (size_t k = 0; k < count; k++) {
+                if (checker_texture::is_even(o.param, point(lanes[k]))) sides[even++] = lanes[k];
+                else sides[--odd] = lanes[k];
+            }
+            eval(o.a, batch, sides.data(), even);
+            eval(o.b, batch, sides.data() + even, count - even);
+            break;
+        }
+        case op_kind::Image: {
+            const rtw_image& image = *images[o.resource];
+            if (image.height() <= 0) {
+                for (size_t k = 0; k < count; k++) store(lanes[k], color(0,1,1));
+                break;
+            }
+            // Lanes filtered over more than a texel are sampled one by one; the rest take
+            // their nearest texel, all in one kernel call
+            std::vector<uint32_t> nearest;
+            std::vector<float> su, sv;
+            for (size_t k = 0; k < count; k++) {
+                uint32_t l = lanes[k];
+                if (image_texture::level_of_detail(image, footprint(l)) > 0) {
+                    store(l, image_texture::filtered(image, batch.u[l], batch.v[l], footprint(l)));
+                } else {
+                    nearest.push_back(l);
+                    su.push_back(static_cast<float>(batch.u[l]));
+                    sv.push_back(static_cast<float>(batch.v[l]));
+                }
+            }
+            std::vector<float> r(nearest.size()), g(nearest.size()), b(nearest.size());
+            simd_active.image_sample(image.view(), su.data(), sv.data(), nearest.size(), r.data(), g.data(), b.data());
+            for (size_t k = 0; k < nearest.size(); k++) store(nearest[k], color(r[k], g[k], b[k]));
+            break;
+        }
+        case op_kind::Noise: {
+            // Lanes off the baked grid go to the turbulence kernel together
+            const noise_source& n = noises[o.resource];
+            std::vector<uint32_t> direct;
+            std::vector<float> x, y, z;
+            for (size_t k = 0; k < count; k++) {
+                uint32_t l = lanes[k];
+                point3 p = point(l);
+                real turbulence;
+                if (n.baked && n.baked->lookup(p, turbulence)) {
+                    store(l, noise_texture::marble(o.param, p, turbulence));
+                } else {
+                    direct.push_back(l);
+                    x.push_back(static_cast<float>(p.x));
+                    y.push_back(static_cast<float>(p.y));
+                    z.push_back(static_cast<float>(p.z));
+                }
+            }
+            std::vector<float> turbulence(direct.size());
+            n.noise->turb(x.data(), y.data(), z.data(), direct.size(), noise_texture::depth, turbulence.data());
+            for (size_t k = 0; k < direct.size(); k++)
+                store(direct[k], noise_texture::marble(o.param, point(direct[k]), turbulence[k]));
+            break;
+        }
+        case op_kind::Mix: {
+            // The second input is written to outputs of its own at the same lanes
+            std::vector<real> r(batch.size), g(batch.size), b(batch.size);
+            texture_batch second = batch;
+            second.r = r.data();
+            second.g = g.data();
+            second.b = b.data();
+            eval(o.a, batch, lanes, count);
+            eval(o.b, second, lanes, count);
+            for (size_t k = 0; k < count; k++) {
+                uint32_t l = lanes[k];
+                store(l, (1 - o.param) * color(batch.r[l], batch.g[l], batch.b[l]) + o.param * color(r[l], g[l], b[l]));
+            }
+            break;
+        }
+        case op_kind::Scale:
+            eval(o.a, batch, lanes, count);
+            for (size_t k = 0; k < count; k++) {
+                uint32_t l = lanes[k];
+                store(l, o.c * color(batch.r[l], batch.g[l], batch.b[l]));
+            }
+            break;
+        case op_kind::Call:
+            for (size_t k = 0; k < count; k++) {
+                uint32_t l = lanes[k];
+                store(l, calls[o.resource]->filtered_value(batch.u[l], batch.v[l], point(l), footprint(l)));
+            }
+            break;
+    }
+}
+
+
+// Concrete type of a material, so batched shading can group hits by type and call that
+// type's scatter() directly instead of through the vtable. A subclass that changes
+// scatter() or emitted() must report Other.
+enum class material_kind : uint8_t { Other, Lambertian, Metal, Dielectric, DiffuseLight, Isotropic, Count };
+
+// Differentials of a perfectly specular bounce, given those of the incoming ray. The offset
+// rays start where they cross the tangent plane at the hit and leave it the way the main ray
+// does. The normal is taken as constant across the footprint, so the spread a curved mirror
+// adds is left out and footprints after it come out narrow, never blurrier than they should.
+inline void reflect_differentials(const ray& r_in, const hit_record& rec, ray& scattered) {
+    point3 px, py;
+    if (!rec.differential_hits(r_in, px, py)) return;
+    scattered.set_differentials(px, reflect(r_in.rx_direction(), rec.normal),
+                                py, reflect(r_in.ry_direction(), rec.normal));
+}
+
+// As reflect_differentials, for a refraction with index ratio `ri`. An offset ray past the
+// critical angle drops the differentials.
+inline void refract_differentials(const ray& r_in, const hit_record& rec, real ri, ray& scattered) {
+    point3 px, py;
+    if (!rec.differential_hits(r_in, px, py)) return;
+    vec3 dx = unit_vector(r_in.rx_direction()), dy = unit_vector(r_in.ry_direction());
+    auto refracts = [&](const vec3& d) {
+        real cos_theta = std::fmin(dot(-d, rec.normal), real(1));
+        return ri * ri * (1 - cos_theta * cos_theta) <= 1;
+    };
+    if (!refracts(dx) || !refracts(dy)) return;
+    scattered.set_differentials(px, refract(dx, rec.normal, ri), py, refract(dy, rec.normal, ri));
+}
 
 class material {
   public:
     virtual ~material() = default;
 
-    virtual color emitted(double u, double v, const point3& p) const {
+    virtual material_kind kind() const { return material_kind::Other; }
+
+    virtual color emitted(real u, real v, const point3& p) const {
       return color(0,0,0);
     }
 
@@ -195,17 +725,32 @@ class material {
         return false;
     }
     virtual shared_ptr<texture> get_texture()const{return tex;}
-    virtual void set_texture(shared_ptr<texture> tex0){tex = tex0;}
+    // The texture is compiled here, once, and shading evaluates the compiled program
+    virtual void set_texture(shared_ptr<texture> tex0){
+        tex = tex0;
+        program = tex ? texture_program(*tex) : texture_program();
+    }
+    const texture_program& get_texture_program() const { return program; }
   private: 
     shared_ptr<texture> tex;
+    texture_program program;
 };
 //Scatter in all lamberatian distrubition based on cos0
 class lambertian : public material {
   public:
+    material_kind kind() const override { return material_kind::Lambertian; }
+
     lambertian(shared_ptr<texture> tex){set_texture(tex);}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
     const override {
+        return scatter(r_in, rec, get_texture_program().value(rec.u, rec.v, rec.p, rec.uv_footprint(r_in)),
+                       attenuation, scattered);
+    }
+
+    // As scatter, with the texture already evaluated at the hit, e.g. for a whole batch
+    bool scatter(const ray& r_in, const hit_record& rec, const color& albedo, color& attenuation, ray& scattered)
+    const {
         auto scatter_direction = rec.normal + random_unit_vector();
         
         // Catch degenerate scatter direction
@@ -213,7 +758,7 @@ class lambertian : public material {
         scatter_direction = rec.normal;
         
         scattered = ray(rec.p, scatter_direction, r_in.time());
-        attenuation = get_texture()->value(rec.u, rec.v, rec.p);
+        attenuation = albedo;
         return true;
     }
 
@@ -223,21 +768,32 @@ class lambertian : public material {
 //Perfect reflection
 class metal : public material {
   public:
-    metal(shared_ptr<texture> tex, double fuzz) : fuzz(fuzz < 1 ? fuzz : 1) {
+    material_kind kind() const override { return material_kind::Metal; }
+
+    metal(shared_ptr<texture> tex, real fuzz) : fuzz(fuzz < 1 ? fuzz : 1) {
       set_texture(tex);
     }
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
     const override {
+      return scatter(r_in, rec, get_texture_program().value(rec.u, rec.v, rec.p, rec.uv_footprint(r_in)),
+                     attenuation, scattered);
+    }
+
+    // As scatter, with the texture already evaluated at the hit
+    bool scatter(const ray& r_in, const hit_record& rec, const color& albedo, color& attenuation, ray& scattered)
+    const {
       vec3 reflected = reflect(r_in.direction(), rec.normal);
       reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
       scattered = ray(rec.p, reflected, r_in.time());
-      attenuation = get_texture()->value(rec.u, rec.v, rec.p);;
+      // A fuzzy reflection scatters the footprint too widely for its differentials to mean much
+      if (fuzz == 0) reflect_differentials(r_in, rec, scattered);
+      attenuation = albedo;
       return (dot(scattered.direction(), rec.normal) > 0);
     }
-    double get_fuzz(){return fuzz;}
+    real get_fuzz(){return fuzz;}
   private:
-    double fuzz;
+    real fuzz;
 };
 
 //Schlick Approximation of Snell laws
@@ -245,37 +801,44 @@ class metal : public material {
 //Water 1.0/1.33
 class dielectric : public material {
   public:
-    dielectric(double refraction_index) : refraction_index(refraction_index) {}
+    material_kind kind() const override { return material_kind::Dielectric; }
+
+    dielectric(real refraction_index) : refraction_index(refraction_index) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
     const override {
         attenuation = color(1.0, 1.0, 1.0);
-        double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
+        real ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
 
         vec3 unit_direction = unit_vector(r_in.direction());
-        double cos_theta = std::fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_theta = std::sqrt(1.0 - cos_theta*cos_theta);
+        real cos_theta = std::fmin(dot(-unit_direction, rec.normal), 1.0);
+        real sin_theta = std::sqrt(1.0 - cos_theta*cos_theta);
 
         bool cannot_refract = ri * sin_theta > 1.0;
         vec3 direction;
 
-        if (cannot_refract || reflectance(cos_theta, ri) > random_double())
+        bool reflected = cannot_refract || reflectance(cos_theta, ri) > random_double();
+        if (reflected)
             direction = reflect(unit_direction, rec.normal);
         else
             direction = refract(unit_direction, rec.normal, ri);
 
         scattered = ray(rec.p, direction, r_in.time());
+        if (reflected)
+            reflect_differentials(r_in, rec, scattered);
+        else
+            refract_differentials(r_in, rec, ri, scattered);
         return true;
     }
 
-  double get_refraction_index(){return refraction_index;};
+  real get_refraction_index(){return refraction_index;};
 
   private:
     // Refractive index in vacuum or air, or the ratio of the material's refractive index over
     // the refractive index of the enclosing media
-    double refraction_index;
+    real refraction_index;
 
-    static double reflectance(double cosine, double refraction_index) {
+    static real reflectance(real cosine, real refraction_index) {
         // Use Schlick's approximation for reflectance.
         auto r0 = (1 - refraction_index) / (1 + refraction_index);
         r0 = r0*r0;
@@ -285,22 +848,32 @@ class dielectric : public material {
 
 class diffuse_light : public material {
   public:
+    material_kind kind() const override { return material_kind::DiffuseLight; }
+
     diffuse_light(shared_ptr<texture> tex) {set_texture(tex);}
 
-    color emitted(double u, double v, const point3& p) const override {
-        return get_texture()->value(u, v, p);
+    color emitted(real u, real v, const point3& p) const override {
+        return get_texture_program().value(u, v, p);
     }
 
 };
 
 class isotropic : public material {
   public:
+    material_kind kind() const override { return material_kind::Isotropic; }
+
     isotropic(shared_ptr<texture> tex){set_texture(tex);}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
     const override {
+        return scatter(r_in, rec, get_texture_program().value(rec.u, rec.v, rec.p), attenuation, scattered);
+    }
+
+    // As scatter, with the texture already evaluated at the hit
+    bool scatter(const ray& r_in, const hit_record& rec, const color& albedo, color& attenuation, ray& scattered)
+    const {
         scattered = ray(rec.p, random_unit_vector(), r_in.time());
-        attenuation = get_texture()->value(rec.u, rec.v, rec.p);
+        attenuation = albedo;
         return true;
     }
 
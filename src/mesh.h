@@ -0,0 +1,683 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "hittable.h"
+#include "wide_bvh.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Geometry parsed from a source file, before its BVH is built and it is shared. Vertex
+// positions are kept as three separate arrays (SoA); build_bvh() reorders the index buffer
+// into BVH leaf order, so a leaf covers a contiguous range of triangles.
+struct mesh_buffers {
+    std::vector<float> px, py, pz;
+    std::vector<uint32_t> indices; // Three per triangle
+    std::vector<flat_bvh_node> nodes;
+
+    size_t vertex_count() const { return px.size(); }
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    void add_vertex(float x, float y, float z) {
+        px.push_back(x);
+        py.push_back(y);
+        pz.push_back(z);
+    }
+
+    void add_triangle(uint32_t a, uint32_t b, uint32_t c) {
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+    }
+
+    // Builds the BVH over the triangles and reorders the index buffer to match its leaves.
+    void build_bvh() {
+        size_t n = triangle_count();
+        std::vector<flat_bvh_prim> prims(n);
+        for (size_t i = 0; i < n; i++) {
+            flat_bvh_prim& p = prims[i];
+            for (int a = 0; a < 3; a++) {
+                p.bmin[a] = std::numeric_limits<float>::infinity();
+                p.bmax[a] = -std::numeric_limits<float>::infinity();
+            }
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[3 * i + k];
+                float c[3] = { px[v], py[v], pz[v] };
+                for (int a = 0; a < 3; a++) {
+                    p.bmin[a] = std::min(p.bmin[a], c[a]);
+                    p.bmax[a] = std::max(p.bmax[a], c[a]);
+                }
+            }
+            for (int a = 0; a < 3; a++)
+                p.centroid[a] = 0.5f * (p.bmin[a] + p.bmax[a]);
+            p.index = static_cast<uint32_t>(i);
+        }
+
+        nodes = flat_bvh_builder(4).build(prims);
+
+        std::vector<uint32_t> ordered(indices.size());
+        for (size_t i = 0; i < n; i++) {
+            uint32_t src = prims[i].index;
+            ordered[3 * i + 0] = indices[3 * src + 0];
+            ordered[3 * i + 1] = indices[3 * src + 1];
+            ordered[3 * i + 2] = indices[3 * src + 2];
+        }
+        indices.swap(ordered);
+    }
+};
+
+// Mesh shared by every object that references the same file. The arrays are read through
+// plain pointers so they can live either in parsed buffers or directly in a mapped cache
+// file; whichever one backs them is owned here.
+struct mesh_data {
+    std::string source;
+    const float* px = nullptr;
+    const float* py = nullptr;
+    const float* pz = nullptr;
+    const uint32_t* indices = nullptr; // Three per triangle, in BVH leaf order
+    const flat_bvh_node* nodes = nullptr;
+    size_t vertices = 0;
+    size_t triangles = 0;
+    size_t node_count = 0;
+    float bmin[3] = { 0, 0, 0 };
+    float bmax[3] = { 0, 0, 0 };
+    // Collapsed from `nodes` after loading; only the binary tree is cached on disk.
+    std::vector<wide_bvh_node<wide_bvh_width>> wide_nodes;
+
+    size_t vertex_count() const { return vertices; }
+    size_t triangle_count() const { return triangles; }
+    bool from_cache() const { return mapping.is_open(); }
+
+    void use_buffers(mesh_buffers&& built) {
+        buffers = std::move(built);
+        px = buffers.px.data();
+        py = buffers.py.data();
+        pz = buffers.pz.data();
+        indices = buffers.indices.data();
+        nodes = buffers.nodes.data();
+        vertices = buffers.vertex_count();
+        triangles = buffers.triangle_count();
+        node_count = buffers.nodes.size();
+        set_bounds();
+        wide_nodes = wide_bvh_collapse<wide_bvh_width>(nodes, node_count);
+    }
+
+    void use_mapping(mapped_file&& file) {
+        mapping = std::move(file);
+        wide_nodes = wide_bvh_collapse<wide_bvh_width>(nodes, node_count);
+    }
+
+    void set_bounds() {
+        if (node_count == 0) {
+            std::fill(bmin, bmin + 3, 0.0f);
+            std::fill(bmax, bmax + 3, 0.0f);
+        } else {
+            std::copy(nodes[0].bmin, nodes[0].bmin + 3, bmin);
+            std::copy(nodes[0].bmax, nodes[0].bmax + 3, bmax);
+        }
+    }
+
+  private:
+    mesh_buffers buffers;
+    mapped_file mapping;
+};
+
+inline std::string read_mesh_file(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open mesh file: " + filename);
+    }
+    in.seekg(0, std::ios::end);
+    std::string bytes(static_cast<size_t>(in.tellg()), '\0');
+    in.seekg(0, std::ios::beg);
+    in.read(bytes.data(), bytes.size());
+    return bytes;
+}
+
+// Wavefront OBJ: only `v` and `f` records are used. Faces with more than three corners are
+// triangulated as fans; texture/normal references (`v/vt/vn`) and negative indices are
+// accepted.
+inline void load_obj(const std::string& filename, mesh_buffers& m) {
+    std::string text = read_mesh_file(filename);
+    const char* p = text.c_str();
+    const char* end = p + text.size();
+    std::vector<int64_t> face;
+
+    auto skip_blanks = [&]() { while (p < end && (*p == ' ' || *p == '\t')) p++; };
+    auto next_line = [&]() { while (p < end && *p != '\n') p++; if (p < end) p++; };
+
+    while (p < end) {
+        skip_blanks();
+        if (p + 1 < end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            p++;
+            char* next;
+            float x = std::strtof(p, &next); p = next;
+            float y = std::strtof(p, &next); p = next;
+            float z = std::strtof(p, &next); p = next;
+            m.add_vertex(x, y, z);
+        } else if (p + 1 < end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            p++;
+            face.clear();
+            while (true) {
+                skip_blanks();
+                if (p >= end || *p == '\n' || *p == '\r' || *p == '#') break;
+                char* next;
+                long long idx = std::strtoll(p, &next, 10);
+                if (next == p) break;
+                p = next;
+                while (p < end && !std::isspace(static_cast<unsigned char>(*p))) p++; // Skip "/vt/vn"
+                int64_t resolved = idx < 0 ? static_cast<int64_t>(m.vertex_count()) + idx : idx - 1;
+                if (resolved < 0 || resolved >= static_cast<int64_t>(m.vertex_count())) {
+                    throw std::runtime_error("Invalid face index in OBJ file: " + filename);
+                }
+                face.push_back(resolved);
+            }
+            for (size_t i = 1; i + 1 < face.size(); i++) {
+                m.add_triangle(static_cast<uint32_t>(face[0]), static_cast<uint32_t>(face[i]),
+                               static_cast<uint32_t>(face[i + 1]));
+            }
+        }
+        next_line();
+    }
+}
+
+// Binary PLY (little or big endian). Reads x/y/z from the `vertex` element and the index
+// list of the `face` element; every other element and property is skipped.
+inline void load_ply(const std::string& filename, mesh_buffers& m) {
+    std::string bytes = read_mesh_file(filename);
+
+    struct property {
+        std::string name;
+        int type = 0;       // Size in bytes of each value
+        bool is_float = false;
+        bool is_signed = false;
+        bool is_list = false;
+        int count_type = 0;
+        bool count_signed = false;
+    };
+    struct element {
+        std::string name;
+        size_t count = 0;
+        std::vector<property> properties;
+    };
+
+    auto parse_type = [&](const std::string& t, int& size, bool& is_float, bool& is_signed) {
+        is_float = false;
+        is_signed = true;
+        if (t == "char" || t == "int8") size = 1;
+        else if (t == "uchar" || t == "uint8") { size = 1; is_signed = false; }
+        else if (t == "short" || t == "int16") size = 2;
+        else if (t == "ushort" || t == "uint16") { size = 2; is_signed = false; }
+        else if (t == "int" || t == "int32") size = 4;
+        else if (t == "uint" || t == "uint32") { size = 4; is_signed = false; }
+        else if (t == "float" || t == "float32") { size = 4; is_float = true; }
+        else if (t == "double" || t == "float64") { size = 8; is_float = true; }
+        else throw std::runtime_error("Unsupported PLY property type '" + t + "' in " + filename);
+    };
+
+    // Header
+    size_t header_end = bytes.find("end_header");
+    if (bytes.compare(0, 3, "ply") != 0 || header_end == std::string::npos) {
+        throw std::runtime_error("Invalid PLY file: " + filename);
+    }
+    size_t body = bytes.find('\n', header_end);
+    if (body == std::string::npos) {
+        throw std::runtime_error("Invalid PLY header: " + filename);
+    }
+    body++;
+
+    bool big_endian = false;
+    std::vector<element> elements;
+    std::istringstream header(bytes.substr(0, header_end));
+    std::string line;
+    while (std::getline(header, line)) {
+        std::istringstream ls(line);
+        std::string keyword;
+        ls >> keyword;
+        if (keyword == "format") {
+            std::string format;
+            ls >> format;
+            if (format == "binary_big_endian") big_endian = true;
+            else if (format != "binary_little_endian") {
+                throw std::runtime_error("Only binary PLY files are supported: " + filename);
+            }
+        } else if (keyword == "element") {
+            element e;
+            ls >> e.name >> e.count;
+            elements.push_back(e);
+        } else if (keyword == "property" && !elements.empty()) {
+            property prop;
+            std::string type;
+            ls >> type;
+            if (type == "list") {
+                std::string count_type, item_type;
+                ls >> count_type >> item_type >> prop.name;
+                bool count_float;
+                parse_type(count_type, prop.count_type, count_float, prop.count_signed);
+                parse_type(item_type, prop.type, prop.is_float, prop.is_signed);
+                prop.is_list = true;
+            } else {
+                ls >> prop.name;
+                parse_type(type, prop.type, prop.is_float, prop.is_signed);
+            }
+            elements.back().properties.push_back(prop);
+        }
+    }
+
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(bytes.data()) + body;
+    const unsigned char* end = reinterpret_cast<const unsigned char*>(bytes.data()) + bytes.size();
+
+    auto read_value = [&](int size, bool is_float, bool is_signed) -> double {
+        if (p + size > end) {
+            throw std::runtime_error("Truncated PLY file: " + filename);
+        }
+        unsigned char raw[8];
+        for (int i = 0; i < size; i++)
+            raw[i] = big_endian ? p[size - 1 - i] : p[i];
+        p += size;
+        switch (size) {
+            case 1: return is_signed ? double(int8_t(raw[0])) : double(raw[0]);
+            case 2: { uint16_t v; std::memcpy(&v, raw, 2); return is_signed ? double(int16_t(v)) : double(v); }
+            case 4: {
+                if (is_float) { float f; std::memcpy(&f, raw, 4); return f; }
+                uint32_t v; std::memcpy(&v, raw, 4); return is_signed ? double(int32_t(v)) : double(v);
+            }
+            default: { double d; std::memcpy(&d, raw, 8); return d; }
+        }
+    };
+
+    std::vector<uint32_t> polygon;
+    for (const element& e : elements) {
+        bool is_vertex = e.name == "vertex";
+        bool is_face = e.name == "face";
+        for (size_t i = 0; i < e.count; i++) {
+            float xyz[3] = { 0, 0, 0 };
+            for (const property& prop : e.properties) {
+                if (prop.is_list) {
+                    size_t n = static_cast<size_t>(read_value(prop.count_type, false, prop.count_signed));
+                    bool indices = is_face && (prop.name == "vertex_indices" || prop.name == "vertex_index");
+                    polygon.clear();
+                    for (size_t k = 0; k < n; k++) {
+                        double v = read_value(prop.type, prop.is_float, prop.is_signed);
+                        if (!indices) continue;
+                        // Converting a negative, fractional, NaN or too large index to uint32_t
+                        // is undefined, so it is rejected here rather than by the check below
+                        if (!(v >= 0 && v < 4294967296.0) || v != std::floor(v)) {
+                            throw std::runtime_error("Invalid face index in PLY file: " + filename);
+                        }
+                        polygon.push_back(static_cast<uint32_t>(v));
+                    }
+                    for (size_t k = 1; indices && k + 1 < polygon.size(); k++) {
+                        m.add_triangle(polygon[0], polygon[k], polygon[k + 1]);
+                    }
+                } else {
+                    double v = read_value(prop.type, prop.is_float, prop.is_signed);
+                    if (is_vertex) {
+                        if (prop.name == "x") xyz[0] = static_cast<float>(v);
+                        else if (prop.name == "y") xyz[1] = static_cast<float>(v);
+                        else if (prop.name == "z") xyz[2] = static_cast<float>(v);
+                    }
+                }
+            }
+            if (is_vertex) m.add_vertex(xyz[0], xyz[1], xyz[2]);
+        }
+    }
+
+    for (uint32_t idx : m.indices) {
+        if (idx >= m.vertex_count()) {
+            throw std::runtime_error("Invalid face index in PLY file: " + filename);
+        }
+    }
+}
+
+// Binary cache written next to the source file as "<source>.zmc". It holds the vertex,
+// index and BVH arrays exactly as they are laid out in memory, each section starting on a
+// 64-byte boundary, so a later load maps the file and points mesh_data straight into it.
+// Sections are found through offsets from the start of the file and BVH nodes only store
+// indices, so nothing needs fixing up after mapping. The cache is keyed by a hash of the
+// source file's contents; a mismatch means the source changed and the cache is rebuilt.
+struct mesh_cache_header {
+    char magic[4];          // "ZMC\0"
+    uint32_t version;
+    uint32_t byte_order;    // mesh_cache_byte_order as written by the producing machine
+    uint32_t vertex_count;
+    uint32_t triangle_count;
+    uint32_t node_count;
+    uint64_t source_hash;
+    uint64_t source_size;
+    float bmin[3];
+    float bmax[3];
+    uint64_t px_offset;
+    uint64_t py_offset;
+    uint64_t pz_offset;
+    uint64_t index_offset;
+    uint64_t node_offset;
+    uint64_t file_size;
+    uint32_t padding[4];
+};
+
+static_assert(sizeof(mesh_cache_header) == 128, "mesh_cache_header must stay 128 bytes");
+
+constexpr uint32_t mesh_cache_version = 1;
+constexpr uint32_t mesh_cache_byte_order = 0x01020304;
+constexpr uint64_t mesh_cache_alignment = 64;
+
+inline std::string mesh_cache_path(const std::string& filename) {
+    return filename + ".zmc";
+}
+
+// 64-bit FNV-1a over the whole source file.
+inline uint64_t hash_bytes(const unsigned char* bytes, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Maps the cache for `source_hash` and points `data` into it. Returns false when the cache
+// is missing, stale, written by a different version or byte order, truncated or damaged.
+inline bool read_mesh_cache(const std::string& filename, uint64_t source_hash, uint64_t source_size,
+                            mesh_data& data) {
+    mapped_file file;
+    if (!file.open(mesh_cache_path(filename))) return false;
+    if (file.size() < sizeof(mesh_cache_header)) return false;
+
+    mesh_cache_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, "ZMC", 4) != 0 || header.version != mesh_cache_version
+        || header.byte_order != mesh_cache_byte_order || header.file_size != file.size()) {
+        return false;
+    }
+    if (header.source_hash != source_hash || header.source_size != source_size) {
+        std::clog << "Mesh cache for " << filename << " is stale\n";
+        return false;
+    }
+    if (header.triangle_count == 0 || header.node_count == 0) return false;
+
+    auto section_fits = [&](uint64_t offset, uint64_t count, uint64_t item_size) {
+        return offset % mesh_cache_alignment == 0 && offset <= file.size()
+            && count <= (file.size() - offset) / item_size;
+    };
+    if (!section_fits(header.px_offset, header.vertex_count, sizeof(float))
+        || !section_fits(header.py_offset, header.vertex_count, sizeof(float))
+        || !section_fits(header.pz_offset, header.vertex_count, sizeof(float))
+        || !section_fits(header.index_offset, 3ull * header.triangle_count, sizeof(uint32_t))
+        || !section_fits(header.node_offset, header.node_count, sizeof(flat_bvh_node))) {
+        return false;
+    }
+
+    // The hash only covers the source, so a damaged cache must not reach traversal: every
+    // node and vertex index it holds is checked before use
+    const unsigned char* base = file.data();
+    const uint32_t* indices = reinterpret_cast<const uint32_t*>(base + header.index_offset);
+    bool valid = flat_bvh_valid(reinterpret_cast<const flat_bvh_node*>(base + header.node_offset),
+                                header.node_count, header.triangle_count);
+    for (uint64_t i = 0; valid && i < 3ull * header.triangle_count; i++) {
+        valid = indices[i] < header.vertex_count;
+    }
+    if (!valid) {
+        std::clog << "Mesh cache for " << filename << " is damaged\n";
+        return false;
+    }
+
+    data.px = reinterpret_cast<const float*>(base + header.px_offset);
+    data.py = reinterpret_cast<const float*>(base + header.py_offset);
+    data.pz = reinterpret_cast<const float*>(base + header.pz_offset);
+    data.indices = indices;
+    data.nodes = reinterpret_cast<const flat_bvh_node*>(base + header.node_offset);
+    data.vertices = header.vertex_count;
+    data.triangles = header.triangle_count;
+    data.node_count = header.node_count;
+    std::copy(header.bmin, header.bmin + 3, data.bmin);
+    std::copy(header.bmax, header.bmax + 3, data.bmax);
+    data.use_mapping(std::move(file));
+    return true;
+}
+
+// Writes the cache to a temporary file and renames it into place, so readers never see a
+// partially written cache.
+inline void write_mesh_cache(const mesh_data& data, uint64_t source_hash, uint64_t source_size) {
+    mesh_cache_header header = {};
+    std::memcpy(header.magic, "ZMC", 4);
+    header.version = mesh_cache_version;
+    header.byte_order = mesh_cache_byte_order;
+    header.vertex_count = static_cast<uint32_t>(data.vertex_count());
+    header.triangle_count = static_cast<uint32_t>(data.triangle_count());
+    header.node_count = static_cast<uint32_t>(data.node_count);
+    header.source_hash = source_hash;
+    header.source_size = source_size;
+    std::copy(data.bmin, data.bmin + 3, header.bmin);
+    std::copy(data.bmax, data.bmax + 3, header.bmax);
+
+    uint64_t offset = sizeof(mesh_cache_header);
+    auto place = [&](uint64_t bytes) {
+        offset = (offset + mesh_cache_alignment - 1) / mesh_cache_alignment * mesh_cache_alignment;
+        uint64_t at = offset;
+        offset += bytes;
+        return at;
+    };
+    header.px_offset = place(data.vertex_count() * sizeof(float));
+    header.py_offset = place(data.vertex_count() * sizeof(float));
+    header.pz_offset = place(data.vertex_count() * sizeof(float));
+    header.index_offset = place(data.triangle_count() * 3 * sizeof(uint32_t));
+    header.node_offset = place(data.node_count * sizeof(flat_bvh_node));
+    header.file_size = offset;
+
+    std::string path = mesh_cache_path(data.source);
+    std::string temp_path = path + ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "ERROR: Cannot write mesh cache " << path << "\n";
+            return;
+        }
+        auto write_at = [&](uint64_t at, const void* bytes, uint64_t size) {
+            static const char zeros[mesh_cache_alignment] = {};
+            uint64_t pos = static_cast<uint64_t>(out.tellp());
+            out.write(zeros, static_cast<std::streamsize>(at - pos));
+            out.write(static_cast<const char*>(bytes), static_cast<std::streamsize>(size));
+        };
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write_at(header.px_offset, data.px, data.vertex_count() * sizeof(float));
+        write_at(header.py_offset, data.py, data.vertex_count() * sizeof(float));
+        write_at(header.pz_offset, data.pz, data.vertex_count() * sizeof(float));
+        write_at(header.index_offset, data.indices, data.triangle_count() * 3 * sizeof(uint32_t));
+        write_at(header.node_offset, data.nodes, data.node_count * sizeof(flat_bvh_node));
+        if (!out) {
+            std::cerr << "ERROR: Failed writing mesh cache " << path << "\n";
+            out.close();
+            std::remove(temp_path.c_str());
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        std::cerr << "ERROR: Cannot replace mesh cache " << path << ": " << ec.message() << "\n";
+        std::remove(temp_path.c_str());
+        return;
+    }
+    std::clog << "Wrote mesh cache " << path << "\n";
+}
+
+// Loads an .obj or .ply file. A valid cache is mapped and used in place; otherwise the file
+// is parsed, its BVH is built, and the cache is (re)written on a background thread. Meshes
+// are shared: asking twice for the same path while the first result is still alive returns
+// the same buffers, so duplicating or updating a mesh object does not load the file again.
+inline shared_ptr<const mesh_data> load_mesh(const std::string& filename) {
+    static std::mutex library_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<const mesh_data>> library;
+
+    std::lock_guard<std::mutex> lock(library_mutex);
+    auto it = library.find(filename);
+    if (it != library.end()) {
+        if (auto shared = it->second.lock()) return shared;
+    }
+
+    uint64_t source_hash, source_size;
+    {
+        mapped_file source;
+        if (!source.open(filename)) {
+            throw std::runtime_error("Failed to open mesh file: " + filename);
+        }
+        source_hash = hash_bytes(source.data(), source.size());
+        source_size = source.size();
+    }
+
+    auto data = make_shared<mesh_data>();
+    data->source = filename;
+
+    if (read_mesh_cache(filename, source_hash, source_size, *data)) {
+        std::clog << "Loaded mesh " << filename << " from cache: " << data->vertex_count() << " vertices, "
+                  << data->triangle_count() << " triangles, " << data->node_count << " BVH nodes\n";
+        library[filename] = data;
+        return data;
+    }
+
+    mesh_buffers buffers;
+    std::string ext = filename.substr(filename.find_last_of('.') + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (ext == "obj") load_obj(filename, buffers);
+    else if (ext == "ply") load_ply(filename, buffers);
+    else throw std::runtime_error("Unsupported mesh format: " + filename);
+
+    if (buffers.triangle_count() == 0) {
+        throw std::runtime_error("Mesh file has no triangles: " + filename);
+    }
+    buffers.build_bvh();
+    data->use_buffers(std::move(buffers));
+
+    std::clog << "Loaded mesh " << filename << ": " << data->vertex_count() << " vertices, "
+              << data->triangle_count() << " triangles, " << data->node_count << " BVH nodes\n";
+
+    // The writer keeps the mesh alive until the cache is on disk.
+    std::thread([data, source_hash, source_size]() {
+        write_mesh_cache(*data, source_hash, source_size);
+    }).detach();
+
+    library[filename] = data;
+    return data;
+}
+
+class mesh : public hittable {
+  public:
+    mesh(shared_ptr<const mesh_data> data, const point3& position)
+      : data(data), offset(position)
+    {
+        set_bounding_box();
+    }
+
+    void set_bounding_box() override {
+        bbox = aabb(point3(data->bmin[0], data->bmin[1], data->bmin[2]) + offset,
+                    point3(data->bmax[0], data->bmax[1], data->bmax[2]) + offset);
+    }
+
+    // Vertices stay in file space; moving the mesh only changes the offset applied to rays.
+    void move_by(const point3& delta) override {
+        offset += delta;
+        set_bounding_box();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        const vec3 o = r.origin() - offset;
+        const vec3 d = r.direction();
+        float org[3] = { float(o.x), float(o.y), float(o.z) };
+        float dir[3] = { float(d.x), float(d.y), float(d.z) };
+
+        const float* px = data->px;
+        const float* py = data->py;
+        const float* pz = data->pz;
+        const uint32_t* idx = data->indices;
+
+        float t_max = static_cast<float>(ray_t.max);
+        float t_min = static_cast<float>(ray_t.min);
+        uint32_t hit_tri = 0;
+        float hit_u = 0, hit_v = 0;
+
+        // Moller-Trumbore, one triangle at a time over each leaf's contiguous range.
+        auto leaf = [&](uint32_t first, uint32_t count, float& t_far) {
+            bool found = false;
+            for (uint32_t tri = first; tri < first + count; tri++) {
+                uint32_t i0 = idx[3 * tri], i1 = idx[3 * tri + 1], i2 = idx[3 * tri + 2];
+                vec3 v0(px[i0], py[i0], pz[i0]);
+                vec3 e1 = vec3(px[i1], py[i1], pz[i1]) - v0;
+                vec3 e2 = vec3(px[i2], py[i2], pz[i2]) - v0;
+
+                vec3 pvec = glm::cross(d, e2);
+                float det = glm::dot(e1, pvec);
+                if (std::fabs(det) < 1e-12f) continue;
+                float inv_det = 1.0f / det;
+
+                vec3 tvec = o - v0;
+                float u = glm::dot(tvec, pvec) * inv_det;
+                if (u < 0.0f || u > 1.0f) continue;
+
+                vec3 qvec = glm::cross(tvec, e1);
+                float v = glm::dot(d, qvec) * inv_det;
+                if (v < 0.0f || u + v > 1.0f) continue;
+
+                float t = glm::dot(e2, qvec) * inv_det;
+                if (t <= t_min || t >= t_far) continue;
+
+                t_far = t;
+                hit_tri = tri;
+                hit_u = u;
+                hit_v = v;
+                found = true;
+            }
+            return found;
+        };
+
+        if (!wide_bvh_traverse(data->wide_nodes.data(), data->wide_nodes.size(), org, dir, t_min, t_max, leaf))
+            return false;
+
+        uint32_t i0 = idx[3 * hit_tri], i1 = idx[3 * hit_tri + 1], i2 = idx[3 * hit_tri + 2];
+        vec3 v0(px[i0], py[i0], pz[i0]);
+        vec3 e1 = vec3(px[i1], py[i1], pz[i1]) - v0;
+        vec3 e2 = vec3(px[i2], py[i2], pz[i2]) - v0;
+
+        rec.t = t_max;
+        rec.p = r.at(rec.t);
+        rec.set_face_normal(r, unit_vector(cross(e1, e2)));
+        rec.u = hit_u;
+        rec.v = hit_v;
+        rec.dpdu = e1;
+        rec.dpdv = e2;
+        rec.mat = mat;
+        return true;
+    }
+
+    std::ostream& print(std::ostream& out) const override {
+        out << "Mesh(file=" << data->source
+            << ", triangles=" << data->triangle_count()
+            << ", offset=" << offset << ")";
+        return out;
+    }
+
+    std::istream& write(std::istream& in) const override {
+        return in;
+    }
+
+  private:
+    shared_ptr<const mesh_data> data;
+    vec3 offset;
+};
+
+#endif
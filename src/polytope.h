@@ -0,0 +1,216 @@
+#ifndef POLYTOPE_H
+#define POLYTOPE_H
+
+#include "hittable.h"
+#include <vector>
+
+// Convex solid stored as the half-spaces dot(n, p) <= d whose intersection it is. A ray is
+// clipped against all of them in one loop (Kay and Kajiya's slab test with arbitrary planes):
+// the latest plane it enters through and the earliest it leaves through bound the span inside,
+// so there is no per-face interior test and only the winning face is shaded. The planes are
+// those of the convex hull of the vertices given, so boxes, prisms, wedges and the like only
+// have to list their corners.
+class convex_polytope : public hittable {
+  public:
+    struct plane {
+        vec3 n; // Outward, unit length
+        real d;
+    };
+
+    convex_polytope() {}
+
+    explicit convex_polytope(const std::vector<point3>& vertices) { set_vertices(vertices); }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        real t_in, t_out;
+        int face_in, face_out;
+        if (!clip(r, t_in, t_out, face_in, face_out)) return false;
+
+        // Rays starting inside report the face they leave through
+        real t;
+        int face;
+        if (ray_t.contains(t_in)) {
+            t = t_in;
+            face = face_in;
+        } else if (ray_t.contains(t_out)) {
+            t = t_out;
+            face = face_out;
+        } else {
+            return false;
+        }
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat = mat;
+        rec.set_face_normal(r, planes[face].n);
+        const face_frame& f = frames[face];
+        vec3 local = rec.p - f.origin;
+        rec.u = dot(local, f.u);
+        rec.v = dot(local, f.v);
+        return true;
+    }
+
+    bool hit_span(const ray& r, interval& span) const override {
+        int face_in, face_out;
+        return clip(r, span.min, span.max, face_in, face_out);
+    }
+
+    void set_bounding_box() override {
+        bbox = aabb::empty;
+        for (const auto& v : vertices) bbox = aabb(bbox, aabb(v, v));
+    }
+
+    void move_by(const point3& offset) override {
+        for (auto& p : planes) p.d += dot(p.n, offset);
+        for (auto& f : frames) f.origin = f.origin + offset;
+        for (auto& v : vertices) v = v + offset;
+        set_bounding_box();
+    }
+
+    std::ostream& print(std::ostream& out) const override {
+        out << "ConvexPolytope(vertices=" << vertices.size() << ", planes=" << planes.size() << ")";
+        return out;
+    }
+
+    std::istream& write(std::istream& in) const override {
+        return in;
+    }
+
+    const std::vector<plane>& get_planes() const { return planes; }
+
+  protected:
+    // Replaces the solid by the convex hull of the points. Fewer than three points, or points
+    // on one line, leave it empty; points in one plane give a flat polygon.
+    void set_vertices(const std::vector<point3>& points) {
+        vertices = points;
+        planes.clear();
+        frames.clear();
+        set_bounding_box();
+        if (points.size() < 3) return;
+
+        const real scale = std::fmax(glm::length(bbox.max() - bbox.min()), real(1e-6));
+        const real tolerance = real(1e-5) * scale;
+        const size_t n = points.size();
+
+        // Every face of the hull contains three of the points and has all the others on
+        // its inner side. The shapes built on this have at most a dozen corners, so trying
+        // every triple is cheap next to the rest of their construction.
+        bool flat = true;
+        vec3 flat_normal(0, 0, 0);
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = i + 1; j < n; j++)
+                for (size_t k = j + 1; k < n; k++) {
+                    vec3 normal = cross(points[j] - points[i], points[k] - points[i]);
+                    real len = glm::length(normal);
+                    if (len <= tolerance * scale) continue;
+                    normal /= len;
+                    int side = outer_side(points, normal, dot(normal, points[i]), tolerance);
+                    if (side == 0) {
+                        flat_normal = normal;
+                        add_plane(points, normal, tolerance);
+                        add_plane(points, -normal, tolerance);
+                    } else {
+                        flat = false;
+                        if (side != 2) add_plane(points, side == 1 ? normal : -normal, tolerance);
+                    }
+                }
+
+        // A flat polygon is the slab of zero thickness around its plane, bounded by planes
+        // through its edges
+        if (flat) {
+            for (size_t i = 0; i < n; i++)
+                for (size_t j = i + 1; j < n; j++) {
+                    vec3 normal = cross(points[j] - points[i], flat_normal);
+                    real len = glm::length(normal);
+                    if (len <= tolerance * scale) continue;
+                    normal /= len;
+                    int side = outer_side(points, normal, dot(normal, points[i]), tolerance);
+                    if (side == 1 || side == -1) add_plane(points, side == 1 ? normal : -normal, tolerance);
+                }
+        }
+    }
+
+  private:
+    // Texture coordinates of a face: the extent of its corners along two directions in its
+    // plane, mapped onto [0,1]
+    struct face_frame {
+        point3 origin;
+        vec3 u, v;
+    };
+
+    std::vector<plane> planes;
+    std::vector<face_frame> frames; // Only read for the face that was hit
+    std::vector<point3> vertices;
+
+    // Span of the ray's line inside every half-space, and the planes it enters and leaves
+    // through. False if the line misses the solid.
+    bool clip(const ray& r, real& t_in, real& t_out, int& face_in, int& face_out) const {
+        if (planes.empty()) return false;
+        t_in = -infinity;
+        t_out = infinity;
+        face_in = face_out = 0;
+        const point3& o = r.origin();
+        const vec3& d = r.direction();
+        for (size_t i = 0; i < planes.size(); i++) {
+            real denom = dot(planes[i].n, d);
+            real dist = planes[i].d - dot(planes[i].n, o);
+            if (denom == 0) {
+                // Parallel: inside this half-space along the whole line, or nowhere
+                if (dist < 0) return false;
+                continue;
+            }
+            real t = dist / denom;
+            if (denom < 0) {
+                if (t > t_in) { t_in = t; face_in = int(i); }
+            } else {
+                if (t < t_out) { t_out = t; face_out = int(i); }
+            }
+            if (t_in > t_out) return false;
+        }
+        return true;
+    }
+
+    // 1 if all the points are on or below the plane, -1 if all are on or above it, 0 if all
+    // lie on it and 2 if it cuts through them
+    static int outer_side(const std::vector<point3>& points, const vec3& normal, real d, real tolerance) {
+        bool above = false, below = false;
+        for (const auto& p : points) {
+            real s = dot(normal, p) - d;
+            if (s > tolerance) above = true;
+            else if (s < -tolerance) below = true;
+        }
+        if (above && below) return 2;
+        if (above) return -1;
+        if (below) return 1;
+        return 0;
+    }
+
+    // Adds the supporting plane with this outward normal unless it is already there, and the
+    // texture frame spanning the corners on it
+    void add_plane(const std::vector<point3>& points, const vec3& normal, real tolerance) {
+        real d = -infinity;
+        for (const auto& p : points) d = std::fmax(d, dot(normal, p));
+        for (const auto& p : planes) {
+            if (dot(p.n, normal) > 1 - real(1e-5) && std::fabs(p.d - d) <= tolerance) return;
+        }
+        planes.push_back({ normal, d });
+
+        // Frame axes along the world axis closest to the plane, projected into it
+        vec3 helper = std::fabs(normal.y) < real(0.9) ? vec3(0, 1, 0) : vec3(0, 0, 1);
+        vec3 u = unit_vector(cross(helper, normal));
+        vec3 v = cross(normal, u);
+        real u_min = infinity, u_max = -infinity, v_min = infinity, v_max = -infinity;
+        for (const auto& p : points) {
+            if (d - dot(normal, p) > tolerance) continue;
+            u_min = std::fmin(u_min, dot(u, p));
+            u_max = std::fmax(u_max, dot(u, p));
+            v_min = std::fmin(v_min, dot(v, p));
+            v_max = std::fmax(v_max, dot(v, p));
+        }
+        real u_scale = u_max > u_min ? 1 / (u_max - u_min) : 0;
+        real v_scale = v_max > v_min ? 1 / (v_max - v_min) : 0;
+        frames.push_back({ d * normal + u_min * u + v_min * v, u * u_scale, v * v_scale });
+    }
+};
+
+#endif
@@ -2,11 +2,69 @@
 #define QUAD_H
 
 #include "hittable.h"
+#include "polytope.h"
+
+// Shapes cut out of a quad's plane. They differ only in which plane coordinates (a, b) they
+// accept, so the test is a switch that can be shared by quad and by the compiled render
+// world. p0/p1 are the shape's parameters where it has any.
+enum class planar_shape : uint8_t {
+    Parallelogram, // Also rectangle
+    Triangle,
+    Disk,          // p0 = radius
+    Ring,          // p0 = inner ratio, p1 = outer ratio
+    Ellipse,
+    Polygon        // Regular, inscribed in the unit square with a corner at a = 1; p0 = sides
+};
+
+// Same test as planar_polygon_test() in batch_kernels.h
+inline bool regular_polygon_contains(real a, real b, real sides) {
+    real x = a - real(0.5), y = b - real(0.5);
+    real r_squared = x * x + y * y;
+    if (!(r_squared <= real(0.25)) || sides < 3) return false;
+    real half_angle = real(3.14159265358979323846) / std::floor(sides);
+    real apothem = real(0.5) * std::cos(half_angle);
+    if (r_squared <= apothem * apothem) return true;
+    real phi = std::atan2(y, x);
+    real offset = phi - (std::floor(phi / (2 * half_angle)) * 2 + 1) * half_angle;
+    return std::sqrt(r_squared) * std::cos(offset) <= apothem;
+}
+
+inline bool planar_shape_contains(planar_shape shape, real a, real b, real p0, real p1) {
+    switch (shape) {
+        case planar_shape::Parallelogram:
+            return a >= 0 && a <= 1 && b >= 0 && b <= 1;
+        case planar_shape::Triangle:
+            return a >= 0 && b >= 0 && a + b <= 1;
+        case planar_shape::Disk: {
+            real dx = a - p0;
+            real dy = b - p0;
+            return dx * dx + dy * dy <= p0 * p0;
+        }
+        case planar_shape::Ring: {
+            real x = a - real(0.5);
+            real y = b - real(0.5);
+            real r_squared = x * x + y * y;
+            return r_squared <= p1 * p1 * real(0.25) && r_squared >= p0 * p0 * real(0.25);
+        }
+        case planar_shape::Ellipse: {
+            // Semi-axes 0.5 and 0.4
+            real x = (a - real(0.5)) / real(0.5);
+            real y = (b - real(0.5)) / real(0.4);
+            return x * x + y * y <= 1;
+        }
+        case planar_shape::Polygon:
+            return regular_polygon_contains(a, b, p0);
+    }
+    return false;
+}
 
+// Every flat shape: the plane through Q spanned by u and v, and the shape's predicate on the
+// plane coordinates of the hit.
 class quad : public hittable {
   public:
-    quad(const point3& Q, const vec3& u, const vec3& v)
-      : Q(Q), u(u), v(v)
+    quad(const point3& Q, const vec3& u, const vec3& v,
+         planar_shape kind = planar_shape::Parallelogram, real p0 = 0, real p1 = 0)
+      : Q(Q), u(u), v(v), kind(kind), p0(p0), p1(p1)
     {
         auto n = cross(u, v);
         normal = unit_vector(n);
@@ -34,7 +92,7 @@ class quad : public hittable {
         auto denom = dot(normal, r.direction());
 
         // No hit if the ray is parallel to the plane.
-        if (std::fabs(denom) < 1e-8)
+        if (std::fabs(denom) < real(1e-8))
             return false;
 
         // Return false if the hit point parameter t is outside the ray interval.
@@ -54,17 +112,18 @@ class quad : public hittable {
         rec.t = t;
         rec.mat = mat;
         rec.set_face_normal(r, normal);
+        rec.dpdu = u;
+        rec.dpdv = v;
 
         rec.p = intersection;
         return true;
     }
 
-    virtual bool is_interior(double a, double b, hit_record& rec) const {
-        interval unit_interval = interval(0, 1);
+    bool is_interior(real a, real b, hit_record& rec) const {
         // Given the hit point in plane coordinates, return false if it is outside the
         // primitive, otherwise set the hit record UV coordinates and return true.
 
-        if (!unit_interval.contains(a) || !unit_interval.contains(b))
+        if (!planar_shape_contains(kind, a, b, p0, p1))
             return false;
 
         rec.u = a;
@@ -72,6 +131,11 @@ class quad : public hittable {
         return true;
     }
 
+    // Shape and parameters as understood by planar_shape_contains().
+    planar_shape shape() const { return kind; }
+    real shape_param0() const { return p0; }
+    real shape_param1() const { return p1; }
+
     std::ostream& print(std::ostream& out) const override{
         out << "Quad("
             << "Q=" << Q
@@ -88,63 +152,32 @@ class quad : public hittable {
     vec3 u, v;
     vec3 w;
     vec3 normal;
-    double D;
+    real D;
   private:
+    planar_shape kind;
+    real p0, p1;
 };
 
+// The classes below only name a shape.
+
 class ring : public quad {
 public:
-    ring(const point3& Q, const vec3& u, const vec3& v, double inner_ratio, double outer_ratio)
-        : quad(Q, u, v), inner_ratio(inner_ratio), outer_ratio(outer_ratio) {}
-
-    bool is_interior(double a, double b, hit_record& rec) const override {
-        double x = a - 0.5;
-        double y = b - 0.5;
-        double r_squared = x * x + y * y;
-        double inner_r_squared = inner_ratio * inner_ratio * 0.25;
-        double outer_r_squared = outer_ratio * outer_ratio * 0.25;
-        if (r_squared > outer_r_squared || r_squared < inner_r_squared) return false;
-        rec.u = a;
-        rec.v = b;
-        return true;
-    }
-
-private:
-    double inner_ratio, outer_ratio;
+    ring(const point3& Q, const vec3& u, const vec3& v, real inner_ratio, real outer_ratio)
+        : quad(Q, u, v, planar_shape::Ring, inner_ratio, outer_ratio) {}
 };
 
 
 class triangle : public quad {
 public:
     triangle(const point3& Q, const vec3& u, const vec3& v)
-        : quad(Q, u, v) {}
-
-    bool is_interior(double a, double b, hit_record& rec) const override {
-        // Triangle: valid if a >= 0, b >= 0, a + b <= 1
-        if (a < 0 || b < 0 || a + b > 1) return false;
-        rec.u = a;
-        rec.v = b;
-        return true;
-    }
+        : quad(Q, u, v, planar_shape::Triangle) {}
 };
 
 
 class disk : public quad {
 public:
-    disk(const point3& Q, const vec3& u, const vec3& v, double radius)
-        : quad(Q, u, v), radius(radius) {}
-
-    bool is_interior(double a, double b, hit_record& rec) const override {
-        double dx = a - radius;
-        double dy = b - radius;
-        if ((dx*dx + dy*dy) > radius * radius) return false;
-        rec.u = a;
-        rec.v = b;
-        return true;
-    }
-
-private:
-    double radius;
+    disk(const point3& Q, const vec3& u, const vec3& v, real radius)
+        : quad(Q, u, v, planar_shape::Disk, radius) {}
 };
 
 
@@ -153,15 +186,6 @@ class rectangle : public quad {
 public:
     rectangle(const point3& Q, const vec3& u, const vec3& v)
         : quad(Q, u, v) {}
-
-    bool is_interior(double a, double b, hit_record& rec) const override {
-        // Rectangle: same as quad (0 <= a,b <= 1)
-        interval unit_interval(0, 1);
-        if (!unit_interval.contains(a) || !unit_interval.contains(b)) return false;
-        rec.u = a;
-        rec.v = b;
-        return true;
-    }
 };
 
 
@@ -170,69 +194,53 @@ public:
 class ellipse : public quad {
 public:
     ellipse(const point3& Q, const vec3& u, const vec3& v)
-        : quad(Q, u, v) {}
-
-    bool is_interior(double a, double b, hit_record& rec) const override {
-        // Ellipse: valid if (a-0.5)^2/0.25 + (b-0.5)^2/0.16 <= 1 (semi-axes 0.5, 0.4)
-        double x = (a - 0.5) / 0.5;
-        double y = (b - 0.5) / 0.4;
-        if (x * x + y * y > 1) return false;
-        rec.u = a;
-        rec.v = b;
-        return true;
-    }
-
+        : quad(Q, u, v, planar_shape::Ellipse) {}
 };
 
 
+// Regular polygon with `sides` corners, centered on `center` in the plane facing `n`
+class regular_polygon : public quad {
+public:
+    regular_polygon(const point3& center, const vec3& n, real radius, int sides)
+        : quad(center - radius * (frame_u(n) + frame_v(n)), 2 * radius * frame_u(n), 2 * radius * frame_v(n),
+               planar_shape::Polygon, real(sides)) {}
+
+private:
+    static vec3 frame_u(const vec3& n) {
+        vec3 helper = std::fabs(n.x) > real(0.9) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        return unit_vector(cross(helper, n));
+    }
+    static vec3 frame_v(const vec3& n) { return cross(unit_vector(n), frame_u(n)); }
+};
 
-class box : public hittable_list {
+class box : public convex_polytope {
 public:
     box(const point3& a, const point3& b)
-        : hittable_list(), a(a), b(b) {
-        // Compute minimum and maximum vertices
-        point3 min(std::fmin(a.x, b.x), std::fmin(a.y, b.y), std::fmin(a.z, b.z));
-        point3 max(std::fmax(a.x, b.x), std::fmax(a.y, b.y), std::fmax(a.z, b.z));
-
-        // Define the vectors for the sides
-        auto dx = vec3(max.x - min.x, 0, 0);
-        auto dy = vec3(0, max.y - min.y, 0);
-        auto dz = vec3(0, 0, max.z - min.z);
-
-        // Add the six quad faces
-        objects.push_back(make_shared<quad>(point3(min.x, min.y, max.z), dx, dy)); // front
-        objects.push_back(make_shared<quad>(point3(max.x, min.y, max.z), -dz, dy)); // right
-        objects.push_back(make_shared<quad>(point3(max.x, min.y, min.z), -dx, dy)); // back
-        objects.push_back(make_shared<quad>(point3(min.x, min.y, min.z), dz, dy)); // left
-        objects.push_back(make_shared<quad>(point3(min.x, max.y, max.z), dx, -dz)); // top
-        objects.push_back(make_shared<quad>(point3(min.x, min.y, min.z), dx, dz)); // bottom
-        set_bounding_box();
+        : a(a), b(b) {
+        set_vertices(corners());
     }
 
-    // Optional: Method to move the box by translating all vertices
-    void move_by(const vec3& offset) {
+    void move_by(const point3& offset) override {
         a = a + offset;
         b = b + offset;
-        // Reconstruct the box with new positions
-        for(auto &obj : objects){
-            obj->move_by(offset);
-        }
-        set_bounding_box();
-    }
-
-    void set_bounding_box() override {
-        bbox = aabb(a, b);
+        convex_polytope::move_by(offset);
     }
 
-    std::istream& write(std::istream& in) const override{
-        return in;
+    std::ostream& print(std::ostream& out) const override {
+        out << "Box(a=" << a << ", b=" << b << ")";
+        return out;
     }
 
-
-
     point3 a; // First opposite vertex
     point3 b; // Second opposite vertex
 private:
+    std::vector<point3> corners() const {
+        std::vector<point3> points;
+        for (int i = 0; i < 8; i++) {
+            points.push_back(point3(i & 1 ? b.x : a.x, i & 2 ? b.y : a.y, i & 4 ? b.z : a.z));
+        }
+        return points;
+    }
 };
 
 std::ostream& operator<<(std::ostream& out, const box& b) {
@@ -246,7 +254,7 @@ std::ostream& operator<<(std::ostream& out, const box& b) {
 
 class grid {
 public:
-    grid(int size = 30, double spacing = 1.0, const color& grid_color = color(0.05, 0.05, 0.05))
+    grid(int size = 30, real spacing = 1.0, const color& grid_color = color(0.05, 0.05, 0.05))
         : m_size(size), m_spacing(spacing), m_color(grid_color) {
         // Pre-calculate the extents of the grid
         m_half_extent = size * spacing * 0.5;
@@ -254,14 +262,14 @@ public:
 
     // Get the color at a specific point in the world
     // Returns true if the point is on a grid line, false otherwise
-    bool get_color_at(const point3& point, color& out_color, double line_width = 0.02) const {
+    bool get_color_at(const point3& point, color& out_color, real line_width = 0.02) const {
         // Only check points near the grid plane (y ≈ 0)
         if (std::abs(point.y) > 0.05) 
             return false;
 
         // Convert to grid space
-        double x = point.x;
-        double z = point.z;
+        real x = point.x;
+        real z = point.z;
 
         // Check if we're outside grid bounds
         if (std::abs(x) > m_half_extent || std::abs(z) > m_half_extent)
@@ -281,8 +289,8 @@ public:
         }
 
         // Check if point is on a grid line
-        double x_mod = std::fmod(std::abs(x), m_spacing);
-        double z_mod = std::fmod(std::abs(z), m_spacing);
+        real x_mod = std::fmod(std::abs(x), m_spacing);
+        real z_mod = std::fmod(std::abs(z), m_spacing);
         
         if ((x_mod < line_width/3 || x_mod > m_spacing - line_width/3) || 
             (z_mod < line_width/3 || z_mod > m_spacing - line_width/3)) {
@@ -294,13 +302,13 @@ public:
     }
 
     // Get grid extents
-    double get_extent() const { return m_half_extent; }
+    real get_extent() const { return m_half_extent; }
 
 private:
     int m_size;                  // Number of grid lines in each direction
-    double m_spacing;            // Distance between grid lines
+    real m_spacing;            // Distance between grid lines
     color m_color;               // Grid color
-    double m_half_extent;        // Half the total extent of the grid
+    real m_half_extent;        // Half the total extent of the grid
 };
 
 
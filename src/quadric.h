@@ -0,0 +1,203 @@
+#ifndef QUADRIC_H
+#define QUADRIC_H
+
+#include "hittable.h"
+#include "sphere.h"
+#include "batch_kernels.h"
+#include <cmath>
+
+// Orthonormal frame around the axis of a rotationally symmetric primitive, built at construction
+// and moved by move_by. hit() takes the ray into it once and solves the surface equation in its
+// axis-aligned form: the axis is +z and the primitive's reference point is the origin. The frame
+// is rigid, so ray parameters carry over unchanged.
+struct axis_frame {
+    point3 origin;
+    vec3 x, y, z;
+
+    axis_frame() {}
+
+    axis_frame(const point3& origin, const vec3& axis) : origin(origin), z(unit_vector(axis)) {
+        vec3 helper = std::fabs(z.x) > real(0.9) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        y = unit_vector(cross(z, helper));
+        x = cross(y, z);
+    }
+
+    vec3 to_local(const vec3& v) const { return vec3(dot(v, x), dot(v, y), dot(v, z)); }
+    point3 point_to_local(const point3& p) const { return to_local(p - origin); }
+    vec3 to_world(const vec3& v) const { return v.x * x + v.y * y + v.z * z; }
+
+    // World-space bounds of the local box [lo, hi]
+    aabb bounds(const point3& lo, const point3& hi) const {
+        point3 pmin(infinity), pmax(-infinity);
+        for (int i = 0; i < 8; i++) {
+            point3 corner(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z);
+            point3 p = origin + to_world(corner);
+            pmin = glm::min(pmin, p);
+            pmax = glm::max(pmax, p);
+        }
+        return aabb(pmin, pmax);
+    }
+
+    // Angle of a local point around the axis, mapped to [0,1]
+    static real azimuth(const point3& p) {
+        return (std::atan2(p.y, p.x) + pi) / (2 * pi);
+    }
+};
+
+// Second-order surface, stored the way quadric_batch in simd/kernel_types.h describes it: the
+// symmetric matrix A, the vector b and the constant c of f(q) = q.A q + 2 b.q + c with
+// q = p - center, a clipping slab along s and optional caps. One kernel intersects every
+// quadric, so the render world tests a run of them, of any shape, in a single batched call.
+//
+// Shapes are described in their own coordinates by a `form`, where the slab is
+// z_min <= z <= z_max, and placed with a basis: the local point l sits at
+// center + l.x * ex + l.y * ey + l.z * ez. The basis does not need to be orthonormal, which is
+// how an ellipsoid is a unit sphere on its three axes.
+class quadric : public hittable {
+  public:
+    // Texture coordinates on the surface: around the local z axis and along the slab, or as on
+    // a unit sphere. Caps map the disk of radius uv_radius onto [0,1]^2.
+    enum class uv_mapping { Axial, Spherical };
+
+    struct form {
+        real xx = 0, yy = 0, zz = 0, xy = 0, xz = 0, yz = 0;
+        vec3 b = vec3(0, 0, 0);
+        real c = 0;
+        real z_min = -infinity, z_max = infinity;
+        bool capped = false;
+        point3 bounds_min = point3(-infinity), bounds_max = point3(infinity); // Around the clipped surface
+        uv_mapping uv = uv_mapping::Axial;
+        real uv_radius = 1;
+    };
+
+    quadric(const point3& center, const vec3& ex, const vec3& ey, const vec3& ez, const form& f)
+        : center(center), basis{ ex, ey, ez }, local_min(f.bounds_min), local_max(f.bounds_max),
+          uv(f.uv), uv_radius(f.uv_radius) {
+        mat3 to_world(ex, ey, ez);
+        to_local = to_world.inverse();
+
+        // With l = N q, f(q) = q.(N^T A N) q + 2 (N^T b).q + c; column j of N is n[j].
+        const vec3 n[3] = { to_local * vec3(1, 0, 0), to_local * vec3(0, 1, 0), to_local * vec3(0, 0, 1) };
+        auto a_times = [&](const vec3& v) {
+            return vec3(f.xx * v.x + f.xy * v.y + f.xz * v.z,
+                        f.xy * v.x + f.yy * v.y + f.yz * v.z,
+                        f.xz * v.x + f.yz * v.y + f.zz * v.z);
+        };
+        xx = dot(n[0], a_times(n[0]));
+        yy = dot(n[1], a_times(n[1]));
+        zz = dot(n[2], a_times(n[2]));
+        xy = dot(n[0], a_times(n[1]));
+        xz = dot(n[0], a_times(n[2]));
+        yz = dot(n[1], a_times(n[2]));
+        lin = vec3(dot(n[0], f.b), dot(n[1], f.b), dot(n[2], f.b));
+        constant = f.c;
+
+        // l.z = s.q, with s the third row of N
+        slab = vec3(n[0].z, n[1].z, n[2].z);
+        slab_min = f.z_min;
+        slab_max = f.z_max;
+        capped = f.capped ? 1 : 0;
+
+        set_bounding_box();
+    }
+
+    quadric(const axis_frame& frame, const form& f)
+        : quadric(frame.origin, frame.x, frame.y, frame.z, f) {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        const point3& o = r.origin();
+        const vec3& d = r.direction();
+        batch_ray<real> batch{ o.x, o.y, o.z, d.x, d.y, d.z, r.time() };
+        real t = ray_t.max;
+        int32_t part = quadric_part_surface;
+        if (quadric_batch_hit_scalar(view(), 0, 1, batch, ray_t.min, t, part) < 0) return false;
+        set_hit_record(r, t, part, rec);
+        return true;
+    }
+
+    // Fills the record of a hit found by one of the quadric kernels.
+    void set_hit_record(const ray& r, real t, int32_t part, hit_record& rec) const {
+        rec.t = t;
+        rec.p = r.at(t);
+        vec3 q = rec.p - center;
+        vec3 l = to_local * q;
+
+        if (part == quadric_part_surface) {
+            vec3 gradient(xx * q.x + xy * q.y + xz * q.z + lin.x,
+                          xy * q.x + yy * q.y + yz * q.z + lin.y,
+                          xz * q.x + yz * q.y + zz * q.z + lin.z);
+            rec.set_face_normal(r, unit_vector(gradient));
+            if (uv == uv_mapping::Spherical) {
+                sphere::get_sphere_uv(unit_vector(l), rec.u, rec.v);
+            } else {
+                rec.u = axis_frame::azimuth(l);
+                rec.v = std::isfinite(slab_max - slab_min) ? (l.z - slab_min) / (slab_max - slab_min) : 0;
+            }
+        } else {
+            rec.set_face_normal(r, unit_vector(part == quadric_part_cap_max ? slab : -slab));
+            rec.u = 0.5 + 0.5 * l.x / uv_radius;
+            rec.v = 0.5 + 0.5 * l.y / uv_radius;
+        }
+        rec.mat = mat;
+    }
+
+    // The coefficients as a one-element batch.
+    quadric_batch<real> view() const {
+        return { &center.x, &center.y, &center.z, &xx, &yy, &zz, &xy, &xz, &yz,
+                 &lin.x, &lin.y, &lin.z, &constant, &slab.x, &slab.y, &slab.z,
+                 &slab_min, &slab_max, &capped };
+    }
+
+    const point3& get_center() const { return center; }
+
+    void set_bounding_box() override {
+        for (int a = 0; a < 3; a++) {
+            if (!std::isfinite(local_min[a]) || !std::isfinite(local_max[a])) {
+                bbox = aabb(); // Unbounded: tested outside the BVH
+                return;
+            }
+        }
+        point3 pmin(infinity), pmax(-infinity);
+        for (int i = 0; i < 8; i++) {
+            point3 p = center + (i & 1 ? local_max.x : local_min.x) * basis[0]
+                              + (i & 2 ? local_max.y : local_min.y) * basis[1]
+                              + (i & 4 ? local_max.z : local_min.z) * basis[2];
+            pmin = glm::min(pmin, p);
+            pmax = glm::max(pmax, p);
+        }
+        bbox = aabb(pmin, pmax);
+    }
+
+    void move_by(const point3& offset) override {
+        center += offset;
+        set_bounding_box();
+    }
+
+    std::ostream& print(std::ostream& out) const override {
+        out << "Quadric(center=" << center << ")";
+        return out;
+    }
+
+    std::istream& write(std::istream& in) const override {
+        return in;
+    }
+
+  private:
+    point3 center;
+    vec3 basis[3];
+    point3 local_min, local_max;
+    mat3 to_local;
+
+    // World-space coefficients relative to center
+    real xx, yy, zz, xy, xz, yz;
+    vec3 lin;
+    real constant;
+    vec3 slab;
+    real slab_min, slab_max;
+    int32_t capped;
+
+    uv_mapping uv;
+    real uv_radius;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "utility.h"
+#include <cstdint>
+
+// Primary rays of a 4x2 block of pixels, traced together by render_world::hit_packet.
+// Lane l covers pixel (l % ray_packet_width, l / ray_packet_width) of the block; lanes
+// falling outside the image are left out of `active`.
+constexpr int ray_packet_width = 4;
+constexpr int ray_packet_height = 2;
+constexpr int ray_packet_size = ray_packet_width * ray_packet_height;
+
+struct ray_packet {
+    ray rays[ray_packet_size];
+    uint32_t active = 0;
+};
+
+#endif
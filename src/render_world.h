@@ -0,0 +1,733 @@
+#ifndef RENDER_WORLD_H
+#define RENDER_WORLD_H
+
+#include "hittable.h"
+#include "sphere.h"
+#include "quad.h"
+#include "quadric.h"
+#include "wide_bvh.h"
+#include "ray_packet.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <vector>
+
+// Render-side form of the scene, compiled from the editable object hierarchy whenever the BVH
+// is rebuilt. Spheres, planar shapes and quadrics are copied into per-type SoA arrays and
+// intersected through a switch, so their tests are inlined into the traversal loop instead of
+// going through hittable::hit and quad::is_interior. Lists are flattened into their parts. Any
+// other object, convex polytopes (boxes, prisms, ...) included, keeps its virtual hit, and
+// objects without finite bounds (planes) are tested on every ray outside the BVH.
+//
+// Inside every BVH leaf the primitives are grouped by type, and the typed arrays are laid
+// out in leaf order, so each group is one contiguous run handed to a batched kernel from
+// batch_kernels.h. The binary BVH is collapsed into a wide one for traversal.
+class render_world : public hittable {
+  public:
+    enum class prim_kind : uint32_t { Sphere, Planar, Quadric, Generic };
+
+    struct prim_ref {
+        prim_kind kind;
+        uint32_t index; // Into the array of that kind
+    };
+
+    struct sphere_prim {
+        point3 center;  // At time 0
+        vec3 velocity;  // Displacement over the shutter interval
+        real radius;
+        uint32_t material;
+    };
+
+    struct planar_prim {
+        point3 Q;
+        vec3 u, v, w;
+        vec3 normal;
+        real D;
+        planar_shape shape;
+        real p0, p1;
+        uint32_t material;
+    };
+
+    render_world() { bbox = aabb::empty; }
+
+    explicit render_world(const std::vector<shared_ptr<hittable>>& objects) {
+        bbox = aabb::empty;
+        for (const auto& object : objects) {
+            if (object) compile(object, object.get());
+        }
+        build_bvh();
+    }
+
+    // The batch views point into this object's own arrays.
+    render_world(const render_world&) = delete;
+    render_world& operator=(const render_world&) = delete;
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        trace_state s = begin_trace(r, ray_t, rec);
+        traverse(r, s, rec);
+        return finish_trace(r, s, rec);
+    }
+
+    // Traces the active rays of a packet together through the BVH, falling back to one ray
+    // at a time when their directions diverge. Returns a bit per ray that hit something.
+    uint32_t hit_packet(const ray_packet& packet, interval ray_t, hit_record recs[ray_packet_size]) const {
+        trace_state states[ray_packet_size];
+        for (int l = 0; l < ray_packet_size; l++) {
+            if (packet.active & (1u << l))
+                states[l] = begin_trace(packet.rays[l], ray_t, recs[l]);
+        }
+
+        if (!nodes.empty()) {
+            wide_bvh_packet<ray_packet_size> lanes;
+            batch_packet<real, ray_packet_size> batch;
+            float t_far[ray_packet_size];
+            for (int l = 0; l < ray_packet_size; l++) {
+                const point3& o = packet.rays[l].origin();
+                const vec3& d = packet.rays[l].direction();
+                for (int a = 0; a < 3; a++) {
+                    lanes.org[l][a] = float(o[a]);
+                    lanes.dir[l][a] = float(d[a]);
+                }
+                batch.ox[l] = o.x; batch.oy[l] = o.y; batch.oz[l] = o.z;
+                batch.dx[l] = d.x; batch.dy[l] = d.y; batch.dz[l] = d.z;
+                batch.time[l] = packet.rays[l].time();
+                t_far[l] = float(states[l].closest);
+            }
+
+            auto leaf = [&](uint32_t first, uint32_t count, uint32_t mask) {
+                uint32_t shortened;
+                if ((mask & (mask - 1)) == 0) {
+                    int l = std::countr_zero(mask);
+                    shortened = intersect_leaf(first, count, packet.rays[l], states[l], recs[l]) ? mask : 0;
+                } else {
+                    shortened = intersect_leaf_packet(first, count, packet, batch, mask, states, recs);
+                }
+                for (; shortened; shortened &= shortened - 1) {
+                    int l = std::countr_zero(shortened);
+                    t_far[l] = std::min(t_far[l], float(states[l].closest));
+                }
+            };
+            if (!wide_bvh_traverse_packet(nodes.data(), nodes.size(), lanes, packet.active, float(ray_t.min), t_far, leaf)) {
+                for (int l = 0; l < ray_packet_size; l++) {
+                    if (packet.active & (1u << l))
+                        traverse(packet.rays[l], states[l], recs[l]);
+                }
+            }
+        }
+
+        uint32_t hits = 0;
+        for (int l = 0; l < ray_packet_size; l++) {
+            if ((packet.active & (1u << l)) && finish_trace(packet.rays[l], states[l], recs[l]))
+                hits |= 1u << l;
+        }
+        return hits;
+    }
+
+    size_t primitive_count() const { return refs.size() + unbounded.size(); }
+
+    // Brings the primitives compiled from `object` up to date after it was moved, and refits
+    // the boxes above them, so dragging an object does not rebuild the world. The tree keeps
+    // its shape, which fits worse the further the object goes; rebuild once the move is over.
+    // Objects hit through their own hit() are shared with the scene and only need new boxes.
+    void refit_object(const hittable* object) {
+        std::vector<std::pair<uint32_t, uint8_t>> leaves;
+        for (size_t r = 0; r < refs.size(); r++) {
+            if (ref_owners[r] != object) continue;
+            const hittable* prim = ref_prims[r];
+            uint32_t k = refs[r].index;
+            switch (refs[r].kind) {
+                case prim_kind::Sphere:
+                    spheres.set(k, sphere_prim_of(static_cast<const sphere*>(prim), spheres.material[k]));
+                    break;
+                case prim_kind::Planar:
+                    planars.set(k, planar_prim_of(static_cast<const quad*>(prim), planars.material[k]));
+                    break;
+                case prim_kind::Quadric:
+                    quadrics.set(k, quadrics.source[k]);
+                    break;
+                case prim_kind::Generic:
+                    break;
+            }
+            aabb box = prim->bounding_box();
+            bbox = aabb(bbox, box);
+            float_bounds(box, ref_boxes[r]);
+            std::pair<uint32_t, uint8_t> leaf(ref_node[r], ref_slot[r]);
+            if (leaves.empty() || leaves.back() != leaf) leaves.push_back(leaf);
+        }
+        for (auto [node, slot] : leaves) refit_leaf(node, slot);
+    }
+
+    std::ostream& print(std::ostream& out) const override {
+        out << "RenderWorld(spheres=" << spheres.size()
+            << ", planars=" << planars.size()
+            << ", quadrics=" << quadrics.size()
+            << ", generic=" << generics.size()
+            << ", unbounded=" << unbounded.size()
+            << ", nodes=" << nodes.size() << ")";
+        return out;
+    }
+
+    std::istream& write(std::istream& in) const override {
+        return in;
+    }
+
+  private:
+    struct sphere_arrays {
+        std::vector<real> cx, cy, cz, vx, vy, vz, radius;
+        std::vector<uint32_t> material;
+        size_t count = 0; // Without the padding
+
+        void push(const sphere_prim& s) {
+            for (auto* a : { &cx, &cy, &cz, &vx, &vy, &vz, &radius })
+                a->emplace_back();
+            material.emplace_back();
+            set(radius.size() - 1, s);
+        }
+
+        void set(size_t k, const sphere_prim& s) {
+            cx[k] = s.center.x; cy[k] = s.center.y; cz[k] = s.center.z;
+            vx[k] = s.velocity.x; vy[k] = s.velocity.y; vz[k] = s.velocity.z;
+            radius[k] = s.radius;
+            material[k] = s.material;
+        }
+
+        size_t size() const { return count; }
+
+        sphere_batch<real> view() const {
+            return { cx.data(), cy.data(), cz.data(), vx.data(), vy.data(), vz.data(), radius.data() };
+        }
+    };
+
+    struct planar_arrays {
+        std::vector<real> qx, qy, qz, ux, uy, uz, vx, vy, vz, wx, wy, wz, nx, ny, nz, d, p0, p1;
+        std::vector<int32_t> shape;
+        std::vector<uint32_t> material;
+        size_t count = 0; // Without the padding
+
+        void push(const planar_prim& q) {
+            for (auto* a : { &qx, &qy, &qz, &ux, &uy, &uz, &vx, &vy, &vz, &wx, &wy, &wz, &nx, &ny, &nz, &d, &p0, &p1 })
+                a->emplace_back();
+            shape.emplace_back();
+            material.emplace_back();
+            set(d.size() - 1, q);
+        }
+
+        void set(size_t k, const planar_prim& q) {
+            qx[k] = q.Q.x; qy[k] = q.Q.y; qz[k] = q.Q.z;
+            ux[k] = q.u.x; uy[k] = q.u.y; uz[k] = q.u.z;
+            vx[k] = q.v.x; vy[k] = q.v.y; vz[k] = q.v.z;
+            wx[k] = q.w.x; wy[k] = q.w.y; wz[k] = q.w.z;
+            nx[k] = q.normal.x; ny[k] = q.normal.y; nz[k] = q.normal.z;
+            d[k] = q.D;
+            p0[k] = q.p0;
+            p1[k] = q.p1;
+            shape[k] = static_cast<int32_t>(q.shape);
+            material[k] = q.material;
+        }
+
+        size_t size() const { return count; }
+
+        planar_batch<real> view() const {
+            return { qx.data(), qy.data(), qz.data(), ux.data(), uy.data(), uz.data(),
+                     vx.data(), vy.data(), vz.data(), wx.data(), wy.data(), wz.data(),
+                     nx.data(), ny.data(), nz.data(), d.data(), p0.data(), p1.data(), shape.data() };
+        }
+    };
+
+    // Quadric coefficients, with the objects kept for filling hit records.
+    struct quadric_arrays {
+        std::vector<real> cx, cy, cz, xx, yy, zz, xy, xz, yz, bx, by, bz, c, sx, sy, sz, slab_min, slab_max;
+        std::vector<int32_t> capped;
+        std::vector<shared_ptr<quadric>> source;
+        size_t count = 0; // Without the padding
+
+        void push(const shared_ptr<quadric>& q) {
+            push_padding();
+            source.push_back(q);
+            set(source.size() - 1, q);
+        }
+
+        // The coefficients are copies, refreshed from the object after it moved
+        void set(size_t k, const shared_ptr<quadric>& q) {
+            quadric_batch<real> f = q->view();
+            cx[k] = *f.cx; cy[k] = *f.cy; cz[k] = *f.cz;
+            xx[k] = *f.xx; yy[k] = *f.yy; zz[k] = *f.zz;
+            xy[k] = *f.xy; xz[k] = *f.xz; yz[k] = *f.yz;
+            bx[k] = *f.bx; by[k] = *f.by; bz[k] = *f.bz;
+            c[k] = *f.c;
+            sx[k] = *f.sx; sy[k] = *f.sy; sz[k] = *f.sz;
+            slab_min[k] = *f.slab_min; slab_max[k] = *f.slab_max;
+            capped[k] = *f.capped;
+        }
+
+        // A quadric with all coefficients zero never produces a hit: both roots come out NaN.
+        void push_padding() {
+            for (auto* v : { &cx, &cy, &cz, &xx, &yy, &zz, &xy, &xz, &yz, &bx, &by, &bz, &c, &sx, &sy, &sz, &slab_min, &slab_max })
+                v->push_back(0);
+            capped.push_back(0);
+        }
+
+        size_t size() const { return count; }
+
+        quadric_batch<real> view() const {
+            return { cx.data(), cy.data(), cz.data(), xx.data(), yy.data(), zz.data(), xy.data(), xz.data(), yz.data(),
+                     bx.data(), by.data(), bz.data(), c.data(), sx.data(), sy.data(), sz.data(),
+                     slab_min.data(), slab_max.data(), capped.data() };
+        }
+    };
+
+    // Large enough to fill an 8-wide batch, small enough to keep leaves tight.
+    static constexpr int leaf_size = 8;
+
+    sphere_arrays spheres;
+    planar_arrays planars;
+    quadric_arrays quadrics;
+    sphere_batch<real> sphere_view{};
+    planar_batch<real> planar_view{};
+    quadric_batch<real> quadric_view{};
+    std::vector<shared_ptr<hittable>> generics;
+    std::vector<shared_ptr<hittable>> unbounded;
+    std::vector<shared_ptr<material>> materials;
+    std::vector<prim_ref> refs;       // In BVH leaf order, grouped by kind inside each leaf
+    std::vector<wide_bvh_node<wide_bvh_width>> nodes;
+
+    // For refit_object, per ref: the scene object it came from, the primitive itself (the
+    // object or one of its parts), its box and the node and child slot of its leaf. Per node:
+    // its parent and its slot there.
+    struct ref_box {
+        float bmin[3], bmax[3];
+    };
+    static constexpr uint32_t no_parent = ~uint32_t(0);
+    std::vector<const hittable*> ref_owners;
+    std::vector<const hittable*> ref_prims;
+    std::vector<ref_box> ref_boxes;
+    std::vector<uint32_t> ref_node;
+    std::vector<uint8_t> ref_slot;
+    std::vector<uint32_t> node_parent;
+    std::vector<uint8_t> node_slot;
+
+    // Build input, dropped once the BVH exists
+    std::vector<sphere_prim> sphere_input;
+    std::vector<planar_prim> planar_input;
+    std::vector<shared_ptr<quadric>> quadric_input;
+    std::vector<aabb> ref_bounds;
+
+    // Nearest hit found so far for one ray. Generic objects write the record directly; for
+    // the typed primitives it is only filled by finish_trace.
+    struct trace_state {
+        batch_ray<real> batch{};
+        prim_ref closest_ref{ prim_kind::Generic, 0 };
+        real t_min = 0;
+        real closest = 0;
+        real hit_a = 0, hit_b = 0;
+        int32_t part = 0; // Quadric part
+        bool found = false;
+    };
+
+    trace_state begin_trace(const ray& r, interval ray_t, hit_record& rec) const {
+        trace_state s;
+        const point3& o = r.origin();
+        const vec3& d = r.direction();
+        s.batch = { o.x, o.y, o.z, d.x, d.y, d.z, r.time() };
+        s.t_min = ray_t.min;
+        s.closest = ray_t.max;
+
+        hit_record generic_rec;
+        for (const auto& object : unbounded) {
+            if (object->hit(r, interval(s.t_min, s.closest), generic_rec)) {
+                s.closest = generic_rec.t;
+                rec = generic_rec;
+                s.closest_ref = { prim_kind::Generic, 0 };
+                s.found = true;
+            }
+        }
+        return s;
+    }
+
+    void traverse(const ray& r, trace_state& s, hit_record& rec) const {
+        if (nodes.empty()) return;
+        const point3& o = r.origin();
+        const vec3& d = r.direction();
+        float org[3] = { float(o.x), float(o.y), float(o.z) };
+        float dir[3] = { float(d.x), float(d.y), float(d.z) };
+        float t_far = float(s.closest);
+
+        auto leaf = [&](uint32_t first, uint32_t count, float& leaf_t_max) {
+            if (!intersect_leaf(first, count, r, s, rec)) return false;
+            leaf_t_max = std::min(leaf_t_max, float(s.closest));
+            return true;
+        };
+        wide_bvh_traverse(nodes.data(), nodes.size(), org, dir, float(s.t_min), t_far, leaf);
+    }
+
+    // Tests the refs of one leaf, one batched call per run of the same kind. Returns true
+    // when the nearest hit moved closer.
+    bool intersect_leaf(uint32_t first, uint32_t count, const ray& r, trace_state& s, hit_record& rec) const {
+        bool shortened = false;
+        uint32_t end = first + count;
+        hit_record generic_rec;
+        for (uint32_t i = first; i < end;) {
+            prim_kind kind = refs[i].kind;
+            uint32_t run_end = i + 1;
+            while (run_end < end && refs[run_end].kind == kind) run_end++;
+
+            switch (kind) {
+                case prim_kind::Sphere: {
+                    int k = sphere_batch_hit(sphere_view, refs[i].index, run_end - i, s.batch, s.t_min, s.closest);
+                    if (k >= 0) {
+                        s.closest_ref = { kind, uint32_t(k) };
+                        shortened = true;
+                    }
+                    break;
+                }
+                case prim_kind::Planar: {
+                    int k = planar_batch_hit(planar_view, refs[i].index, run_end - i, s.batch, s.t_min, s.closest, s.hit_a, s.hit_b);
+                    if (k >= 0) {
+                        s.closest_ref = { kind, uint32_t(k) };
+                        shortened = true;
+                    }
+                    break;
+                }
+                case prim_kind::Quadric: {
+                    int k = quadric_batch_hit(quadric_view, refs[i].index, run_end - i, s.batch, s.t_min, s.closest, s.part);
+                    if (k >= 0) {
+                        s.closest_ref = { kind, uint32_t(k) };
+                        shortened = true;
+                    }
+                    break;
+                }
+                case prim_kind::Generic: {
+                    for (uint32_t g = i; g < run_end; g++) {
+                        if (!generics[refs[g].index]->hit(r, interval(s.t_min, s.closest), generic_rec)) continue;
+                        s.closest = generic_rec.t;
+                        rec = generic_rec;
+                        s.closest_ref = refs[g];
+                        shortened = true;
+                    }
+                    break;
+                }
+            }
+            i = run_end;
+        }
+        if (shortened) s.found = true;
+        return shortened;
+    }
+
+    // Packet form of intersect_leaf: each run is tested against all the `lanes` rays at once.
+    // Returns the lanes whose nearest hit moved closer.
+    uint32_t intersect_leaf_packet(uint32_t first, uint32_t count, const ray_packet& packet,
+                                   const batch_packet<real, ray_packet_size>& batch, uint32_t lanes,
+                                   trace_state states[ray_packet_size], hit_record recs[ray_packet_size]) const {
+        uint32_t shortened = 0;
+        uint32_t end = first + count;
+        real t_max[ray_packet_size], hit_a[ray_packet_size], hit_b[ray_packet_size];
+        int32_t best[ray_packet_size], part[ray_packet_size];
+        real t_min = states[std::countr_zero(lanes)].t_min;
+        for (int l = 0; l < ray_packet_size; l++) {
+            t_max[l] = states[l].closest;
+            hit_a[l] = hit_b[l] = 0;
+            best[l] = -1;
+            part[l] = 0;
+        }
+
+        for (uint32_t i = first; i < end;) {
+            prim_kind kind = refs[i].kind;
+            uint32_t run_end = i + 1;
+            while (run_end < end && refs[run_end].kind == kind) run_end++;
+
+            uint32_t hit = 0;
+            switch (kind) {
+                case prim_kind::Sphere:
+                    hit = sphere_packet_hit(sphere_view, refs[i].index, run_end - i, batch, lanes, t_min, t_max, best);
+                    break;
+                case prim_kind::Planar:
+                    hit = planar_packet_hit(planar_view, refs[i].index, run_end - i, batch, lanes, t_min, t_max, best, hit_a, hit_b);
+                    break;
+                case prim_kind::Quadric:
+                    hit = quadric_packet_hit(quadric_view, refs[i].index, run_end - i, batch, lanes, t_min, t_max, best, part);
+                    break;
+                case prim_kind::Generic: {
+                    hit_record generic_rec;
+                    for (uint32_t m = lanes; m; m &= m - 1) {
+                        int l = std::countr_zero(m);
+                        for (uint32_t g = i; g < run_end; g++) {
+                            if (!generics[refs[g].index]->hit(packet.rays[l], interval(t_min, t_max[l]), generic_rec)) continue;
+                            t_max[l] = generic_rec.t;
+                            recs[l] = generic_rec;
+                            states[l].closest_ref = refs[g];
+                            hit |= 1u << l;
+                        }
+                    }
+                    break;
+                }
+            }
+
+            for (uint32_t m = hit; kind != prim_kind::Generic && m; m &= m - 1) {
+                int l = std::countr_zero(m);
+                states[l].closest_ref = { kind, uint32_t(best[l]) };
+                states[l].hit_a = hit_a[l];
+                states[l].hit_b = hit_b[l];
+                states[l].part = part[l];
+            }
+            shortened |= hit;
+            i = run_end;
+        }
+
+        for (uint32_t m = shortened; m; m &= m - 1) {
+            int l = std::countr_zero(m);
+            states[l].closest = t_max[l];
+            states[l].found = true;
+        }
+        return shortened;
+    }
+
+    // The record is filled once, for the nearest primitive only.
+    bool finish_trace(const ray& r, const trace_state& s, hit_record& rec) const {
+        if (!s.found) return false;
+
+        uint32_t k = s.closest_ref.index;
+        switch (s.closest_ref.kind) {
+            case prim_kind::Sphere: {
+                point3 current_center = point3(spheres.cx[k], spheres.cy[k], spheres.cz[k])
+                                      + r.time() * vec3(spheres.vx[k], spheres.vy[k], spheres.vz[k]);
+                rec.t = s.closest;
+                rec.p = r.at(s.closest);
+                vec3 outward_normal = (rec.p - current_center) / spheres.radius[k];
+                rec.set_face_normal(r, outward_normal);
+                sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+                sphere::get_sphere_tangents(outward_normal, spheres.radius[k], rec.dpdu, rec.dpdv);
+                rec.mat = materials[spheres.material[k]];
+                break;
+            }
+            case prim_kind::Planar: {
+                rec.t = s.closest;
+                rec.p = r.at(s.closest);
+                rec.set_face_normal(r, vec3(planars.nx[k], planars.ny[k], planars.nz[k]));
+                rec.u = s.hit_a;
+                rec.v = s.hit_b;
+                rec.dpdu = vec3(planars.ux[k], planars.uy[k], planars.uz[k]);
+                rec.dpdv = vec3(planars.vx[k], planars.vy[k], planars.vz[k]);
+                rec.mat = materials[planars.material[k]];
+                break;
+            }
+            case prim_kind::Quadric:
+                quadrics.source[k]->set_hit_record(r, s.closest, s.part, rec);
+                break;
+            case prim_kind::Generic:
+                break; // Already copied from the object's own hit
+        }
+        return true;
+    }
+
+    static bool has_finite_bounds(const aabb& box) {
+        for (int axis = 0; axis < 3; axis++) {
+            const interval& ax = box.axis_interval(axis);
+            if (!std::isfinite(ax.min) || !std::isfinite(ax.max) || ax.min > ax.max)
+                return false;
+        }
+        return true;
+    }
+
+    uint32_t add_material(const shared_ptr<material>& mat) {
+        materials.push_back(mat);
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    void add_ref(prim_kind kind, size_t index, const hittable* prim, const hittable* owner) {
+        aabb box = prim->bounding_box();
+        refs.push_back({ kind, static_cast<uint32_t>(index) });
+        ref_bounds.push_back(box);
+        ref_prims.push_back(prim);
+        ref_owners.push_back(owner);
+        bbox = aabb(bbox, box);
+    }
+
+    static sphere_prim sphere_prim_of(const sphere* s, uint32_t material) {
+        const ray& center = s->get_center();
+        return { center.origin(), center.direction(), s->get_radius(), material };
+    }
+
+    static planar_prim planar_prim_of(const quad* q, uint32_t material) {
+        return { q->Q, q->u, q->v, q->w, q->normal, q->D, q->shape(), q->shape_param0(), q->shape_param1(), material };
+    }
+
+    // Float box of a primitive, rounded outwards so float boxes never cut off a primitive
+    // traced in double
+    static void float_bounds(const aabb& box, ref_box& out) {
+        for (int a = 0; a < 3; a++) {
+            const interval& ax = box.axis_interval(a);
+            out.bmin[a] = std::nextafter(float(ax.min), -std::numeric_limits<float>::infinity());
+            out.bmax[a] = std::nextafter(float(ax.max), std::numeric_limits<float>::infinity());
+        }
+    }
+
+    // `owner` is the scene object the primitive belongs to, for refit_object.
+    void compile(const shared_ptr<hittable>& object, const hittable* owner) {
+        const hittable* obj = object.get();
+
+        if (auto s = dynamic_cast<const sphere*>(obj)) {
+            sphere_input.push_back(sphere_prim_of(s, add_material(s->get_material())));
+            add_ref(prim_kind::Sphere, sphere_input.size() - 1, s, owner);
+            return;
+        }
+
+        if (auto q = dynamic_cast<const quad*>(obj)) {
+            planar_input.push_back(planar_prim_of(q, add_material(q->get_material())));
+            add_ref(prim_kind::Planar, planar_input.size() - 1, q, owner);
+            return;
+        }
+
+        if (auto q = std::dynamic_pointer_cast<quadric>(object)) {
+            if (has_finite_bounds(q->bounding_box())) {
+                quadric_input.push_back(q);
+                add_ref(prim_kind::Quadric, quadric_input.size() - 1, obj, owner);
+                return;
+            }
+        }
+
+        // Plain lists and the shapes assembled from them only forward hit() to their parts.
+        if (auto list = dynamic_cast<const hittable_list*>(obj)) {
+            for (const auto& part : list->objects) {
+                if (part) compile(part, owner);
+            }
+            return;
+        }
+
+        if (!has_finite_bounds(obj->bounding_box())) {
+            unbounded.push_back(object);
+            return;
+        }
+        generics.push_back(object);
+        add_ref(prim_kind::Generic, generics.size() - 1, obj, owner);
+    }
+
+    // Recomputes the box of one leaf child from its refs, then the boxes of every node above
+    void refit_leaf(uint32_t node, uint8_t slot) {
+        const float inf = std::numeric_limits<float>::infinity();
+        auto set_slot = [&](wide_bvh_node<wide_bvh_width>& n, int k, const float lo[3], const float hi[3]) {
+            n.bmin_x[k] = lo[0]; n.bmin_y[k] = lo[1]; n.bmin_z[k] = lo[2];
+            n.bmax_x[k] = hi[0]; n.bmax_y[k] = hi[1]; n.bmax_z[k] = hi[2];
+        };
+
+        wide_bvh_node<wide_bvh_width>& leaf = nodes[node];
+        float lo[3] = { inf, inf, inf }, hi[3] = { -inf, -inf, -inf };
+        for (uint32_t r = leaf.child[slot]; r < leaf.child[slot] + leaf.count[slot]; r++) {
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::min(lo[a], ref_boxes[r].bmin[a]);
+                hi[a] = std::max(hi[a], ref_boxes[r].bmax[a]);
+            }
+        }
+        set_slot(leaf, slot, lo, hi);
+
+        for (uint32_t child = node; node_parent[child] != no_parent; child = node_parent[child]) {
+            const wide_bvh_node<wide_bvh_width>& n = nodes[child];
+            float nlo[3] = { inf, inf, inf }, nhi[3] = { -inf, -inf, -inf };
+            for (int k = 0; k < wide_bvh_width; k++) {
+                nlo[0] = std::min(nlo[0], n.bmin_x[k]); nhi[0] = std::max(nhi[0], n.bmax_x[k]);
+                nlo[1] = std::min(nlo[1], n.bmin_y[k]); nhi[1] = std::max(nhi[1], n.bmax_y[k]);
+                nlo[2] = std::min(nlo[2], n.bmin_z[k]); nhi[2] = std::max(nhi[2], n.bmax_z[k]);
+            }
+            set_slot(nodes[node_parent[child]], node_slot[child], nlo, nhi);
+        }
+    }
+
+    void build_bvh() {
+        std::vector<flat_bvh_prim> prims(refs.size());
+        for (size_t i = 0; i < refs.size(); i++) {
+            flat_bvh_prim& p = prims[i];
+            ref_box box;
+            float_bounds(ref_bounds[i], box);
+            for (int a = 0; a < 3; a++) {
+                p.bmin[a] = box.bmin[a];
+                p.bmax[a] = box.bmax[a];
+                p.centroid[a] = 0.5f * (p.bmin[a] + p.bmax[a]);
+            }
+            p.index = static_cast<uint32_t>(i);
+        }
+
+        std::vector<flat_bvh_node> binary = flat_bvh_builder(leaf_size).build(prims);
+
+        // Group each leaf by kind, then lay the typed arrays out in that order so that every
+        // group is one contiguous run.
+        std::vector<uint32_t> order(prims.size());
+        for (size_t i = 0; i < prims.size(); i++) order[i] = prims[i].index;
+        for (const flat_bvh_node& node : binary) {
+            if (!node.is_leaf()) continue;
+            std::stable_sort(order.begin() + node.offset, order.begin() + node.offset + node.count,
+                [this](uint32_t a, uint32_t b) { return refs[a].kind < refs[b].kind; });
+        }
+
+        std::vector<prim_ref> ordered(refs.size());
+        std::vector<const hittable*> owners(refs.size()), parts(refs.size());
+        ref_boxes.resize(refs.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            ordered[i] = refs[order[i]];
+            owners[i] = ref_owners[order[i]];
+            parts[i] = ref_prims[order[i]];
+            float_bounds(ref_bounds[order[i]], ref_boxes[i]);
+        }
+        refs.swap(ordered);
+        ref_owners.swap(owners);
+        ref_prims.swap(parts);
+        for (prim_ref& ref : refs) {
+            if (ref.kind == prim_kind::Sphere) {
+                spheres.push(sphere_input[ref.index]);
+                ref.index = static_cast<uint32_t>(spheres.count++);
+            } else if (ref.kind == prim_kind::Planar) {
+                planars.push(planar_input[ref.index]);
+                ref.index = static_cast<uint32_t>(planars.count++);
+            } else if (ref.kind == prim_kind::Quadric) {
+                quadrics.push(quadric_input[ref.index]);
+                ref.index = static_cast<uint32_t>(quadrics.count++);
+            }
+        }
+
+        // Read by the SIMD kernels past the last run. A zero radius or a zero normal never
+        // produces a hit.
+        for (uint32_t i = 0; i < batch_padding; i++) {
+            spheres.push({ point3(0, 0, 0), vec3(0, 0, 0), 0, 0 });
+            planars.push({ point3(0, 0, 0), vec3(0, 0, 0), vec3(0, 0, 0), vec3(0, 0, 0), vec3(0, 0, 0), 0,
+                           planar_shape::Parallelogram, 0, 0, 0 });
+            quadrics.push_padding();
+        }
+        nodes = wide_bvh_collapse<wide_bvh_width>(binary.data(), binary.size());
+        link_nodes();
+        sphere_view = spheres.view();
+        planar_view = planars.view();
+        quadric_view = quadrics.view();
+
+        sphere_input.clear();
+        planar_input.clear();
+        quadric_input.clear();
+        ref_bounds.clear();
+        sphere_input.shrink_to_fit();
+        planar_input.shrink_to_fit();
+        quadric_input.shrink_to_fit();
+        ref_bounds.shrink_to_fit();
+    }
+
+    // Parent links of the nodes and leaf positions of the refs, for refit_leaf. Interior
+    // children always come after their parent, so a child index of 0 marks an unused slot.
+    void link_nodes() {
+        node_parent.assign(nodes.size(), no_parent);
+        node_slot.assign(nodes.size(), 0);
+        ref_node.assign(refs.size(), 0);
+        ref_slot.assign(refs.size(), 0);
+        for (uint32_t i = 0; i < nodes.size(); i++) {
+            const wide_bvh_node<wide_bvh_width>& n = nodes[i];
+            for (int k = 0; k < wide_bvh_width; k++) {
+                if (n.count[k] > 0) {
+                    for (uint32_t r = n.child[k]; r < n.child[k] + n.count[k]; r++) {
+                        ref_node[r] = i;
+                        ref_slot[r] = static_cast<uint8_t>(k);
+                    }
+                } else if (n.child[k] != 0) {
+                    node_parent[n.child[k]] = i;
+                    node_slot[n.child[k]] = static_cast<uint8_t>(k);
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -9,9 +9,17 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
 #include "../external/stb_image.h"
+#include "simd/simd.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <string>
+#include <vector>
 
 class rtw_image {
   public:
@@ -25,66 +33,147 @@ class rtw_image {
         // parent, on so on, for six levels up. If the image was not loaded successfully,
         // width() and height() will return 0.
 
-        auto filename = std::string(image_filename);
-        auto imagedir = getenv("RTW_IMAGES");
-
-        // Hunt for the image file in some likely locations.
-        if (imagedir && load(std::string(imagedir) + "/" + image_filename)) return;
-        if (load(filename)) return;
-        if (load("images/" + filename)) return;
-        if (load("../images/" + filename)) return;
-        if (load("../../images/" + filename)) return;
-        if (load("../../../images/" + filename)) return;
-        if (load("../../../../images/" + filename)) return;
-        if (load("../../../../../images/" + filename)) return;
-        if (load("../../../../../../images/" + filename)) return;
+        for (const auto& path : search_paths(image_filename)) {
+            if (load(path)) return;
+        }
 
         std::cerr << "ERROR: Could not load image file '" << image_filename << "'.\n";
     }
 
+    // The pixel buffers are owned; images are shared through shared_ptr instead of copied
+    rtw_image(const rtw_image&) = delete;
+    rtw_image& operator=(const rtw_image&) = delete;
+
     ~rtw_image() {
         delete[] bdata;
-        STBI_FREE(fdata);
+    }
+
+    // The places the constructor looks for an image, in order
+    static std::vector<std::string> search_paths(const std::string& filename) {
+        std::vector<std::string> paths;
+        if (auto imagedir = getenv("RTW_IMAGES")) paths.push_back(std::string(imagedir) + "/" + filename);
+        paths.push_back(filename);
+        std::string prefix = "images/";
+        for (int level = 0; level < 7; level++, prefix = "../" + prefix) paths.push_back(prefix + filename);
+        return paths;
+    }
+
+    // First of the search paths naming an existing file, or an empty string
+    static std::string find_file(const std::string& filename) {
+        std::error_code ec;
+        for (const auto& path : search_paths(filename)) {
+            if (std::filesystem::is_regular_file(path, ec)) return path;
+        }
+        return {};
     }
 
     bool load(const std::string& filename) {
-        // Loads the linear (gamma=1) image data from the given file name. Returns true if the
-        // load succeeded. The resulting data buffer contains the three [0.0, 1.0]
-        // floating-point values for the first pixel (red, then green, then blue). Pixels are
-        // contiguous, going left to right for the width of the image, followed by the next row
-        // below, for the full height of the image.
-
-        auto n = bytes_per_pixel; // Dummy out parameter: original components per pixel
-        fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, bytes_per_pixel);
-        if (fdata == nullptr) return false;
-
-        bytes_per_scanline = image_width * bytes_per_pixel;
-        convert_to_bytes();
+        // Loads the image from the given file name, returning true if the load succeeded. The
+        // texels are kept in one copy, in the tiled layout of image_view: ordinary images as
+        // their sRGB bytes, decoded to linear through a table when sampled, and HDR images
+        // as linear half floats. Below the image sits its full mip chain, each level a 2x2
+        // box filter of the one above, averaged in linear space, down to a single texel.
+
+        delete[] bdata;
+        bdata = nullptr;
+        levels.clear();
+        int n; // Original components per pixel, unused
+        std::vector<float> linear; // Linear RGB of the last level stored, row-major
+        if (stbi_is_hdr(filename.c_str())) {
+            float* fdata = stbi_loadf(filename.c_str(), &image_width, &image_height, &n, 3);
+            if (fdata == nullptr) return false;
+            format = image_format_rgb16f;
+            bytes_per_pixel = 6;
+            allocate_levels();
+            linear.assign(fdata, fdata + size_t(image_width) * image_height * 3);
+            stbi_image_free(fdata);
+            store_level(0, [&](size_t pixel, unsigned char* texel) { encode(format, &linear[3 * pixel], texel); });
+        } else {
+            unsigned char* data = stbi_load(filename.c_str(), &image_width, &image_height, &n, 3);
+            if (data == nullptr) return false;
+            format = image_format_rgb8;
+            bytes_per_pixel = 3;
+            allocate_levels();
+            store_level(0, [&](size_t pixel, unsigned char* texel) { std::memcpy(texel, data + 3 * pixel, 3); });
+            const float* decode = srgb_decode();
+            linear.resize(size_t(image_width) * image_height * 3);
+            for (size_t i = 0; i < linear.size(); i++) linear[i] = decode[data[i]];
+            stbi_image_free(data);
+        }
+
+        for (int level = 1; level < mip_levels(); level++) {
+            linear = downsample(linear, levels[level - 1].width, levels[level - 1].height);
+            store_level(level, [&](size_t pixel, unsigned char* texel) { encode(format, &linear[3 * pixel], texel); });
+        }
         return true;
     }
 
-    int width()  const { return (fdata == nullptr) ? 0 : image_width; }
-    int height() const { return (fdata == nullptr) ? 0 : image_height; }
+    int width()  const { return (bdata == nullptr) ? 0 : image_width; }
+    int height() const { return (bdata == nullptr) ? 0 : image_height; }
+
+    // Bytes of texel data held
+    size_t memory_size() const { return bdata == nullptr ? 0 : stored_bytes; }
+
+    // Levels of the mip chain, the image itself being level 0; 0 if there is no image data
+    int mip_levels() const { return bdata == nullptr ? 0 : int(levels.size()); }
+
+    // A level of the mip chain as seen by the image_sample kernel; only meaningful when
+    // height() > 0. Every level covers the whole [0,1] x [0,1] texture space.
+    image_view view(int level = 0) const {
+        const mip_level& m = levels[level];
+        return { bdata + m.offset, m.width, m.height, bytes_per_pixel, m.tiles_x, format, srgb_decode() };
+    }
 
     const unsigned char* pixel_data(int x, int y) const {
-        // Return the address of the three RGB bytes of the pixel at x,y. If there is no image
-        // data, returns magenta.
+        // Return the address of the texel at x,y: three sRGB bytes, or three half floats for
+        // HDR images. If there is no image data, returns magenta.
         static unsigned char magenta[] = { 255, 0, 255 };
         if (bdata == nullptr) return magenta;
 
         x = clamp(x, 0, image_width);
         y = clamp(y, 0, image_height);
 
-        return bdata + y*bytes_per_scanline + x*bytes_per_pixel;
+        return bdata + size_t(image_texel_index(x, y, levels[0].tiles_x)) * bytes_per_pixel;
+    }
+
+    // Linear value of each sRGB byte
+    static const float* srgb_decode() {
+        static const auto table = [] {
+            std::array<float, 256> values;
+            for (int i = 0; i < 256; i++) {
+                double c = i / 255.0;
+                values[i] = float(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    // Stores a linear RGB colour as one texel of the given format, as load() does for every
+    // level it computes
+    static void encode(int32_t format, const float* rgb, unsigned char* texel) {
+        if (format == image_format_rgb8) {
+            for (int c = 0; c < 3; c++) texel[c] = srgb_encode(rgb[c]);
+        } else {
+            uint16_t h[3];
+            for (int c = 0; c < 3; c++) h[c] = float_to_half(rgb[c]);
+            std::memcpy(texel, h, sizeof(h));
+        }
     }
 
   private:
-    const int      bytes_per_pixel = 3;
-    float         *fdata = nullptr;         // Linear floating point pixel data
-    unsigned char *bdata = nullptr;         // Linear 8-bit pixel data
+    struct mip_level {
+        size_t offset;  // Of the level's first texel in bdata, in bytes
+        int width, height, tiles_x;
+    };
+
+    int            bytes_per_pixel = 3;
+    int32_t        format = image_format_rgb8;
+    unsigned char *bdata = nullptr;         // Tiled texel data
+    size_t         stored_bytes = 0;
     int            image_width = 0;         // Loaded image width
     int            image_height = 0;        // Loaded image height
-    int            bytes_per_scanline = 0;
+    std::vector<mip_level> levels;
 
     static int clamp(int x, int low, int high) {
         // Return the value clamped to the range [low, high).
@@ -93,28 +182,85 @@ class rtw_image {
         return high - 1;
     }
 
-    static unsigned char float_to_byte(float value) {
-        if (value <= 0.0)
-            return 0;
-        if (1.0 <= value)
-            return 255;
-        return static_cast<unsigned char>(256.0 * value);
+    static uint16_t float_to_half(float value) {
+        // Rounds to nearest; out of range values saturate to infinity, tiny ones flush to zero
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+        if (std::isnan(value)) return uint16_t(sign | 0x7e00);
+        float magnitude = std::fabs(value);
+        if (magnitude >= 65520.0f) return uint16_t(sign | 0x7c00);
+        if (magnitude < 6.103515625e-05f) {
+            // Subnormal halves are multiples of 2^-24
+            return uint16_t(sign | uint16_t(std::nearbyint(magnitude * 16777216.0f)));
+        }
+        int exponent;
+        float mantissa = std::frexp(magnitude, &exponent); // In [0.5, 1)
+        uint32_t m = uint32_t(std::nearbyint(mantissa * 2048.0f)); // 11 significant bits
+        if (m == 2048) {
+            m = 1024;
+            exponent++;
+        }
+        return uint16_t(sign | uint16_t(exponent + 14) << 10 | (m - 1024));
     }
 
-    void convert_to_bytes() {
-        // Convert the linear floating point pixel data to bytes, storing the resulting byte
-        // data in the `bdata` member.
+    // Inverse of srgb_decode, rounded to the nearest byte
+    static unsigned char srgb_encode(float linear) {
+        double c = linear > 0 ? (linear < 1 ? linear : 1) : 0;
+        c = c <= 0.0031308 ? c * 12.92 : 1.055 * std::pow(c, 1 / 2.4) - 0.055;
+        return static_cast<unsigned char>(c * 255 + 0.5);
+    }
 
-        int total_bytes = image_width * image_height * bytes_per_pixel;
-        bdata = new unsigned char[total_bytes];
+    // The next mip level down: each texel averages the 2x2 block above it. An odd texel left
+    // over at the right or bottom edge is folded into the last block, so a level of 2k + 1
+    // texels still covers the whole image.
+    static std::vector<float> downsample(const std::vector<float>& src, int width, int height) {
+        int w = std::max(width / 2, 1), h = std::max(height / 2, 1);
+        std::vector<float> dst(size_t(w) * h * 3);
+        for (int y = 0; y < h; y++) {
+            int y0 = std::min(2 * y, height - 1), y1 = (y == h - 1) ? height - 1 : std::min(2 * y + 1, height - 1);
+            for (int x = 0; x < w; x++) {
+                int x0 = std::min(2 * x, width - 1), x1 = (x == w - 1) ? width - 1 : std::min(2 * x + 1, width - 1);
+                float sum[3] = { 0, 0, 0 };
+                int count = 0;
+                for (int sy = y0; sy <= y1; sy++)
+                    for (int sx = x0; sx <= x1; sx++, count++)
+                        for (int c = 0; c < 3; c++) sum[c] += src[(size_t(sy) * width + sx) * 3 + c];
+                for (int c = 0; c < 3; c++) dst[(size_t(y) * w + x) * 3 + c] = sum[c] / count;
+            }
+        }
+        return dst;
+    }
 
-        // Iterate through all pixel components, converting from [0.0, 1.0] float values to
-        // unsigned [0, 255] byte values.
+    // Lays out every mip level of an image_width x image_height image and allocates one
+    // buffer holding them all, each level tiled on its own
+    void allocate_levels() {
+        levels.clear();
+        size_t offset = 0;
+        int w = image_width, h = image_height;
+        while (true) {
+            int tiles_x = (w + image_tile_size - 1) >> image_tile_shift;
+            int tiles_y = (h + image_tile_size - 1) >> image_tile_shift;
+            levels.push_back({ offset, w, h, tiles_x });
+            offset += size_t(tiles_x) * tiles_y * image_tile_size * image_tile_size * bytes_per_pixel;
+            if (w == 1 && h == 1) break;
+            w = std::max(w / 2, 1);
+            h = std::max(h / 2, 1);
+        }
+
+        // One spare byte lets the image_sample kernels fetch the last texel with a 32-bit load.
+        stored_bytes = offset + 1;
+        bdata = new unsigned char[stored_bytes]();
+    }
 
-        auto *bptr = bdata;
-        auto *fptr = fdata;
-        for (auto i=0; i < total_bytes; i++, fptr++, bptr++)
-            *bptr = float_to_byte(*fptr);
+    // Fills each texel of a level from the row-major pixel it holds
+    template <typename Fill>
+    void store_level(int level, Fill&& fill) {
+        const mip_level& m = levels[level];
+        unsigned char* base = bdata + m.offset;
+        for (int y = 0; y < m.height; y++)
+            for (int x = 0; x < m.width; x++)
+                fill(size_t(y) * m.width + x, base + size_t(image_texel_index(x, y, m.tiles_x)) * bytes_per_pixel);
     }
 };
 
@@ -5,8 +5,15 @@
 #include "sphere.h"
 #include "quad.h"
 #include "objects.h"
+#include "mesh.h"
+#include "sphere_cloud.h"
+#include "heightfield.h"
+#include "voxel_grid.h"
+#include "volume.h"
 #include "material.h"
+#include "virtual_texture.h"
 #include "bvh.h"
+#include "render_world.h"
 #include <unordered_map>
 #include <vector>
 #include <memory>
@@ -35,6 +42,11 @@ enum class ObjectType {
     Cone,
     HollowCylinder,
     Hexagon,
+    Mesh,
+    SphereCloud,
+    Heightfield,
+    VoxelGrid,
+    Volume,
     Count,
 
     //Further
@@ -85,6 +97,11 @@ std::map<ObjectType, std::pair<std::string, std::string>> object_type_map = {
     {ObjectType::Capsule, {"Capsule", "\ue578"}}, 
     {ObjectType::Cylinder, {"Cylinder", "\ue39e"}},      
     {ObjectType::HollowCylinder, {"Hollow Cylinder", "\ue39e"}},
+    {ObjectType::Mesh, {"Mesh", "\ue9f4"}},
+    {ObjectType::SphereCloud, {"Sphere Cloud", "\ue3a5"}},
+    {ObjectType::Heightfield, {"Heightfield", "\ue564"}},
+    {ObjectType::VoxelGrid, {"Voxel Grid", "\ue8f6"}},
+    {ObjectType::Volume, {"Volume", "\ue2bd"}},
      
     {ObjectType::Count, {"Count", "\uea26"}},
     {ObjectType::Torus, {"Torus", "\uE1A6"}},           
@@ -122,6 +139,11 @@ struct state {
     bool color_picker_open;
     double texture_scale;
     std::string texture_file;
+    std::string mesh_file;
+    std::string particle_file;
+    std::string heightmap_file;
+    std::string voxel_file;
+    std::string volume_file;
     float noise_scale;
     float fuzz;
 
@@ -172,6 +194,13 @@ struct state {
     const float* normal() const { return &data[40]; }
     float& vertices_count()     { return data[43]; }
     const float& vertices_count() const { return data[43]; }
+    // 44..91 hold the vertices
+    float& density()            { return data[92]; }
+    const float& density() const { return data[92]; }
+    float& noise_seed()         { return data[93]; }
+    const float& noise_seed() const { return data[93]; }
+    float& noise_bake_resolution() { return data[94]; } // 0 computes the noise at every hit
+    const float& noise_bake_resolution() const { return data[94]; }
 
     void set_vertex(size_t index, const point3& vertex) {
         if (index >= 16) return;
@@ -221,6 +250,11 @@ struct state {
         color_picker_open = false;
         texture_scale = 0.1;
         texture_file = "../assets/earthmap.jpg";
+        mesh_file.clear();
+        particle_file.clear();
+        heightmap_file.clear();
+        voxel_file.clear();
+        volume_file.clear();
         noise_scale = 4.0f;
         fuzz = 0.1f;
         data.fill(0.0f);
@@ -248,6 +282,7 @@ struct state {
         p4()[0] = 0.0f; p4()[1] = 0.0f; p4()[2] = 0.5f; // Tetrahedron point 4
         normal()[0] = 1.0f; normal()[1] = 0.0f; normal()[2] = 0.0f; // Plane/hexagon normal
         vertices_count() = 0.0f;  
+        density() = 1.0f;                    // Volume extinction scale
     }
 
     state() {
@@ -343,13 +378,17 @@ private:
         void execute() override {
             assert(scene_->states.find(id_) != scene_->states.end());
             scene_->states[id_].back().position += offset_;
-            if (_shouldComputeMove) {
-                auto it = scene_->object_map.find(id_);
-                if (it != scene_->object_map.end()){
+            auto it = scene_->object_map.find(id_);
+            if (it != scene_->object_map.end()){
+                if (_shouldComputeMove) {
                     it->second.back()->move_by(offset_);
                     // scene_->bvh_world->update(it->second);
                 }
+                // Moved here or while dragging, either way its baked noise is left behind
+                if (scene_->bake_noise(it->second.back(), scene_->states[id_].back()))
+                    scene_->set_palette(it->second.back(), scene_->states[id_].back());
             }
+            scene_->bvh_needs_rebuild = true;
         }
         void undo() override {
             auto& state_vec = scene_->states[id_];
@@ -358,6 +397,8 @@ private:
                 state_vec.back().position -= offset_;
                 it->second.back()->move_by(-offset_);
                 // scene_->bvh_world->update(it->second);
+                if (scene_->bake_noise(it->second.back(), state_vec.back()))
+                    scene_->set_palette(it->second.back(), state_vec.back());
                 scene_->bvh_needs_rebuild = true;
             }
         }
@@ -378,9 +419,9 @@ public:
         grid_visualization = std::make_shared<grid>();
     }
 
-    bool select_object(const ray& r, double max_t) {
+    bool select_object(const ray& r, real max_t) {
         hit_record rec;
-        double closest_t = max_t;
+        real closest_t = max_t;
         int selected_id = -1;
 
         for (const auto& [id, objs] : object_map) {
@@ -423,6 +464,9 @@ public:
             if (shouldMove == 1) { //During moving
                 accumulated_offset += offset;
                 it->second.back()->move_by(offset);
+                // The render world holds copies of the primitives: patch them in place and
+                // leave the full rebuild to the MoveCommand at the end of the move
+                if (bvh_world) bvh_world->refit_object(it->second.back().get());
             } else if (shouldMove == 2) { // End moving
                 execute_command(std::make_unique<MoveCommand>(this, selected_object_id, accumulated_offset, false));
                 accumulated_offset = vec3(0, 0, 0);
@@ -445,39 +489,24 @@ public:
                 tex = std::make_shared<checker_texture>(st.texture_scale, st.color_values, st.color_values0);
                 break;
             case TextureType::Image:
-                tex = std::make_shared<image_texture>(st.texture_file.data());
+                // Virtual textures stream their pages from disk instead of loading whole
+                if (std::filesystem::path(st.texture_file).extension() == ".ztx")
+                    tex = std::make_shared<virtual_image_texture>(st.texture_file);
+                else
+                    tex = std::make_shared<image_texture>(st.texture_file.data());
                 break;
             case TextureType::Noise:
-                tex = std::make_shared<noise_texture>(st.noise_scale);
+                tex = std::make_shared<noise_texture>(st.noise_scale, uint32_t(st.noise_seed()));
                 break;
             default:
                 tex = std::make_shared<solid_color>(st.color_values);
         }
 
-        shared_ptr<material> mat;
-        switch (st.material_type) {
-            case MaterialType::Lambertian:
-                mat = std::make_shared<lambertian>(tex);
-                break;
-            case MaterialType::Metal:
-                mat = std::make_shared<metal>(tex, st.fuzz);
-                break;
-            case MaterialType::Dielectric:
-                mat = std::make_shared<dielectric>(st.refraction_index);
-                break;
-            case MaterialType::DiffuseLight:
-                mat = std::make_shared<diffuse_light>(tex);
-                break;
-            case MaterialType::Isotropic:
-                mat = std::make_shared<isotropic>(tex);
-                break;
-            default:
-                mat = std::make_shared<lambertian>(tex);
-        }
-
         shared_ptr<hittable> obj = create_object(st);
         if(!obj) return;
 
+        shared_ptr<material> mat = make_material(st, tex);
+
         if(id_object == -1){//New(Add)
             id_object = next_id;
             next_id++;
@@ -492,6 +521,8 @@ public:
         obj->set_id(id_object);
         obj->set_material(mat);
         apply_transformations(obj, st);
+        bake_noise(obj, st);
+        set_palette(obj, st);
 
 
     }
@@ -513,7 +544,7 @@ public:
         return next_id - 1;
     }
 
-    const hittable& get_world() const {
+    const render_world& get_world() const {
         return *bvh_world;
     }
 
@@ -522,7 +553,7 @@ public:
     }
 
     void initialize() {
-        bvh_world = make_shared<bvh_node>();
+        bvh_world = make_shared<render_world>();
         state st;
         // add_or_update_object(st); 
     }
@@ -592,7 +623,7 @@ public:
     void load_new() {
         object_map.clear();
         states.clear();
-        bvh_world = make_shared<bvh_node>();
+        bvh_world = make_shared<render_world>();
         next_id = 0;
         undo_stack = std::stack<std::unique_ptr<Command>>();
         redo_stack = std::stack<std::unique_ptr<Command>>();
@@ -608,7 +639,8 @@ public:
     void rebuild_bvh() {
         if (!bvh_needs_rebuild) return;
         if(object_map.empty()) {
-            bvh_world = std::make_shared<bvh_node>();
+            bvh_world = std::make_shared<render_world>();
+            bvh_needs_rebuild = false;
             return;
         }
         std::vector<std::shared_ptr<hittable>> objects;
@@ -618,7 +650,7 @@ public:
         }
         // objects.insert(objects.end(), pending_objects.begin(), pending_objects.end());
 
-        bvh_world = std::make_shared<bvh_node>(objects, 0, objects.size());
+        bvh_world = std::make_shared<render_world>(objects);
         // pending_objects.clear();
         bvh_needs_rebuild = false;
     }
@@ -629,7 +661,7 @@ public:
 private:
     std::unordered_map<int, std::vector<std::shared_ptr<hittable>>> object_map;
     std::unordered_map<int, std::vector<state>> states;
-    shared_ptr<bvh_node> bvh_world;
+    shared_ptr<render_world> bvh_world;
     std::shared_ptr<grid> grid_visualization;
     bool show_grid = false;
     int selected_object_id = -1;
@@ -644,6 +676,80 @@ private:
     std::stack<std::unique_ptr<class Command>> undo_stack;
     std::stack<std::unique_ptr<class Command>> redo_stack;
 
+    // Baked noise covers the object's box where it stands, so it is baked again whenever the
+    // object is placed or moved, and the material's texture compiled again to pick up the grid.
+    // Not while dragging: the move is only committed, and baked, once the drag ends. True if it
+    // baked, in which case a palette built from the material needs building again too.
+    bool bake_noise(const std::shared_ptr<hittable>& obj, const state& st) {
+        if (st.noise_bake_resolution() <= 0) return false;
+        auto mat = obj->get_material();
+        auto noise = mat ? std::dynamic_pointer_cast<noise_texture>(mat->get_texture()) : nullptr;
+        if (!noise) return false;
+        aabb box = obj->bounding_box();
+        noise->bake(box.min(), box.max(), int(st.noise_bake_resolution()));
+        mat->set_texture(noise);
+        return true;
+    }
+
+    // Sphere clouds and voxel grids take the material of each particle or voxel from a palette,
+    // built from the object's own material: entry 0 is that material, and each further one the
+    // same kind of material over its texture tinted another hue, so the indices in the file come
+    // out as distinct colours. At most 256 entries; a dielectric, which has no texture, gets no
+    // palette and is used throughout.
+    void set_palette(const std::shared_ptr<hittable>& obj, const state& st) {
+        auto cloud = std::dynamic_pointer_cast<sphere_cloud>(obj);
+        auto grid = std::dynamic_pointer_cast<voxel_grid>(obj);
+        if (!cloud && !grid) return;
+        auto mat = obj->get_material();
+        auto tex = mat ? mat->get_texture() : nullptr;
+        std::vector<shared_ptr<material>> palette;
+        if (tex) {
+            size_t count = std::min<size_t>(cloud ? cloud->material_count() : grid->material_count(), 256);
+            for (size_t k = 0; k < count; k++)
+                palette.push_back(k == 0 ? mat : make_material(st, std::make_shared<scale_texture>(tex, palette_tint(k))));
+        }
+        if (cloud) cloud->set_palette(std::move(palette));
+        else grid->set_palette(std::move(palette));
+    }
+
+    // Hue k of a sequence stepping round the colour wheel by the golden ratio, so neighbouring
+    // entries differ most, at saturation 0.6 and full value
+    static color palette_tint(size_t k) {
+        real h = std::fmod(real(k) * real(0.618033988749895), real(1)) * 6;
+        int sector = int(h);
+        real f = h - sector;
+        real low = real(0.4), falling = 1 - real(0.6) * f, rising = real(0.4) + real(0.6) * f;
+        switch (sector) {
+            case 0: return color(1, rising, low);
+            case 1: return color(falling, 1, low);
+            case 2: return color(low, 1, rising);
+            case 3: return color(low, falling, 1);
+            case 4: return color(rising, low, 1);
+            default: return color(1, low, falling);
+        }
+    }
+
+    static shared_ptr<material> make_material(const state& st, shared_ptr<texture> tex) {
+        // A medium's material is its phase function, and only isotropic scattering means
+        // anything there: the others would scatter about the arbitrary normal the medium's hits
+        // carry. The object's texture still gives the fog its albedo.
+        if (st.object_type == ObjectType::Volume) return std::make_shared<isotropic>(tex);
+        switch (st.material_type) {
+            case MaterialType::Lambertian:
+                return std::make_shared<lambertian>(tex);
+            case MaterialType::Metal:
+                return std::make_shared<metal>(tex, st.fuzz);
+            case MaterialType::Dielectric:
+                return std::make_shared<dielectric>(st.refraction_index);
+            case MaterialType::DiffuseLight:
+                return std::make_shared<diffuse_light>(tex);
+            case MaterialType::Isotropic:
+                return std::make_shared<isotropic>(tex);
+            default:
+                return std::make_shared<lambertian>(tex);
+        }
+    }
+
     void apply_transformations(std::shared_ptr<hittable> obj, const state& st) {
         // if (st.scale != vec3(1, 1, 1)) {
         //     obj = std::make_shared<scale>(obj, st.scale);
@@ -768,6 +874,54 @@ private:
                 obj = std::make_shared<octahedron>(st.position, st.size());
                 break;
             }
+            case ObjectType::Mesh: {
+                try {
+                    obj = std::make_shared<mesh>(load_mesh(st.mesh_file), st.position);
+                } catch (const std::exception& e) {
+                    std::cerr << "ERROR: " << e.what() << "\n";
+                }
+                break;
+            }
+            case ObjectType::SphereCloud: {
+                try {
+                    obj = std::make_shared<sphere_cloud>(load_sphere_cloud(st.particle_file), st.position);
+                } catch (const std::exception& e) {
+                    std::cerr << "ERROR: " << e.what() << "\n";
+                }
+                break;
+            }
+            case ObjectType::Heightfield: {
+                // Centered on the position horizontally, rising from it
+                point3 corner(st.position.x - bl[0] / 2, st.position.y, st.position.z - bl[2] / 2);
+                try {
+                    obj = std::make_shared<heightfield>(load_heightfield(st.heightmap_file), corner, vec3(bl[0], bl[1], bl[2]));
+                } catch (const std::exception& e) {
+                    std::cerr << "ERROR: " << e.what() << "\n";
+                }
+                break;
+            }
+            case ObjectType::VoxelGrid: {
+                try {
+                    obj = std::make_shared<voxel_grid>(load_voxel_grid(st.voxel_file), st.position, st.size());
+                } catch (const std::exception& e) {
+                    std::cerr << "ERROR: " << e.what() << "\n";
+                }
+                break;
+            }
+            case ObjectType::Volume: {
+                point3 lo(st.position.x - bl[0] / 2, st.position.y - bl[1] / 2, st.position.z - bl[2] / 2);
+                point3 hi(st.position.x + bl[0] / 2, st.position.y + bl[1] / 2, st.position.z + bl[2] / 2);
+                try {
+                    // Without a density file, the density is Perlin noise baked over the box
+                    auto grid = st.volume_file.empty()
+                        ? bake_density_grid(noise_texture(st.noise_scale, uint32_t(st.noise_seed())), lo, hi, 48)
+                        : load_density_grid(st.volume_file);
+                    obj = std::make_shared<heterogeneous_medium>(grid, lo, hi, st.density(), nullptr);
+                } catch (const std::exception& e) {
+                    std::cerr << "ERROR: " << e.what() << "\n";
+                }
+                break;
+            }
         }
         return obj;
     }    
@@ -807,7 +961,7 @@ void scene::save_to_file(const std::string& filename) const {
 
     // Header
     const char magic[] = "ZSC";
-    uint32_t version = 3; 
+    uint32_t version = 8; 
     uint32_t state_map_size = static_cast<uint32_t>(states.size());
     uint32_t n_id = static_cast<uint32_t>(next_id);
     uint32_t sh_grid = static_cast<uint32_t>(show_grid);
@@ -861,6 +1015,31 @@ void scene::save_to_file(const std::string& filename) const {
         out.write(reinterpret_cast<const char*>(&s.fuzz), sizeof(s.fuzz));
 
         out.write(reinterpret_cast<const char*>(s.data.data()), sizeof(float) * s.data.size());
+
+        // Version 4: meshes are stored as a reference to their external file
+        uint32_t mesh_file_len = static_cast<uint32_t>(s.mesh_file.size());
+        out.write(reinterpret_cast<const char*>(&mesh_file_len), sizeof(mesh_file_len));
+        out.write(s.mesh_file.data(), mesh_file_len);
+
+        // Version 5: particle files, by reference like meshes
+        uint32_t particle_file_len = static_cast<uint32_t>(s.particle_file.size());
+        out.write(reinterpret_cast<const char*>(&particle_file_len), sizeof(particle_file_len));
+        out.write(s.particle_file.data(), particle_file_len);
+
+        // Version 6: heightfield images
+        uint32_t heightmap_file_len = static_cast<uint32_t>(s.heightmap_file.size());
+        out.write(reinterpret_cast<const char*>(&heightmap_file_len), sizeof(heightmap_file_len));
+        out.write(s.heightmap_file.data(), heightmap_file_len);
+
+        // Version 7: voxel files
+        uint32_t voxel_file_len = static_cast<uint32_t>(s.voxel_file.size());
+        out.write(reinterpret_cast<const char*>(&voxel_file_len), sizeof(voxel_file_len));
+        out.write(s.voxel_file.data(), voxel_file_len);
+
+        // Version 8: density files
+        uint32_t volume_file_len = static_cast<uint32_t>(s.volume_file.size());
+        out.write(reinterpret_cast<const char*>(&volume_file_len), sizeof(volume_file_len));
+        out.write(s.volume_file.data(), volume_file_len);
     }
 
     if (!out.good()) {
@@ -889,7 +1068,7 @@ void scene::load_from_file(const std::string& filename) {
     }
 
     in.read(reinterpret_cast<char*>(&version), sizeof(version));
-    if (version != 3) {
+    if (version < 3 || version > 8) {
         throw std::runtime_error("Unsupported .zsc file version: " + std::to_string(version));
     }
     in.read(reinterpret_cast<char*>(&state_map_size), sizeof(state_map_size));
@@ -965,6 +1144,56 @@ void scene::load_from_file(const std::string& filename) {
 
         in.read(reinterpret_cast<char*>(s.data.data()), sizeof(float) * s.data.size());
 
+        if (version >= 4) {
+            uint32_t mesh_file_len;
+            in.read(reinterpret_cast<char*>(&mesh_file_len), sizeof(mesh_file_len));
+            if (mesh_file_len > 1024) {
+                throw std::runtime_error("Invalid mesh file length in file");
+            }
+            s.mesh_file.resize(mesh_file_len);
+            in.read(s.mesh_file.data(), mesh_file_len);
+        }
+
+        if (version >= 5) {
+            uint32_t particle_file_len;
+            in.read(reinterpret_cast<char*>(&particle_file_len), sizeof(particle_file_len));
+            if (particle_file_len > 1024) {
+                throw std::runtime_error("Invalid particle file length in file");
+            }
+            s.particle_file.resize(particle_file_len);
+            in.read(s.particle_file.data(), particle_file_len);
+        }
+
+        if (version >= 6) {
+            uint32_t heightmap_file_len;
+            in.read(reinterpret_cast<char*>(&heightmap_file_len), sizeof(heightmap_file_len));
+            if (heightmap_file_len > 1024) {
+                throw std::runtime_error("Invalid heightmap file length in file");
+            }
+            s.heightmap_file.resize(heightmap_file_len);
+            in.read(s.heightmap_file.data(), heightmap_file_len);
+        }
+
+        if (version >= 7) {
+            uint32_t voxel_file_len;
+            in.read(reinterpret_cast<char*>(&voxel_file_len), sizeof(voxel_file_len));
+            if (voxel_file_len > 1024) {
+                throw std::runtime_error("Invalid voxel file length in file");
+            }
+            s.voxel_file.resize(voxel_file_len);
+            in.read(s.voxel_file.data(), voxel_file_len);
+        }
+
+        if (version >= 8) {
+            uint32_t volume_file_len;
+            in.read(reinterpret_cast<char*>(&volume_file_len), sizeof(volume_file_len));
+            if (volume_file_len > 1024) {
+                throw std::runtime_error("Invalid volume file length in file");
+            }
+            s.volume_file.resize(volume_file_len);
+            in.read(s.volume_file.data(), volume_file_len);
+        }
+
         states[id] = std::vector<state>{s};
         add_or_update_object(s, id);
     }
@@ -0,0 +1,317 @@
+#ifndef SDF_H
+#define SDF_H
+
+#include "hittable.h"
+#include "sphere.h"
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Shapes given by a signed distance function: negative inside, and outside never more than the
+// distance to the surface, so a ray can always advance by it without crossing the surface
+// (sphere tracing). A shape is a tree of sdf_node, primitives at the leaves and operators
+// above them, compiled into an sdf_program: a flat postfix list run with a small value stack.
+
+struct sdf_node {
+    enum class kind { RoundBox, Torus, Capsule, SmoothUnion, Subtract };
+
+    kind type = kind::RoundBox;
+    point3 a = point3(0, 0, 0); // Box and torus center, first capsule end
+    vec3 b = vec3(0, 0, 0);     // Box half size, second capsule end
+    real p0 = 0, p1 = 0;        // Box rounding, torus radii, capsule radius, blend width
+    shared_ptr<sdf_node> left = nullptr, right = nullptr;
+};
+
+// Box of half size `half_size` around center, its edges rounded with `radius`
+inline shared_ptr<sdf_node> sdf_round_box(const point3& center, const vec3& half_size, real radius) {
+    real max_radius = std::min({ half_size.x, half_size.y, half_size.z });
+    return make_shared<sdf_node>(sdf_node{ sdf_node::kind::RoundBox, center, half_size,
+                                           std::min(std::max(real(0), radius), max_radius) });
+}
+
+// Around the y axis through center, like the torus primitive
+inline shared_ptr<sdf_node> sdf_torus(const point3& center, real major_radius, real minor_radius) {
+    return make_shared<sdf_node>(sdf_node{ sdf_node::kind::Torus, center, vec3(0, 0, 0),
+                                           std::max(real(0), major_radius), std::max(real(0), minor_radius) });
+}
+
+inline shared_ptr<sdf_node> sdf_capsule(const point3& p1, const point3& p2, real radius) {
+    return make_shared<sdf_node>(sdf_node{ sdf_node::kind::Capsule, p1, p2, std::max(real(0), radius) });
+}
+
+// Union of a and b, blended where their distances are within `width` of each other. A width of
+// zero is the plain union.
+inline shared_ptr<sdf_node> sdf_smooth_union(shared_ptr<sdf_node> a, shared_ptr<sdf_node> b, real width) {
+    return make_shared<sdf_node>(sdf_node{ sdf_node::kind::SmoothUnion, point3(0, 0, 0), vec3(0, 0, 0),
+                                           std::max(real(0), width), 0, std::move(a), std::move(b) });
+}
+
+// a with b cut away
+inline shared_ptr<sdf_node> sdf_subtract(shared_ptr<sdf_node> a, shared_ptr<sdf_node> b) {
+    return make_shared<sdf_node>(sdf_node{ sdf_node::kind::Subtract, point3(0, 0, 0), vec3(0, 0, 0),
+                                           real(0), real(0), std::move(a), std::move(b) });
+}
+
+class sdf_program {
+  public:
+    static constexpr int max_stack = 16;
+
+    sdf_program() {}
+
+    explicit sdf_program(const sdf_node& root) {
+        if (required_stack(root) > max_stack) throw std::runtime_error("SDF tree is too deep");
+        emit(root);
+        box = node_bounds(root);
+        lipschitz_bound = node_lipschitz(root);
+    }
+
+    real distance(const point3& p) const {
+        real stack[max_stack];
+        int top = 0;
+        for (const instruction& in : code) {
+            switch (in.op) {
+                case opcode::RoundBox: {
+                    vec3 q = glm::abs(p - in.a) - in.b;
+                    real outside = glm::length(glm::max(q, vec3(0, 0, 0)));
+                    real inside = std::fmin(std::fmax(q.x, std::fmax(q.y, q.z)), real(0));
+                    stack[top++] = outside + inside - in.p0;
+                    break;
+                }
+                case opcode::Torus: {
+                    vec3 q = p - in.a;
+                    real ring = std::sqrt(q.x * q.x + q.z * q.z) - in.p0;
+                    stack[top++] = std::sqrt(ring * ring + q.y * q.y) - in.p1;
+                    break;
+                }
+                case opcode::Capsule: {
+                    vec3 pa = p - in.a, ba = in.b - in.a;
+                    real length_squared = dot(ba, ba);
+                    real h = length_squared > 0 ? std::clamp(dot(pa, ba) / length_squared, real(0), real(1)) : real(0);
+                    stack[top++] = glm::length(pa - h * ba) - in.p0;
+                    break;
+                }
+                case opcode::SmoothUnion: {
+                    real d2 = stack[--top], d1 = stack[top - 1];
+                    real d = std::fmin(d1, d2);
+                    // Quadratic smooth minimum: at most width / 4 below the plain one
+                    if (in.p0 > 0) {
+                        real h = std::fmax(in.p0 - std::fabs(d1 - d2), real(0)) / in.p0;
+                        d -= h * h * in.p0 * real(0.25);
+                    }
+                    stack[top - 1] = d;
+                    break;
+                }
+                case opcode::Subtract: {
+                    real cut = stack[--top];
+                    stack[top - 1] = std::fmax(stack[top - 1], -cut);
+                    break;
+                }
+                case opcode::SubtractFrom: {
+                    real kept = stack[--top];
+                    stack[top - 1] = std::fmax(kept, -stack[top - 1]);
+                    break;
+                }
+            }
+        }
+        return stack[0];
+    }
+
+    // Conservative bounds of the surface
+    const aabb& bounds() const { return box; }
+
+    // How much faster than 1 the field can change per unit of distance: a ray may advance by
+    // distance / lipschitz().
+    real lipschitz() const { return lipschitz_bound; }
+
+  private:
+    // SubtractFrom is Subtract with the operands evaluated in the other order, emitted when the
+    // cut is the deeper subtree so the stack stays shallow.
+    enum class opcode : uint8_t { RoundBox, Torus, Capsule, SmoothUnion, Subtract, SubtractFrom };
+
+    struct instruction {
+        opcode op;
+        point3 a;
+        vec3 b;
+        real p0, p1;
+    };
+
+    std::vector<instruction> code;
+    aabb box;
+    real lipschitz_bound = 1;
+
+    static const sdf_node& child(const shared_ptr<sdf_node>& node) {
+        if (!node) throw std::runtime_error("SDF operator without an operand");
+        return *node;
+    }
+
+    static bool is_operator(const sdf_node& node) {
+        return node.type == sdf_node::kind::SmoothUnion || node.type == sdf_node::kind::Subtract;
+    }
+
+    // Values on the stack while evaluating node, with the deeper operand evaluated first
+    static int required_stack(const sdf_node& node) {
+        if (!is_operator(node)) return 1;
+        int l = required_stack(child(node.left)), r = required_stack(child(node.right));
+        return l == r ? l + 1 : std::max(l, r);
+    }
+
+    void emit(const sdf_node& node) {
+        switch (node.type) {
+            case sdf_node::kind::RoundBox:
+                // The rounding is grown back out of the shrunk box
+                code.push_back({ opcode::RoundBox, node.a, node.b - vec3(node.p0, node.p0, node.p0), node.p0, 0 });
+                return;
+            case sdf_node::kind::Torus:
+                code.push_back({ opcode::Torus, node.a, node.b, node.p0, node.p1 });
+                return;
+            case sdf_node::kind::Capsule:
+                code.push_back({ opcode::Capsule, node.a, node.b, node.p0, 0 });
+                return;
+            default:
+                break;
+        }
+
+        const sdf_node& l = child(node.left);
+        const sdf_node& r = child(node.right);
+        bool right_first = required_stack(r) > required_stack(l);
+        emit(right_first ? r : l);
+        emit(right_first ? l : r);
+        if (node.type == sdf_node::kind::SmoothUnion)
+            code.push_back({ opcode::SmoothUnion, point3(0, 0, 0), vec3(0, 0, 0), node.p0, 0 });
+        else
+            code.push_back({ right_first ? opcode::SubtractFrom : opcode::Subtract, point3(0, 0, 0), vec3(0, 0, 0), 0, 0 });
+    }
+
+    static aabb node_bounds(const sdf_node& node) {
+        switch (node.type) {
+            case sdf_node::kind::RoundBox:
+                return aabb(node.a - node.b, node.a + node.b);
+            case sdf_node::kind::Torus: {
+                vec3 extent(node.p0 + node.p1, node.p1, node.p0 + node.p1);
+                return aabb(node.a - extent, node.a + extent);
+            }
+            case sdf_node::kind::Capsule: {
+                vec3 extent(node.p0, node.p0, node.p0);
+                return aabb(glm::min(node.a, node.b) - extent, glm::max(node.a, node.b) + extent);
+            }
+            case sdf_node::kind::SmoothUnion: {
+                // The blend reaches at most width / 4 past either operand, so that is the pad on
+                // each side (interval::expand would take the total, twice that)
+                aabb box(node_bounds(child(node.left)), node_bounds(child(node.right)));
+                real pad = node.p0 * real(0.25);
+                vec3 extent(pad, pad, pad);
+                return aabb(box.min() - extent, box.max() + extent);
+            }
+            case sdf_node::kind::Subtract:
+                return node_bounds(child(node.left));
+        }
+        return aabb();
+    }
+
+    // Every primitive is an exact distance, and the union and subtraction never change faster
+    // than the larger of their operands.
+    static real node_lipschitz(const sdf_node& node) {
+        if (!is_operator(node)) return 1;
+        return std::fmax(node_lipschitz(child(node.left)), node_lipschitz(child(node.right)));
+    }
+};
+
+// Intersected by sphere tracing within its bounds. Normals are the gradient of the field, by
+// tetrahedral finite differences: four evaluations instead of six for central ones.
+class sdf_shape : public hittable {
+  public:
+    explicit sdf_shape(const shared_ptr<sdf_node>& root) : program(*root), offset(0, 0, 0) {
+        const aabb& b = program.bounds();
+        real size = std::fmax(b.x.size(), std::fmax(b.y.size(), b.z.size()));
+        epsilon = real(1e-4) * size;
+        set_bounding_box();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // March along the unit direction, so t below is a distance.
+        real len = glm::length(r.direction());
+        if (len == 0) return false;
+        vec3 dir = r.direction() / len;
+        point3 origin = r.origin() - offset;
+        real t = ray_t.min * len, t_end = ray_t.max * len;
+
+        // March the field from the side the ray starts on, so rays refracted into the shape find
+        // their way out. A ray leaving the surface after a bounce is on the side it heads into,
+        // and a hit only counts once it has been clear of the surface.
+        real d = program.distance(origin + t * dir);
+        real side = d < 0 ? -1 : 1;
+        if (std::fabs(d) < epsilon) side = dot(gradient(origin + t * dir), dir) > 0 ? 1 : -1;
+        bool clear = side * d >= epsilon;
+
+        // Only the span inside the bounds can hold the surface
+        const aabb& b = program.bounds();
+        for (int axis = 0; axis < 3; axis++) {
+            const interval& ax = b.axis_interval(axis);
+            real inv = real(1) / dir[axis];
+            real t0 = (ax.min - origin[axis]) * inv, t1 = (ax.max - origin[axis]) * inv;
+            t = std::fmax(t, std::fmin(t0, t1));
+            t_end = std::fmin(t_end, std::fmax(t0, t1));
+        }
+        if (!(t <= t_end)) return false;
+
+        const real step_scale = real(1) / program.lipschitz();
+        for (int i = 0; i < max_steps && t <= t_end; i++) {
+            real sd = side * program.distance(origin + t * dir);
+            if (sd < epsilon) {
+                if (clear) {
+                    rec.t = t / len;
+                    rec.p = r.at(rec.t);
+                    vec3 normal = unit_vector(gradient(rec.p - offset));
+                    rec.set_face_normal(r, normal);
+                    sphere::get_sphere_uv(unit_vector(rec.p - offset - center()), rec.u, rec.v);
+                    rec.mat = mat;
+                    return true;
+                }
+            } else {
+                clear = true;
+            }
+            t += std::fmax(sd * step_scale, epsilon);
+        }
+        return false;
+    }
+
+    void set_bounding_box() override {
+        bbox = program.bounds() + offset;
+    }
+
+    void move_by(const point3& displacement) override {
+        offset += displacement;
+        set_bounding_box();
+    }
+
+    std::ostream& print(std::ostream& out) const override {
+        out << "SDF(center=" << center() + offset << ")";
+        return out;
+    }
+
+    std::istream& write(std::istream& in) const override {
+        return in;
+    }
+
+  private:
+    static constexpr int max_steps = 256;
+
+    sdf_program program;
+    vec3 offset; // Moved by, the program keeps the positions it was built with
+    real epsilon;
+
+    point3 center() const {
+        const aabb& b = program.bounds();
+        return point3(b.x.min + b.x.max, b.y.min + b.y.max, b.z.min + b.z.max) / real(2);
+    }
+
+    vec3 gradient(const point3& p) const {
+        const vec3 k0(1, -1, -1), k1(-1, -1, 1), k2(-1, 1, -1), k3(1, 1, 1);
+        real h = epsilon;
+        return k0 * program.distance(p + h * k0) + k1 * program.distance(p + h * k1) +
+               k2 * program.distance(p + h * k2) + k3 * program.distance(p + h * k3);
+    }
+};
+
+#endif
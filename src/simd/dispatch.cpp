@@ -0,0 +1,165 @@
+#include "simd.h"
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define ZENGINE_SIMD_X86 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define ZENGINE_SIMD_X86 1
+#endif
+
+namespace {
+
+const simd_kernels* const tables[] = {
+    &simd_kernels_scalar,
+    &simd_kernels_sse42,
+    &simd_kernels_avx2,
+    &simd_kernels_avx512,
+};
+
+const char* const isa_names[] = { "scalar", "sse42", "avx2", "avx512" };
+
+static_assert(sizeof(tables) / sizeof(tables[0]) == static_cast<size_t>(simd_isa::Count));
+static_assert(sizeof(isa_names) / sizeof(isa_names[0]) == static_cast<size_t>(simd_isa::Count));
+
+simd_isa selected = simd_isa::Scalar;
+
+// A table is left empty when the compiler could not build its translation unit for that ISA.
+bool compiled(simd_isa isa) {
+    return tables[static_cast<int>(isa)]->tonemap != nullptr;
+}
+
+#ifdef ZENGINE_SIMD_X86
+
+void cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, static_cast<int>(leaf), static_cast<int>(subleaf));
+    for (int i = 0; i < 4; i++) regs[i] = static_cast<unsigned>(r[i]);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the OS saves on context switches: bits 1-2 for SSE and AVX, 5-7 for AVX-512.
+unsigned long long enabled_state() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+}
+
+simd_isa cpu_isa() {
+    unsigned regs[4];
+    cpuid(0, 0, regs);
+    unsigned max_leaf = regs[0];
+
+    cpuid(1, 0, regs);
+    bool sse42 = (regs[2] & (1u << 19)) && (regs[2] & (1u << 20));
+    bool osxsave = regs[2] & (1u << 27);
+    bool avx = regs[2] & (1u << 28);
+    if (!sse42) return simd_isa::Scalar;
+    if (!osxsave || !avx || max_leaf < 7) return simd_isa::SSE42;
+
+    unsigned long long state = enabled_state();
+    if ((state & 0x6) != 0x6) return simd_isa::SSE42;
+
+    cpuid(7, 0, regs);
+    if (!(regs[1] & (1u << 5))) return simd_isa::SSE42;
+    if ((regs[1] & (1u << 16)) && (state & 0xe6) == 0xe6) return simd_isa::AVX512;
+    return simd_isa::AVX2;
+}
+
+#else
+
+simd_isa cpu_isa() { return simd_isa::Scalar; }
+
+#endif
+
+template <typename F>
+void take(F& entry, F candidate) {
+    if (candidate) entry = candidate;
+}
+
+} // namespace
+
+simd_isa simd_detect() {
+    simd_isa isa = cpu_isa();
+    while (isa != simd_isa::Scalar && !compiled(isa))
+        isa = static_cast<simd_isa>(static_cast<int>(isa) - 1);
+    return isa;
+}
+
+bool simd_select(simd_isa isa) {
+    if (static_cast<int>(isa) > static_cast<int>(simd_detect())) return false;
+
+    simd_kernels kernels = simd_kernels_scalar;
+    for (int level = 1; level <= static_cast<int>(isa); level++) {
+        const simd_kernels& t = *tables[level];
+        take(kernels.box_hit8, t.box_hit8);
+        take(kernels.box_hit_packet8, t.box_hit_packet8);
+        take(kernels.sphere_hit, t.sphere_hit);
+        take(kernels.planar_hit, t.planar_hit);
+        take(kernels.quadric_hit, t.quadric_hit);
+        take(kernels.sphere_packet_hit, t.sphere_packet_hit);
+        take(kernels.planar_packet_hit, t.planar_packet_hit);
+        take(kernels.tonemap, t.tonemap);
+        take(kernels.perlin_noise, t.perlin_noise);
+        take(kernels.perlin_turbulence, t.perlin_turbulence);
+        take(kernels.image_sample, t.image_sample);
+    }
+    simd_active = kernels;
+    selected = isa;
+    return true;
+}
+
+simd_isa simd_selected() {
+    return selected;
+}
+
+const char* simd_isa_name(simd_isa isa) {
+    int index = static_cast<int>(isa);
+    return index < static_cast<int>(simd_isa::Count) ? isa_names[index] : "unknown";
+}
+
+bool simd_parse_isa(const char* name, simd_isa& isa) {
+    for (int i = 0; i < static_cast<int>(simd_isa::Count); i++) {
+        const char* a = name;
+        const char* b = isa_names[i];
+        while (*a && *b && std::tolower(static_cast<unsigned char>(*a)) == *b) {
+            a++;
+            b++;
+        }
+        if (*a == '\0' && *b == '\0') {
+            isa = static_cast<simd_isa>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+simd_isa simd_init(const char* name) {
+    simd_isa best = simd_detect();
+    simd_isa isa = best;
+
+    if (!name || !*name) name = std::getenv("ZENGINE_ISA");
+    if (name && *name) {
+        simd_isa requested;
+        if (!simd_parse_isa(name, requested))
+            std::clog << "Unknown ISA '" << name << "', expected scalar, sse42, avx2 or avx512\n";
+        else if (static_cast<int>(requested) > static_cast<int>(best))
+            std::clog << "ISA '" << name << "' is not supported on this CPU\n";
+        else
+            isa = requested;
+    }
+
+    simd_select(isa);
+    std::clog << "SIMD kernels: " << simd_isa_name(isa) << " (best available: " << simd_isa_name(best) << ")\n";
+    return isa;
+}
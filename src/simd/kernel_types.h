@@ -0,0 +1,140 @@
+#ifndef KERNEL_TYPES_H
+#define KERNEL_TYPES_H
+
+#include <cstdint>
+
+// Plain data passed to the vectorized kernels. Everything here is a layout: no functions, no
+// engine types, so the per-ISA translation units in this directory can include it without
+// sharing any inline code with the rest of the engine.
+
+// One ray for the batch kernels.
+template <typename T>
+struct batch_ray {
+    T ox, oy, oz;
+    T dx, dy, dz;
+    T time;
+};
+
+// Rays of a packet in SoA form, for the kernels that test one primitive against every ray
+// of the packet at once. Those kernels take a lane mask and per-lane t_max and best index
+// arrays, and return the mask of lanes whose nearest hit moved closer.
+template <typename T, int P>
+struct alignas(32) batch_packet {
+    T ox[P], oy[P], oz[P];
+    T dx[P], dy[P], dz[P];
+    T time[P];
+};
+
+template <typename T>
+struct sphere_batch {
+    const T *cx, *cy, *cz; // Center at time 0
+    const T *vx, *vy, *vz; // Displacement over the shutter interval
+    const T *radius;
+};
+
+// Planar shapes, tested with the same predicate as planar_shape_contains() in quad.h; the
+// shape codes are the planar_shape enumerators.
+template <typename T>
+struct planar_batch {
+    const T *qx, *qy, *qz;
+    const T *ux, *uy, *uz;
+    const T *vx, *vy, *vz;
+    const T *wx, *wy, *wz;
+    const T *nx, *ny, *nz;
+    const T *d;
+    const T *p0, *p1;
+    const int32_t* shape;
+};
+
+enum : int32_t {
+    batch_shape_parallelogram = 0,
+    batch_shape_triangle = 1,
+    batch_shape_disk = 2,
+    batch_shape_ring = 3,
+    batch_shape_ellipse = 4,
+    batch_shape_polygon = 5 // Regular, p0 sides
+};
+
+// General quadrics, see quadric.h. With q = p - center, the surface is
+// f(q) = q.A q + 2 b.q + c = 0 with A symmetric, negative inside. Hits are kept where
+// slab_min <= s.q <= slab_max; where capped is non-zero the slab planes also close the
+// surface with its cross-section there. The kernels report which part was hit: 0 for the
+// surface, 1 for the cap at slab_min, 2 for the cap at slab_max.
+template <typename T>
+struct quadric_batch {
+    const T *cx, *cy, *cz;
+    const T *xx, *yy, *zz, *xy, *xz, *yz;
+    const T *bx, *by, *bz;
+    const T *c;
+    const T *sx, *sy, *sz;
+    const T *slab_min, *slab_max;
+    const int32_t* capped;
+};
+
+enum : int32_t {
+    quadric_part_surface = 0,
+    quadric_part_cap_min = 1,
+    quadric_part_cap_max = 2
+};
+
+// Node of a BVH with N children, see wide_bvh.h. The bounds of the children are stored per
+// axis (all min x, then all min y, ...) so one node visit tests every child box with a single
+// vector slab test. A child slot either points to another wide node (count 0) or holds the
+// primitive range of a leaf. Unused slots have empty bounds and are never hit.
+template <int N>
+struct alignas(sizeof(float) * N) wide_bvh_node {
+    float bmin_x[N], bmin_y[N], bmin_z[N];
+    float bmax_x[N], bmax_y[N], bmax_z[N];
+    uint32_t child[N]; // Wide node index for interior children, first primitive for leaves
+    uint32_t count[N]; // Primitive count for leaves, 0 for interior children and empty slots
+};
+
+// Per-axis lanes of a packet of P rays, laid out so that one box can be tested against every
+// ray with vector operations over the rays.
+template <int P>
+struct alignas(32) wide_bvh_packet_lanes {
+    float org[3][P];
+    float inv_dir[3][P];
+};
+
+// Gradient and permutation tables of a perlin generator, perlin_point_count entries each.
+constexpr int perlin_point_count = 256;
+
+struct perlin_tables {
+    const float *gx, *gy, *gz;
+    const int32_t *perm_x, *perm_y, *perm_z;
+};
+
+// Texel encodings of an image_view.
+//   image_format_rgb8   three bytes, each an index into the view's decode table (sRGB for
+//                       ordinary images)
+//   image_format_rgb16f three IEEE half floats, linear, for HDR sources
+constexpr int32_t image_format_rgb8 = 0;
+constexpr int32_t image_format_rgb16f = 1;
+
+// Images are stored in square tiles of 2^image_tile_shift texels a side, tiles row by row
+// from the top, and the texels of a tile in Morton (Z) order, so texels close in 2D are
+// close in memory whichever direction lookups walk.
+constexpr int32_t image_tile_shift = 3;
+constexpr int32_t image_tile_size = 1 << image_tile_shift;
+
+// Image as read by the image_sample kernels, in whole tiles; the rows and columns past
+// width and height pad the last tiles. The data stays readable for one byte past the last
+// texel so the kernels can fetch an rgb8 texel with a single 32-bit load.
+struct image_view {
+    const uint8_t* data;
+    int32_t width, height;
+    int32_t bytes_per_pixel;
+    int32_t tiles_x;
+    int32_t format;
+    const float* decode; // 256 linear values, for image_format_rgb8
+};
+
+// Bit positions of the channels of a 32-bit display pixel, and the alpha bits set in every
+// pixel.
+struct pixel_layout {
+    uint32_t r_shift, g_shift, b_shift;
+    uint32_t alpha;
+};
+
+#endif
@@ -0,0 +1,673 @@
+#include "simd.h"
+
+// 8-wide kernels. The gathers are what make the noise, texture and tonemap kernels worth
+// vectorizing at this width.
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+#include <math.h>
+
+namespace {
+
+__m256 lanes_below(uint32_t n) {
+    const __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(n)), index));
+}
+
+// Returns the lane of the smallest t, or -1 when no lane is below `limit`.
+int nearest_lane(__m256 t, float limit, float& t_out) {
+    __m256 m = _mm256_min_ps(t, _mm256_permute2f128_ps(t, t, 1));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    float nearest = _mm256_cvtss_f32(m);
+    if (!(nearest < limit)) return -1;
+    int bits = _mm256_movemask_ps(_mm256_cmp_ps(t, m, _CMP_EQ_OQ));
+    int lane = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        lane++;
+    }
+    t_out = nearest;
+    return lane;
+}
+
+unsigned box_hit8(const wide_bvh_node<8>& node, const float org[3], const float inv_dir[3],
+                  const bool neg[3], float t_min, float t_max, float t_entry[8]) {
+    const float* lo[3] = { neg[0] ? node.bmax_x : node.bmin_x,
+                           neg[1] ? node.bmax_y : node.bmin_y,
+                           neg[2] ? node.bmax_z : node.bmin_z };
+    const float* hi[3] = { neg[0] ? node.bmin_x : node.bmax_x,
+                           neg[1] ? node.bmin_y : node.bmax_y,
+                           neg[2] ? node.bmin_z : node.bmax_z };
+    __m256 tn = _mm256_set1_ps(t_min);
+    __m256 tf = _mm256_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        __m256 o = _mm256_set1_ps(org[a]);
+        __m256 inv = _mm256_set1_ps(inv_dir[a]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(lo[a]), o), inv);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(hi[a]), o), inv);
+        tn = _mm256_max_ps(t0, tn); // Keeps tn when t0 is NaN
+        tf = _mm256_min_ps(t1, tf);
+    }
+    _mm256_storeu_ps(t_entry, tn);
+    return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ)));
+}
+
+// All 8 rays against one child at a time.
+void box_hit_packet8(const wide_bvh_node<8>& node, unsigned children, const wide_bvh_packet_lanes<8>& lanes,
+                     const bool neg[3], float t_min, const float t_max[8], uint32_t hits[8], float t_entry[8]) {
+    const float* lo[3] = { neg[0] ? node.bmax_x : node.bmin_x,
+                           neg[1] ? node.bmax_y : node.bmin_y,
+                           neg[2] ? node.bmax_z : node.bmin_z };
+    const float* hi[3] = { neg[0] ? node.bmin_x : node.bmax_x,
+                           neg[1] ? node.bmin_y : node.bmax_y,
+                           neg[2] ? node.bmin_z : node.bmax_z };
+    const __m256 inf = _mm256_set1_ps(INFINITY);
+    const __m256 far_limit = _mm256_loadu_ps(t_max);
+    __m256 org[3], inv[3];
+    for (int a = 0; a < 3; a++) {
+        org[a] = _mm256_load_ps(lanes.org[a]);
+        inv[a] = _mm256_load_ps(lanes.inv_dir[a]);
+    }
+
+    for (int k = 0; k < 8; k++) {
+        hits[k] = 0;
+        t_entry[k] = INFINITY;
+        if (!(children & (1u << k))) continue;
+        __m256 tn = _mm256_set1_ps(t_min);
+        __m256 tf = far_limit;
+        for (int a = 0; a < 3; a++) {
+            tn = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(lo[a][k]), org[a]), inv[a]), tn);
+            tf = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(hi[a][k]), org[a]), inv[a]), tf);
+        }
+        __m256 hit = _mm256_cmp_ps(tn, tf, _CMP_LE_OQ);
+        hits[k] = static_cast<uint32_t>(_mm256_movemask_ps(hit));
+        if (hits[k] == 0) continue;
+        __m256 m = _mm256_blendv_ps(inf, tn, hit);
+        m = _mm256_min_ps(m, _mm256_permute2f128_ps(m, m, 1));
+        m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        t_entry[k] = _mm256_cvtss_f32(m);
+    }
+}
+
+int sphere_hit(const sphere_batch<float>& s, uint32_t begin, uint32_t count,
+               const batch_ray<float>& r, float t_min, float& t_max) {
+    const __m256 ox = _mm256_set1_ps(r.ox), oy = _mm256_set1_ps(r.oy), oz = _mm256_set1_ps(r.oz);
+    const __m256 dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+    const __m256 time = _mm256_set1_ps(r.time);
+    const __m256 a = _mm256_set1_ps(r.dx * r.dx + r.dy * r.dy + r.dz * r.dz);
+    const __m256 lo = _mm256_set1_ps(t_min);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 inf = _mm256_set1_ps(INFINITY);
+    int best = -1;
+
+    for (uint32_t i = begin; i < begin + count; i += 8) {
+        __m256 hi = _mm256_set1_ps(t_max);
+        __m256 ocx = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(s.cx + i), _mm256_mul_ps(time, _mm256_loadu_ps(s.vx + i))), ox);
+        __m256 ocy = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(s.cy + i), _mm256_mul_ps(time, _mm256_loadu_ps(s.vy + i))), oy);
+        __m256 ocz = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(s.cz + i), _mm256_mul_ps(time, _mm256_loadu_ps(s.vz + i))), oz);
+        __m256 radius = _mm256_loadu_ps(s.radius + i);
+
+        __m256 h = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, ocx), _mm256_mul_ps(dy, ocy)), _mm256_mul_ps(dz, ocz));
+        __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz)),
+                                 _mm256_mul_ps(radius, radius));
+        __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(h, h), _mm256_mul_ps(a, c));
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ), lanes_below(begin + count - i));
+
+        __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+        __m256 near_root = _mm256_div_ps(_mm256_sub_ps(h, sqrtd), a);
+        __m256 far_root = _mm256_div_ps(_mm256_add_ps(h, sqrtd), a);
+        __m256 near_ok = _mm256_and_ps(_mm256_cmp_ps(lo, near_root, _CMP_LT_OQ), _mm256_cmp_ps(near_root, hi, _CMP_LT_OQ));
+        __m256 far_ok = _mm256_and_ps(_mm256_cmp_ps(lo, far_root, _CMP_LT_OQ), _mm256_cmp_ps(far_root, hi, _CMP_LT_OQ));
+
+        __m256 t = _mm256_blendv_ps(far_root, near_root, near_ok);
+        t = _mm256_blendv_ps(inf, t, _mm256_and_ps(valid, _mm256_or_ps(near_ok, far_ok)));
+
+        int lane = nearest_lane(t, t_max, t_max);
+        if (lane >= 0) best = static_cast<int>(i) + lane;
+    }
+    return best;
+}
+
+int planar_hit(const planar_batch<float>& q, uint32_t begin, uint32_t count,
+               const batch_ray<float>& r, float t_min, float& t_max, float& hit_a, float& hit_b) {
+    const __m256 ox = _mm256_set1_ps(r.ox), oy = _mm256_set1_ps(r.oy), oz = _mm256_set1_ps(r.oz);
+    const __m256 dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+    const __m256 lo = _mm256_set1_ps(t_min);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f), quarter = _mm256_set1_ps(0.25f);
+    const __m256 inf = _mm256_set1_ps(INFINITY);
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    int best = -1;
+
+    for (uint32_t i = begin; i < begin + count; i += 8) {
+        __m256 hi = _mm256_set1_ps(t_max);
+        __m256 nx = _mm256_loadu_ps(q.nx + i), ny = _mm256_loadu_ps(q.ny + i), nz = _mm256_loadu_ps(q.nz + i);
+        __m256 denom = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, dx), _mm256_mul_ps(ny, dy)), _mm256_mul_ps(nz, dz));
+        __m256 n_dot_o = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, ox), _mm256_mul_ps(ny, oy)), _mm256_mul_ps(nz, oz));
+        __m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(q.d + i), n_dot_o), denom);
+
+        __m256 mask = _mm256_cmp_ps(_mm256_andnot_ps(sign_mask, denom), _mm256_set1_ps(1e-8f), _CMP_GE_OQ);
+        mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(lo, t, _CMP_LE_OQ), _mm256_cmp_ps(t, hi, _CMP_LE_OQ)));
+        mask = _mm256_and_ps(mask, lanes_below(begin + count - i));
+        if (_mm256_movemask_ps(mask) == 0) continue;
+
+        __m256 px = _mm256_sub_ps(_mm256_add_ps(ox, _mm256_mul_ps(t, dx)), _mm256_loadu_ps(q.qx + i));
+        __m256 py = _mm256_sub_ps(_mm256_add_ps(oy, _mm256_mul_ps(t, dy)), _mm256_loadu_ps(q.qy + i));
+        __m256 pz = _mm256_sub_ps(_mm256_add_ps(oz, _mm256_mul_ps(t, dz)), _mm256_loadu_ps(q.qz + i));
+        __m256 ux = _mm256_loadu_ps(q.ux + i), uy = _mm256_loadu_ps(q.uy + i), uz = _mm256_loadu_ps(q.uz + i);
+        __m256 vx = _mm256_loadu_ps(q.vx + i), vy = _mm256_loadu_ps(q.vy + i), vz = _mm256_loadu_ps(q.vz + i);
+        __m256 wx = _mm256_loadu_ps(q.wx + i), wy = _mm256_loadu_ps(q.wy + i), wz = _mm256_loadu_ps(q.wz + i);
+
+        __m256 a = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(wx, _mm256_sub_ps(_mm256_mul_ps(py, vz), _mm256_mul_ps(pz, vy))),
+            _mm256_mul_ps(wy, _mm256_sub_ps(_mm256_mul_ps(pz, vx), _mm256_mul_ps(px, vz)))),
+            _mm256_mul_ps(wz, _mm256_sub_ps(_mm256_mul_ps(px, vy), _mm256_mul_ps(py, vx))));
+        __m256 b = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(wx, _mm256_sub_ps(_mm256_mul_ps(uy, pz), _mm256_mul_ps(uz, py))),
+            _mm256_mul_ps(wy, _mm256_sub_ps(_mm256_mul_ps(uz, px), _mm256_mul_ps(ux, pz)))),
+            _mm256_mul_ps(wz, _mm256_sub_ps(_mm256_mul_ps(ux, py), _mm256_mul_ps(uy, px))));
+
+        // Evaluate every shape's predicate and keep the one each lane asks for.
+        __m256i shape = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(q.shape + i));
+        __m256 p0 = _mm256_loadu_ps(q.p0 + i), p1 = _mm256_loadu_ps(q.p1 + i);
+        auto is_shape = [&](int32_t code) {
+            return _mm256_castsi256_ps(_mm256_cmpeq_epi32(shape, _mm256_set1_epi32(code)));
+        };
+        auto le = [](__m256 x, __m256 y) { return _mm256_cmp_ps(x, y, _CMP_LE_OQ); };
+
+        __m256 a_pos = _mm256_cmp_ps(a, zero, _CMP_GE_OQ), b_pos = _mm256_cmp_ps(b, zero, _CMP_GE_OQ);
+        __m256 inside_para = _mm256_and_ps(_mm256_and_ps(a_pos, b_pos), _mm256_and_ps(le(a, one), le(b, one)));
+        __m256 inside_tri = _mm256_and_ps(_mm256_and_ps(a_pos, b_pos), le(_mm256_add_ps(a, b), one));
+        __m256 ddx = _mm256_sub_ps(a, p0), ddy = _mm256_sub_ps(b, p0);
+        __m256 inside_disk = le(_mm256_add_ps(_mm256_mul_ps(ddx, ddx), _mm256_mul_ps(ddy, ddy)), _mm256_mul_ps(p0, p0));
+        __m256 cx = _mm256_sub_ps(a, half), cy = _mm256_sub_ps(b, half);
+        __m256 r2 = _mm256_add_ps(_mm256_mul_ps(cx, cx), _mm256_mul_ps(cy, cy));
+        __m256 inside_ring = _mm256_and_ps(le(r2, _mm256_mul_ps(_mm256_mul_ps(p1, p1), quarter)),
+                                           le(_mm256_mul_ps(_mm256_mul_ps(p0, p0), quarter), r2));
+        __m256 ex = _mm256_div_ps(cx, half), ey = _mm256_div_ps(cy, _mm256_set1_ps(0.4f));
+        __m256 inside_ellipse = le(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)), one);
+
+        __m256 inside = _mm256_or_ps(_mm256_or_ps(
+            _mm256_and_ps(is_shape(batch_shape_parallelogram), inside_para),
+            _mm256_and_ps(is_shape(batch_shape_triangle), inside_tri)), _mm256_or_ps(_mm256_or_ps(
+            _mm256_and_ps(is_shape(batch_shape_disk), inside_disk),
+            _mm256_and_ps(is_shape(batch_shape_ring), inside_ring)),
+            _mm256_and_ps(is_shape(batch_shape_ellipse), inside_ellipse)));
+
+        // Polygons need an angle, so their lanes go through the scalar test
+        int polygon_lanes = _mm256_movemask_ps(_mm256_and_ps(mask, is_shape(batch_shape_polygon)));
+        if (polygon_lanes) {
+            alignas(32) float as[8], bs[8], sides[8];
+            _mm256_store_ps(as, a);
+            _mm256_store_ps(bs, b);
+            _mm256_store_ps(sides, p0);
+            const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+            __m256i hits = _mm256_set1_epi32(static_cast<int>(planar_polygon_lanes(polygon_lanes, as, bs, sides)));
+            inside = _mm256_or_ps(inside, _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(hits, bit), bit)));
+        }
+
+        t = _mm256_blendv_ps(inf, t, _mm256_and_ps(mask, inside));
+        // t_max itself is an accepted distance for planes, so compare against the next float.
+        int lane = nearest_lane(t, nextafterf(t_max, INFINITY), t_max);
+        if (lane >= 0) {
+            alignas(32) float as[8], bs[8];
+            _mm256_store_ps(as, a);
+            _mm256_store_ps(bs, b);
+            hit_a = as[lane];
+            hit_b = bs[lane];
+            best = static_cast<int>(i) + lane;
+        }
+    }
+    return best;
+}
+
+// Eight quadrics against one ray, in the order of operations of quadric_batch_hit_scalar.
+int quadric_hit(const quadric_batch<float>& q, uint32_t begin, uint32_t count,
+                const batch_ray<float>& r, float t_min, float& t_max, int32_t& part) {
+    const __m256 dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+    const __m256 lo = _mm256_set1_ps(t_min);
+    const __m256 zero = _mm256_setzero_ps(), two = _mm256_set1_ps(2.0f);
+    const __m256 inf = _mm256_set1_ps(INFINITY);
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    int best = -1;
+
+    for (uint32_t i = begin; i < begin + count; i += 4) {
+        const __m256 hi = _mm256_set1_ps(t_max);
+        const __m256 lanes = lanes_below(begin + count - i);
+        __m256 ox = _mm256_sub_ps(_mm256_set1_ps(r.ox), _mm256_loadu_ps(q.cx + i));
+        __m256 oy = _mm256_sub_ps(_mm256_set1_ps(r.oy), _mm256_loadu_ps(q.cy + i));
+        __m256 oz = _mm256_sub_ps(_mm256_set1_ps(r.oz), _mm256_loadu_ps(q.cz + i));
+        __m256 xx = _mm256_loadu_ps(q.xx + i), yy = _mm256_loadu_ps(q.yy + i), zz = _mm256_loadu_ps(q.zz + i);
+        __m256 xy = _mm256_loadu_ps(q.xy + i), xz = _mm256_loadu_ps(q.xz + i), yz = _mm256_loadu_ps(q.yz + i);
+        __m256 bx = _mm256_loadu_ps(q.bx + i), by = _mm256_loadu_ps(q.by + i), bz = _mm256_loadu_ps(q.bz + i);
+        __m256 c0 = _mm256_loadu_ps(q.c + i);
+        __m256 sx = _mm256_loadu_ps(q.sx + i), sy = _mm256_loadu_ps(q.sy + i), sz = _mm256_loadu_ps(q.sz + i);
+        __m256 slab_min = _mm256_loadu_ps(q.slab_min + i), slab_max = _mm256_loadu_ps(q.slab_max + i);
+
+        auto dot3 = [](__m256 ax, __m256 ay, __m256 az, __m256 bx_, __m256 by_, __m256 bz_) {
+            return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx_), _mm256_mul_ps(ay, by_)), _mm256_mul_ps(az, bz_));
+        };
+        __m256 adx = dot3(xx, xy, xz, dx, dy, dz);
+        __m256 ady = dot3(xy, yy, yz, dx, dy, dz);
+        __m256 adz = dot3(xz, yz, zz, dx, dy, dz);
+        __m256 gx = _mm256_add_ps(dot3(xx, xy, xz, ox, oy, oz), bx);
+        __m256 gy = _mm256_add_ps(dot3(xy, yy, yz, ox, oy, oz), by);
+        __m256 gz = _mm256_add_ps(dot3(xz, yz, zz, ox, oy, oz), bz);
+        __m256 a = dot3(adx, ady, adz, dx, dy, dz);
+        __m256 h = dot3(gx, gy, gz, dx, dy, dz);
+        __m256 c = _mm256_add_ps(_mm256_add_ps(dot3(gx, gy, gz, ox, oy, oz), dot3(bx, by, bz, ox, oy, oz)), c0);
+        __m256 s_o = dot3(sx, sy, sz, ox, oy, oz);
+        __m256 s_d = dot3(sx, sy, sz, dx, dy, dz);
+
+        __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(h, h), _mm256_mul_ps(a, c));
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ), lanes);
+        __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+        __m256 k = _mm256_xor_ps(_mm256_add_ps(h, _mm256_or_ps(sqrtd, _mm256_and_ps(h, sign_mask))), sign_mask);
+        __m256 t0 = _mm256_div_ps(k, a), t1 = _mm256_div_ps(c, k);
+        __m256 near_root = _mm256_min_ps(t0, t1), far_root = _mm256_max_ps(t0, t1);
+        __m256 s_near = _mm256_add_ps(s_o, _mm256_mul_ps(near_root, s_d));
+        __m256 s_far = _mm256_add_ps(s_o, _mm256_mul_ps(far_root, s_d));
+        __m256 near_ok = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(lo, near_root, _CMP_LT_OQ), _mm256_cmp_ps(near_root, hi, _CMP_LT_OQ)),
+                                       _mm256_and_ps(_mm256_cmp_ps(slab_min, s_near, _CMP_LE_OQ), _mm256_cmp_ps(s_near, slab_max, _CMP_LE_OQ)));
+        __m256 far_ok = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(lo, far_root, _CMP_LT_OQ), _mm256_cmp_ps(far_root, hi, _CMP_LT_OQ)),
+                                      _mm256_and_ps(_mm256_cmp_ps(slab_min, s_far, _CMP_LE_OQ), _mm256_cmp_ps(s_far, slab_max, _CMP_LE_OQ)));
+        __m256 t = _mm256_blendv_ps(_mm256_blendv_ps(inf, far_root, _mm256_and_ps(valid, far_ok)), near_root, _mm256_and_ps(valid, near_ok));
+        __m256i hit_part = _mm256_set1_epi32(quadric_part_surface);
+
+        __m256 capped = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(q.capped + i)), _mm256_setzero_si256())), lanes);
+        if (_mm256_movemask_ps(capped) != 0) {
+            for (int side = 0; side < 2; side++) {
+                __m256 limit = _mm256_min_ps(t, hi);
+                __m256 tc = _mm256_div_ps(_mm256_sub_ps(side ? slab_max : slab_min, s_o), s_d);
+                __m256 px = _mm256_add_ps(ox, _mm256_mul_ps(tc, dx));
+                __m256 py = _mm256_add_ps(oy, _mm256_mul_ps(tc, dy));
+                __m256 pz = _mm256_add_ps(oz, _mm256_mul_ps(tc, dz));
+                __m256 fx = _mm256_add_ps(dot3(xx, xy, xz, px, py, pz), _mm256_mul_ps(two, bx));
+                __m256 fy = _mm256_add_ps(dot3(xy, yy, yz, px, py, pz), _mm256_mul_ps(two, by));
+                __m256 fz = _mm256_add_ps(dot3(xz, yz, zz, px, py, pz), _mm256_mul_ps(two, bz));
+                __m256 f = _mm256_add_ps(dot3(fx, fy, fz, px, py, pz), c0);
+                __m256 ok = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(lo, tc, _CMP_LT_OQ), _mm256_cmp_ps(tc, limit, _CMP_LT_OQ)),
+                                          _mm256_and_ps(_mm256_cmp_ps(f, zero, _CMP_LE_OQ), capped));
+                t = _mm256_blendv_ps(t, tc, ok);
+                hit_part = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(hit_part),
+                    _mm256_castsi256_ps(_mm256_set1_epi32(side ? quadric_part_cap_max : quadric_part_cap_min)), ok));
+            }
+        }
+
+        int lane = nearest_lane(t, t_max, t_max);
+        if (lane >= 0) {
+            alignas(32) int32_t parts[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(parts), hit_part);
+            part = parts[lane];
+            best = static_cast<int>(i) + lane;
+        }
+    }
+    return best;
+}
+
+// Mask of the packet lanes in `lanes`
+__m256 packet_lanes8(uint32_t lanes) {
+    const __m256i bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int>(lanes)), bit), bit));
+}
+
+// One sphere against the 8 rays at a time, with the same arithmetic as the per-ray kernels so
+// both paths agree on every hit.
+uint32_t sphere_packet_hit(const sphere_batch<float>& s, uint32_t begin, uint32_t count,
+                           const batch_packet<float, 8>& r, uint32_t lanes, float t_min, float t_max[8],
+                           int32_t best[8]) {
+    const __m256 lo = _mm256_set1_ps(t_min);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 active = packet_lanes8(lanes);
+    const __m256 ox = _mm256_load_ps(r.ox), oy = _mm256_load_ps(r.oy), oz = _mm256_load_ps(r.oz);
+    const __m256 dx = _mm256_load_ps(r.dx), dy = _mm256_load_ps(r.dy), dz = _mm256_load_ps(r.dz);
+    const __m256 time = _mm256_load_ps(r.time);
+    const __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+    __m256 hi = _mm256_loadu_ps(t_max);
+    __m256 found = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(best)));
+    __m256 any = zero;
+
+    for (uint32_t i = begin; i < begin + count; i++) {
+        __m256 ocx = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps(s.cx[i]), _mm256_mul_ps(time, _mm256_set1_ps(s.vx[i]))), ox);
+        __m256 ocy = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps(s.cy[i]), _mm256_mul_ps(time, _mm256_set1_ps(s.vy[i]))), oy);
+        __m256 ocz = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps(s.cz[i]), _mm256_mul_ps(time, _mm256_set1_ps(s.vz[i]))), oz);
+        __m256 radius = _mm256_set1_ps(s.radius[i]);
+
+        __m256 h = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, ocx), _mm256_mul_ps(dy, ocy)), _mm256_mul_ps(dz, ocz));
+        __m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz)),
+                                 _mm256_mul_ps(radius, radius));
+        __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(h, h), _mm256_mul_ps(a, c));
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ), active);
+        if (_mm256_movemask_ps(valid) == 0) continue;
+
+        __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+        __m256 near_root = _mm256_div_ps(_mm256_sub_ps(h, sqrtd), a);
+        __m256 far_root = _mm256_div_ps(_mm256_add_ps(h, sqrtd), a);
+        __m256 near_ok = _mm256_and_ps(_mm256_cmp_ps(lo, near_root, _CMP_LT_OQ), _mm256_cmp_ps(near_root, hi, _CMP_LT_OQ));
+        __m256 far_ok = _mm256_and_ps(_mm256_cmp_ps(lo, far_root, _CMP_LT_OQ), _mm256_cmp_ps(far_root, hi, _CMP_LT_OQ));
+        __m256 ok = _mm256_and_ps(valid, _mm256_or_ps(near_ok, far_ok));
+
+        hi = _mm256_blendv_ps(hi, _mm256_blendv_ps(far_root, near_root, near_ok), ok);
+        found = _mm256_blendv_ps(found, _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(i))), ok);
+        any = _mm256_or_ps(any, ok);
+    }
+
+    _mm256_storeu_ps(t_max, hi);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(best), _mm256_castps_si256(found));
+    return static_cast<uint32_t>(_mm256_movemask_ps(any));
+}
+
+// One planar shape against the 8 rays at a time. The shape is the same for every ray, so only
+// its own predicate is evaluated.
+uint32_t planar_packet_hit(const planar_batch<float>& q, uint32_t begin, uint32_t count,
+                           const batch_packet<float, 8>& r, uint32_t lanes, float t_min, float t_max[8],
+                           int32_t best[8], float hit_a[8], float hit_b[8]) {
+    const __m256 lo = _mm256_set1_ps(t_min);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f), quarter = _mm256_set1_ps(0.25f);
+    const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    const __m256 active = packet_lanes8(lanes);
+    const __m256 ox = _mm256_load_ps(r.ox), oy = _mm256_load_ps(r.oy), oz = _mm256_load_ps(r.oz);
+    const __m256 dx = _mm256_load_ps(r.dx), dy = _mm256_load_ps(r.dy), dz = _mm256_load_ps(r.dz);
+    __m256 hi = _mm256_loadu_ps(t_max);
+    __m256 found_a = _mm256_loadu_ps(hit_a), found_b = _mm256_loadu_ps(hit_b);
+    __m256 found = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(best)));
+    __m256 any = zero;
+    auto le = [](__m256 x, __m256 y) { return _mm256_cmp_ps(x, y, _CMP_LE_OQ); };
+
+    for (uint32_t i = begin; i < begin + count; i++) {
+        __m256 nx = _mm256_set1_ps(q.nx[i]), ny = _mm256_set1_ps(q.ny[i]), nz = _mm256_set1_ps(q.nz[i]);
+        __m256 denom = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, dx), _mm256_mul_ps(ny, dy)), _mm256_mul_ps(nz, dz));
+        __m256 n_dot_o = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, ox), _mm256_mul_ps(ny, oy)), _mm256_mul_ps(nz, oz));
+        __m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_set1_ps(q.d[i]), n_dot_o), denom);
+
+        __m256 mask = _mm256_cmp_ps(_mm256_andnot_ps(sign_mask, denom), _mm256_set1_ps(1e-8f), _CMP_GE_OQ);
+        mask = _mm256_and_ps(mask, _mm256_and_ps(le(lo, t), le(t, hi)));
+        mask = _mm256_and_ps(mask, active);
+        if (_mm256_movemask_ps(mask) == 0) continue;
+
+        __m256 px = _mm256_sub_ps(_mm256_add_ps(ox, _mm256_mul_ps(t, dx)), _mm256_set1_ps(q.qx[i]));
+        __m256 py = _mm256_sub_ps(_mm256_add_ps(oy, _mm256_mul_ps(t, dy)), _mm256_set1_ps(q.qy[i]));
+        __m256 pz = _mm256_sub_ps(_mm256_add_ps(oz, _mm256_mul_ps(t, dz)), _mm256_set1_ps(q.qz[i]));
+        __m256 ux = _mm256_set1_ps(q.ux[i]), uy = _mm256_set1_ps(q.uy[i]), uz = _mm256_set1_ps(q.uz[i]);
+        __m256 vx = _mm256_set1_ps(q.vx[i]), vy = _mm256_set1_ps(q.vy[i]), vz = _mm256_set1_ps(q.vz[i]);
+        __m256 wx = _mm256_set1_ps(q.wx[i]), wy = _mm256_set1_ps(q.wy[i]), wz = _mm256_set1_ps(q.wz[i]);
+
+        __m256 a = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(wx, _mm256_sub_ps(_mm256_mul_ps(py, vz), _mm256_mul_ps(pz, vy))),
+            _mm256_mul_ps(wy, _mm256_sub_ps(_mm256_mul_ps(pz, vx), _mm256_mul_ps(px, vz)))),
+            _mm256_mul_ps(wz, _mm256_sub_ps(_mm256_mul_ps(px, vy), _mm256_mul_ps(py, vx))));
+        __m256 b = _mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(wx, _mm256_sub_ps(_mm256_mul_ps(uy, pz), _mm256_mul_ps(uz, py))),
+            _mm256_mul_ps(wy, _mm256_sub_ps(_mm256_mul_ps(uz, px), _mm256_mul_ps(ux, pz)))),
+            _mm256_mul_ps(wz, _mm256_sub_ps(_mm256_mul_ps(ux, py), _mm256_mul_ps(uy, px))));
+
+        __m256 p0 = _mm256_set1_ps(q.p0[i]), p1 = _mm256_set1_ps(q.p1[i]);
+        __m256 inside;
+        switch (q.shape[i]) {
+            case batch_shape_parallelogram:
+                inside = _mm256_and_ps(_mm256_and_ps(le(zero, a), le(zero, b)), _mm256_and_ps(le(a, one), le(b, one)));
+                break;
+            case batch_shape_triangle:
+                inside = _mm256_and_ps(_mm256_and_ps(le(zero, a), le(zero, b)), le(_mm256_add_ps(a, b), one));
+                break;
+            case batch_shape_disk: {
+                __m256 ddx = _mm256_sub_ps(a, p0), ddy = _mm256_sub_ps(b, p0);
+                inside = le(_mm256_add_ps(_mm256_mul_ps(ddx, ddx), _mm256_mul_ps(ddy, ddy)), _mm256_mul_ps(p0, p0));
+                break;
+            }
+            case batch_shape_ring: {
+                __m256 cx = _mm256_sub_ps(a, half), cy = _mm256_sub_ps(b, half);
+                __m256 r2 = _mm256_add_ps(_mm256_mul_ps(cx, cx), _mm256_mul_ps(cy, cy));
+                inside = _mm256_and_ps(le(r2, _mm256_mul_ps(_mm256_mul_ps(p1, p1), quarter)),
+                                       le(_mm256_mul_ps(_mm256_mul_ps(p0, p0), quarter), r2));
+                break;
+            }
+            case batch_shape_ellipse: {
+                __m256 ex = _mm256_div_ps(_mm256_sub_ps(a, half), half);
+                __m256 ey = _mm256_div_ps(_mm256_sub_ps(b, half), _mm256_set1_ps(0.4f));
+                inside = le(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)), one);
+                break;
+            }
+            case batch_shape_polygon: {
+                alignas(32) float as[8], bs[8], sides[8];
+                _mm256_store_ps(as, a);
+                _mm256_store_ps(bs, b);
+                _mm256_store_ps(sides, p0);
+                inside = packet_lanes8(planar_polygon_lanes(_mm256_movemask_ps(mask), as, bs, sides));
+                break;
+            }
+            default:
+                inside = zero;
+                break;
+        }
+
+        __m256 ok = _mm256_and_ps(mask, inside);
+        hi = _mm256_blendv_ps(hi, t, ok);
+        found_a = _mm256_blendv_ps(found_a, a, ok);
+        found_b = _mm256_blendv_ps(found_b, b, ok);
+        found = _mm256_blendv_ps(found, _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(i))), ok);
+        any = _mm256_or_ps(any, ok);
+    }
+
+    _mm256_storeu_ps(t_max, hi);
+    _mm256_storeu_ps(hit_a, found_a);
+    _mm256_storeu_ps(hit_b, found_b);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(best), _mm256_castps_si256(found));
+    return static_cast<uint32_t>(_mm256_movemask_ps(any));
+}
+
+__m256i tonemap_channel(__m256 c, __m256 scale, __m128i shift) {
+    c = _mm256_sqrt_ps(_mm256_max_ps(_mm256_mul_ps(c, scale), _mm256_setzero_ps())); // NaN goes to 0
+    c = _mm256_min_ps(c, _mm256_set1_ps(1.0f));
+    return _mm256_sll_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(c, _mm256_set1_ps(255.99f))), shift);
+}
+
+void tonemap(const float* rgb, size_t n, float scale, const pixel_layout& layout, uint32_t* out) {
+    const __m256 s = _mm256_set1_ps(scale);
+    const __m128i r_shift = _mm_cvtsi32_si128(static_cast<int>(layout.r_shift));
+    const __m128i g_shift = _mm_cvtsi32_si128(static_cast<int>(layout.g_shift));
+    const __m128i b_shift = _mm_cvtsi32_si128(static_cast<int>(layout.b_shift));
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(layout.alpha));
+    const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+    for (size_t i = 0; i < n; i += 8) {
+        // The last group reads from a zero-padded copy.
+        float tail[24] = {};
+        const float* p = rgb + 3 * i;
+        size_t lanes = n - i < 8 ? n - i : 8;
+        if (lanes < 8) {
+            for (size_t k = 0; k < 3 * lanes; k++) tail[k] = p[k];
+            p = tail;
+        }
+
+        __m256 r = _mm256_i32gather_ps(p, stride, 4);
+        __m256 g = _mm256_i32gather_ps(p + 1, stride, 4);
+        __m256 b = _mm256_i32gather_ps(p + 2, stride, 4);
+        __m256i pixels = _mm256_or_si256(_mm256_or_si256(alpha, tonemap_channel(r, s, r_shift)),
+                                         _mm256_or_si256(tonemap_channel(g, s, g_shift), tonemap_channel(b, s, b_shift)));
+        if (lanes == 8) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), pixels);
+        } else {
+            alignas(32) uint32_t packed[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(packed), pixels);
+            for (size_t k = 0; k < lanes; k++) out[i + k] = packed[k];
+        }
+    }
+}
+
+// Noise at the 8 points of px, py, pz
+__m256 perlin8(const perlin_tables& p, __m256 px, __m256 py, __m256 pz) {
+    const __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f), three = _mm256_set1_ps(3.0f);
+    const __m256i mask = _mm256_set1_epi32(perlin_point_count - 1);
+    const __m256i one_i = _mm256_set1_epi32(1);
+
+    __m256 fx = _mm256_floor_ps(px), fy = _mm256_floor_ps(py), fz = _mm256_floor_ps(pz);
+    __m256 u = _mm256_sub_ps(px, fx), v = _mm256_sub_ps(py, fy), w = _mm256_sub_ps(pz, fz);
+    __m256i i = _mm256_cvttps_epi32(fx), j = _mm256_cvttps_epi32(fy), k = _mm256_cvttps_epi32(fz);
+
+    // Permutation entries of both corners on each axis
+    __m256i perm_x[2] = { _mm256_i32gather_epi32(p.perm_x, _mm256_and_si256(i, mask), 4),
+                          _mm256_i32gather_epi32(p.perm_x, _mm256_and_si256(_mm256_add_epi32(i, one_i), mask), 4) };
+    __m256i perm_y[2] = { _mm256_i32gather_epi32(p.perm_y, _mm256_and_si256(j, mask), 4),
+                          _mm256_i32gather_epi32(p.perm_y, _mm256_and_si256(_mm256_add_epi32(j, one_i), mask), 4) };
+    __m256i perm_z[2] = { _mm256_i32gather_epi32(p.perm_z, _mm256_and_si256(k, mask), 4),
+                          _mm256_i32gather_epi32(p.perm_z, _mm256_and_si256(_mm256_add_epi32(k, one_i), mask), 4) };
+
+    __m256 uu = _mm256_mul_ps(_mm256_mul_ps(u, u), _mm256_sub_ps(three, _mm256_mul_ps(two, u)));
+    __m256 vv = _mm256_mul_ps(_mm256_mul_ps(v, v), _mm256_sub_ps(three, _mm256_mul_ps(two, v)));
+    __m256 ww = _mm256_mul_ps(_mm256_mul_ps(w, w), _mm256_sub_ps(three, _mm256_mul_ps(two, w)));
+    __m256 cu[2] = { _mm256_sub_ps(one, uu), uu }, cv[2] = { _mm256_sub_ps(one, vv), vv }, cw[2] = { _mm256_sub_ps(one, ww), ww };
+    __m256 du[2] = { u, _mm256_sub_ps(u, one) }, dv[2] = { v, _mm256_sub_ps(v, one) }, dw[2] = { w, _mm256_sub_ps(w, one) };
+
+    __m256 accum = _mm256_setzero_ps();
+    for (int di = 0; di < 2; di++)
+        for (int dj = 0; dj < 2; dj++)
+            for (int dk = 0; dk < 2; dk++) {
+                __m256i g = _mm256_xor_si256(_mm256_xor_si256(perm_x[di], perm_y[dj]), perm_z[dk]);
+                __m256 gx = _mm256_i32gather_ps(p.gx, g, 4);
+                __m256 gy = _mm256_i32gather_ps(p.gy, g, 4);
+                __m256 gz = _mm256_i32gather_ps(p.gz, g, 4);
+                __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(gx, du[di]), _mm256_mul_ps(gy, dv[dj])),
+                                           _mm256_mul_ps(gz, dw[dk]));
+                __m256 weight = _mm256_mul_ps(_mm256_mul_ps(cu[di], cv[dj]), cw[dk]);
+                accum = _mm256_add_ps(accum, _mm256_mul_ps(weight, dot));
+            }
+    return accum;
+}
+
+// Copies up to 8 points into padded lanes
+void load_points8(const float* x, const float* y, const float* z, size_t lanes, __m256& px, __m256& py, __m256& pz) {
+    alignas(32) float bx[8] = {}, by[8] = {}, bz[8] = {};
+    for (size_t l = 0; l < lanes; l++) {
+        bx[l] = x[l];
+        by[l] = y[l];
+        bz[l] = z[l];
+    }
+    px = _mm256_load_ps(bx);
+    py = _mm256_load_ps(by);
+    pz = _mm256_load_ps(bz);
+}
+
+void store_lanes8(__m256 values, size_t lanes, float* out) {
+    alignas(32) float result[8];
+    _mm256_store_ps(result, values);
+    for (size_t l = 0; l < lanes; l++) out[l] = result[l];
+}
+
+void perlin_noise(const perlin_tables& p, const float* x, const float* y, const float* z,
+                  size_t n, float* out) {
+    for (size_t s = 0; s < n; s += 8) {
+        size_t lanes = n - s < 8 ? n - s : 8;
+        __m256 px, py, pz;
+        load_points8(x + s, y + s, z + s, lanes, px, py, pz);
+        store_lanes8(perlin8(p, px, py, pz), lanes, out + s);
+    }
+}
+
+void perlin_turbulence(const perlin_tables& p, const float* x, const float* y, const float* z,
+                       size_t n, int depth, float* out) {
+    const __m256 half = _mm256_set1_ps(0.5f), two = _mm256_set1_ps(2.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    for (size_t s = 0; s < n; s += 8) {
+        size_t lanes = n - s < 8 ? n - s : 8;
+        __m256 px, py, pz;
+        load_points8(x + s, y + s, z + s, lanes, px, py, pz);
+        __m256 accum = _mm256_setzero_ps(), weight = _mm256_set1_ps(1.0f), scale = _mm256_set1_ps(1.0f);
+        for (int o = 0; o < depth; o++) {
+            __m256 octave = perlin8(p, _mm256_mul_ps(px, scale), _mm256_mul_ps(py, scale), _mm256_mul_ps(pz, scale));
+            accum = _mm256_add_ps(accum, _mm256_mul_ps(weight, octave));
+            weight = _mm256_mul_ps(weight, half);
+            scale = _mm256_mul_ps(scale, two);
+        }
+        store_lanes8(_mm256_andnot_ps(sign, accum), lanes, out + s);
+    }
+}
+
+// Low three bits of each lane moved to the even bits
+__m256i spread_bits(__m256i b) {
+    b = _mm256_and_si256(_mm256_or_si256(b, _mm256_slli_epi32(b, 2)), _mm256_set1_epi32(0x33));
+    return _mm256_and_si256(_mm256_or_si256(b, _mm256_slli_epi32(b, 1)), _mm256_set1_epi32(0x55));
+}
+
+void image_sample(const image_view& image, const float* u, const float* v, size_t n,
+                  float* r, float* g, float* b) {
+    // Half-float texels take a 48-bit load and a conversion this ISA level lacks
+    if (image.format != image_format_rgb8) {
+        simd_kernels_scalar.image_sample(image, u, v, n, r, g, b);
+        return;
+    }
+
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    const __m256 width = _mm256_set1_ps(static_cast<float>(image.width));
+    const __m256 height = _mm256_set1_ps(static_cast<float>(image.height));
+    const __m256i last_x = _mm256_set1_epi32(image.width - 1), last_y = _mm256_set1_epi32(image.height - 1);
+    const __m256i bpp = _mm256_set1_epi32(image.bytes_per_pixel);
+    const __m256i tiles_x = _mm256_set1_epi32(image.tiles_x);
+    const __m256i in_tile = _mm256_set1_epi32(image_tile_size - 1);
+    const __m256i byte = _mm256_set1_epi32(0xff);
+    const int* base = reinterpret_cast<const int*>(image.data);
+
+    for (size_t s = 0; s < n; s += 8) {
+        size_t lanes = n - s < 8 ? n - s : 8;
+        alignas(32) float pu[8] = {}, pv[8] = {};
+        for (size_t l = 0; l < lanes; l++) {
+            pu[l] = u[s + l];
+            pv[l] = v[s + l];
+        }
+
+        __m256 uc = _mm256_max_ps(_mm256_min_ps(_mm256_load_ps(pu), one), zero);
+        __m256 vc = _mm256_sub_ps(one, _mm256_max_ps(_mm256_min_ps(_mm256_load_ps(pv), one), zero));
+        __m256i i = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(uc, width)), last_x);
+        __m256i j = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(vc, height)), last_y);
+
+        // Tile, then the Morton index within it
+        __m256i tile = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(j, image_tile_shift), tiles_x),
+                                        _mm256_srli_epi32(i, image_tile_shift));
+        __m256i index = _mm256_or_si256(_mm256_slli_epi32(tile, 2 * image_tile_shift),
+                                        _mm256_or_si256(_mm256_slli_epi32(spread_bits(_mm256_and_si256(j, in_tile)), 1),
+                                                        spread_bits(_mm256_and_si256(i, in_tile))));
+
+        // One 32-bit load per texel; the image keeps a byte of padding for the last one.
+        __m256i texel = _mm256_i32gather_epi32(base, _mm256_mullo_epi32(index, bpp), 1);
+
+        // Each byte looks up its linear value
+        alignas(32) float cr[8], cg[8], cb[8];
+        _mm256_store_ps(cr, _mm256_i32gather_ps(image.decode, _mm256_and_si256(texel, byte), 4));
+        _mm256_store_ps(cg, _mm256_i32gather_ps(image.decode, _mm256_and_si256(_mm256_srli_epi32(texel, 8), byte), 4));
+        _mm256_store_ps(cb, _mm256_i32gather_ps(image.decode, _mm256_and_si256(_mm256_srli_epi32(texel, 16), byte), 4));
+        for (size_t l = 0; l < lanes; l++) {
+            r[s + l] = cr[l];
+            g[s + l] = cg[l];
+            b[s + l] = cb[l];
+        }
+    }
+}
+
+constexpr simd_kernels avx2_kernels = {
+    box_hit8,
+    box_hit_packet8,
+    sphere_hit,
+    planar_hit,
+    quadric_hit,
+    sphere_packet_hit,
+    planar_packet_hit,
+    tonemap,
+    perlin_noise,
+    perlin_turbulence,
+    image_sample,
+};
+
+} // namespace
+
+const simd_kernels simd_kernels_avx2 = avx2_kernels;
+
+#else
+
+const simd_kernels simd_kernels_avx2 = {};
+
+#endif
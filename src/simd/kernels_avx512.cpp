@@ -0,0 +1,380 @@
+#include "simd.h"
+
+// 16-wide kernels for the loops over independent samples. BVH nodes and leaves hold at most 8
+// entries, so the single-ray box and primitive tests keep the AVX2 versions; the packet
+// primitive tests put the 8 rays in each half and test two primitives at once. Run tails use
+// masked loads and stores instead of padded copies.
+
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+
+namespace {
+
+__mmask16 tail_mask(size_t lanes) {
+    return lanes >= 16 ? static_cast<__mmask16>(0xffff) : static_cast<__mmask16>((1u << lanes) - 1);
+}
+
+// The 8 lanes of v in both halves
+__m512 both_halves(__m256 v) {
+    __m512 w = _mm512_castps256_ps512(v);
+    return _mm512_shuffle_f32x4(w, w, 0x44);
+}
+
+// The high half moved to the low one
+__m512 high_half(__m512 v) {
+    return _mm512_shuffle_f32x4(v, v, 0x4e);
+}
+
+// x in the low half, y in the high half
+__m512 halves(float x, float y) {
+    return _mm512_mask_blend_ps(0xff00, _mm512_set1_ps(x), _mm512_set1_ps(y));
+}
+
+__m512i halves(int32_t x, int32_t y) {
+    return _mm512_mask_blend_epi32(0xff00, _mm512_set1_epi32(x), _mm512_set1_epi32(y));
+}
+
+// Primitives i and i + 1 against the 8 rays, one in each half. Both are tested against the
+// distances found before them; the second one's hits then only count where they are nearer
+// than the first one's, which is what testing them one after the other gives. Results live
+// in the low half and are copied to both before each pair.
+
+uint32_t sphere_packet_hit(const sphere_batch<float>& s, uint32_t begin, uint32_t count,
+                           const batch_packet<float, 8>& r, uint32_t lanes, float t_min, float t_max[8],
+                           int32_t best[8]) {
+    const __m512 lo = _mm512_set1_ps(t_min);
+    const __m512 zero = _mm512_setzero_ps();
+    const __mmask16 active = static_cast<__mmask16>((lanes & 0xff) * 0x101);
+    const __m512 ox = both_halves(_mm256_load_ps(r.ox)), oy = both_halves(_mm256_load_ps(r.oy)), oz = both_halves(_mm256_load_ps(r.oz));
+    const __m512 dx = both_halves(_mm256_load_ps(r.dx)), dy = both_halves(_mm256_load_ps(r.dy)), dz = both_halves(_mm256_load_ps(r.dz));
+    const __m512 time = both_halves(_mm256_load_ps(r.time));
+    const __m512 a = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), _mm512_mul_ps(dz, dz));
+    __m512 hi = both_halves(_mm256_loadu_ps(t_max));
+    __m512i found = _mm512_castsi256_si512(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(best)));
+    __mmask16 any = 0;
+
+    const uint32_t end = begin + count;
+    for (uint32_t i = begin; i < end; i += 2) {
+        uint32_t j = i + 1 < end ? i + 1 : i;
+        __mmask16 pair = i + 1 < end ? active : static_cast<__mmask16>(active & 0xff);
+        __m512 ocx = _mm512_sub_ps(_mm512_add_ps(halves(s.cx[i], s.cx[j]), _mm512_mul_ps(time, halves(s.vx[i], s.vx[j]))), ox);
+        __m512 ocy = _mm512_sub_ps(_mm512_add_ps(halves(s.cy[i], s.cy[j]), _mm512_mul_ps(time, halves(s.vy[i], s.vy[j]))), oy);
+        __m512 ocz = _mm512_sub_ps(_mm512_add_ps(halves(s.cz[i], s.cz[j]), _mm512_mul_ps(time, halves(s.vz[i], s.vz[j]))), oz);
+        __m512 radius = halves(s.radius[i], s.radius[j]);
+
+        __m512 h = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, ocx), _mm512_mul_ps(dy, ocy)), _mm512_mul_ps(dz, ocz));
+        __m512 c = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)), _mm512_mul_ps(ocz, ocz)),
+                                 _mm512_mul_ps(radius, radius));
+        __m512 discriminant = _mm512_sub_ps(_mm512_mul_ps(h, h), _mm512_mul_ps(a, c));
+        __mmask16 valid = _mm512_mask_cmp_ps_mask(pair, discriminant, zero, _CMP_GE_OQ);
+        if (valid == 0) continue;
+
+        __m512 sqrtd = _mm512_sqrt_ps(_mm512_max_ps(discriminant, zero));
+        __m512 near_root = _mm512_div_ps(_mm512_sub_ps(h, sqrtd), a);
+        __m512 far_root = _mm512_div_ps(_mm512_add_ps(h, sqrtd), a);
+        __mmask16 near_ok = _mm512_cmp_ps_mask(lo, near_root, _CMP_LT_OQ) & _mm512_cmp_ps_mask(near_root, hi, _CMP_LT_OQ);
+        __mmask16 far_ok = _mm512_cmp_ps_mask(lo, far_root, _CMP_LT_OQ) & _mm512_cmp_ps_mask(far_root, hi, _CMP_LT_OQ);
+        __mmask16 ok = valid & (near_ok | far_ok);
+        __m512 root = _mm512_mask_blend_ps(near_ok, far_root, near_root);
+
+        __mmask16 first = ok & 0xff;
+        hi = _mm512_mask_mov_ps(hi, first, root);
+        found = _mm512_mask_mov_epi32(found, first, _mm512_set1_epi32(static_cast<int>(i)));
+        __m512 second = high_half(root);
+        __mmask16 later = _mm512_mask_cmp_ps_mask(static_cast<__mmask16>(ok >> 8), second, hi, _CMP_LT_OQ);
+        hi = _mm512_mask_mov_ps(hi, later, second);
+        found = _mm512_mask_mov_epi32(found, later, _mm512_set1_epi32(static_cast<int>(j)));
+        any |= first | later;
+        hi = both_halves(_mm512_castps512_ps256(hi));
+    }
+
+    _mm256_storeu_ps(t_max, _mm512_castps512_ps256(hi));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(best), _mm512_castsi512_si256(found));
+    return any;
+}
+
+uint32_t planar_packet_hit(const planar_batch<float>& q, uint32_t begin, uint32_t count,
+                           const batch_packet<float, 8>& r, uint32_t lanes, float t_min, float t_max[8],
+                           int32_t best[8], float hit_a[8], float hit_b[8]) {
+    const __m512 lo = _mm512_set1_ps(t_min);
+    const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f);
+    const __m512 half = _mm512_set1_ps(0.5f), quarter = _mm512_set1_ps(0.25f);
+    const __mmask16 active = static_cast<__mmask16>((lanes & 0xff) * 0x101);
+    const __m512 ox = both_halves(_mm256_load_ps(r.ox)), oy = both_halves(_mm256_load_ps(r.oy)), oz = both_halves(_mm256_load_ps(r.oz));
+    const __m512 dx = both_halves(_mm256_load_ps(r.dx)), dy = both_halves(_mm256_load_ps(r.dy)), dz = both_halves(_mm256_load_ps(r.dz));
+    __m512 hi = both_halves(_mm256_loadu_ps(t_max));
+    __m512 found_a = _mm512_castps256_ps512(_mm256_loadu_ps(hit_a)), found_b = _mm512_castps256_ps512(_mm256_loadu_ps(hit_b));
+    __m512i found = _mm512_castsi256_si512(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(best)));
+    __mmask16 any = 0;
+    auto le = [](__m512 x, __m512 y) { return _mm512_cmp_ps_mask(x, y, _CMP_LE_OQ); };
+
+    const uint32_t end = begin + count;
+    for (uint32_t i = begin; i < end; i += 2) {
+        uint32_t j = i + 1 < end ? i + 1 : i;
+        __mmask16 pair = i + 1 < end ? active : static_cast<__mmask16>(active & 0xff);
+        __m512 nx = halves(q.nx[i], q.nx[j]), ny = halves(q.ny[i], q.ny[j]), nz = halves(q.nz[i], q.nz[j]);
+        __m512 denom = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(nx, dx), _mm512_mul_ps(ny, dy)), _mm512_mul_ps(nz, dz));
+        __m512 n_dot_o = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(nx, ox), _mm512_mul_ps(ny, oy)), _mm512_mul_ps(nz, oz));
+        __m512 t = _mm512_div_ps(_mm512_sub_ps(halves(q.d[i], q.d[j]), n_dot_o), denom);
+
+        __mmask16 mask = _mm512_mask_cmp_ps_mask(pair, _mm512_abs_ps(denom), _mm512_set1_ps(1e-8f), _CMP_GE_OQ);
+        mask &= le(lo, t) & le(t, hi);
+        if (mask == 0) continue;
+
+        __m512 px = _mm512_sub_ps(_mm512_add_ps(ox, _mm512_mul_ps(t, dx)), halves(q.qx[i], q.qx[j]));
+        __m512 py = _mm512_sub_ps(_mm512_add_ps(oy, _mm512_mul_ps(t, dy)), halves(q.qy[i], q.qy[j]));
+        __m512 pz = _mm512_sub_ps(_mm512_add_ps(oz, _mm512_mul_ps(t, dz)), halves(q.qz[i], q.qz[j]));
+        __m512 ux = halves(q.ux[i], q.ux[j]), uy = halves(q.uy[i], q.uy[j]), uz = halves(q.uz[i], q.uz[j]);
+        __m512 vx = halves(q.vx[i], q.vx[j]), vy = halves(q.vy[i], q.vy[j]), vz = halves(q.vz[i], q.vz[j]);
+        __m512 wx = halves(q.wx[i], q.wx[j]), wy = halves(q.wy[i], q.wy[j]), wz = halves(q.wz[i], q.wz[j]);
+
+        __m512 a = _mm512_add_ps(_mm512_add_ps(
+            _mm512_mul_ps(wx, _mm512_sub_ps(_mm512_mul_ps(py, vz), _mm512_mul_ps(pz, vy))),
+            _mm512_mul_ps(wy, _mm512_sub_ps(_mm512_mul_ps(pz, vx), _mm512_mul_ps(px, vz)))),
+            _mm512_mul_ps(wz, _mm512_sub_ps(_mm512_mul_ps(px, vy), _mm512_mul_ps(py, vx))));
+        __m512 b = _mm512_add_ps(_mm512_add_ps(
+            _mm512_mul_ps(wx, _mm512_sub_ps(_mm512_mul_ps(uy, pz), _mm512_mul_ps(uz, py))),
+            _mm512_mul_ps(wy, _mm512_sub_ps(_mm512_mul_ps(uz, px), _mm512_mul_ps(ux, pz)))),
+            _mm512_mul_ps(wz, _mm512_sub_ps(_mm512_mul_ps(ux, py), _mm512_mul_ps(uy, px))));
+
+        // The halves may hold different shapes: evaluate each shape present and keep the one
+        // each half asks for.
+        __m512i shape = halves(q.shape[i], q.shape[j]);
+        __m512 p0 = halves(q.p0[i], q.p0[j]), p1 = halves(q.p1[i], q.p1[j]);
+        const int32_t codes[2] = { q.shape[i], q.shape[j] };
+        __mmask16 inside = 0;
+        for (int h = 0; h < (codes[0] == codes[1] ? 1 : 2); h++) {
+            const int32_t code = codes[h];
+            __mmask16 lanes_of = _mm512_cmpeq_epi32_mask(shape, _mm512_set1_epi32(code)) & mask;
+            if (lanes_of == 0) continue;
+            __mmask16 in;
+            switch (code) {
+                case batch_shape_parallelogram:
+                    in = le(zero, a) & le(zero, b) & le(a, one) & le(b, one);
+                    break;
+                case batch_shape_triangle:
+                    in = le(zero, a) & le(zero, b) & le(_mm512_add_ps(a, b), one);
+                    break;
+                case batch_shape_disk: {
+                    __m512 ddx = _mm512_sub_ps(a, p0), ddy = _mm512_sub_ps(b, p0);
+                    in = le(_mm512_add_ps(_mm512_mul_ps(ddx, ddx), _mm512_mul_ps(ddy, ddy)), _mm512_mul_ps(p0, p0));
+                    break;
+                }
+                case batch_shape_ring: {
+                    __m512 cx = _mm512_sub_ps(a, half), cy = _mm512_sub_ps(b, half);
+                    __m512 r2 = _mm512_add_ps(_mm512_mul_ps(cx, cx), _mm512_mul_ps(cy, cy));
+                    in = le(r2, _mm512_mul_ps(_mm512_mul_ps(p1, p1), quarter)) &
+                         le(_mm512_mul_ps(_mm512_mul_ps(p0, p0), quarter), r2);
+                    break;
+                }
+                case batch_shape_ellipse: {
+                    __m512 ex = _mm512_div_ps(_mm512_sub_ps(a, half), half);
+                    __m512 ey = _mm512_div_ps(_mm512_sub_ps(b, half), _mm512_set1_ps(0.4f));
+                    in = le(_mm512_add_ps(_mm512_mul_ps(ex, ex), _mm512_mul_ps(ey, ey)), one);
+                    break;
+                }
+                case batch_shape_polygon: {
+                    alignas(64) float as[16], bs[16], sides[16];
+                    _mm512_store_ps(as, a);
+                    _mm512_store_ps(bs, b);
+                    _mm512_store_ps(sides, p0);
+                    in = static_cast<__mmask16>(planar_polygon_lanes(lanes_of, as, bs, sides));
+                    break;
+                }
+                default:
+                    in = 0;
+                    break;
+            }
+            inside |= lanes_of & in;
+        }
+
+        __mmask16 ok = mask & inside;
+        __mmask16 first = ok & 0xff;
+        hi = _mm512_mask_mov_ps(hi, first, t);
+        found_a = _mm512_mask_mov_ps(found_a, first, a);
+        found_b = _mm512_mask_mov_ps(found_b, first, b);
+        found = _mm512_mask_mov_epi32(found, first, _mm512_set1_epi32(static_cast<int>(i)));
+        __m512 second = high_half(t);
+        __mmask16 later = _mm512_mask_cmp_ps_mask(static_cast<__mmask16>(ok >> 8), second, hi, _CMP_LE_OQ);
+        hi = _mm512_mask_mov_ps(hi, later, second);
+        found_a = _mm512_mask_mov_ps(found_a, later, high_half(a));
+        found_b = _mm512_mask_mov_ps(found_b, later, high_half(b));
+        found = _mm512_mask_mov_epi32(found, later, _mm512_set1_epi32(static_cast<int>(j)));
+        any |= first | later;
+        hi = both_halves(_mm512_castps512_ps256(hi));
+    }
+
+    _mm256_storeu_ps(t_max, _mm512_castps512_ps256(hi));
+    _mm256_storeu_ps(hit_a, _mm512_castps512_ps256(found_a));
+    _mm256_storeu_ps(hit_b, _mm512_castps512_ps256(found_b));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(best), _mm512_castsi512_si256(found));
+    return any;
+}
+
+__m512i tonemap_channel(__m512 c, __m512 scale, __m128i shift) {
+    c = _mm512_sqrt_ps(_mm512_max_ps(_mm512_mul_ps(c, scale), _mm512_setzero_ps())); // NaN goes to 0
+    c = _mm512_min_ps(c, _mm512_set1_ps(1.0f));
+    return _mm512_sll_epi32(_mm512_cvttps_epi32(_mm512_mul_ps(c, _mm512_set1_ps(255.99f))), shift);
+}
+
+void tonemap(const float* rgb, size_t n, float scale, const pixel_layout& layout, uint32_t* out) {
+    const __m512 s = _mm512_set1_ps(scale);
+    const __m128i r_shift = _mm_cvtsi32_si128(static_cast<int>(layout.r_shift));
+    const __m128i g_shift = _mm_cvtsi32_si128(static_cast<int>(layout.g_shift));
+    const __m128i b_shift = _mm_cvtsi32_si128(static_cast<int>(layout.b_shift));
+    const __m512i alpha = _mm512_set1_epi32(static_cast<int>(layout.alpha));
+    const __m512i stride = _mm512_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 33, 36, 39, 42, 45);
+
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 k = tail_mask(n - i);
+        const float* p = rgb + 3 * i;
+        __m512 r = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), k, stride, p, 4);
+        __m512 g = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), k, stride, p + 1, 4);
+        __m512 b = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), k, stride, p + 2, 4);
+        __m512i pixels = _mm512_or_si512(_mm512_or_si512(alpha, tonemap_channel(r, s, r_shift)),
+                                         _mm512_or_si512(tonemap_channel(g, s, g_shift), tonemap_channel(b, s, b_shift)));
+        _mm512_mask_storeu_epi32(out + i, k, pixels);
+    }
+}
+
+// Noise at the 16 points of px, py, pz
+__m512 perlin16(const perlin_tables& p, __m512 px, __m512 py, __m512 pz) {
+    const __m512 one = _mm512_set1_ps(1.0f), two = _mm512_set1_ps(2.0f), three = _mm512_set1_ps(3.0f);
+    const __m512i mask = _mm512_set1_epi32(perlin_point_count - 1);
+    const __m512i one_i = _mm512_set1_epi32(1);
+
+    __m512 fx = _mm512_roundscale_ps(px, _MM_FROUND_FLOOR);
+    __m512 fy = _mm512_roundscale_ps(py, _MM_FROUND_FLOOR);
+    __m512 fz = _mm512_roundscale_ps(pz, _MM_FROUND_FLOOR);
+    __m512 u = _mm512_sub_ps(px, fx), v = _mm512_sub_ps(py, fy), w = _mm512_sub_ps(pz, fz);
+    __m512i i = _mm512_cvttps_epi32(fx), j = _mm512_cvttps_epi32(fy), k = _mm512_cvttps_epi32(fz);
+
+    // Permutation entries of both corners on each axis
+    __m512i perm_x[2] = { _mm512_i32gather_epi32(_mm512_and_si512(i, mask), p.perm_x, 4),
+                          _mm512_i32gather_epi32(_mm512_and_si512(_mm512_add_epi32(i, one_i), mask), p.perm_x, 4) };
+    __m512i perm_y[2] = { _mm512_i32gather_epi32(_mm512_and_si512(j, mask), p.perm_y, 4),
+                          _mm512_i32gather_epi32(_mm512_and_si512(_mm512_add_epi32(j, one_i), mask), p.perm_y, 4) };
+    __m512i perm_z[2] = { _mm512_i32gather_epi32(_mm512_and_si512(k, mask), p.perm_z, 4),
+                          _mm512_i32gather_epi32(_mm512_and_si512(_mm512_add_epi32(k, one_i), mask), p.perm_z, 4) };
+
+    __m512 uu = _mm512_mul_ps(_mm512_mul_ps(u, u), _mm512_sub_ps(three, _mm512_mul_ps(two, u)));
+    __m512 vv = _mm512_mul_ps(_mm512_mul_ps(v, v), _mm512_sub_ps(three, _mm512_mul_ps(two, v)));
+    __m512 ww = _mm512_mul_ps(_mm512_mul_ps(w, w), _mm512_sub_ps(three, _mm512_mul_ps(two, w)));
+    __m512 cu[2] = { _mm512_sub_ps(one, uu), uu }, cv[2] = { _mm512_sub_ps(one, vv), vv }, cw[2] = { _mm512_sub_ps(one, ww), ww };
+    __m512 du[2] = { u, _mm512_sub_ps(u, one) }, dv[2] = { v, _mm512_sub_ps(v, one) }, dw[2] = { w, _mm512_sub_ps(w, one) };
+
+    __m512 accum = _mm512_setzero_ps();
+    for (int di = 0; di < 2; di++)
+        for (int dj = 0; dj < 2; dj++)
+            for (int dk = 0; dk < 2; dk++) {
+                __m512i g = _mm512_xor_si512(_mm512_xor_si512(perm_x[di], perm_y[dj]), perm_z[dk]);
+                __m512 gx = _mm512_i32gather_ps(g, p.gx, 4);
+                __m512 gy = _mm512_i32gather_ps(g, p.gy, 4);
+                __m512 gz = _mm512_i32gather_ps(g, p.gz, 4);
+                __m512 dot = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(gx, du[di]), _mm512_mul_ps(gy, dv[dj])),
+                                           _mm512_mul_ps(gz, dw[dk]));
+                __m512 weight = _mm512_mul_ps(_mm512_mul_ps(cu[di], cv[dj]), cw[dk]);
+                accum = _mm512_add_ps(accum, _mm512_mul_ps(weight, dot));
+            }
+    return accum;
+}
+
+void perlin_noise(const perlin_tables& p, const float* x, const float* y, const float* z,
+                  size_t n, float* out) {
+    for (size_t s = 0; s < n; s += 16) {
+        __mmask16 k16 = tail_mask(n - s);
+        __m512 px = _mm512_maskz_loadu_ps(k16, x + s), py = _mm512_maskz_loadu_ps(k16, y + s), pz = _mm512_maskz_loadu_ps(k16, z + s);
+        _mm512_mask_storeu_ps(out + s, k16, perlin16(p, px, py, pz));
+    }
+}
+
+void perlin_turbulence(const perlin_tables& p, const float* x, const float* y, const float* z,
+                       size_t n, int depth, float* out) {
+    const __m512 half = _mm512_set1_ps(0.5f), two = _mm512_set1_ps(2.0f);
+    for (size_t s = 0; s < n; s += 16) {
+        __mmask16 k16 = tail_mask(n - s);
+        __m512 px = _mm512_maskz_loadu_ps(k16, x + s), py = _mm512_maskz_loadu_ps(k16, y + s), pz = _mm512_maskz_loadu_ps(k16, z + s);
+        __m512 accum = _mm512_setzero_ps(), weight = _mm512_set1_ps(1.0f), scale = _mm512_set1_ps(1.0f);
+        for (int o = 0; o < depth; o++) {
+            __m512 octave = perlin16(p, _mm512_mul_ps(px, scale), _mm512_mul_ps(py, scale), _mm512_mul_ps(pz, scale));
+            accum = _mm512_add_ps(accum, _mm512_mul_ps(weight, octave));
+            weight = _mm512_mul_ps(weight, half);
+            scale = _mm512_mul_ps(scale, two);
+        }
+        _mm512_mask_storeu_ps(out + s, k16, _mm512_abs_ps(accum));
+    }
+}
+
+// Low three bits of each lane moved to the even bits
+__m512i spread_bits(__m512i b) {
+    b = _mm512_and_si512(_mm512_or_si512(b, _mm512_slli_epi32(b, 2)), _mm512_set1_epi32(0x33));
+    return _mm512_and_si512(_mm512_or_si512(b, _mm512_slli_epi32(b, 1)), _mm512_set1_epi32(0x55));
+}
+
+void image_sample(const image_view& image, const float* u, const float* v, size_t n,
+                  float* r, float* g, float* b) {
+    // Half-float texels take a 48-bit load; they are rare enough to leave to the scalar kernel
+    if (image.format != image_format_rgb8) {
+        simd_kernels_scalar.image_sample(image, u, v, n, r, g, b);
+        return;
+    }
+
+    const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f);
+    const __m512 width = _mm512_set1_ps(static_cast<float>(image.width));
+    const __m512 height = _mm512_set1_ps(static_cast<float>(image.height));
+    const __m512i last_x = _mm512_set1_epi32(image.width - 1), last_y = _mm512_set1_epi32(image.height - 1);
+    const __m512i bpp = _mm512_set1_epi32(image.bytes_per_pixel);
+    const __m512i tiles_x = _mm512_set1_epi32(image.tiles_x);
+    const __m512i in_tile = _mm512_set1_epi32(image_tile_size - 1);
+    const __m512i byte = _mm512_set1_epi32(0xff);
+
+    for (size_t s = 0; s < n; s += 16) {
+        __mmask16 k = tail_mask(n - s);
+        __m512 uc = _mm512_max_ps(_mm512_min_ps(_mm512_maskz_loadu_ps(k, u + s), one), zero);
+        __m512 vc = _mm512_sub_ps(one, _mm512_max_ps(_mm512_min_ps(_mm512_maskz_loadu_ps(k, v + s), one), zero));
+        __m512i i = _mm512_min_epi32(_mm512_cvttps_epi32(_mm512_mul_ps(uc, width)), last_x);
+        __m512i j = _mm512_min_epi32(_mm512_cvttps_epi32(_mm512_mul_ps(vc, height)), last_y);
+
+        // Tile, then the Morton index within it
+        __m512i tile = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_srli_epi32(j, image_tile_shift), tiles_x),
+                                        _mm512_srli_epi32(i, image_tile_shift));
+        __m512i index = _mm512_or_si512(_mm512_slli_epi32(tile, 2 * image_tile_shift),
+                                        _mm512_or_si512(_mm512_slli_epi32(spread_bits(_mm512_and_si512(j, in_tile)), 1),
+                                                        spread_bits(_mm512_and_si512(i, in_tile))));
+
+        // One 32-bit load per texel; the image keeps a byte of padding for the last one.
+        __m512i offset = _mm512_mullo_epi32(index, bpp);
+        __m512i texel = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), k, offset, image.data, 1);
+
+        // Each byte looks up its linear value
+        const __m512 none = _mm512_setzero_ps();
+        _mm512_mask_storeu_ps(r + s, k, _mm512_mask_i32gather_ps(none, k, _mm512_and_si512(texel, byte), image.decode, 4));
+        _mm512_mask_storeu_ps(g + s, k, _mm512_mask_i32gather_ps(none, k, _mm512_and_si512(_mm512_srli_epi32(texel, 8), byte), image.decode, 4));
+        _mm512_mask_storeu_ps(b + s, k, _mm512_mask_i32gather_ps(none, k, _mm512_and_si512(_mm512_srli_epi32(texel, 16), byte), image.decode, 4));
+    }
+}
+
+constexpr simd_kernels avx512_kernels = {
+    nullptr, // box_hit8
+    nullptr, // box_hit_packet8: pairing two children per vector measured slower than AVX2
+    nullptr, // sphere_hit
+    nullptr, // planar_hit
+    nullptr, // quadric_hit
+    sphere_packet_hit,
+    planar_packet_hit,
+    tonemap,
+    perlin_noise,
+    perlin_turbulence,
+    image_sample,
+};
+
+} // namespace
+
+const simd_kernels simd_kernels_avx512 = avx512_kernels;
+
+#else
+
+const simd_kernels simd_kernels_avx512 = {};
+
+#endif
@@ -0,0 +1,232 @@
+#include "simd.h"
+#include "../batch_kernels.h"
+#include <cmath>
+#include <cstring>
+
+// Reference kernels, built for the baseline ISA. Every other table falls back to these for
+// the entries it leaves null, so this one must be complete.
+
+namespace {
+
+unsigned box_hit8(const wide_bvh_node<8>& node, const float org[3], const float inv_dir[3],
+                  const bool neg[3], float t_min, float t_max, float t_entry[8]) {
+    const float* lo[3] = { neg[0] ? node.bmax_x : node.bmin_x,
+                           neg[1] ? node.bmax_y : node.bmin_y,
+                           neg[2] ? node.bmax_z : node.bmin_z };
+    const float* hi[3] = { neg[0] ? node.bmin_x : node.bmax_x,
+                           neg[1] ? node.bmin_y : node.bmax_y,
+                           neg[2] ? node.bmin_z : node.bmax_z };
+
+    unsigned mask = 0;
+    for (int k = 0; k < 8; k++) {
+        float tn = t_min, tf = t_max;
+        for (int a = 0; a < 3; a++) {
+            float t0 = (lo[a][k] - org[a]) * inv_dir[a];
+            float t1 = (hi[a][k] - org[a]) * inv_dir[a];
+            tn = t0 > tn ? t0 : tn;
+            tf = t1 < tf ? t1 : tf;
+        }
+        t_entry[k] = tn;
+        if (tn <= tf) mask |= 1u << k;
+    }
+    return mask;
+}
+
+void box_hit_packet8(const wide_bvh_node<8>& node, unsigned children, const wide_bvh_packet_lanes<8>& lanes,
+                     const bool neg[3], float t_min, const float t_max[8], uint32_t hits[8], float t_entry[8]) {
+    const float* lo[3] = { neg[0] ? node.bmax_x : node.bmin_x,
+                           neg[1] ? node.bmax_y : node.bmin_y,
+                           neg[2] ? node.bmax_z : node.bmin_z };
+    const float* hi[3] = { neg[0] ? node.bmin_x : node.bmax_x,
+                           neg[1] ? node.bmin_y : node.bmax_y,
+                           neg[2] ? node.bmin_z : node.bmax_z };
+
+    for (int k = 0; k < 8; k++) {
+        hits[k] = 0;
+        t_entry[k] = INFINITY;
+        if (!(children & (1u << k))) continue;
+        for (int l = 0; l < 8; l++) {
+            float tn = t_min, tf = t_max[l];
+            for (int a = 0; a < 3; a++) {
+                float t0 = (lo[a][k] - lanes.org[a][l]) * lanes.inv_dir[a][l];
+                float t1 = (hi[a][k] - lanes.org[a][l]) * lanes.inv_dir[a][l];
+                tn = t0 > tn ? t0 : tn;
+                tf = t1 < tf ? t1 : tf;
+            }
+            if (tn <= tf) {
+                hits[k] |= 1u << l;
+                t_entry[k] = tn < t_entry[k] ? tn : t_entry[k];
+            }
+        }
+    }
+}
+
+int sphere_hit(const sphere_batch<float>& s, uint32_t begin, uint32_t count,
+               const batch_ray<float>& r, float t_min, float& t_max) {
+    return sphere_batch_hit_scalar(s, begin, count, r, t_min, t_max);
+}
+
+int planar_hit(const planar_batch<float>& q, uint32_t begin, uint32_t count,
+               const batch_ray<float>& r, float t_min, float& t_max, float& hit_a, float& hit_b) {
+    return planar_batch_hit_scalar(q, begin, count, r, t_min, t_max, hit_a, hit_b);
+}
+
+int quadric_hit(const quadric_batch<float>& q, uint32_t begin, uint32_t count,
+                const batch_ray<float>& r, float t_min, float& t_max, int32_t& part) {
+    return quadric_batch_hit_scalar(q, begin, count, r, t_min, t_max, part);
+}
+
+uint32_t sphere_packet_hit(const sphere_batch<float>& s, uint32_t begin, uint32_t count,
+                           const batch_packet<float, 8>& r, uint32_t lanes, float t_min, float t_max[8],
+                           int32_t best[8]) {
+    return sphere_packet_hit_scalar(s, begin, count, r, lanes, t_min, t_max, best);
+}
+
+uint32_t planar_packet_hit(const planar_batch<float>& q, uint32_t begin, uint32_t count,
+                           const batch_packet<float, 8>& r, uint32_t lanes, float t_min, float t_max[8],
+                           int32_t best[8], float hit_a[8], float hit_b[8]) {
+    return planar_packet_hit_scalar(q, begin, count, r, lanes, t_min, t_max, best, hit_a, hit_b);
+}
+
+// The comparisons are written the way the vector min/max instructions behave, so NaNs end up
+// where they do in the SIMD versions.
+void tonemap(const float* rgb, size_t n, float scale, const pixel_layout& layout, uint32_t* out) {
+    const uint32_t shift[3] = { layout.r_shift, layout.g_shift, layout.b_shift };
+    for (size_t i = 0; i < n; i++) {
+        uint32_t pixel = layout.alpha;
+        for (int c = 0; c < 3; c++) {
+            float v = rgb[3 * i + c] * scale;
+            v = std::sqrt(v > 0.0f ? v : 0.0f);
+            v = v < 1.0f ? v : 1.0f;
+            pixel |= static_cast<uint32_t>(static_cast<int32_t>(v * 255.99f)) << shift[c];
+        }
+        out[i] = pixel;
+    }
+}
+
+float perlin_point(const perlin_tables& p, float x, float y, float z) {
+    const int32_t mask = perlin_point_count - 1;
+    float fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+    float u = x - fx, v = y - fy, w = z - fz;
+    int32_t i = static_cast<int32_t>(fx), j = static_cast<int32_t>(fy), k = static_cast<int32_t>(fz);
+
+    // Hermite smoothing of the fractions
+    float uu = u * u * (3.0f - 2.0f * u);
+    float vv = v * v * (3.0f - 2.0f * v);
+    float ww = w * w * (3.0f - 2.0f * w);
+
+    float accum = 0.0f;
+    for (int di = 0; di < 2; di++)
+        for (int dj = 0; dj < 2; dj++)
+            for (int dk = 0; dk < 2; dk++) {
+                int32_t g = p.perm_x[(i + di) & mask] ^ p.perm_y[(j + dj) & mask] ^ p.perm_z[(k + dk) & mask];
+                float dot = p.gx[g] * (u - di) + p.gy[g] * (v - dj) + p.gz[g] * (w - dk);
+                float weight = (di ? uu : 1.0f - uu) * (dj ? vv : 1.0f - vv) * (dk ? ww : 1.0f - ww);
+                accum += weight * dot;
+            }
+    return accum;
+}
+
+void perlin_noise(const perlin_tables& p, const float* x, const float* y, const float* z,
+                  size_t n, float* out) {
+    for (size_t s = 0; s < n; s++) out[s] = perlin_point(p, x[s], y[s], z[s]);
+}
+
+void perlin_turbulence(const perlin_tables& p, const float* x, const float* y, const float* z,
+                       size_t n, int depth, float* out) {
+    for (size_t s = 0; s < n; s++) {
+        float accum = 0.0f, weight = 1.0f, scale = 1.0f;
+        for (int o = 0; o < depth; o++) {
+            accum += weight * perlin_point(p, x[s] * scale, y[s] * scale, z[s] * scale);
+            weight *= 0.5f;
+            scale *= 2.0f;
+        }
+        out[s] = std::fabs(accum);
+    }
+}
+
+// Low three bits of b moved to the even bits
+int32_t spread_bits(int32_t b) {
+    b = (b | (b << 2)) & 0x33;
+    return (b | (b << 1)) & 0x55;
+}
+
+float half_to_float(uint16_t h) {
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    int32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    if (exponent == 0) {
+        // Zero or subnormal: mantissa * 2^-24
+        float value = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -value : value;
+    }
+    uint32_t bits = exponent == 0x1f ? sign | 0x7f800000 | (mantissa << 13)
+                                     : sign | uint32_t(exponent + 112) << 23 | (mantissa << 13);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void image_sample(const image_view& image, const float* u, const float* v, size_t n,
+                  float* r, float* g, float* b) {
+    const float width = static_cast<float>(image.width), height = static_cast<float>(image.height);
+    for (size_t s = 0; s < n; s++) {
+        float uc = u[s] < 1.0f ? u[s] : 1.0f;
+        float vc = v[s] < 1.0f ? v[s] : 1.0f;
+        uc = uc > 0.0f ? uc : 0.0f;
+        vc = 1.0f - (vc > 0.0f ? vc : 0.0f);
+
+        int32_t i = static_cast<int32_t>(uc * width), j = static_cast<int32_t>(vc * height);
+        i = i < image.width - 1 ? i : image.width - 1;
+        j = j < image.height - 1 ? j : image.height - 1;
+
+        const uint8_t* texel = image.data + image_texel_index(i, j, image.tiles_x) * image.bytes_per_pixel;
+        if (image.format == image_format_rgb8) {
+            r[s] = image.decode[texel[0]];
+            g[s] = image.decode[texel[1]];
+            b[s] = image.decode[texel[2]];
+        } else {
+            uint16_t h[3];
+            std::memcpy(h, texel, sizeof(h));
+            r[s] = half_to_float(h[0]);
+            g[s] = half_to_float(h[1]);
+            b[s] = half_to_float(h[2]);
+        }
+    }
+}
+
+constexpr simd_kernels scalar_kernels = {
+    box_hit8,
+    box_hit_packet8,
+    sphere_hit,
+    planar_hit,
+    quadric_hit,
+    sphere_packet_hit,
+    planar_packet_hit,
+    tonemap,
+    perlin_noise,
+    perlin_turbulence,
+    image_sample,
+};
+
+} // namespace
+
+const simd_kernels simd_kernels_scalar = scalar_kernels;
+
+int32_t image_texel_index(int32_t x, int32_t y, int32_t tiles_x) {
+    const int32_t mask = image_tile_size - 1;
+    int32_t tile = (y >> image_tile_shift) * tiles_x + (x >> image_tile_shift);
+    return (tile << (2 * image_tile_shift)) | (spread_bits(y & mask) << 1) | spread_bits(x & mask);
+}
+
+unsigned planar_polygon_lanes(unsigned lanes, const float* a, const float* b, const float* sides) {
+    unsigned inside = 0;
+    for (int k = 0; lanes >> k; k++) {
+        if ((lanes >> k & 1) && planar_polygon_test(a[k], b[k], sides[k])) inside |= 1u << k;
+    }
+    return inside;
+}
+
+// Defined here rather than in dispatch.cpp so it is constant-initialized from this table and
+// usable before main().
+simd_kernels simd_active = scalar_kernels;
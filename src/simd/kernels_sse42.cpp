@@ -0,0 +1,627 @@
+#include "simd.h"
+
+// 4-wide kernels. SSE4.1 adds the rounding and blend instructions the noise and selection code
+// needs; the rest is plain SSE.
+
+#if defined(__SSE4_2__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+
+#include <immintrin.h>
+#include <math.h>
+
+namespace {
+
+__m128 lanes_below(uint32_t n) {
+    const __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    return _mm_castsi128_ps(_mm_cmplt_epi32(index, _mm_set1_epi32(static_cast<int>(n))));
+}
+
+// Returns the lane of the smallest t, or -1 when no lane is below `limit`.
+int nearest_lane(__m128 t, float limit, float& t_out) {
+    __m128 m = _mm_min_ps(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)));
+    m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    float nearest = _mm_cvtss_f32(m);
+    if (!(nearest < limit)) return -1;
+    int bits = _mm_movemask_ps(_mm_cmpeq_ps(t, m));
+    int lane = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        lane++;
+    }
+    t_out = nearest;
+    return lane;
+}
+
+unsigned box_hit_half(const float* const lo[3], const float* const hi[3], int first,
+                        const float org[3], const float inv_dir[3], float t_min, float t_max, float* t_entry) {
+    __m128 tn = _mm_set1_ps(t_min);
+    __m128 tf = _mm_set1_ps(t_max);
+    for (int a = 0; a < 3; a++) {
+        __m128 o = _mm_set1_ps(org[a]);
+        __m128 inv = _mm_set1_ps(inv_dir[a]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(lo[a] + first), o), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(hi[a] + first), o), inv);
+        tn = _mm_max_ps(t0, tn); // Keeps tn when t0 is NaN
+        tf = _mm_min_ps(t1, tf);
+    }
+    _mm_storeu_ps(t_entry + first, tn);
+    return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(tn, tf))) << first;
+}
+
+// The 8 children as two 4-wide halves.
+unsigned box_hit8(const wide_bvh_node<8>& node, const float org[3], const float inv_dir[3],
+                  const bool neg[3], float t_min, float t_max, float t_entry[8]) {
+    const float* lo[3] = { neg[0] ? node.bmax_x : node.bmin_x,
+                           neg[1] ? node.bmax_y : node.bmin_y,
+                           neg[2] ? node.bmax_z : node.bmin_z };
+    const float* hi[3] = { neg[0] ? node.bmin_x : node.bmax_x,
+                           neg[1] ? node.bmin_y : node.bmax_y,
+                           neg[2] ? node.bmin_z : node.bmax_z };
+    return box_hit_half(lo, hi, 0, org, inv_dir, t_min, t_max, t_entry) |
+           box_hit_half(lo, hi, 4, org, inv_dir, t_min, t_max, t_entry);
+}
+
+// The rays as two 4-wide halves, one child at a time.
+void box_hit_packet8(const wide_bvh_node<8>& node, unsigned children, const wide_bvh_packet_lanes<8>& lanes,
+                     const bool neg[3], float t_min, const float t_max[8], uint32_t hits[8], float t_entry[8]) {
+    const float* lo[3] = { neg[0] ? node.bmax_x : node.bmin_x,
+                           neg[1] ? node.bmax_y : node.bmin_y,
+                           neg[2] ? node.bmax_z : node.bmin_z };
+    const float* hi[3] = { neg[0] ? node.bmin_x : node.bmax_x,
+                           neg[1] ? node.bmin_y : node.bmax_y,
+                           neg[2] ? node.bmin_z : node.bmax_z };
+    const __m128 inf = _mm_set1_ps(INFINITY);
+
+    for (int k = 0; k < 8; k++) {
+        hits[k] = 0;
+        t_entry[k] = INFINITY;
+        if (!(children & (1u << k))) continue;
+        __m128 nearest = inf;
+        for (int l = 0; l < 8; l += 4) {
+            __m128 tn = _mm_set1_ps(t_min);
+            __m128 tf = _mm_loadu_ps(t_max + l);
+            for (int a = 0; a < 3; a++) {
+                __m128 o = _mm_load_ps(lanes.org[a] + l);
+                __m128 inv = _mm_load_ps(lanes.inv_dir[a] + l);
+                tn = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lo[a][k]), o), inv), tn);
+                tf = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(hi[a][k]), o), inv), tf);
+            }
+            __m128 hit = _mm_cmple_ps(tn, tf);
+            hits[k] |= static_cast<uint32_t>(_mm_movemask_ps(hit)) << l;
+            nearest = _mm_min_ps(nearest, _mm_blendv_ps(inf, tn, hit));
+        }
+        nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+        nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+        t_entry[k] = _mm_cvtss_f32(nearest);
+    }
+}
+
+int sphere_hit(const sphere_batch<float>& s, uint32_t begin, uint32_t count,
+               const batch_ray<float>& r, float t_min, float& t_max) {
+    const __m128 ox = _mm_set1_ps(r.ox), oy = _mm_set1_ps(r.oy), oz = _mm_set1_ps(r.oz);
+    const __m128 dx = _mm_set1_ps(r.dx), dy = _mm_set1_ps(r.dy), dz = _mm_set1_ps(r.dz);
+    const __m128 time = _mm_set1_ps(r.time);
+    const __m128 a = _mm_set1_ps(r.dx * r.dx + r.dy * r.dy + r.dz * r.dz);
+    const __m128 lo = _mm_set1_ps(t_min);
+    const __m128 inf = _mm_set1_ps(INFINITY);
+    int best = -1;
+
+    for (uint32_t i = begin; i < begin + count; i += 4) {
+        __m128 hi = _mm_set1_ps(t_max);
+        __m128 ocx = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(s.cx + i), _mm_mul_ps(time, _mm_loadu_ps(s.vx + i))), ox);
+        __m128 ocy = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(s.cy + i), _mm_mul_ps(time, _mm_loadu_ps(s.vy + i))), oy);
+        __m128 ocz = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(s.cz + i), _mm_mul_ps(time, _mm_loadu_ps(s.vz + i))), oz);
+        __m128 radius = _mm_loadu_ps(s.radius + i);
+
+        __m128 h = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ocx), _mm_mul_ps(dy, ocy)), _mm_mul_ps(dz, ocz));
+        __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+                              _mm_mul_ps(radius, radius));
+        __m128 discriminant = _mm_sub_ps(_mm_mul_ps(h, h), _mm_mul_ps(a, c));
+        __m128 valid = _mm_and_ps(_mm_cmpge_ps(discriminant, _mm_setzero_ps()), lanes_below(begin + count - i));
+
+        __m128 sqrtd = _mm_sqrt_ps(_mm_max_ps(discriminant, _mm_setzero_ps()));
+        __m128 near_root = _mm_div_ps(_mm_sub_ps(h, sqrtd), a);
+        __m128 far_root = _mm_div_ps(_mm_add_ps(h, sqrtd), a);
+        __m128 near_ok = _mm_and_ps(_mm_cmplt_ps(lo, near_root), _mm_cmplt_ps(near_root, hi));
+        __m128 far_ok = _mm_and_ps(_mm_cmplt_ps(lo, far_root), _mm_cmplt_ps(far_root, hi));
+
+        __m128 t = _mm_blendv_ps(far_root, near_root, near_ok);
+        t = _mm_blendv_ps(inf, t, _mm_and_ps(valid, _mm_or_ps(near_ok, far_ok)));
+
+        int lane = nearest_lane(t, t_max, t_max);
+        if (lane >= 0) best = static_cast<int>(i) + lane;
+    }
+    return best;
+}
+
+int planar_hit(const planar_batch<float>& q, uint32_t begin, uint32_t count,
+               const batch_ray<float>& r, float t_min, float& t_max, float& hit_a, float& hit_b) {
+    const __m128 ox = _mm_set1_ps(r.ox), oy = _mm_set1_ps(r.oy), oz = _mm_set1_ps(r.oz);
+    const __m128 dx = _mm_set1_ps(r.dx), dy = _mm_set1_ps(r.dy), dz = _mm_set1_ps(r.dz);
+    const __m128 lo = _mm_set1_ps(t_min);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f), quarter = _mm_set1_ps(0.25f);
+    const __m128 inf = _mm_set1_ps(INFINITY);
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    int best = -1;
+
+    for (uint32_t i = begin; i < begin + count; i += 4) {
+        __m128 hi = _mm_set1_ps(t_max);
+        __m128 nx = _mm_loadu_ps(q.nx + i), ny = _mm_loadu_ps(q.ny + i), nz = _mm_loadu_ps(q.nz + i);
+        __m128 denom = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dx), _mm_mul_ps(ny, dy)), _mm_mul_ps(nz, dz));
+        __m128 n_dot_o = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, ox), _mm_mul_ps(ny, oy)), _mm_mul_ps(nz, oz));
+        __m128 t = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(q.d + i), n_dot_o), denom);
+
+        __m128 mask = _mm_cmpge_ps(_mm_andnot_ps(sign_mask, denom), _mm_set1_ps(1e-8f));
+        mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmple_ps(lo, t), _mm_cmple_ps(t, hi)));
+        mask = _mm_and_ps(mask, lanes_below(begin + count - i));
+        if (_mm_movemask_ps(mask) == 0) continue;
+
+        __m128 px = _mm_sub_ps(_mm_add_ps(ox, _mm_mul_ps(t, dx)), _mm_loadu_ps(q.qx + i));
+        __m128 py = _mm_sub_ps(_mm_add_ps(oy, _mm_mul_ps(t, dy)), _mm_loadu_ps(q.qy + i));
+        __m128 pz = _mm_sub_ps(_mm_add_ps(oz, _mm_mul_ps(t, dz)), _mm_loadu_ps(q.qz + i));
+        __m128 ux = _mm_loadu_ps(q.ux + i), uy = _mm_loadu_ps(q.uy + i), uz = _mm_loadu_ps(q.uz + i);
+        __m128 vx = _mm_loadu_ps(q.vx + i), vy = _mm_loadu_ps(q.vy + i), vz = _mm_loadu_ps(q.vz + i);
+        __m128 wx = _mm_loadu_ps(q.wx + i), wy = _mm_loadu_ps(q.wy + i), wz = _mm_loadu_ps(q.wz + i);
+
+        __m128 a = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(wx, _mm_sub_ps(_mm_mul_ps(py, vz), _mm_mul_ps(pz, vy))),
+            _mm_mul_ps(wy, _mm_sub_ps(_mm_mul_ps(pz, vx), _mm_mul_ps(px, vz)))),
+            _mm_mul_ps(wz, _mm_sub_ps(_mm_mul_ps(px, vy), _mm_mul_ps(py, vx))));
+        __m128 b = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(wx, _mm_sub_ps(_mm_mul_ps(uy, pz), _mm_mul_ps(uz, py))),
+            _mm_mul_ps(wy, _mm_sub_ps(_mm_mul_ps(uz, px), _mm_mul_ps(ux, pz)))),
+            _mm_mul_ps(wz, _mm_sub_ps(_mm_mul_ps(ux, py), _mm_mul_ps(uy, px))));
+
+        // Evaluate every shape's predicate and keep the one each lane asks for.
+        __m128i shape = _mm_loadu_si128(reinterpret_cast<const __m128i*>(q.shape + i));
+        __m128 p0 = _mm_loadu_ps(q.p0 + i), p1 = _mm_loadu_ps(q.p1 + i);
+        auto is_shape = [&](int32_t code) {
+            return _mm_castsi128_ps(_mm_cmpeq_epi32(shape, _mm_set1_epi32(code)));
+        };
+
+        __m128 a_pos = _mm_cmpge_ps(a, zero), b_pos = _mm_cmpge_ps(b, zero);
+        __m128 inside_para = _mm_and_ps(_mm_and_ps(a_pos, b_pos), _mm_and_ps(_mm_cmple_ps(a, one), _mm_cmple_ps(b, one)));
+        __m128 inside_tri = _mm_and_ps(_mm_and_ps(a_pos, b_pos), _mm_cmple_ps(_mm_add_ps(a, b), one));
+        __m128 ddx = _mm_sub_ps(a, p0), ddy = _mm_sub_ps(b, p0);
+        __m128 inside_disk = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(ddx, ddx), _mm_mul_ps(ddy, ddy)), _mm_mul_ps(p0, p0));
+        __m128 cx = _mm_sub_ps(a, half), cy = _mm_sub_ps(b, half);
+        __m128 r2 = _mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy));
+        __m128 inside_ring = _mm_and_ps(_mm_cmple_ps(r2, _mm_mul_ps(_mm_mul_ps(p1, p1), quarter)),
+                                        _mm_cmpge_ps(r2, _mm_mul_ps(_mm_mul_ps(p0, p0), quarter)));
+        __m128 ex = _mm_div_ps(cx, half), ey = _mm_div_ps(cy, _mm_set1_ps(0.4f));
+        __m128 inside_ellipse = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)), one);
+
+        __m128 inside = _mm_or_ps(_mm_or_ps(
+            _mm_and_ps(is_shape(batch_shape_parallelogram), inside_para),
+            _mm_and_ps(is_shape(batch_shape_triangle), inside_tri)), _mm_or_ps(_mm_or_ps(
+            _mm_and_ps(is_shape(batch_shape_disk), inside_disk),
+            _mm_and_ps(is_shape(batch_shape_ring), inside_ring)),
+            _mm_and_ps(is_shape(batch_shape_ellipse), inside_ellipse)));
+
+        // Polygons need an angle, so their lanes go through the scalar test
+        int polygon_lanes = _mm_movemask_ps(_mm_and_ps(mask, is_shape(batch_shape_polygon)));
+        if (polygon_lanes) {
+            alignas(16) float as[4], bs[4], sides[4];
+            _mm_store_ps(as, a);
+            _mm_store_ps(bs, b);
+            _mm_store_ps(sides, p0);
+            const __m128i bit = _mm_setr_epi32(1, 2, 4, 8);
+            __m128i hits = _mm_set1_epi32(static_cast<int>(planar_polygon_lanes(polygon_lanes, as, bs, sides)));
+            inside = _mm_or_ps(inside, _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(hits, bit), bit)));
+        }
+
+        t = _mm_blendv_ps(inf, t, _mm_and_ps(mask, inside));
+        // t_max itself is an accepted distance for planes, so compare against the next float.
+        int lane = nearest_lane(t, nextafterf(t_max, INFINITY), t_max);
+        if (lane >= 0) {
+            alignas(16) float as[4], bs[4];
+            _mm_store_ps(as, a);
+            _mm_store_ps(bs, b);
+            hit_a = as[lane];
+            hit_b = bs[lane];
+            best = static_cast<int>(i) + lane;
+        }
+    }
+    return best;
+}
+
+// Four quadrics against one ray, in the order of operations of quadric_batch_hit_scalar.
+int quadric_hit(const quadric_batch<float>& q, uint32_t begin, uint32_t count,
+                const batch_ray<float>& r, float t_min, float& t_max, int32_t& part) {
+    const __m128 dx = _mm_set1_ps(r.dx), dy = _mm_set1_ps(r.dy), dz = _mm_set1_ps(r.dz);
+    const __m128 lo = _mm_set1_ps(t_min);
+    const __m128 zero = _mm_setzero_ps(), two = _mm_set1_ps(2.0f);
+    const __m128 inf = _mm_set1_ps(INFINITY);
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    int best = -1;
+
+    for (uint32_t i = begin; i < begin + count; i += 4) {
+        const __m128 hi = _mm_set1_ps(t_max);
+        const __m128 lanes = lanes_below(begin + count - i);
+        __m128 ox = _mm_sub_ps(_mm_set1_ps(r.ox), _mm_loadu_ps(q.cx + i));
+        __m128 oy = _mm_sub_ps(_mm_set1_ps(r.oy), _mm_loadu_ps(q.cy + i));
+        __m128 oz = _mm_sub_ps(_mm_set1_ps(r.oz), _mm_loadu_ps(q.cz + i));
+        __m128 xx = _mm_loadu_ps(q.xx + i), yy = _mm_loadu_ps(q.yy + i), zz = _mm_loadu_ps(q.zz + i);
+        __m128 xy = _mm_loadu_ps(q.xy + i), xz = _mm_loadu_ps(q.xz + i), yz = _mm_loadu_ps(q.yz + i);
+        __m128 bx = _mm_loadu_ps(q.bx + i), by = _mm_loadu_ps(q.by + i), bz = _mm_loadu_ps(q.bz + i);
+        __m128 c0 = _mm_loadu_ps(q.c + i);
+        __m128 sx = _mm_loadu_ps(q.sx + i), sy = _mm_loadu_ps(q.sy + i), sz = _mm_loadu_ps(q.sz + i);
+        __m128 slab_min = _mm_loadu_ps(q.slab_min + i), slab_max = _mm_loadu_ps(q.slab_max + i);
+
+        auto dot3 = [](__m128 ax, __m128 ay, __m128 az, __m128 bx_, __m128 by_, __m128 bz_) {
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx_), _mm_mul_ps(ay, by_)), _mm_mul_ps(az, bz_));
+        };
+        __m128 adx = dot3(xx, xy, xz, dx, dy, dz);
+        __m128 ady = dot3(xy, yy, yz, dx, dy, dz);
+        __m128 adz = dot3(xz, yz, zz, dx, dy, dz);
+        __m128 gx = _mm_add_ps(dot3(xx, xy, xz, ox, oy, oz), bx);
+        __m128 gy = _mm_add_ps(dot3(xy, yy, yz, ox, oy, oz), by);
+        __m128 gz = _mm_add_ps(dot3(xz, yz, zz, ox, oy, oz), bz);
+        __m128 a = dot3(adx, ady, adz, dx, dy, dz);
+        __m128 h = dot3(gx, gy, gz, dx, dy, dz);
+        __m128 c = _mm_add_ps(_mm_add_ps(dot3(gx, gy, gz, ox, oy, oz), dot3(bx, by, bz, ox, oy, oz)), c0);
+        __m128 s_o = dot3(sx, sy, sz, ox, oy, oz);
+        __m128 s_d = dot3(sx, sy, sz, dx, dy, dz);
+
+        __m128 discriminant = _mm_sub_ps(_mm_mul_ps(h, h), _mm_mul_ps(a, c));
+        __m128 valid = _mm_and_ps(_mm_cmpge_ps(discriminant, zero), lanes);
+        __m128 sqrtd = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+        __m128 k = _mm_xor_ps(_mm_add_ps(h, _mm_or_ps(sqrtd, _mm_and_ps(h, sign_mask))), sign_mask);
+        __m128 t0 = _mm_div_ps(k, a), t1 = _mm_div_ps(c, k);
+        __m128 near_root = _mm_min_ps(t0, t1), far_root = _mm_max_ps(t0, t1);
+        __m128 s_near = _mm_add_ps(s_o, _mm_mul_ps(near_root, s_d));
+        __m128 s_far = _mm_add_ps(s_o, _mm_mul_ps(far_root, s_d));
+        __m128 near_ok = _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(lo, near_root), _mm_cmplt_ps(near_root, hi)),
+                                    _mm_and_ps(_mm_cmple_ps(slab_min, s_near), _mm_cmple_ps(s_near, slab_max)));
+        __m128 far_ok = _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(lo, far_root), _mm_cmplt_ps(far_root, hi)),
+                                   _mm_and_ps(_mm_cmple_ps(slab_min, s_far), _mm_cmple_ps(s_far, slab_max)));
+        __m128 t = _mm_blendv_ps(_mm_blendv_ps(inf, far_root, _mm_and_ps(valid, far_ok)), near_root, _mm_and_ps(valid, near_ok));
+        __m128i hit_part = _mm_set1_epi32(quadric_part_surface);
+
+        __m128 capped = _mm_and_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(q.capped + i)), _mm_setzero_si128())), lanes);
+        if (_mm_movemask_ps(capped) != 0) {
+            for (int side = 0; side < 2; side++) {
+                __m128 limit = _mm_min_ps(t, hi);
+                __m128 tc = _mm_div_ps(_mm_sub_ps(side ? slab_max : slab_min, s_o), s_d);
+                __m128 px = _mm_add_ps(ox, _mm_mul_ps(tc, dx));
+                __m128 py = _mm_add_ps(oy, _mm_mul_ps(tc, dy));
+                __m128 pz = _mm_add_ps(oz, _mm_mul_ps(tc, dz));
+                __m128 fx = _mm_add_ps(dot3(xx, xy, xz, px, py, pz), _mm_mul_ps(two, bx));
+                __m128 fy = _mm_add_ps(dot3(xy, yy, yz, px, py, pz), _mm_mul_ps(two, by));
+                __m128 fz = _mm_add_ps(dot3(xz, yz, zz, px, py, pz), _mm_mul_ps(two, bz));
+                __m128 f = _mm_add_ps(dot3(fx, fy, fz, px, py, pz), c0);
+                __m128 ok = _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(lo, tc), _mm_cmplt_ps(tc, limit)),
+                                       _mm_and_ps(_mm_cmple_ps(f, zero), capped));
+                t = _mm_blendv_ps(t, tc, ok);
+                hit_part = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(hit_part),
+                    _mm_castsi128_ps(_mm_set1_epi32(side ? quadric_part_cap_max : quadric_part_cap_min)), ok));
+            }
+        }
+
+        int lane = nearest_lane(t, t_max, t_max);
+        if (lane >= 0) {
+            alignas(16) int32_t parts[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(parts), hit_part);
+            part = parts[lane];
+            best = static_cast<int>(i) + lane;
+        }
+    }
+    return best;
+}
+
+// Mask of the packet lanes in `lanes` among the four starting at `first`
+__m128 packet_lanes4(uint32_t lanes, int first) {
+    const __m128i bit = _mm_setr_epi32(1, 2, 4, 8);
+    return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int>(lanes >> first)), bit), bit));
+}
+
+// One sphere against four rays at a time, with the same arithmetic as the per-ray kernels so
+// both paths agree on every hit.
+uint32_t sphere_packet_hit(const sphere_batch<float>& s, uint32_t begin, uint32_t count,
+                           const batch_packet<float, 8>& r, uint32_t lanes, float t_min, float t_max[8],
+                           int32_t best[8]) {
+    const __m128 lo = _mm_set1_ps(t_min);
+    const __m128 zero = _mm_setzero_ps();
+    uint32_t improved = 0;
+
+    for (int l = 0; l < 8; l += 4) {
+        if (((lanes >> l) & 0xf) == 0) continue;
+        const __m128 active = packet_lanes4(lanes, l);
+        const __m128 ox = _mm_load_ps(r.ox + l), oy = _mm_load_ps(r.oy + l), oz = _mm_load_ps(r.oz + l);
+        const __m128 dx = _mm_load_ps(r.dx + l), dy = _mm_load_ps(r.dy + l), dz = _mm_load_ps(r.dz + l);
+        const __m128 time = _mm_load_ps(r.time + l);
+        const __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        __m128 hi = _mm_loadu_ps(t_max + l);
+        __m128 found = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(best + l)));
+        __m128 any = zero;
+
+        for (uint32_t i = begin; i < begin + count; i++) {
+            __m128 ocx = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(s.cx[i]), _mm_mul_ps(time, _mm_set1_ps(s.vx[i]))), ox);
+            __m128 ocy = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(s.cy[i]), _mm_mul_ps(time, _mm_set1_ps(s.vy[i]))), oy);
+            __m128 ocz = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(s.cz[i]), _mm_mul_ps(time, _mm_set1_ps(s.vz[i]))), oz);
+            __m128 radius = _mm_set1_ps(s.radius[i]);
+
+            __m128 h = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ocx), _mm_mul_ps(dy, ocy)), _mm_mul_ps(dz, ocz));
+            __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+                                  _mm_mul_ps(radius, radius));
+            __m128 discriminant = _mm_sub_ps(_mm_mul_ps(h, h), _mm_mul_ps(a, c));
+            __m128 valid = _mm_and_ps(_mm_cmpge_ps(discriminant, zero), active);
+            if (_mm_movemask_ps(valid) == 0) continue;
+
+            __m128 sqrtd = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+            __m128 near_root = _mm_div_ps(_mm_sub_ps(h, sqrtd), a);
+            __m128 far_root = _mm_div_ps(_mm_add_ps(h, sqrtd), a);
+            __m128 near_ok = _mm_and_ps(_mm_cmplt_ps(lo, near_root), _mm_cmplt_ps(near_root, hi));
+            __m128 far_ok = _mm_and_ps(_mm_cmplt_ps(lo, far_root), _mm_cmplt_ps(far_root, hi));
+            __m128 ok = _mm_and_ps(valid, _mm_or_ps(near_ok, far_ok));
+
+            hi = _mm_blendv_ps(hi, _mm_blendv_ps(far_root, near_root, near_ok), ok);
+            found = _mm_blendv_ps(found, _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(i))), ok);
+            any = _mm_or_ps(any, ok);
+        }
+
+        _mm_storeu_ps(t_max + l, hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(best + l), _mm_castps_si128(found));
+        improved |= static_cast<uint32_t>(_mm_movemask_ps(any)) << l;
+    }
+    return improved;
+}
+
+// One planar shape against four rays at a time. The shape is the same for every ray, so only
+// its own predicate is evaluated.
+uint32_t planar_packet_hit(const planar_batch<float>& q, uint32_t begin, uint32_t count,
+                           const batch_packet<float, 8>& r, uint32_t lanes, float t_min, float t_max[8],
+                           int32_t best[8], float hit_a[8], float hit_b[8]) {
+    const __m128 lo = _mm_set1_ps(t_min);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f), quarter = _mm_set1_ps(0.25f);
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    uint32_t improved = 0;
+
+    for (int l = 0; l < 8; l += 4) {
+        if (((lanes >> l) & 0xf) == 0) continue;
+        const __m128 active = packet_lanes4(lanes, l);
+        const __m128 ox = _mm_load_ps(r.ox + l), oy = _mm_load_ps(r.oy + l), oz = _mm_load_ps(r.oz + l);
+        const __m128 dx = _mm_load_ps(r.dx + l), dy = _mm_load_ps(r.dy + l), dz = _mm_load_ps(r.dz + l);
+        __m128 hi = _mm_loadu_ps(t_max + l);
+        __m128 found_a = _mm_loadu_ps(hit_a + l), found_b = _mm_loadu_ps(hit_b + l);
+        __m128 found = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(best + l)));
+        __m128 any = zero;
+
+        for (uint32_t i = begin; i < begin + count; i++) {
+            __m128 nx = _mm_set1_ps(q.nx[i]), ny = _mm_set1_ps(q.ny[i]), nz = _mm_set1_ps(q.nz[i]);
+            __m128 denom = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dx), _mm_mul_ps(ny, dy)), _mm_mul_ps(nz, dz));
+            __m128 n_dot_o = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, ox), _mm_mul_ps(ny, oy)), _mm_mul_ps(nz, oz));
+            __m128 t = _mm_div_ps(_mm_sub_ps(_mm_set1_ps(q.d[i]), n_dot_o), denom);
+
+            __m128 mask = _mm_cmpge_ps(_mm_andnot_ps(sign_mask, denom), _mm_set1_ps(1e-8f));
+            mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmple_ps(lo, t), _mm_cmple_ps(t, hi)));
+            mask = _mm_and_ps(mask, active);
+            if (_mm_movemask_ps(mask) == 0) continue;
+
+            __m128 px = _mm_sub_ps(_mm_add_ps(ox, _mm_mul_ps(t, dx)), _mm_set1_ps(q.qx[i]));
+            __m128 py = _mm_sub_ps(_mm_add_ps(oy, _mm_mul_ps(t, dy)), _mm_set1_ps(q.qy[i]));
+            __m128 pz = _mm_sub_ps(_mm_add_ps(oz, _mm_mul_ps(t, dz)), _mm_set1_ps(q.qz[i]));
+            __m128 ux = _mm_set1_ps(q.ux[i]), uy = _mm_set1_ps(q.uy[i]), uz = _mm_set1_ps(q.uz[i]);
+            __m128 vx = _mm_set1_ps(q.vx[i]), vy = _mm_set1_ps(q.vy[i]), vz = _mm_set1_ps(q.vz[i]);
+            __m128 wx = _mm_set1_ps(q.wx[i]), wy = _mm_set1_ps(q.wy[i]), wz = _mm_set1_ps(q.wz[i]);
+
+            __m128 a = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(wx, _mm_sub_ps(_mm_mul_ps(py, vz), _mm_mul_ps(pz, vy))),
+                _mm_mul_ps(wy, _mm_sub_ps(_mm_mul_ps(pz, vx), _mm_mul_ps(px, vz)))),
+                _mm_mul_ps(wz, _mm_sub_ps(_mm_mul_ps(px, vy), _mm_mul_ps(py, vx))));
+            __m128 b = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(wx, _mm_sub_ps(_mm_mul_ps(uy, pz), _mm_mul_ps(uz, py))),
+                _mm_mul_ps(wy, _mm_sub_ps(_mm_mul_ps(uz, px), _mm_mul_ps(ux, pz)))),
+                _mm_mul_ps(wz, _mm_sub_ps(_mm_mul_ps(ux, py), _mm_mul_ps(uy, px))));
+
+            __m128 p0 = _mm_set1_ps(q.p0[i]), p1 = _mm_set1_ps(q.p1[i]);
+            __m128 inside;
+            switch (q.shape[i]) {
+                case batch_shape_parallelogram:
+                    inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(a, zero), _mm_cmpge_ps(b, zero)),
+                                        _mm_and_ps(_mm_cmple_ps(a, one), _mm_cmple_ps(b, one)));
+                    break;
+                case batch_shape_triangle:
+                    inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(a, zero), _mm_cmpge_ps(b, zero)),
+                                        _mm_cmple_ps(_mm_add_ps(a, b), one));
+                    break;
+                case batch_shape_disk: {
+                    __m128 ddx = _mm_sub_ps(a, p0), ddy = _mm_sub_ps(b, p0);
+                    inside = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(ddx, ddx), _mm_mul_ps(ddy, ddy)), _mm_mul_ps(p0, p0));
+                    break;
+                }
+                case batch_shape_ring: {
+                    __m128 cx = _mm_sub_ps(a, half), cy = _mm_sub_ps(b, half);
+                    __m128 r2 = _mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy));
+                    inside = _mm_and_ps(_mm_cmple_ps(r2, _mm_mul_ps(_mm_mul_ps(p1, p1), quarter)),
+                                        _mm_cmpge_ps(r2, _mm_mul_ps(_mm_mul_ps(p0, p0), quarter)));
+                    break;
+                }
+                case batch_shape_ellipse: {
+                    __m128 ex = _mm_div_ps(_mm_sub_ps(a, half), half);
+                    __m128 ey = _mm_div_ps(_mm_sub_ps(b, half), _mm_set1_ps(0.4f));
+                    inside = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)), one);
+                    break;
+                }
+                case batch_shape_polygon: {
+                    alignas(16) float as[4], bs[4], sides[4] = { q.p0[i], q.p0[i], q.p0[i], q.p0[i] };
+                    _mm_store_ps(as, a);
+                    _mm_store_ps(bs, b);
+                    inside = packet_lanes4(planar_polygon_lanes(_mm_movemask_ps(mask), as, bs, sides), 0);
+                    break;
+                }
+                default:
+                    inside = zero;
+                    break;
+            }
+
+            __m128 ok = _mm_and_ps(mask, inside);
+            hi = _mm_blendv_ps(hi, t, ok);
+            found_a = _mm_blendv_ps(found_a, a, ok);
+            found_b = _mm_blendv_ps(found_b, b, ok);
+            found = _mm_blendv_ps(found, _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(i))), ok);
+            any = _mm_or_ps(any, ok);
+        }
+
+        _mm_storeu_ps(t_max + l, hi);
+        _mm_storeu_ps(hit_a + l, found_a);
+        _mm_storeu_ps(hit_b + l, found_b);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(best + l), _mm_castps_si128(found));
+        improved |= static_cast<uint32_t>(_mm_movemask_ps(any)) << l;
+    }
+    return improved;
+}
+
+__m128i tonemap_channel(__m128 c, __m128 scale, __m128i shift) {
+    c = _mm_sqrt_ps(_mm_max_ps(_mm_mul_ps(c, scale), _mm_setzero_ps())); // NaN goes to 0
+    c = _mm_min_ps(c, _mm_set1_ps(1.0f));
+    return _mm_sll_epi32(_mm_cvttps_epi32(_mm_mul_ps(c, _mm_set1_ps(255.99f))), shift);
+}
+
+void tonemap(const float* rgb, size_t n, float scale, const pixel_layout& layout, uint32_t* out) {
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128i r_shift = _mm_cvtsi32_si128(static_cast<int>(layout.r_shift));
+    const __m128i g_shift = _mm_cvtsi32_si128(static_cast<int>(layout.g_shift));
+    const __m128i b_shift = _mm_cvtsi32_si128(static_cast<int>(layout.b_shift));
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(layout.alpha));
+
+    for (size_t i = 0; i < n; i += 4) {
+        // The last group reads from a zero-padded copy.
+        float tail[12] = {};
+        const float* p = rgb + 3 * i;
+        size_t lanes = n - i < 4 ? n - i : 4;
+        if (lanes < 4) {
+            for (size_t k = 0; k < 3 * lanes; k++) tail[k] = p[k];
+            p = tail;
+        }
+
+        __m128 r = _mm_setr_ps(p[0], p[3], p[6], p[9]);
+        __m128 g = _mm_setr_ps(p[1], p[4], p[7], p[10]);
+        __m128 b = _mm_setr_ps(p[2], p[5], p[8], p[11]);
+        __m128i pixels = _mm_or_si128(_mm_or_si128(alpha, tonemap_channel(r, s, r_shift)),
+                                      _mm_or_si128(tonemap_channel(g, s, g_shift), tonemap_channel(b, s, b_shift)));
+        if (lanes == 4) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), pixels);
+        } else {
+            alignas(16) uint32_t packed[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(packed), pixels);
+            for (size_t k = 0; k < lanes; k++) out[i + k] = packed[k];
+        }
+    }
+}
+
+// Noise at the 4 points of px, py, pz
+__m128 perlin4(const perlin_tables& p, __m128 px, __m128 py, __m128 pz) {
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), three = _mm_set1_ps(3.0f);
+    const __m128i mask = _mm_set1_epi32(perlin_point_count - 1);
+    const __m128i one_i = _mm_set1_epi32(1);
+
+    __m128 fx = _mm_floor_ps(px), fy = _mm_floor_ps(py), fz = _mm_floor_ps(pz);
+    __m128 u = _mm_sub_ps(px, fx), v = _mm_sub_ps(py, fy), w = _mm_sub_ps(pz, fz);
+    __m128i i = _mm_cvttps_epi32(fx), j = _mm_cvttps_epi32(fy), k = _mm_cvttps_epi32(fz);
+
+    // Permutation entries of both corners on each axis
+    alignas(16) int32_t ix[2][4], iy[2][4], iz[2][4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(ix[0]), _mm_and_si128(i, mask));
+    _mm_store_si128(reinterpret_cast<__m128i*>(ix[1]), _mm_and_si128(_mm_add_epi32(i, one_i), mask));
+    _mm_store_si128(reinterpret_cast<__m128i*>(iy[0]), _mm_and_si128(j, mask));
+    _mm_store_si128(reinterpret_cast<__m128i*>(iy[1]), _mm_and_si128(_mm_add_epi32(j, one_i), mask));
+    _mm_store_si128(reinterpret_cast<__m128i*>(iz[0]), _mm_and_si128(k, mask));
+    _mm_store_si128(reinterpret_cast<__m128i*>(iz[1]), _mm_and_si128(_mm_add_epi32(k, one_i), mask));
+
+    __m128 uu = _mm_mul_ps(_mm_mul_ps(u, u), _mm_sub_ps(three, _mm_mul_ps(two, u)));
+    __m128 vv = _mm_mul_ps(_mm_mul_ps(v, v), _mm_sub_ps(three, _mm_mul_ps(two, v)));
+    __m128 ww = _mm_mul_ps(_mm_mul_ps(w, w), _mm_sub_ps(three, _mm_mul_ps(two, w)));
+    __m128 cu[2] = { _mm_sub_ps(one, uu), uu }, cv[2] = { _mm_sub_ps(one, vv), vv }, cw[2] = { _mm_sub_ps(one, ww), ww };
+    __m128 du[2] = { u, _mm_sub_ps(u, one) }, dv[2] = { v, _mm_sub_ps(v, one) }, dw[2] = { w, _mm_sub_ps(w, one) };
+
+    __m128 accum = _mm_setzero_ps();
+    for (int di = 0; di < 2; di++)
+        for (int dj = 0; dj < 2; dj++)
+            for (int dk = 0; dk < 2; dk++) {
+                int32_t g[4];
+                for (int l = 0; l < 4; l++)
+                    g[l] = p.perm_x[ix[di][l]] ^ p.perm_y[iy[dj][l]] ^ p.perm_z[iz[dk][l]];
+                __m128 gx = _mm_setr_ps(p.gx[g[0]], p.gx[g[1]], p.gx[g[2]], p.gx[g[3]]);
+                __m128 gy = _mm_setr_ps(p.gy[g[0]], p.gy[g[1]], p.gy[g[2]], p.gy[g[3]]);
+                __m128 gz = _mm_setr_ps(p.gz[g[0]], p.gz[g[1]], p.gz[g[2]], p.gz[g[3]]);
+                __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, du[di]), _mm_mul_ps(gy, dv[dj])), _mm_mul_ps(gz, dw[dk]));
+                __m128 weight = _mm_mul_ps(_mm_mul_ps(cu[di], cv[dj]), cw[dk]);
+                accum = _mm_add_ps(accum, _mm_mul_ps(weight, dot));
+            }
+    return accum;
+}
+
+// Copies up to 4 points into padded lanes
+void load_points4(const float* x, const float* y, const float* z, size_t lanes, __m128& px, __m128& py, __m128& pz) {
+    alignas(16) float bx[4] = {}, by[4] = {}, bz[4] = {};
+    for (size_t l = 0; l < lanes; l++) {
+        bx[l] = x[l];
+        by[l] = y[l];
+        bz[l] = z[l];
+    }
+    px = _mm_load_ps(bx);
+    py = _mm_load_ps(by);
+    pz = _mm_load_ps(bz);
+}
+
+void store_lanes4(__m128 values, size_t lanes, float* out) {
+    alignas(16) float result[4];
+    _mm_store_ps(result, values);
+    for (size_t l = 0; l < lanes; l++) out[l] = result[l];
+}
+
+void perlin_noise(const perlin_tables& p, const float* x, const float* y, const float* z,
+                  size_t n, float* out) {
+    for (size_t s = 0; s < n; s += 4) {
+        size_t lanes = n - s < 4 ? n - s : 4;
+        __m128 px, py, pz;
+        load_points4(x + s, y + s, z + s, lanes, px, py, pz);
+        store_lanes4(perlin4(p, px, py, pz), lanes, out + s);
+    }
+}
+
+void perlin_turbulence(const perlin_tables& p, const float* x, const float* y, const float* z,
+                       size_t n, int depth, float* out) {
+    const __m128 half = _mm_set1_ps(0.5f), two = _mm_set1_ps(2.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    for (size_t s = 0; s < n; s += 4) {
+        size_t lanes = n - s < 4 ? n - s : 4;
+        __m128 px, py, pz;
+        load_points4(x + s, y + s, z + s, lanes, px, py, pz);
+        __m128 accum = _mm_setzero_ps(), weight = _mm_set1_ps(1.0f), scale = _mm_set1_ps(1.0f);
+        for (int o = 0; o < depth; o++) {
+            __m128 octave = perlin4(p, _mm_mul_ps(px, scale), _mm_mul_ps(py, scale), _mm_mul_ps(pz, scale));
+            accum = _mm_add_ps(accum, _mm_mul_ps(weight, octave));
+            weight = _mm_mul_ps(weight, half);
+            scale = _mm_mul_ps(scale, two);
+        }
+        store_lanes4(_mm_andnot_ps(sign, accum), lanes, out + s);
+    }
+}
+
+constexpr simd_kernels sse42_kernels = {
+    box_hit8,
+    box_hit_packet8,
+    sphere_hit,
+    planar_hit,
+    quadric_hit,
+    sphere_packet_hit,
+    planar_packet_hit,
+    tonemap,
+    perlin_noise,
+    perlin_turbulence,
+    nullptr, // image_sample: one scattered texel load per sample leaves nothing to vectorize
+};
+
+} // namespace
+
+const simd_kernels simd_kernels_sse42 = sse42_kernels;
+
+#else
+
+const simd_kernels simd_kernels_sse42 = {};
+
+#endif
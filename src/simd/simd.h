@@ -0,0 +1,111 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "kernel_types.h"
+#include <cstddef>
+#include <cstdint>
+
+// Runtime selection of the vectorized kernels. Each instruction set has its own translation
+// unit, kernels_<isa>.cpp, built with that ISA's compiler flags and exporting a table of the
+// kernels it implements. simd_select() layers those tables from scalar up to the chosen ISA
+// into simd_active, so an entry an ISA leaves null is taken from the next one down.
+//
+// The ISA translation units include nothing but this header and the intrinsics headers: an
+// inline function they shared with the rest of the engine could be emitted with the wider
+// instructions and picked by the linker for code that runs on every CPU. They are also built
+// without floating-point contraction, so every ISA computes bit-identical results.
+
+enum class simd_isa : uint8_t {
+    Scalar,
+    SSE42,
+    AVX2,
+    AVX512, // AVX-512F
+    Count
+};
+
+struct simd_kernels {
+    // wide_bvh_children_hit.
+    unsigned (*box_hit8)(const wide_bvh_node<8>& node, const float org[3], const float inv_dir[3],
+                         const bool neg[3], float t_min, float t_max, float t_entry[8]);
+
+    // wide_bvh_children_hit_packet: the children of `node` in the `children` mask against the 8
+    // rays of a packet. Writes a mask of the rays hitting each child and their nearest entry
+    // distance; children left out get no rays.
+    void (*box_hit_packet8)(const wide_bvh_node<8>& node, unsigned children, const wide_bvh_packet_lanes<8>& lanes,
+                            const bool neg[3], float t_min, const float t_max[8], uint32_t hits[8], float t_entry[8]);
+
+    // sphere_batch_hit, planar_batch_hit and quadric_batch_hit in single precision.
+    int (*sphere_hit)(const sphere_batch<float>& s, uint32_t begin, uint32_t count,
+                      const batch_ray<float>& r, float t_min, float& t_max);
+    int (*planar_hit)(const planar_batch<float>& q, uint32_t begin, uint32_t count,
+                      const batch_ray<float>& r, float t_min, float& t_max, float& hit_a, float& hit_b);
+    int (*quadric_hit)(const quadric_batch<float>& q, uint32_t begin, uint32_t count,
+                       const batch_ray<float>& r, float t_min, float& t_max, int32_t& part);
+
+    // sphere_packet_hit and planar_packet_hit in single precision, for packets of 8 rays.
+    uint32_t (*sphere_packet_hit)(const sphere_batch<float>& s, uint32_t begin, uint32_t count,
+                                  const batch_packet<float, 8>& r, uint32_t lanes, float t_min, float t_max[8],
+                                  int32_t best[8]);
+    uint32_t (*planar_packet_hit)(const planar_batch<float>& q, uint32_t begin, uint32_t count,
+                                  const batch_packet<float, 8>& r, uint32_t lanes, float t_min, float t_max[8],
+                                  int32_t best[8], float hit_a[8], float hit_b[8]);
+
+    // Display pixels of n accumulated colors, stored as r, g, b triples: each channel is
+    // multiplied by `scale`, gamma corrected with a square root and clamped to [0, 1].
+    void (*tonemap)(const float* rgb, size_t n, float scale, const pixel_layout& layout, uint32_t* out);
+
+    // Perlin noise at n points.
+    void (*perlin_noise)(const perlin_tables& tables, const float* x, const float* y, const float* z,
+                         size_t n, float* out);
+
+    // Turbulence at n points: |sum over octaves o < depth of noise(2^o p) / 2^o|, each octave
+    // computed exactly as perlin_noise does. Lanes run over the points, so this is the one to
+    // use for many points; a single point does better with its octaves batched through
+    // perlin_noise.
+    void (*perlin_turbulence)(const perlin_tables& tables, const float* x, const float* y, const float* z,
+                              size_t n, int depth, float* out);
+
+    // Nearest texel at n texture coordinates, clamped to the image, with v pointing up.
+    // Channels are written in [0, 1].
+    void (*image_sample)(const image_view& image, const float* u, const float* v, size_t n,
+                         float* r, float* g, float* b);
+};
+
+// Mask of the lanes in `lanes` whose plane coordinates (a, b) are inside their regular
+// polygon (batch_shape_polygon) with sides[k] sides. The test needs an angle, so the vector
+// kernels hand those lanes to this one, built for the baseline ISA like the scalar kernels.
+unsigned planar_polygon_lanes(unsigned lanes, const float* a, const float* b, const float* sides);
+
+// Offset in texels of texel (x, y) in the tiled layout of an image `tiles_x` tiles wide (see
+// image_view). For building images; the kernels compute it inline.
+int32_t image_texel_index(int32_t x, int32_t y, int32_t tiles_x);
+
+extern const simd_kernels simd_kernels_scalar;
+extern const simd_kernels simd_kernels_sse42;
+extern const simd_kernels simd_kernels_avx2;
+extern const simd_kernels simd_kernels_avx512;
+
+// Kernels in use: the scalar ones until simd_select() is called. Selection is meant for
+// startup, before any thread reads the table.
+extern simd_kernels simd_active;
+
+// Widest ISA the CPU, the OS and this build all support.
+simd_isa simd_detect();
+
+// Switches simd_active to `isa`. Returns false, leaving it unchanged, when `isa` is not
+// supported here.
+bool simd_select(simd_isa isa);
+
+simd_isa simd_selected();
+
+const char* simd_isa_name(simd_isa isa);
+
+// Accepts the names returned by simd_isa_name, case insensitive.
+bool simd_parse_isa(const char* name, simd_isa& isa);
+
+// Selects the ISA named by `name` (the --isa command line option), or else by the ZENGINE_ISA
+// environment variable, or else the detected one, and logs the choice. A name that is unknown
+// or not supported falls back to the detected ISA.
+simd_isa simd_init(const char* name = nullptr);
+
+#endif
@@ -91,6 +91,179 @@ int solve_quartic(double A, double B, double C, double D, double E, double* root
     return n;
 }
 
+// Evaluates c[0] + c[1] x + ... + c[degree] x^degree
+inline double poly_eval(const double* c, int degree, double x) {
+    double v = c[degree];
+    for (int i = degree - 1; i >= 0; i--) v = v * x + c[i];
+    return v;
+}
+
+// Root of the polynomial between lo and hi, where it changes sign from f_lo to f_hi, to within
+// `precision` of the bracket width. Newton steps from the secant through the ends, with a
+// bisection whenever a step would leave the shrinking bracket.
+inline double poly_bracketed_root(const double* c, int degree, double lo, double hi, double f_lo, double f_hi,
+                                  double precision) {
+    const double tolerance = precision * (hi - lo);
+    double x = lo + (hi - lo) * (f_lo / (f_lo - f_hi));
+    for (int iter = 0; iter < 64; iter++) {
+        double f = c[degree], df = 0;
+        for (int i = degree - 1; i >= 0; i--) {
+            df = df * x + f;
+            f = f * x + c[i];
+        }
+        if (f == 0) return x;
+        if ((f < 0) == (f_lo < 0)) lo = x;
+        else hi = x;
+
+        double next = x - f / df;
+        if (!(next > lo && next < hi)) next = 0.5 * (lo + hi); // Also catches df == 0
+        bool converged = std::abs(next - x) <= tolerance;
+        x = next;
+        if (converged) break;
+    }
+    return x;
+}
+
+// Smallest root in [lo, hi] of the quartic c[0] + c[1] x + ... + c[4] x^4, c[4] != 0. The
+// roots of its derivative split the interval into monotonic pieces, each holding at most one
+// root, so no root is lost the way a closed-form solve loses them to cancellation; the pieces
+// are walked from lo and only as far as the first sign change. Roots of even multiplicity,
+// where the quartic touches zero without crossing it, are not reported.
+inline bool quartic_first_root(const double c[5], double lo, double hi, double& root) {
+    const double d1[4] = { c[1], 2 * c[2], 3 * c[3], 4 * c[4] };
+
+    // The derivative is monotonic between the roots of the second derivative, solved as
+    // q / a and c / q, which lose no precision to cancellation.
+    double bounds[4] = { lo, 0, 0, hi };
+    int bound_count = 1;
+    double a2 = 12 * c[4], b2 = 6 * c[3], c2 = 2 * c[2];
+    double discriminant = b2 * b2 - 4 * a2 * c2;
+    if (discriminant > 0) {
+        double q = -0.5 * (b2 + std::copysign(std::sqrt(discriminant), b2));
+        double x0 = std::fmin(q / a2, c2 / q), x1 = std::fmax(q / a2, c2 / q);
+        if (x0 > lo && x0 < hi) bounds[bound_count++] = x0;
+        if (x1 > lo && x1 < hi) bounds[bound_count++] = x1;
+    }
+    bounds[bound_count++] = hi;
+
+    double start = lo, f_start = poly_eval(c, 4, lo);
+    double g_lo = poly_eval(d1, 3, lo);
+    for (int k = 0; k + 1 < bound_count; k++) {
+        double g_hi = poly_eval(d1, 3, bounds[k + 1]);
+        if ((g_lo < 0) != (g_hi < 0)) {
+            // The quartic is flat around the roots of its derivative, so they only need to be
+            // roughly placed to separate its roots.
+            double turn = poly_bracketed_root(d1, 3, bounds[k], bounds[k + 1], g_lo, g_hi, 1e-6);
+            double f_turn = poly_eval(c, 4, turn);
+            if ((f_start < 0) != (f_turn < 0)) {
+                root = poly_bracketed_root(c, 4, start, turn, f_start, f_turn, 1e-13);
+                return true;
+            }
+            start = turn;
+            f_start = f_turn;
+        }
+        g_lo = g_hi;
+    }
+
+    double f_hi = poly_eval(c, 4, hi);
+    if ((f_start < 0) == (f_hi < 0)) return false;
+    root = poly_bracketed_root(c, 4, start, hi, f_start, f_hi, 1e-13);
+    return true;
+}
+
+// Largest real root of the cubic x^3 + a x^2 + b x + c. Only the one root is worked out, with a
+// single cube root or cosine, rather than all of them as solve_cubic does.
+inline double cubic_largest_root(double a, double b, double c) {
+    double q = (3 * b - a * a) * (1.0 / 9);
+    double r = (9 * a * b - 27 * c - 2 * a * a * a) * (1.0 / 54);
+    double D = q * q * q + r * r;
+    double x, terms;
+    if (D >= 0) {
+        // s t = -q, so the second cube root follows from the first
+        double s = std::cbrt(r + std::copysign(std::sqrt(D), r));
+        x = s != 0 ? s - q / s : 0;
+        terms = 2 * std::fabs(s) + std::fabs(x);
+    } else {
+        double sqrt_q = std::sqrt(-q);
+        x = 2 * sqrt_q * std::cos(std::acos(std::clamp(r / (-q * sqrt_q), -1.0, 1.0)) / 3);
+        terms = 2 * sqrt_q;
+    }
+    x -= a * (1.0 / 3);
+    terms += std::fabs(a) * (1.0 / 3);
+
+    // A root much smaller than the terms summed for it has lost digits to their cancellation,
+    // which a Newton step recovers
+    if (std::fabs(x) < 1e-3 * terms) {
+        double g = ((x + a) * x + b) * x + c, dg = (3 * x + 2 * a) * x + b;
+        if (dg != 0) x -= g / dg;
+    }
+    return x;
+}
+
+// Smallest root in [lo, hi] of the depressed quartic y^4 + p y^2 + q y + r, as quartic_first_root
+// finds it, but in closed form by Ferrari's method: m, the largest root of the resolvent cubic,
+// splits the quartic into the quadratics y^2 -+ sqrt(2m) y + p/2 + m +- q / (2 sqrt(2m)). The root
+// is polished with a Newton step on the quartic and only taken when
+//   - neither quadratic is close to a double root, where rounding decides whether a grazing pair
+//     of roots is reported at all,
+//   - no root is so close to lo or hi that rounding decides which side of it the root falls,
+//   - the number of roots placed in [lo, hi] agrees with the signs of the quartic at the ends,
+//   - and the Newton step stays within a small step of the root, on a slope crossing away from
+//     the sign the quartic has at lo.
+// Anything else falls back to the bracketed isolation.
+inline bool depressed_quartic_first_root(double p, double q, double r, double lo, double hi, double& root) {
+    const double c[5] = { r, q, p, 0, 1 };
+    const double ambiguous = 1e-8;
+    auto fallback = [&] { return quartic_first_root(c, lo, hi, root); };
+    auto f = [&](double y) { double y2 = y * y; return (y2 + p) * y2 + q * y + r; };
+
+    double m = cubic_largest_root(p, 0.25 * p * p - r, -0.125 * q * q);
+    double s, t;
+    if (m > 1e-12 * (std::fabs(p) + std::sqrt(std::fabs(r)))) {
+        // t = q / (2 s), divided out of m so that the division does not wait on the square root
+        s = std::sqrt(2 * m);
+        t = (q / (4 * m)) * s;
+    } else {
+        // m is lost in rounding, and q with it, which leaves q / (2 s) as 0 / 0: the quartic is
+        // biquadratic, and t comes from t^2 = (m + p/2)^2 - r at m = 0 instead.
+        m = s = 0;
+        double t2 = 0.25 * p * p - r;
+        t = std::copysign(std::sqrt(t2 > 0 ? t2 : 0), q);
+    }
+    const double quad[2][2] = { { -s, 0.5 * p + m + t }, { s, 0.5 * p + m - t } };
+
+    // The roots in [lo, hi] are counted and the smallest kept without branching on them, which
+    // would mispredict on every other ray.
+    const double edge = 1e-6 * (std::fabs(lo) + std::fabs(hi) + std::sqrt(std::fabs(p)));
+    int inside = 0, at_edge = 0;
+    double x = hi;
+    for (const auto& [B, C] : quad) {
+        double D = B * B - 4 * C;
+        if (std::fabs(D) <= ambiguous * (B * B + 4 * std::fabs(C) + std::fabs(p) + std::fabs(r))) return fallback();
+        // The root of larger magnitude, h, without cancellation; the other one, -B - h, may lose
+        // digits relative to itself but not against [lo, hi], and is polished if it is taken.
+        double h = -0.5 * (B + std::copysign(std::sqrt(D > 0 ? D : 0), B));
+        for (double y : { h, -B - h }) {
+            bool in = (D > 0) & (y >= lo) & (y <= hi);
+            at_edge += (D > 0) & ((std::fabs(y - lo) <= edge) | (std::fabs(y - hi) <= edge));
+            inside += in;
+            x = std::min(x, in ? y : hi);
+        }
+    }
+    double f_lo = f(lo), f_hi = f(hi);
+    if (at_edge || f_lo == 0 || f_hi == 0 || (inside % 2 == 1) != ((f_lo < 0) != (f_hi < 0))) return fallback();
+    if (inside == 0) return false;
+
+    // The residual check: a Newton step that moves the root by no more than step, down a slope
+    // heading away from the sign at lo, puts a simple crossing within step of it
+    double step = 1e-7 * (hi - lo + std::fabs(x));
+    double df = (4 * x * x + 2 * p) * x + q;
+    double polished = x - f(x) / df;
+    if (!((df < 0) == (f_lo > 0) && std::fabs(polished - x) <= step)) return fallback();
+    root = polished;
+    return true;
+}
+
 vec3 rotate(const vec3& v, double angle, const vec3& axis) {
     // Normalize the axis
     vec3 a = unit_vector(axis);
@@ -8,7 +8,7 @@ using point3 = vec3;
 class sphere : public hittable {
   public:
     // Stationary Sphere
-    sphere(const point3& static_center, double radius)
+    sphere(const point3& static_center, real radius)
       : center(static_center, vec3(0,0,0)), radius(std::fmax(0,radius))
     {
       set_bounding_box();
@@ -16,7 +16,7 @@ class sphere : public hittable {
     }
 
     // Moving Sphere // Motion blur
-    sphere(const point3& center1, const point3& center2, double radius)
+    sphere(const point3& center1, const point3& center2, real radius)
       : center(center1, center2 - center1), radius(std::fmax(0,radius))
     {
       set_bounding_box();
@@ -66,6 +66,7 @@ class sphere : public hittable {
         vec3 outward_normal = (rec.p - current_center) / radius;
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
+        get_sphere_tangents(outward_normal, radius, rec.dpdu, rec.dpdv);
         rec.mat = mat;
 
         return true;
@@ -83,12 +84,12 @@ class sphere : public hittable {
 
 
 
-  private:
-    ray center;
-    double radius;
+    // Center at time 0 and its displacement over the shutter interval.
+    const ray& get_center() const { return center; }
+    real get_radius() const { return radius; }
 
     // y, x, z =−cos(θ), −cos(ϕ)sin(θ), sin(ϕ)sin(θ)
-    static void get_sphere_uv(const point3& p, double& u, double& v) {
+    static void get_sphere_uv(const point3& p, real& u, real& v) {
         // p: a given point on the sphere of radius one, centered at the origin.
         // u: returned value [0,1] of angle around the Y axis from X=-1.
         // v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -102,6 +103,24 @@ class sphere : public hittable {
         u = phi / (2*pi);
         v = theta / pi;
     }
+
+    // Derivatives of the point on a sphere of the given radius along the u and v of
+    // get_sphere_uv, at unit normal n. At the poles, where u has no direction, dpdu is zero.
+    static void get_sphere_tangents(const vec3& n, real radius, vec3& dpdu, vec3& dpdv) {
+        // With phi and theta as above, n = (-cos(phi) sin(theta), -cos(theta), sin(phi) sin(theta))
+        real sin_theta = std::sqrt(std::fmax(real(0), 1 - n.y * n.y));
+        dpdu = (2 * pi * radius) * vec3(n.z, 0, -n.x);
+        if (sin_theta > 1e-6) {
+            real k = n.y / sin_theta;
+            dpdv = (pi * radius) * vec3(-n.x * k, sin_theta, -n.z * k);
+        } else {
+            dpdv = vec3(0);
+        }
+    }
+
+  private:
+    ray center;
+    real radius;
 };
 #endif
 
@@ -0,0 +1,228 @@
+#ifndef SPHERE_CLOUD_H
+#define SPHERE_CLOUD_H
+
+#include "hittable.h"
+#include "sphere.h"
+#include "batch_kernels.h"
+#include "wide_bvh.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Particles loaded as one object: a few million small spheres cost 18 bytes each plus their
+// share of the BVH, instead of a hittable with its own name, material and bounds apiece.
+// Centers, radii and material indices are separate arrays (SoA) in BVH leaf order, so each
+// leaf is one run handed to the batched sphere kernel.
+struct sphere_cloud_data {
+    std::string source;
+    std::vector<float> cx, cy, cz, radius; // Padded by batch_padding for the SIMD kernels
+    std::vector<uint16_t> material;       // Into the owning cloud's palette
+    std::vector<flat_bvh_node> nodes;
+    std::vector<wide_bvh_node<wide_bvh_width>> wide_nodes;
+    float bmin[3] = { 0, 0, 0 };
+    float bmax[3] = { 0, 0, 0 };
+
+    size_t count() const { return material.size(); }
+
+    void add(float x, float y, float z, float r, uint16_t m = 0) {
+        cx.push_back(x);
+        cy.push_back(y);
+        cz.push_back(z);
+        radius.push_back(r);
+        material.push_back(m);
+    }
+
+    // Builds the BVH, reorders the particles into its leaves and pads the arrays.
+    void build_bvh() {
+        size_t n = count();
+        std::vector<flat_bvh_prim> prims(n);
+        for (size_t i = 0; i < n; i++) {
+            flat_bvh_prim& p = prims[i];
+            float c[3] = { cx[i], cy[i], cz[i] };
+            for (int a = 0; a < 3; a++) {
+                p.bmin[a] = c[a] - radius[i];
+                p.bmax[a] = c[a] + radius[i];
+                p.centroid[a] = c[a];
+            }
+            p.index = static_cast<uint32_t>(i);
+        }
+
+        // Leaves as wide as the widest sphere kernel
+        nodes = flat_bvh_builder(8).build(prims);
+
+        auto reorder = [&](auto& values) {
+            std::remove_reference_t<decltype(values)> ordered(n);
+            for (size_t i = 0; i < n; i++) ordered[i] = values[prims[i].index];
+            values.swap(ordered);
+        };
+        reorder(cx);
+        reorder(cy);
+        reorder(cz);
+        reorder(radius);
+        reorder(material);
+        for (auto* values : { &cx, &cy, &cz, &radius }) values->resize(n + batch_padding, 0.0f);
+
+        if (!nodes.empty()) {
+            std::copy(nodes[0].bmin, nodes[0].bmin + 3, bmin);
+            std::copy(nodes[0].bmax, nodes[0].bmax + 3, bmax);
+        }
+        wide_nodes = wide_bvh_collapse<wide_bvh_width>(nodes.data(), nodes.size());
+    }
+};
+
+// Raw little-endian particle files, one fixed-size record per particle and no header:
+//   .xyzr   float32 x, y, z, radius
+//   .xyzrm  the same followed by a uint32 material index into the cloud's palette
+inline shared_ptr<const sphere_cloud_data> load_sphere_cloud(const std::string& filename) {
+    static std::mutex library_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<const sphere_cloud_data>> library;
+
+    std::lock_guard<std::mutex> lock(library_mutex);
+    auto it = library.find(filename);
+    if (it != library.end()) {
+        if (auto shared = it->second.lock()) return shared;
+    }
+
+    std::string ext = filename.substr(filename.find_last_of('.') + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    size_t record;
+    if (ext == "xyzr") record = 16;
+    else if (ext == "xyzrm") record = 20;
+    else throw std::runtime_error("Unsupported particle format: " + filename);
+
+    mapped_file file;
+    if (!file.open(filename)) {
+        throw std::runtime_error("Failed to open particle file: " + filename);
+    }
+    if (file.size() == 0 || file.size() % record != 0) {
+        throw std::runtime_error("Particle file is not a whole number of records: " + filename);
+    }
+
+    auto data = make_shared<sphere_cloud_data>();
+    data->source = filename;
+    size_t n = file.size() / record;
+    for (auto* values : { &data->cx, &data->cy, &data->cz, &data->radius }) values->reserve(n + batch_padding);
+    data->material.reserve(n);
+
+    const unsigned char* p = file.data();
+    for (size_t i = 0; i < n; i++, p += record) {
+        float v[4];
+        std::memcpy(v, p, sizeof(v));
+        if (!std::isfinite(v[0]) || !std::isfinite(v[1]) || !std::isfinite(v[2]) || !(v[3] > 0 && v[3] < INFINITY)) {
+            throw std::runtime_error("Invalid particle " + std::to_string(i) + " in " + filename);
+        }
+        uint32_t m = 0;
+        if (record == 20) std::memcpy(&m, p + 16, sizeof(m));
+        data->add(v[0], v[1], v[2], v[3], static_cast<uint16_t>(std::min<uint32_t>(m, UINT16_MAX)));
+    }
+    data->build_bvh();
+
+    std::clog << "Loaded particles " << filename << ": " << data->count() << " spheres, "
+              << data->nodes.size() << " BVH nodes\n";
+
+    library[filename] = data;
+    return data;
+}
+
+class sphere_cloud : public hittable {
+  public:
+    sphere_cloud(shared_ptr<const sphere_cloud_data> data, const point3& position)
+      : data(data), offset(position)
+    {
+        set_bounding_box();
+    }
+
+    void set_bounding_box() override {
+        bbox = aabb(point3(data->bmin[0], data->bmin[1], data->bmin[2]) + offset,
+                    point3(data->bmax[0], data->bmax[1], data->bmax[2]) + offset);
+    }
+
+    // Particles stay in file space; moving the cloud only changes the offset applied to rays.
+    void move_by(const point3& delta) override {
+        offset += delta;
+        set_bounding_box();
+    }
+
+    // Materials the particles' indices refer to. Indices past the end, and every particle
+    // while the palette is empty, use the cloud's own material.
+    void set_palette(std::vector<shared_ptr<material>> materials) { palette = std::move(materials); }
+
+    // Palette entries the particles refer to: one past the largest index
+    size_t material_count() const {
+        auto largest = std::max_element(data->material.begin(), data->material.end());
+        return largest == data->material.end() ? 0 : size_t(*largest) + 1;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        const vec3 o = r.origin() - offset;
+        const vec3 d = r.direction();
+        float org[3] = { float(o.x), float(o.y), float(o.z) };
+        float dir[3] = { float(d.x), float(d.y), float(d.z) };
+
+        // The particles do not move, so the kernel's velocity arrays alias the centers and the
+        // ray time is 0: the displacement term is exactly zero.
+        const sphere_batch<float> batch{ data->cx.data(), data->cy.data(), data->cz.data(),
+                                         data->cx.data(), data->cy.data(), data->cz.data(),
+                                         data->radius.data() };
+        const float dd = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+
+        float t_max = static_cast<float>(ray_t.max);
+        float t_min = static_cast<float>(ray_t.min);
+        int hit_sphere = -1;
+        auto leaf = [&](uint32_t first, uint32_t count, float& t_far) {
+            // Small particles far from the ray origin would lose the whole discriminant to
+            // cancellation in |o - c|^2 - r^2, so each leaf is tested from the point of the ray
+            // nearest to its first particle.
+            float t0 = ((data->cx[first] - org[0]) * dir[0] + (data->cy[first] - org[1]) * dir[1]
+                      + (data->cz[first] - org[2]) * dir[2]) / dd;
+            const batch_ray<float> local{ org[0] + t0 * dir[0], org[1] + t0 * dir[1], org[2] + t0 * dir[2],
+                                          dir[0], dir[1], dir[2], 0.0f };
+            float local_far = t_far - t0;
+            int k = sphere_batch_hit(batch, first, count, local, t_min - t0, local_far);
+            if (k < 0) return false;
+            t_far = local_far + t0;
+            hit_sphere = k;
+            return true;
+        };
+
+        if (!wide_bvh_traverse(data->wide_nodes.data(), data->wide_nodes.size(), org, dir, t_min, t_max, leaf))
+            return false;
+
+        point3 center = point3(data->cx[hit_sphere], data->cy[hit_sphere], data->cz[hit_sphere]) + offset;
+        rec.t = t_max;
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - center) / real(data->radius[hit_sphere]);
+        rec.set_face_normal(r, outward_normal);
+        sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+        sphere::get_sphere_tangents(outward_normal, real(data->radius[hit_sphere]), rec.dpdu, rec.dpdv);
+        uint16_t m = data->material[hit_sphere];
+        rec.mat = m < palette.size() && palette[m] ? palette[m] : mat;
+        return true;
+    }
+
+    std::ostream& print(std::ostream& out) const override {
+        out << "SphereCloud(file=" << data->source
+            << ", spheres=" << data->count()
+            << ", offset=" << offset << ")";
+        return out;
+    }
+
+    std::istream& write(std::istream& in) const override {
+        return in;
+    }
+
+  private:
+    shared_ptr<const sphere_cloud_data> data;
+    vec3 offset;
+    std::vector<shared_ptr<material>> palette;
+};
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "rtw_stb_image.h"
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Process-wide cache of decoded images, so every texture naming the same file shares one
+// immutable copy and editing an object does not decode its image again. Files are keyed by
+// their resolved, canonical path; a file whose modification time changed is decoded anew.
+//
+// Images in use are always shared, however many there are. On top of that the cache keeps
+// the most recently requested images alive after their last user is gone, up to a memory
+// budget, dropping the least recently used first.
+class texture_cache {
+  public:
+    struct statistics {
+        size_t hits = 0;
+        size_t misses = 0;      // Decodes, including reloads of changed files
+        size_t evictions = 0;
+        size_t retained_bytes = 0;
+        size_t retained_images = 0;
+    };
+
+    static texture_cache& instance() {
+        static texture_cache cache;
+        return cache;
+    }
+
+    // The image for a file, searched for like rtw_image does. Files that cannot be found or
+    // decoded give an empty image and are not cached, so they are tried again next time.
+    std::shared_ptr<const rtw_image> get(const std::string& filename) {
+        std::string path = rtw_image::find_file(filename);
+        std::error_code ec;
+        if (!path.empty()) {
+            auto canonical = std::filesystem::weakly_canonical(path, ec);
+            if (!ec) path = canonical.string();
+        }
+        auto mtime = path.empty() ? std::filesystem::file_time_type() : std::filesystem::last_write_time(path, ec);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!path.empty() && !ec) {
+            auto it = entries.find(path);
+            if (it != entries.end() && it->second.mtime == mtime) {
+                if (auto image = it->second.image.lock()) {
+                    stats.hits++;
+                    retain(it->second, image);
+                    return image;
+                }
+            }
+        }
+
+        stats.misses++;
+        auto image = std::make_shared<const rtw_image>(path.empty() ? filename.c_str() : path.c_str());
+        if (path.empty() || ec || image->height() <= 0) return image;
+
+        auto it = entries.try_emplace(path).first;
+        if (it->second.is_retained) release(it->second);
+        it->second.image = image;
+        it->second.mtime = mtime;
+        it->second.bytes = image->memory_size();
+        retain(it->second, image);
+        return image;
+    }
+
+    // Memory the cache may keep alive for images no one is using. Zero keeps none.
+    void set_budget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    size_t get_budget() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return budget;
+    }
+
+    statistics get_stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    // Lets go of every retained image; images still in use stay shared.
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!lru.empty()) release(*lru.back().first);
+    }
+
+  private:
+    struct entry;
+    using retained_list = std::list<std::pair<entry*, std::shared_ptr<const rtw_image>>>;
+
+    struct entry {
+        std::weak_ptr<const rtw_image> image;
+        std::filesystem::file_time_type mtime;
+        size_t bytes = 0;
+        bool is_retained = false;
+        retained_list::iterator retained; // Into lru while is_retained
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, entry> entries; // Node-based, so entry pointers stay valid
+    retained_list lru; // Most recently used first
+    size_t budget = size_t(512) << 20;
+    statistics stats;
+
+    texture_cache() = default;
+
+    void retain(entry& e, const std::shared_ptr<const rtw_image>& image) {
+        if (e.is_retained) {
+            lru.splice(lru.begin(), lru, e.retained);
+        } else {
+            lru.emplace_front(&e, image);
+            e.retained = lru.begin();
+            e.is_retained = true;
+            stats.retained_bytes += e.bytes;
+            stats.retained_images++;
+        }
+        evict();
+    }
+
+    void release(entry& e) {
+        lru.erase(e.retained);
+        e.is_retained = false;
+        stats.retained_bytes -= e.bytes;
+        stats.retained_images--;
+    }
+
+    void evict() {
+        while (stats.retained_bytes > budget && !lru.empty()) {
+            release(*lru.back().first);
+            stats.evictions++;
+        }
+    }
+};
+
+#endif
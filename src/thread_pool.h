@@ -0,0 +1,113 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    ThreadPool(size_t num_threads) : stop(false) {
+        for (size_t i = 0; i < num_threads; ++i) {
+            workers.emplace_back([this] {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(queue_mutex);
+                        condition.wait(lock, [this] { return stop || !tasks.empty(); });
+                        if (stop && tasks.empty()) return;
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                    }
+                    task();
+                    notify_task_completion();
+                }
+            });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            stop = true;
+        }
+        condition.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void enqueue(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            tasks.push(std::move(task));
+            total_tasks++;
+        }
+        condition.notify_one();
+    }
+
+    void wait_for_completion() {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        completion_condition.wait(lock, [this] { return tasks_completed >= total_tasks; });
+    }
+
+
+    void notify_task_completion() {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            tasks_completed++;
+        }
+        completion_condition.notify_one();
+    }
+
+    // Runs fn(begin, end) over [0, count) in chunks of `grain` items and returns once every
+    // chunk is done. Must not be called from one of the pool's own tasks.
+    void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+        if (count == 0) return;
+        grain = std::max<size_t>(1, grain);
+        size_t chunks = (count + grain - 1) / grain;
+        if (chunks == 1 || workers.empty()) {
+            for (size_t begin = 0; begin < count; begin += grain)
+                fn(begin, std::min(count, begin + grain));
+            return;
+        }
+
+        std::mutex done_mutex;
+        std::condition_variable done;
+        size_t remaining = chunks;
+        for (size_t begin = 0; begin < count; begin += grain) {
+            size_t end = std::min(count, begin + grain);
+            enqueue([&, begin, end]() {
+                fn(begin, end);
+                std::lock_guard<std::mutex> lock(done_mutex);
+                if (--remaining == 0) done.notify_one();
+            });
+        }
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done.wait(lock, [&] { return remaining == 0; });
+    }
+
+    size_t size() const { return workers.size(); }
+
+    void reset_completion() {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        tasks_completed = 0;
+        total_tasks = 0;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queue_mutex;
+    std::condition_variable condition;
+    std::condition_variable completion_condition;
+    bool stop;
+    size_t tasks_completed = 0;
+    size_t total_tasks = 0;
+};
+
+#endif
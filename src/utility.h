@@ -24,15 +24,26 @@
 using std::make_shared;
 using std::shared_ptr;
 
+// Precision Policy
+
+// Scalar type of the whole intersection and shading path: vectors, intervals, ray times and
+// hit records all use it, so a hit never converts between widths. Float by default; configure
+// with ZENGINE_DOUBLE_PRECISION for reference renders.
+#ifdef ZENGINE_DOUBLE_PRECISION
+using real = double;
+#else
+using real = float;
+#endif
+
 // Constants
 
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = real(3.1415926535897932385);
 
 // Utility Functions
 
-inline double degrees_to_radians(double degrees) {
-    return degrees * pi / 180.0;
+inline real degrees_to_radians(real degrees) {
+    return degrees * pi / real(180);
 }
 
 inline double random_double() {
@@ -54,11 +65,11 @@ struct float3 {
 double random_double();
 double random_double(double min, double max);
 
-// Use GLM's vec3 instead of custom vec3 class
-using vec3 = glm::vec3;
+// Use GLM's vec3 instead of custom vec3 class, in the configured precision
+using vec3 = glm::vec<3, real>;
 
-// point3 is an alias for glm::vec3
-using point3 = glm::vec3;
+// point3 is an alias for vec3
+using point3 = vec3;
 
 // Vector Utility Functions
 
@@ -68,20 +79,18 @@ std::ostream& operator<<(std::ostream& out, const vec3& v) {
 }
 
 
-inline vec3 operator*(double t, const vec3& v) {
-    return static_cast<float>(t) * v; // GLM scalar multiplication
+// Scalar overloads let mixed literals like `0.5 * v` compile; real arguments match GLM's own
+// operators exactly. Component-wise vec3 / vec3 comes from GLM.
+inline vec3 operator*(real t, const vec3& v) {
+    return vec3(t) * v; // GLM scalar multiplication
 }
 
-inline vec3 operator*(const vec3& v, double t) {
+inline vec3 operator*(const vec3& v, real t) {
     return t * v;
 }
 
-inline vec3 operator/(const vec3& v, double t) {
-    return v / static_cast<float>(t); // GLM scalar division
-}
-
-inline vec3 operator/(const vec3& v, const vec3& u) {
-    return v / u; // GLM component-wise division
+inline vec3 operator/(const vec3& v, real t) {
+    return v / vec3(t); // GLM scalar division
 }
 
 inline bool operator==(const vec3& u, const vec3& v) {
@@ -92,7 +101,7 @@ inline bool operator!=(const vec3& u, const vec3& v) {
     return !glm::all(glm::equal(u, v)); // GLM inequality check
 }
 
-inline double dot(const vec3& u, const vec3& v) {
+inline real dot(const vec3& u, const vec3& v) {
     return glm::dot(u, v); // GLM dot product
 }
 
@@ -120,12 +129,12 @@ inline vec3 reflect(const vec3& v, const vec3& n) {
     return glm::reflect(v, n); // GLM reflection
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-    return glm::refract(uv, n, static_cast<float>(etai_over_etat)); // GLM refraction
+inline vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
+    return glm::refract(uv, n, etai_over_etat); // GLM refraction
 }
 
 inline vec3 random_in_unit_disk() {
-    return glm::sphericalRand(1.0f); // GLM random in unit disk
+    return glm::sphericalRand(real(1)); // GLM random in unit disk
 }
 
 inline int random_int(int min, int max) {
@@ -156,7 +165,7 @@ public:
 
     // Matrix inverse (using adjugate method)
     mat3 inverse() const {
-        double det = data[0] * (data[4] * data[8] - data[7] * data[5]) -
+        real det = data[0] * (data[4] * data[8] - data[7] * data[5]) -
                      data[3] * (data[1] * data[8] - data[7] * data[2]) +
                      data[6] * (data[1] * data[5] - data[4] * data[2]);
         if (std::abs(det) < 1e-8) {
@@ -187,7 +196,7 @@ public:
     }
 
 private:
-    double data[9]; // Column-major storage
+    real data[9]; // Column-major storage
 };
 
 // Extension of vec3 to include missing methods
@@ -195,17 +204,17 @@ inline vec3 randomVec3() {
     return vec3(random_double(), random_double(), random_double());
 }
 
-inline vec3 randomVec3(double min, double max) {
+inline vec3 randomVec3(real min, real max) {
     return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
 }
 
 inline bool near_zero(const vec3& v) {
-    const float s = 1e-8;
+    const real s = real(1e-8);
     return glm::all(glm::lessThan(glm::abs(v), vec3(s)));
 }
 
 inline float3 to_float3(const vec3& v) {
-    return float3{v.x, v.y, v.z};
+    return float3{float(v.x), float(v.y), float(v.z)};
 }
 
 
@@ -215,7 +224,7 @@ class ray {
   public:
     ray() {}
 
-    ray(const point3& origin, const vec3& direction, double time)
+    ray(const point3& origin, const vec3& direction, real time)
       : orig(origin), dir(direction), tm(time) {}
 
     ray(const point3& origin, const vec3& direction)
@@ -224,16 +233,36 @@ class ray {
     const point3& origin() const  { return orig; }
     const vec3& direction() const { return dir; }
 
-    double time() const { return tm; }
+    real time() const { return tm; }
 
-    point3 at(double t) const {
+    point3 at(real t) const {
         return orig + t*dir;
     }
 
+    // Ray differentials: the rays through the neighbouring pixels in x and y, carried along
+    // camera rays and their specular bounces so a hit can tell how much of a texture one
+    // pixel covers. Rays built without them leave textures unfiltered.
+    bool has_differentials() const { return differentials; }
+    const point3& rx_origin() const { return rx_orig; }
+    const point3& ry_origin() const { return ry_orig; }
+    const vec3& rx_direction() const { return rx_dir; }
+    const vec3& ry_direction() const { return ry_dir; }
+
+    void set_differentials(const point3& rx_o, const vec3& rx_d, const point3& ry_o, const vec3& ry_d) {
+        rx_orig = rx_o;
+        rx_dir = rx_d;
+        ry_orig = ry_o;
+        ry_dir = ry_d;
+        differentials = true;
+    }
+
   private:
     point3 orig;
     vec3 dir;
-    double tm;
+    real tm;
+    bool differentials = false;
+    point3 rx_orig, ry_orig;
+    vec3 rx_dir, ry_dir;
 };
 
 std::ostream& operator<<(std::ostream& out, const ray& r) {
@@ -249,17 +278,57 @@ class hit_record {
     point3 p;
     vec3 normal;
     shared_ptr<material> mat;
-    double t;
-    double u;
-    double v;
+    real t;
+    real u;
+    real v;
     bool front_face;
+    // Change of p per unit of u and of v, for texture filtering. Primitives that do not
+    // provide them leave them zero, and textures on them are sampled unfiltered.
+    vec3 dpdu = vec3(0);
+    vec3 dpdv = vec3(0);
 
     void set_face_normal(const ray& r, const vec3& outward_normal) {
-        // Sets the hit record normal vector.
+        // Sets the hit record normal vector, and clears the tangents, which the primitive
+        // sets afterwards if it has them.
         // NOTE: the parameter `outward_normal` is assumed to have unit length.
 
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
+        dpdu = dpdv = vec3(0);
+    }
+
+    // Where the ray's x and y differential rays cross the tangent plane at p. False if the
+    // ray has no differentials or they run parallel to the plane.
+    bool differential_hits(const ray& r, point3& px, point3& py) const {
+        if (!r.has_differentials()) return false;
+        real d = dot(normal, p);
+        real nx = dot(normal, r.rx_direction()), ny = dot(normal, r.ry_direction());
+        if (nx == 0 || ny == 0) return false;
+        px = r.rx_origin() + ((d - dot(normal, r.rx_origin())) / nx) * r.rx_direction();
+        py = r.ry_origin() + ((d - dot(normal, r.ry_origin())) / ny) * r.ry_direction();
+        return true;
+    }
+
+    // Width in texture coordinates of the pixel footprint of the hit, or 0 if it is not
+    // known. The footprint's offsets along the tangent plane are expressed in u and v by
+    // least squares on the tangents, as in pbrt.
+    real uv_footprint(const ray& r) const {
+        point3 px, py;
+        if (!differential_hits(r, px, py)) return 0;
+        real a00 = dot(dpdu, dpdu), a01 = dot(dpdu, dpdv), a11 = dot(dpdv, dpdv);
+        real det = a00 * a11 - a01 * a01;
+        if (!(std::fabs(det) > 1e-20)) return 0;
+
+        auto uv_offset = [&](const vec3& dp, real& du, real& dv) {
+            real b0 = dot(dpdu, dp), b1 = dot(dpdv, dp);
+            du = (a11 * b0 - a01 * b1) / det;
+            dv = (a00 * b1 - a01 * b0) / det;
+        };
+        real dudx, dvdx, dudy, dvdy;
+        uv_offset(px - p, dudx, dvdx);
+        uv_offset(py - p, dudy, dvdy);
+        real width = std::fmax(std::fmax(std::fabs(dudx), std::fabs(dvdx)), std::fmax(std::fabs(dudy), std::fabs(dvdy)));
+        return std::isfinite(width) ? width : 0;
     }
 };
 
@@ -0,0 +1,808 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include "material.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Virtual textures (.ztx): an image and its mip chain cut into square pages, which are read
+// from disk one at a time as rendering touches them, so only a bounded working set of a huge
+// texture is ever decoded in memory.
+//
+// The file starts with a ztx_header, followed by one ztx_page entry per page and then the
+// pages themselves. Levels follow each other from the full image down to 1x1 texel, sized
+// like rtw_image's mip chain, and each level's pages are numbered row by row; the pages
+// themselves may be stored in any order, the table giving where each one is. A page holds
+// 2^page_shift x 2^page_shift texels in the tiled layout of image_view, as sRGB bytes or half
+// floats like rtw_image; pages at the right and bottom edges repeat the last texel. Pages may
+// be deflate-compressed (zlib format) after replacing each byte with its difference from the
+// byte one texel earlier.
+struct ztx_header {
+    char magic[4];              // "ZTX\0"
+    uint32_t version;
+    uint32_t byte_order;        // ztx_byte_order as written by the producing machine
+    uint32_t width;             // Of the full image, in texels
+    uint32_t height;
+    int32_t format;             // image_format_rgb8 or image_format_rgb16f
+    uint32_t page_shift;
+    uint32_t level_count;
+    uint32_t page_count;
+    uint32_t padding0;
+    uint64_t page_table_offset;
+    uint64_t file_size;
+    uint32_t padding[2];
+};
+
+struct ztx_page {
+    uint64_t offset;            // From the start of the file
+    uint32_t size;              // Stored bytes
+    uint32_t compressed;        // 1 if deflated, 0 if stored as is
+};
+
+static_assert(sizeof(ztx_header) == 64, "ztx_header must stay 64 bytes");
+static_assert(sizeof(ztx_page) == 16, "ztx_page must stay 16 bytes");
+
+constexpr uint32_t ztx_version = 1;
+constexpr uint32_t ztx_byte_order = 0x01020304;
+constexpr uint32_t ztx_page_shift = 6;
+
+// Zlib stream of `size` bytes: greedy LZ77 over a 32 KB window with hash chains, coded with
+// the fixed Huffman tables of deflate. Inflated by stb_image's zlib decoder at load time.
+inline std::vector<unsigned char> deflate_bytes(const unsigned char* data, size_t size) {
+    std::vector<unsigned char> out = { 0x78, 0x01 };
+    uint32_t bits = 0;
+    int bit_count = 0;
+    auto put = [&](uint32_t value, int count) { // LSB first
+        bits |= value << bit_count;
+        bit_count += count;
+        while (bit_count >= 8) {
+            out.push_back(static_cast<unsigned char>(bits));
+            bits >>= 8;
+            bit_count -= 8;
+        }
+    };
+    auto put_code = [&](uint32_t code, int count) { // Huffman codes go MSB first
+        uint32_t reversed = 0;
+        for (int i = 0; i < count; i++) reversed |= ((code >> i) & 1) << (count - 1 - i);
+        put(reversed, count);
+    };
+    auto literal = [&](int symbol) {
+        if (symbol < 144) put_code(0x30 + symbol, 8);
+        else if (symbol < 256) put_code(0x190 + symbol - 144, 9);
+        else if (symbol < 280) put_code(symbol - 256, 7);
+        else put_code(0xc0 + symbol - 280, 8);
+    };
+
+    static const int length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51,
+                                         59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const int length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,
+                                          4, 5, 5, 5, 5, 0 };
+    static const int dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                       513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const int dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10,
+                                        10, 11, 11, 12, 12, 13, 13 };
+
+    constexpr int window = 32768, max_match = 258, max_chain = 16, hash_bits = 15;
+    std::vector<int32_t> head(1 << hash_bits, -1), prev(size, -1);
+    auto hash = [&](size_t i) {
+        return ((uint32_t(data[i]) << 16 | uint32_t(data[i + 1]) << 8 | data[i + 2]) * 2654435761u) >> (32 - hash_bits);
+    };
+
+    put(1, 1); // Final block
+    put(1, 2); // Fixed Huffman codes
+    size_t i = 0;
+    while (i < size) {
+        int best_length = 0, best_distance = 0;
+        if (i + 3 <= size) {
+            uint32_t h = hash(i);
+            int limit = int(std::min<size_t>(max_match, size - i));
+            int chain = 0;
+            for (int32_t j = head[h]; j >= 0 && int(i - j) <= window && chain < max_chain; j = prev[j], chain++) {
+                int length = 0;
+                while (length < limit && data[j + length] == data[i + length]) length++;
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = int(i - j);
+                    if (length == limit) break;
+                }
+            }
+            prev[i] = head[h];
+            head[h] = int32_t(i);
+        }
+
+        if (best_length < 3) {
+            literal(data[i++]);
+            continue;
+        }
+        int l = 28;
+        while (length_base[l] > best_length) l--;
+        literal(257 + l);
+        put(best_length - length_base[l], length_extra[l]);
+        int d = 29;
+        while (dist_base[d] > best_distance) d--;
+        put_code(d, 5);
+        put(best_distance - dist_base[d], dist_extra[d]);
+
+        // The matched bytes still go into the hash chains
+        for (size_t end = i + best_length, k = i + 1; k < end; k++) {
+            if (k + 3 <= size) {
+                uint32_t h = hash(k);
+                prev[k] = head[h];
+                head[h] = int32_t(k);
+            }
+        }
+        i += best_length;
+    }
+    literal(256); // End of block
+    if (bit_count > 0) put(0, 8 - bit_count);
+
+    uint32_t a = 1, b = 0;
+    for (size_t k = 0; k < size; k++) {
+        a = (a + data[k]) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint32_t adler = b << 16 | a;
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<unsigned char>(adler >> shift));
+    return out;
+}
+
+// An open .ztx file: the mapping, its page table and the layout of its levels. Pages are
+// decoded on demand, through the page_cache.
+struct virtual_texture_data {
+    struct level {
+        int width, height;       // In texels
+        int pages_x, pages_y;
+        uint32_t first_page;     // Index of the level's first page in the page table
+    };
+
+    std::string source;
+    uint32_t id = 0;             // Distinguishes the file's pages in the page cache
+    int format = image_format_rgb8;
+    int bytes_per_pixel = 3;
+    int page_shift = ztx_page_shift;
+    int page_size = 1 << ztx_page_shift;
+    std::vector<level> levels;
+    mapped_file file;
+    const ztx_page* pages = nullptr;
+
+    int width() const { return levels[0].width; }
+    int height() const { return levels[0].height; }
+
+    size_t page_bytes() const { return size_t(page_size) * page_size * bytes_per_pixel; }
+
+    // Decoded texels of a page, with one spare byte like rtw_image so the image_sample
+    // kernels can fetch the last texel with a 32-bit load. A page that fails to inflate
+    // comes back black.
+    std::vector<unsigned char> read_page(uint32_t page) const {
+        std::vector<unsigned char> texels(page_bytes() + 1, 0);
+        const ztx_page& entry = pages[page];
+        const char* stored = reinterpret_cast<const char*>(file.data() + entry.offset);
+        if (!entry.compressed) {
+            std::memcpy(texels.data(), stored, page_bytes());
+            return texels;
+        }
+        int n = stbi_zlib_decode_buffer(reinterpret_cast<char*>(texels.data()), int(page_bytes()), stored, int(entry.size));
+        if (n != int(page_bytes())) {
+            std::cerr << "ERROR: Corrupt page " << page << " in " << source << "\n";
+            std::fill(texels.begin(), texels.end(), 0);
+            return texels;
+        }
+        for (size_t k = bytes_per_pixel; k < page_bytes(); k++) texels[k] += texels[k - bytes_per_pixel];
+        return texels;
+    }
+};
+
+// Levels of a width x height image, as rtw_image builds them, cut into pages
+inline std::vector<virtual_texture_data::level> virtual_texture_levels(int width, int height, int page_shift) {
+    std::vector<virtual_texture_data::level> levels;
+    uint32_t first_page = 0;
+    while (true) {
+        int pages_x = (width + (1 << page_shift) - 1) >> page_shift;
+        int pages_y = (height + (1 << page_shift) - 1) >> page_shift;
+        levels.push_back({ width, height, pages_x, pages_y, first_page });
+        first_page += uint32_t(pages_x) * pages_y;
+        if (width == 1 && height == 1) break;
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+    return levels;
+}
+
+inline shared_ptr<const virtual_texture_data> load_virtual_texture(const std::string& filename) {
+    static std::mutex library_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<const virtual_texture_data>> library;
+    static uint32_t next_id = 0;
+
+    std::lock_guard<std::mutex> lock(library_mutex);
+    auto it = library.find(filename);
+    if (it != library.end()) {
+        if (auto shared = it->second.lock()) return shared;
+    }
+
+    auto data = make_shared<virtual_texture_data>();
+    if (!data->file.open(filename)) {
+        throw std::runtime_error("Failed to open virtual texture: " + filename);
+    }
+    const mapped_file& file = data->file;
+    ztx_header header;
+    if (file.size() < sizeof(header)) {
+        throw std::runtime_error("Virtual texture has no header: " + filename);
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, "ZTX", 4) != 0 || header.version != ztx_version
+        || header.byte_order != ztx_byte_order || header.file_size != file.size()) {
+        throw std::runtime_error("Not a virtual texture of this version: " + filename);
+    }
+    if (header.width == 0 || header.height == 0 || header.width > 1u << 20 || header.height > 1u << 20
+        || (header.format != image_format_rgb8 && header.format != image_format_rgb16f)
+        || header.page_shift < image_tile_shift || header.page_shift > 12) {
+        throw std::runtime_error("Virtual texture has an invalid header: " + filename);
+    }
+
+    data->source = filename;
+    data->id = next_id++;
+    data->format = header.format;
+    data->bytes_per_pixel = header.format == image_format_rgb8 ? 3 : 6;
+    data->page_shift = int(header.page_shift);
+    data->page_size = 1 << header.page_shift;
+    data->levels = virtual_texture_levels(int(header.width), int(header.height), int(header.page_shift));
+    const auto& last = data->levels.back();
+    if (header.level_count != data->levels.size() || header.page_count != last.first_page + 1
+        || header.page_table_offset % alignof(ztx_page) != 0 || header.page_table_offset > file.size()
+        || header.page_count > (file.size() - header.page_table_offset) / sizeof(ztx_page)) {
+        throw std::runtime_error("Virtual texture page table does not match its size: " + filename);
+    }
+    data->pages = reinterpret_cast<const ztx_page*>(file.data() + header.page_table_offset);
+    for (uint32_t p = 0; p < header.page_count; p++) {
+        const ztx_page& entry = data->pages[p];
+        if (entry.offset > file.size() || entry.size > file.size() - entry.offset
+            || (entry.compressed ? entry.size == 0 : entry.size != data->page_bytes())) {
+            throw std::runtime_error("Virtual texture page " + std::to_string(p) + " is out of bounds: " + filename);
+        }
+    }
+
+    std::clog << "Opened virtual texture " << filename << ": " << header.width << "x" << header.height
+              << ", " << header.level_count << " levels, " << header.page_count << " pages\n";
+
+    library[filename] = data;
+    return data;
+}
+
+// The preprocessing step: decodes an image and writes it as a virtual texture, with the mip
+// chain rtw_image would build for it. Rather than building that rtw_image, the levels are
+// converted a row at a time: each row is stored into the band of pages it falls in, which is
+// written out once full, and averaged into the row below it in the next level. Apart from the
+// decoded file, only a band of pages and up to three linear rows per level are held at once.
+// Written to a temporary file and renamed into place, like the mesh cache.
+inline bool write_virtual_texture(const std::string& image_file, const std::string& ztx_file, bool compress) {
+    std::string path = rtw_image::find_file(image_file);
+    int width = 0, height = 0, n;
+    bool hdr = !path.empty() && stbi_is_hdr(path.c_str());
+    std::unique_ptr<float, void (*)(void*)> fdata(
+        hdr ? stbi_loadf(path.c_str(), &width, &height, &n, 3) : nullptr, stbi_image_free);
+    std::unique_ptr<unsigned char, void (*)(void*)> bdata(
+        !hdr && !path.empty() ? stbi_load(path.c_str(), &width, &height, &n, 3) : nullptr, stbi_image_free);
+    if (!fdata && !bdata) {
+        std::cerr << "ERROR: Could not load image file '" << image_file << "'.\n";
+        return false;
+    }
+
+    const int32_t format = hdr ? image_format_rgb16f : image_format_rgb8;
+    const int bytes_per_pixel = hdr ? 6 : 3;
+    const int page_size = 1 << ztx_page_shift, page_mask = page_size - 1;
+    const int page_tiles = page_size >> image_tile_shift;
+    const size_t page_bytes = size_t(page_size) * page_size * bytes_per_pixel;
+    auto levels = virtual_texture_levels(width, height, ztx_page_shift);
+
+    ztx_header header = {};
+    std::memcpy(header.magic, "ZTX", 4);
+    header.version = ztx_version;
+    header.byte_order = ztx_byte_order;
+    header.width = uint32_t(width);
+    header.height = uint32_t(height);
+    header.format = format;
+    header.page_shift = ztx_page_shift;
+    header.level_count = uint32_t(levels.size());
+    header.page_count = levels.back().first_page + 1;
+    header.page_table_offset = sizeof(header);
+    std::vector<ztx_page> table(header.page_count);
+
+    std::string temp_path = ztx_file + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "ERROR: Cannot write virtual texture " << ztx_file << "\n";
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), std::streamsize(table.size() * sizeof(ztx_page)));
+
+    uint64_t offset = sizeof(header) + table.size() * sizeof(ztx_page);
+    size_t stored_bytes = 0;
+    std::vector<unsigned char> filtered(page_bytes);
+    auto write_page = [&](uint32_t index, const unsigned char* page) {
+        ztx_page& entry = table[index];
+        entry.offset = offset;
+        std::vector<unsigned char> deflated;
+        if (compress) {
+            for (size_t k = 0; k < page_bytes; k++)
+                filtered[k] = k < size_t(bytes_per_pixel) ? page[k] : page[k] - page[k - bytes_per_pixel];
+            deflated = deflate_bytes(filtered.data(), page_bytes);
+        }
+        // Pages that do not shrink are stored as they are
+        if (compress && deflated.size() < page_bytes) {
+            entry.size = uint32_t(deflated.size());
+            entry.compressed = 1;
+            out.write(reinterpret_cast<const char*>(deflated.data()), std::streamsize(deflated.size()));
+        } else {
+            entry.size = uint32_t(page_bytes);
+            entry.compressed = 0;
+            out.write(reinterpret_cast<const char*>(page), std::streamsize(page_bytes));
+        }
+        offset += entry.size;
+        stored_bytes += entry.size;
+    };
+
+    struct level_state {
+        std::vector<unsigned char> band;    // The row of pages being filled, one after the other
+        std::vector<float> pending;         // Linear rows not yet averaged into the level below
+        std::vector<float> below;           // The row they average to
+        int rows = 0;                       // Received so far
+        int rows_below = 0;                 // Passed on to the level below so far
+    };
+    std::vector<level_state> state(levels.size());
+    for (size_t l = 0; l < levels.size(); l++) {
+        state[l].band.resize(size_t(levels[l].pages_x) * page_bytes);
+        if (l + 1 < levels.size()) state[l].below.resize(size_t(levels[l + 1].width) * 3);
+    }
+
+    // The next row of level l, as linear RGB, and as stored texels when it already is in that
+    // form (the sRGB bytes of level 0), so they are copied rather than encoded again
+    auto push_row = [&](auto& self, int l, const float* linear, const unsigned char* texels) -> void {
+        const auto& level = levels[l];
+        level_state& s = state[l];
+        int y = s.rows++, row = y & page_mask;
+        auto texel = [&](int x, int r) {
+            return s.band.data() + size_t(x >> ztx_page_shift) * page_bytes
+                   + size_t(image_texel_index(x & page_mask, r, page_tiles)) * bytes_per_pixel;
+        };
+        for (int x = 0; x < level.width; x++) {
+            if (texels) std::memcpy(texel(x, row), texels + size_t(x) * bytes_per_pixel, bytes_per_pixel);
+            else rtw_image::encode(format, linear + size_t(x) * 3, texel(x, row));
+        }
+        // Pages at the right and bottom edges repeat the last texel
+        for (int x = level.width; x < level.pages_x * page_size; x++)
+            std::memcpy(texel(x, row), texel(level.width - 1, row), bytes_per_pixel);
+        if (row == page_mask || y == level.height - 1) {
+            for (int r = row + 1; r < page_size; r++)
+                for (int x = 0; x < level.pages_x * page_size; x++)
+                    std::memcpy(texel(x, r), texel(x, row), bytes_per_pixel);
+            for (int px = 0; px < level.pages_x; px++)
+                write_page(level.first_page + uint32_t(y >> ztx_page_shift) * level.pages_x + px,
+                           s.band.data() + size_t(px) * page_bytes);
+        }
+        if (l + 1 == int(levels.size())) return;
+
+        // rtw_image's 2x2 box filter, summed in the same order: the last row and column of the
+        // level below take in the odd one left over
+        s.pending.insert(s.pending.end(), linear, linear + size_t(level.width) * 3);
+        const auto& next = levels[l + 1];
+        int last_row = s.rows_below == next.height - 1 ? level.height - 1 : std::min(2 * s.rows_below + 1, level.height - 1);
+        if (y < last_row) return;
+        int rows = int(s.pending.size() / (size_t(level.width) * 3));
+        for (int x = 0; x < next.width; x++) {
+            int x0 = std::min(2 * x, level.width - 1), x1 = (x == next.width - 1) ? level.width - 1 : std::min(2 * x + 1, level.width - 1);
+            float sum[3] = { 0, 0, 0 };
+            int count = 0;
+            for (int sy = 0; sy < rows; sy++)
+                for (int sx = x0; sx <= x1; sx++, count++)
+                    for (int c = 0; c < 3; c++) sum[c] += s.pending[(size_t(sy) * level.width + sx) * 3 + c];
+            for (int c = 0; c < 3; c++) s.below[size_t(x) * 3 + c] = sum[c] / count;
+        }
+        s.pending.clear();
+        s.rows_below++;
+        self(self, l + 1, s.below.data(), nullptr);
+    };
+
+    std::vector<float> linear(size_t(width) * 3);
+    const float* decode = rtw_image::srgb_decode();
+    for (int y = 0; y < height; y++) {
+        if (hdr) {
+            push_row(push_row, 0, fdata.get() + size_t(y) * width * 3, nullptr);
+        } else {
+            const unsigned char* row = bdata.get() + size_t(y) * width * 3;
+            for (size_t i = 0; i < linear.size(); i++) linear[i] = decode[row[i]];
+            push_row(push_row, 0, linear.data(), row);
+        }
+    }
+
+    header.file_size = offset;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), std::streamsize(table.size() * sizeof(ztx_page)));
+    out.close();
+    if (!out) {
+        std::cerr << "ERROR: Failed writing virtual texture " << ztx_file << "\n";
+        std::remove(temp_path.c_str());
+        return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, ztx_file, ec);
+    if (ec) {
+        std::cerr << "ERROR: Cannot replace virtual texture " << ztx_file << ": " << ec.message() << "\n";
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    std::clog << "Wrote virtual texture " << ztx_file << ": " << header.page_count << " pages, "
+              << stored_bytes / 1048576.0 << " MB of texels\n";
+    return true;
+}
+
+// Process-wide cache of decoded virtual texture pages, holding at most a fixed budget of
+// memory and dropping the least recently used page first. A page that is not resident is
+// either decoded on the spot by the thread asking for it, or, with asynchronous loading on,
+// queued for a loader thread while the texture makes do with a coarser level.
+//
+// Resident pages are found through a small table of handles kept by each sampling thread,
+// without taking the mutex; only misses go through the shared table. Recency is tracked
+// lazily to match: a lookup sets the page's referenced flag rather than moving it in the lru
+// list, and eviction gives a referenced page a second chance at the front of the list.
+class page_cache {
+  public:
+    using page = std::vector<unsigned char>;
+
+    struct statistics {
+        size_t hits = 0;
+        size_t misses = 0;          // Pages decoded
+        size_t evictions = 0;
+        size_t resident_bytes = 0;
+        size_t resident_pages = 0;
+        size_t queued = 0;          // Waiting for the loader thread
+    };
+
+    static page_cache& instance() {
+        static page_cache cache;
+        return cache;
+    }
+
+    ~page_cache() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        if (loader.joinable()) loader.join();
+    }
+
+    // The page, decoded on the calling thread if it is not resident.
+    std::shared_ptr<const page> get(const shared_ptr<const virtual_texture_data>& tex, uint32_t index) {
+        uint64_t key = page_key(*tex, index);
+        if (auto p = find_local(key)) return p;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (auto p = lookup(key)) return p;
+            stats.misses++;
+        }
+        auto decoded = std::make_shared<const page>(tex->read_page(index));
+        std::lock_guard<std::mutex> lock(mutex);
+        return remember(key, insert(key, decoded));
+    }
+
+    // The page if it is resident. Otherwise, with asynchronous loading, queues it for the
+    // loader thread and returns nullptr; without, decodes it like get().
+    std::shared_ptr<const page> request(const shared_ptr<const virtual_texture_data>& tex, uint32_t index) {
+        uint64_t key = page_key(*tex, index);
+        if (auto p = find_local(key)) return p;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (auto p = lookup(key)) return p;
+            if (async) {
+                if (queued.insert(key).second) {
+                    queue.emplace_back(tex, index);
+                    stats.queued++;
+                    if (!loader.joinable()) loader = std::thread([this] { load_pages(); });
+                    wake.notify_one();
+                }
+                return nullptr;
+            }
+        }
+        return get(tex, index);
+    }
+
+    void set_budget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    size_t get_budget() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return budget;
+    }
+
+    // Asynchronous loading keeps rendering going while pages load, at the cost of blurrier
+    // samples until they arrive; synchronous loading gives final quality from the first pass.
+    void set_async(bool on) {
+        std::lock_guard<std::mutex> lock(mutex);
+        async = on;
+    }
+
+    bool is_async() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return async;
+    }
+
+    // Hits found through the threads' handles are added up in batches, so the count may trail
+    // by a few hundred per sampling thread.
+    statistics get_stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        statistics current = stats;
+        current.hits += local_hits.load(std::memory_order_relaxed);
+        return current;
+    }
+
+    // Drops every resident page; pages being sampled stay alive until their users are done.
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!lru.empty()) drop_oldest();
+    }
+
+  private:
+    struct entry {
+        std::shared_ptr<const page> texels;
+        std::list<uint64_t>::iterator used;     // Into lru
+        std::atomic<bool> referenced{ false };  // Looked up since eviction last passed it
+        std::atomic<bool> evicted{ false };     // Set once, under the mutex
+    };
+
+    // A thread's handles, direct-mapped by key. A handle left on an evicted page keeps its
+    // texels alive until the slot is reused, so the budget can be overrun by at most
+    // handle_count pages per sampling thread.
+    static constexpr int handle_shift = 6, handle_count = 1 << handle_shift;
+    struct handle {
+        uint64_t key = UINT64_MAX;
+        std::shared_ptr<entry> resident;
+    };
+    struct thread_handles {
+        handle slots[handle_count];
+        size_t hits = 0;    // Not yet added to local_hits
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, std::shared_ptr<entry>> entries;
+    std::list<uint64_t> lru; // Most recently inserted or given a second chance first
+    size_t budget = size_t(256) << 20;
+    bool async = false;
+    statistics stats;
+    std::atomic<size_t> local_hits{ 0 };
+
+    std::deque<std::pair<shared_ptr<const virtual_texture_data>, uint32_t>> queue;
+    std::unordered_set<uint64_t> queued;
+    std::condition_variable wake;
+    std::thread loader;
+    bool stop = false;
+
+    page_cache() = default;
+
+    static uint64_t page_key(const virtual_texture_data& tex, uint32_t index) {
+        return uint64_t(tex.id) << 32 | index;
+    }
+
+    static thread_handles& local_handles() {
+        static thread_local thread_handles handles;
+        return handles;
+    }
+
+    static handle& local_handle(thread_handles& handles, uint64_t key) {
+        return handles.slots[(key * 0x9e3779b97f4a7c15ull) >> (64 - handle_shift)];
+    }
+
+    // The page through the calling thread's handles, if it is still resident. Takes no lock.
+    std::shared_ptr<const page> find_local(uint64_t key) {
+        thread_handles& handles = local_handles();
+        handle& h = local_handle(handles, key);
+        if (h.key != key) return nullptr;
+        if (h.resident->evicted.load(std::memory_order_acquire)) {
+            h = {};
+            return nullptr;
+        }
+        // Only stored when it changes, so a page every thread samples is not written to by each
+        if (!h.resident->referenced.load(std::memory_order_relaxed)) {
+            h.resident->referenced.store(true, std::memory_order_relaxed);
+        }
+        if (++handles.hits == 256) {
+            local_hits.fetch_add(handles.hits, std::memory_order_relaxed);
+            handles.hits = 0;
+        }
+        return h.resident->texels;
+    }
+
+    // Points the calling thread's handle for key at a resident page
+    static std::shared_ptr<const page> remember(uint64_t key, const std::shared_ptr<entry>& resident) {
+        local_handle(local_handles(), key) = { key, resident };
+        return resident->texels;
+    }
+
+    std::shared_ptr<const page> lookup(uint64_t key) {
+        auto it = entries.find(key);
+        if (it == entries.end()) return nullptr;
+        stats.hits++;
+        it->second->referenced.store(true, std::memory_order_relaxed);
+        return remember(key, it->second);
+    }
+
+    // Another thread may have decoded the same page meanwhile; the first copy wins
+    std::shared_ptr<entry> insert(uint64_t key, const std::shared_ptr<const page>& texels) {
+        auto [it, inserted] = entries.try_emplace(key);
+        if (!inserted) return it->second;
+        std::shared_ptr<entry> resident = std::make_shared<entry>();
+        resident->texels = texels;
+        lru.push_front(key);
+        resident->used = lru.begin();
+        it->second = resident;
+        stats.resident_bytes += texels->size();
+        stats.resident_pages++;
+        evict();
+        return resident;
+    }
+
+    void drop_oldest() {
+        auto it = entries.find(lru.back());
+        it->second->evicted.store(true, std::memory_order_release);
+        stats.resident_bytes -= it->second->texels->size();
+        stats.resident_pages--;
+        entries.erase(it);
+        lru.pop_back();
+    }
+
+    // Each page is given at most one second chance per call, so pages that keep being sampled
+    // meanwhile cannot hold eviction up.
+    void evict() {
+        size_t chances = lru.size();
+        while (stats.resident_bytes > budget && !lru.empty()) {
+            entry& oldest = *entries.find(lru.back())->second;
+            if (chances > 0 && oldest.referenced.exchange(false, std::memory_order_relaxed)) {
+                chances--;
+                lru.splice(lru.begin(), lru, oldest.used);
+                continue;
+            }
+            drop_oldest();
+            stats.evictions++;
+        }
+    }
+
+    void load_pages() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return stop || !queue.empty(); });
+            if (stop) return;
+            auto [tex, index] = std::move(queue.front());
+            queue.pop_front();
+            stats.queued--;
+            stats.misses++;
+            lock.unlock();
+            auto decoded = std::make_shared<const page>(tex->read_page(index));
+            lock.lock();
+            uint64_t key = page_key(*tex, index);
+            queued.erase(key);
+            insert(key, decoded);
+        }
+    }
+};
+
+// Image texture read from a virtual texture file through the page cache. Sampling matches
+// image_texture: the nearest texel of the full image, or trilinear filtering over the mip
+// chain when the footprint is known. A level whose pages are still loading is replaced by the
+// nearest coarser level that is resident; the last level, one page, is always read.
+class virtual_image_texture : public texture {
+  public:
+    virtual_image_texture(const std::string& filename) {
+        try {
+            data = load_virtual_texture(filename);
+        } catch (const std::exception& e) {
+            std::cerr << "ERROR: " << e.what() << "\n";
+        }
+    }
+
+    color value(real u, real v, const point3& p) const override {
+        // Cyan marks a missing texture, as for image_texture
+        if (!data) return color(0,1,1);
+
+        const auto& level = data->levels[0];
+        real uc = std::clamp(u, real(0), real(1)), vc = 1 - std::clamp(v, real(0), real(1));
+        int x = std::min(int(uc * level.width), level.width - 1);
+        int y = std::min(int(vc * level.height), level.height - 1);
+        for (int l = 0; l < int(data->levels.size()); l++) {
+            color c;
+            int tx = std::min(x >> l, data->levels[l].width - 1), ty = std::min(y >> l, data->levels[l].height - 1);
+            if (texels(l, &tx, &ty, 1, &c, l + 1 == int(data->levels.size()))) return c;
+        }
+        return color(0,0,0);
+    }
+
+    color filtered_value(real u, real v, const point3& p, real footprint) const override {
+        if (!data) return color(0,1,1);
+
+        real lod = std::log2(footprint * std::max(data->width(), data->height()));
+        if (!(lod > 0)) return value(u, v, p);
+
+        int last = int(data->levels.size()) - 1;
+        int level = std::min(int(lod), last);
+        real blend = level < last ? lod - level : 0;
+        for (; level <= last; level++, blend = 0) {
+            color fine;
+            if (!bilinear(level, u, v, fine)) continue;
+            if (blend <= 0) return fine;
+            color coarse;
+            if (!bilinear(level + 1, u, v, coarse)) return fine;
+            return (1 - blend) * fine + blend * coarse;
+        }
+        return color(0,0,0);
+    }
+
+  private:
+    shared_ptr<const virtual_texture_data> data;
+
+    // Colours of n texels of a level. False if a page is not resident yet, unless `wait`.
+    bool texels(int l, const int* x, const int* y, int n, color* out, bool wait) const {
+        const auto& level = data->levels[l];
+        const int shift = data->page_shift, mask = data->page_size - 1;
+        page_cache& cache = page_cache::instance();
+        uint32_t current = UINT32_MAX;
+        std::shared_ptr<const page_cache::page> resident;
+        for (int k = 0; k < n; k++) {
+            uint32_t index = level.first_page + uint32_t(y[k] >> shift) * level.pages_x + uint32_t(x[k] >> shift);
+            if (index != current) {
+                resident = wait ? cache.get(data, index) : cache.request(data, index);
+                if (!resident) return false;
+                current = index;
+            }
+            // The page is a small image of its own; its texel centre maps to exactly that texel
+            image_view page{ resident->data(), data->page_size, data->page_size, data->bytes_per_pixel,
+                             data->page_size >> image_tile_shift, data->format, rtw_image::srgb_decode() };
+            float su = ((x[k] & mask) + 0.5f) / data->page_size, sv = 1 - ((y[k] & mask) + 0.5f) / data->page_size;
+            float r, g, b;
+            simd_active.image_sample(page, &su, &sv, 1, &r, &g, &b);
+            out[k] = color(r, g, b);
+        }
+        return true;
+    }
+
+    bool bilinear(int l, real u, real v, color& out) const {
+        const auto& level = data->levels[l];
+        real x = std::clamp(u, real(0), real(1)) * level.width - real(0.5);
+        real y = (1 - std::clamp(v, real(0), real(1))) * level.height - real(0.5);
+        real x0 = std::floor(x), y0 = std::floor(y);
+        real fx = x - x0, fy = y - y0;
+
+        int tx[4], ty[4];
+        for (int k = 0; k < 4; k++) {
+            tx[k] = std::clamp(int(x0) + (k & 1), 0, level.width - 1);
+            ty[k] = std::clamp(int(y0) + (k >> 1), 0, level.height - 1);
+        }
+        color c[4];
+        if (!texels(l, tx, ty, 4, c, l + 1 == int(data->levels.size()))) return false;
+        out = (1 - fx) * (1 - fy) * c[0] + fx * (1 - fy) * c[1] + (1 - fx) * fy * c[2] + fx * fy * c[3];
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include "hittable.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Density sampled on a lattice of nx x ny x nz points spanning a box, interpolated trilinearly
+// between them. Next to it sits a coarse majorant grid: the highest density over each block of
+// 8^3 lattice cells, which bounds the interpolated density anywhere in the block. Tracking
+// uses it as the rate of tentative collisions, so blocks with no density are crossed without
+// sampling and thin regions are sampled sparsely.
+struct density_grid {
+    static constexpr int block_shift = 3;
+    static constexpr int block_size = 1 << block_shift;
+
+    std::string source;
+    int nx = 0, ny = 0, nz = 0;        // Lattice points along each axis
+    std::vector<float> density;        // x fastest
+    int blocks_x = 0, blocks_y = 0, blocks_z = 0;
+    std::vector<float> majorant;       // Per block of lattice cells, x fastest
+
+    density_grid(std::vector<float> values, int nx, int ny, int nz)
+      : nx(nx), ny(ny), nz(nz), density(std::move(values))
+    {
+        if (nx < 2 || ny < 2 || nz < 2 || density.size() != size_t(nx) * ny * nz) {
+            throw std::runtime_error("Density grid needs at least 2 x 2 x 2 samples");
+        }
+        build_majorants();
+    }
+
+    float at(int x, int y, int z) const { return density[(size_t(z) * ny + y) * nx + x]; }
+
+    float block_majorant(int bx, int by, int bz) const {
+        return majorant[(size_t(bz) * blocks_y + by) * blocks_x + bx];
+    }
+
+    // Trilinear density at a point in lattice units, clamped to the lattice
+    float lookup(real gx, real gy, real gz) const {
+        auto split = [](real g, int n, int& i) {
+            g = std::clamp(g, real(0), real(n - 1));
+            i = std::min(int(g), n - 2);
+            return float(g - i);
+        };
+        int x, y, z;
+        float fx = split(gx, nx, x), fy = split(gy, ny, y), fz = split(gz, nz, z);
+        auto lerp = [](float a, float b, float f) { return a + (b - a) * f; };
+        float c00 = lerp(at(x, y, z), at(x + 1, y, z), fx);
+        float c10 = lerp(at(x, y + 1, z), at(x + 1, y + 1, z), fx);
+        float c01 = lerp(at(x, y, z + 1), at(x + 1, y, z + 1), fx);
+        float c11 = lerp(at(x, y + 1, z + 1), at(x + 1, y + 1, z + 1), fx);
+        return lerp(lerp(c00, c10, fy), lerp(c01, c11, fy), fz);
+    }
+
+  private:
+    void build_majorants() {
+        blocks_x = (nx - 1 + block_size - 1) >> block_shift;
+        blocks_y = (ny - 1 + block_size - 1) >> block_shift;
+        blocks_z = (nz - 1 + block_size - 1) >> block_shift;
+        majorant.assign(size_t(blocks_x) * blocks_y * blocks_z, 0.0f);
+        // A block's cells reach the lattice points on its far faces too
+        for (int bz = 0; bz < blocks_z; bz++)
+            for (int by = 0; by < blocks_y; by++)
+                for (int bx = 0; bx < blocks_x; bx++) {
+                    float m = 0;
+                    for (int z = bz * block_size; z <= std::min((bz + 1) * block_size, nz - 1); z++)
+                        for (int y = by * block_size; y <= std::min((by + 1) * block_size, ny - 1); y++)
+                            for (int x = bx * block_size; x <= std::min((bx + 1) * block_size, nx - 1); x++)
+                                m = std::max(m, at(x, y, z));
+                    majorant[(size_t(bz) * blocks_y + by) * blocks_x + bx] = m;
+                }
+    }
+};
+
+// Raw density files (.zvol): three little-endian uint32 lattice sizes x, y, z, then one
+// float32 per point with x varying fastest and z slowest.
+inline shared_ptr<const density_grid> load_density_grid(const std::string& filename) {
+    static std::mutex library_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<const density_grid>> library;
+
+    std::lock_guard<std::mutex> lock(library_mutex);
+    auto it = library.find(filename);
+    if (it != library.end()) {
+        if (auto shared = it->second.lock()) return shared;
+    }
+
+    mapped_file file;
+    if (!file.open(filename)) {
+        throw std::runtime_error("Failed to open density file: " + filename);
+    }
+    uint32_t dims[3];
+    if (file.size() < sizeof(dims)) {
+        throw std::runtime_error("Density file has no header: " + filename);
+    }
+    std::memcpy(dims, file.data(), sizeof(dims));
+    if (dims[0] > 4096 || dims[1] > 4096 || dims[2] > 4096
+        || file.size() - sizeof(dims) != uint64_t(dims[0]) * dims[1] * dims[2] * sizeof(float)) {
+        throw std::runtime_error("Density file size does not match its dimensions: " + filename);
+    }
+
+    std::vector<float> values(size_t(dims[0]) * dims[1] * dims[2]);
+    std::memcpy(values.data(), file.data() + sizeof(dims), values.size() * sizeof(float));
+    for (size_t i = 0; i < values.size(); i++) {
+        if (!(values[i] >= 0 && values[i] < INFINITY)) {
+            throw std::runtime_error("Invalid density " + std::to_string(i) + " in " + filename);
+        }
+    }
+    auto data = make_shared<density_grid>(std::move(values), int(dims[0]), int(dims[1]), int(dims[2]));
+    data->source = filename;
+
+    std::clog << "Loaded density " << filename << ": " << data->nx << "x" << data->ny << "x" << data->nz
+              << " samples\n";
+
+    library[filename] = data;
+    return data;
+}
+
+// Density baked from a texture, e.g. a noise_texture, sampled at `resolution` points along
+// each axis of the box. The texture's channels are averaged and negative values dropped.
+inline shared_ptr<const density_grid> bake_density_grid(const texture& tex, const point3& lo, const point3& hi,
+                                                        int resolution) {
+    int n = std::max(resolution, 2);
+    std::vector<float> values(size_t(n) * n * n);
+    vec3 step = (hi - lo) / real(n - 1);
+    for (int z = 0; z < n; z++)
+        for (int y = 0; y < n; y++)
+            for (int x = 0; x < n; x++) {
+                color c = tex.value(0, 0, lo + vec3(x * step.x, y * step.y, z * step.z));
+                values[(size_t(z) * n + y) * n + x] = std::max(float((c.x + c.y + c.z) / 3), 0.0f);
+            }
+    auto data = make_shared<density_grid>(std::move(values), n, n, n);
+    data->source = "(baked)";
+    return data;
+}
+
+// Participating medium filling a box with a varying density. Distances are sampled by delta
+// tracking against the majorant grid: tentative collisions arrive at the block's majorant
+// rate and each is real with probability density / majorant, which is unbiased for any
+// density the majorant bounds. Real collisions scatter with the object's material, normally
+// isotropic, like constant_medium.
+class heterogeneous_medium : public hittable {
+  public:
+    // `density_scale` turns the grid's values into extinction per unit length.
+    heterogeneous_medium(shared_ptr<const density_grid> grid, const point3& lo, const point3& hi,
+                         real density_scale, shared_ptr<material> phase_function)
+      : grid(grid), lo(lo), hi(hi), density_scale(density_scale)
+    {
+        if (!(hi.x > lo.x && hi.y > lo.y && hi.z > lo.z)) {
+            throw std::runtime_error("Volume box must have a positive extent");
+        }
+        if (!(density_scale >= 0)) {
+            throw std::runtime_error("Volume density must not be negative");
+        }
+        mat = phase_function;
+        set_bounding_box();
+    }
+
+    heterogeneous_medium(shared_ptr<const density_grid> grid, const point3& lo, const point3& hi,
+                         real density_scale, const color& albedo)
+      : heterogeneous_medium(grid, lo, hi, density_scale, make_shared<isotropic>(make_shared<solid_color>(albedo))) {}
+
+    void set_bounding_box() override { bbox = aabb(lo, hi); }
+
+    void move_by(const point3& offset) override {
+        lo = lo + offset;
+        hi = hi + offset;
+        set_bounding_box();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        real t_hit;
+        bool scattered = false;
+        track(r, ray_t, [&](real t, real ratio) {
+            if (random_double() >= ratio) return true;
+            t_hit = t;
+            scattered = true;
+            return false;
+        });
+        if (!scattered) return false;
+
+        rec.t = t_hit;
+        rec.p = r.at(t_hit);
+        rec.normal = vec3(1,0,0);  // arbitrary
+        rec.front_face = true;     // also arbitrary
+        rec.mat = mat;
+        return true;
+    }
+
+    // Fraction of light crossing the medium along the ray within ray_t, for shadow rays: an
+    // unbiased ratio-tracking estimate, which only reads densities and never scatters.
+    real transmittance(const ray& r, interval ray_t) const {
+        real transmitted = 1;
+        track(r, ray_t, [&](real, real ratio) {
+            transmitted *= 1 - ratio;
+            return transmitted > 0;
+        });
+        return transmitted;
+    }
+
+    std::ostream& print(std::ostream& out) const override {
+        out << "HeterogeneousMedium(grid=" << grid->source
+            << ", samples=" << grid->nx << "x" << grid->ny << "x" << grid->nz
+            << ", min=" << lo << ", max=" << hi << ", density=" << density_scale << ")";
+        return out;
+    }
+
+    std::istream& write(std::istream& in) const override {
+        return in;
+    }
+
+  private:
+    shared_ptr<const density_grid> grid;
+    point3 lo, hi;
+    real density_scale;
+
+    // Walks the majorant blocks along the ray with a 3D DDA and places tentative collisions in
+    // each at its majorant rate. Calls collide(t, density / majorant) for each one until it
+    // returns false.
+    template <typename Collide>
+    void track(const ray& r, interval ray_t, Collide&& collide) const {
+        // Lattice space: one unit per lattice cell; ray parameters are unchanged
+        const int size[3] = { grid->nx - 1, grid->ny - 1, grid->nz - 1 };
+        const vec3 cell = (hi - lo) / vec3(size[0], size[1], size[2]);
+        const vec3 o = (r.origin() - lo) / cell;
+        const vec3 d = r.direction() / cell;
+        const real ray_length = glm::length(r.direction());
+
+        real t_start = ray_t.min, t_end = ray_t.max;
+        for (int a = 0; a < 3; a++) {
+            real inv = 1 / d[a];
+            real t0 = (0 - o[a]) * inv, t1 = (size[a] - o[a]) * inv;
+            if (inv < 0) std::swap(t0, t1);
+            t_start = t0 > t_start ? t0 : t_start;
+            t_end = t1 < t_end ? t1 : t_end;
+            if (t_end <= t_start) return;
+        }
+
+        const int bs = density_grid::block_size;
+        const int blocks[3] = { grid->blocks_x, grid->blocks_y, grid->blocks_z };
+        int step[3], block[3];
+        real t_next[3], t_delta[3];
+        for (int a = 0; a < 3; a++) {
+            step[a] = d[a] >= 0 ? 1 : -1;
+            int c = std::clamp(int(std::floor(o[a] + t_start * d[a])), 0, size[a] - 1);
+            block[a] = c >> density_grid::block_shift;
+            t_delta[a] = d[a] != 0 ? bs / std::fabs(d[a]) : infinity;
+            t_next[a] = d[a] != 0 ? ((step[a] > 0 ? (block[a] + 1) * bs : block[a] * bs) - o[a]) / d[a] : infinity;
+        }
+
+        real t = t_start;
+        while (t < t_end) {
+            int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+            real t_exit = std::fmin(t_next[axis], t_end);
+
+            // Tentative collisions per unit of t; the exponential distance is memoryless, so
+            // the walk restarts at each block boundary with the next block's rate
+            real rate = density_scale * grid->block_majorant(block[0], block[1], block[2]) * ray_length;
+            if (rate > 0) {
+                real s = t;
+                while (true) {
+                    s -= std::log(1 - random_double()) / rate;
+                    if (s >= t_exit) break;
+                    real sigma = density_scale * grid->lookup(o.x + s * d.x, o.y + s * d.y, o.z + s * d.z) * ray_length;
+                    if (!collide(s, std::min(sigma / rate, real(1)))) return;
+                }
+            }
+
+            block[axis] += step[axis];
+            if (block[axis] < 0 || block[axis] >= blocks[axis]) return;
+            t = t_next[axis];
+            t_next[axis] += t_delta[axis];
+        }
+    }
+};
+
+#endif
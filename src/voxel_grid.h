@@ -0,0 +1,260 @@
+#ifndef VOXEL_GRID_H
+#define VOXEL_GRID_H
+
+#include "hittable.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Voxels stored as a two-level grid: the volume is cut into bricks of 8^3 voxels, and only
+// bricks holding at least one solid voxel get storage. Each voxel is a byte, 0 for empty and
+// otherwise an index into the owning grid's palette, so a million solid voxels cost about a
+// megabyte instead of a million boxes.
+struct voxel_grid_data {
+    static constexpr int brick_shift = 3;
+    static constexpr int brick_size = 1 << brick_shift;
+    static constexpr int brick_voxels = brick_size * brick_size * brick_size;
+
+    std::string source;
+    int nx = 0, ny = 0, nz = 0;          // Voxels along each axis
+    int bricks_x = 0, bricks_y = 0, bricks_z = 0;
+    std::vector<uint32_t> brick_index;   // Per brick, 0 if empty, otherwise 1 + its slot in voxels
+    std::vector<uint8_t> voxels;         // brick_voxels bytes per stored brick, x fastest
+
+    voxel_grid_data(int nx, int ny, int nz) : nx(nx), ny(ny), nz(nz) {
+        if (nx <= 0 || ny <= 0 || nz <= 0) {
+            throw std::runtime_error("Voxel grid dimensions must be positive");
+        }
+        bricks_x = (nx + brick_size - 1) >> brick_shift;
+        bricks_y = (ny + brick_size - 1) >> brick_shift;
+        bricks_z = (nz + brick_size - 1) >> brick_shift;
+        brick_index.assign(size_t(bricks_x) * bricks_y * bricks_z, 0);
+    }
+
+    size_t brick_count() const { return voxels.size() / brick_voxels; }
+
+    // Slot of the brick holding voxel (x, y, z) in `voxels`, or nullptr if the brick is empty
+    const uint8_t* brick(int bx, int by, int bz) const {
+        uint32_t index = brick_index[(size_t(bz) * bricks_y + by) * bricks_x + bx];
+        return index == 0 ? nullptr : &voxels[size_t(index - 1) * brick_voxels];
+    }
+
+    static int voxel_in_brick(int x, int y, int z) {
+        const int mask = brick_size - 1;
+        return (((z & mask) << brick_shift | (y & mask)) << brick_shift) | (x & mask);
+    }
+
+    uint8_t get(int x, int y, int z) const {
+        const uint8_t* b = brick(x >> brick_shift, y >> brick_shift, z >> brick_shift);
+        return b ? b[voxel_in_brick(x, y, z)] : 0;
+    }
+
+    // Setting a voxel in an empty brick allocates the brick
+    void set(int x, int y, int z, uint8_t value) {
+        uint32_t& index = brick_index[(size_t(z >> brick_shift) * bricks_y + (y >> brick_shift)) * bricks_x
+                                      + (x >> brick_shift)];
+        if (index == 0) {
+            if (value == 0) return;
+            voxels.resize(voxels.size() + brick_voxels, 0);
+            index = static_cast<uint32_t>(brick_count());
+        }
+        voxels[size_t(index - 1) * brick_voxels + voxel_in_brick(x, y, z)] = value;
+    }
+};
+
+// Raw dense voxel files (.zvox): three little-endian uint32 dimensions x, y, z, then one
+// byte per voxel with x varying fastest and z slowest, 0 for empty and otherwise a palette
+// index.
+inline shared_ptr<const voxel_grid_data> load_voxel_grid(const std::string& filename) {
+    static std::mutex library_mutex;
+    static std::unordered_map<std::string, std::weak_ptr<const voxel_grid_data>> library;
+
+    std::lock_guard<std::mutex> lock(library_mutex);
+    auto it = library.find(filename);
+    if (it != library.end()) {
+        if (auto shared = it->second.lock()) return shared;
+    }
+
+    mapped_file file;
+    if (!file.open(filename)) {
+        throw std::runtime_error("Failed to open voxel file: " + filename);
+    }
+    uint32_t dims[3];
+    if (file.size() < sizeof(dims)) {
+        throw std::runtime_error("Voxel file has no header: " + filename);
+    }
+    std::memcpy(dims, file.data(), sizeof(dims));
+    if (dims[0] == 0 || dims[1] == 0 || dims[2] == 0 || dims[0] > 65536 || dims[1] > 65536 || dims[2] > 65536
+        || file.size() - sizeof(dims) != uint64_t(dims[0]) * dims[1] * dims[2]) {
+        throw std::runtime_error("Voxel file size does not match its dimensions: " + filename);
+    }
+
+    auto data = make_shared<voxel_grid_data>(int(dims[0]), int(dims[1]), int(dims[2]));
+    data->source = filename;
+    const unsigned char* p = file.data() + sizeof(dims);
+    for (int z = 0; z < data->nz; z++)
+        for (int y = 0; y < data->ny; y++)
+            for (int x = 0; x < data->nx; x++, p++)
+                if (*p) data->set(x, y, z, *p);
+
+    std::clog << "Loaded voxels " << filename << ": " << data->nx << "x" << data->ny << "x" << data->nz
+              << ", " << data->brick_count() << " of " << data->brick_index.size() << " bricks stored\n";
+
+    library[filename] = data;
+    return data;
+}
+
+// Traced with Amanatides and Woo's 3D DDA at two levels: the ray steps brick by brick, passing
+// empty bricks in one step, and only walks the voxels of bricks that have storage.
+class voxel_grid : public hittable {
+  public:
+    // The grid's minimum corner sits at `corner`, each voxel a cube of side `voxel_size`.
+    voxel_grid(shared_ptr<const voxel_grid_data> data, const point3& corner, real voxel_size)
+      : data(data), corner(corner), voxel_size(voxel_size)
+    {
+        if (!(voxel_size > 0)) {
+            throw std::runtime_error("Voxel size must be positive");
+        }
+        set_bounding_box();
+    }
+
+    void set_bounding_box() override {
+        bbox = aabb(corner, corner + voxel_size * vec3(data->nx, data->ny, data->nz));
+    }
+
+    void move_by(const point3& offset) override {
+        corner = corner + offset;
+        set_bounding_box();
+    }
+
+    // Materials the voxels' values refer to, value k using entry k - 1. Values past the end,
+    // and every voxel while the palette is empty, use the grid's own material.
+    void set_palette(std::vector<shared_ptr<material>> materials) { palette = std::move(materials); }
+
+    // Palette entries the voxels refer to: as many as the largest value
+    size_t material_count() const {
+        auto largest = std::max_element(data->voxels.begin(), data->voxels.end());
+        return largest == data->voxels.end() ? 0 : size_t(*largest);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Grid space: one unit per voxel; ray parameters are unchanged
+        const vec3 o = (r.origin() - corner) / voxel_size;
+        const vec3 d = r.direction() / voxel_size;
+        const int size[3] = { data->nx, data->ny, data->nz };
+
+        // Clip to the grid, remembering the axis the ray enters through
+        real t_start = ray_t.min, t_end = ray_t.max;
+        int axis = -1;
+        for (int a = 0; a < 3; a++) {
+            real inv = 1 / d[a];
+            real t0 = (0 - o[a]) * inv, t1 = (size[a] - o[a]) * inv;
+            if (inv < 0) std::swap(t0, t1);
+            if (t0 > t_start) {
+                t_start = t0;
+                axis = a;
+            }
+            t_end = t1 < t_end ? t1 : t_end;
+            if (t_end <= t_start) return false;
+        }
+
+        int step[3], brick[3];
+        real t_next[3], t_delta[3];
+        const int bs = voxel_grid_data::brick_size;
+        for (int a = 0; a < 3; a++) {
+            step[a] = d[a] >= 0 ? 1 : -1;
+            int cell = std::clamp(int(std::floor(o[a] + t_start * d[a])), 0, size[a] - 1);
+            brick[a] = cell >> voxel_grid_data::brick_shift;
+            t_delta[a] = d[a] != 0 ? bs / std::fabs(d[a]) : infinity;
+            t_next[a] = d[a] != 0 ? ((step[a] > 0 ? (brick[a] + 1) * bs : brick[a] * bs) - o[a]) / d[a] : infinity;
+        }
+        const int brick_limit[3] = { data->bricks_x, data->bricks_y, data->bricks_z };
+
+        real t = t_start;
+        while (t < t_end) {
+            int exit_axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+            real t_exit = std::fmin(t_next[exit_axis], t_end);
+
+            if (const uint8_t* voxels = data->brick(brick[0], brick[1], brick[2])) {
+                if (hit_brick(voxels, brick, o, d, t, t_exit, axis, ray_t, r, rec)) return true;
+            }
+
+            brick[exit_axis] += step[exit_axis];
+            if (brick[exit_axis] < 0 || brick[exit_axis] >= brick_limit[exit_axis]) return false;
+            t = t_next[exit_axis];
+            t_next[exit_axis] += t_delta[exit_axis];
+            axis = exit_axis;
+        }
+        return false;
+    }
+
+    std::ostream& print(std::ostream& out) const override {
+        out << "VoxelGrid(file=" << data->source
+            << ", voxels=" << data->nx << "x" << data->ny << "x" << data->nz
+            << ", corner=" << corner << ", voxel_size=" << voxel_size << ")";
+        return out;
+    }
+
+    std::istream& write(std::istream& in) const override {
+        return in;
+    }
+
+  private:
+    shared_ptr<const voxel_grid_data> data;
+    point3 corner;
+    real voxel_size;
+    std::vector<shared_ptr<material>> palette;
+
+    // Walks the voxels of one brick between t_enter and t_exit. `axis` is the axis the ray
+    // crossed to reach t_enter, or -1 if it starts inside the grid.
+    bool hit_brick(const uint8_t* voxels, const int* brick, const vec3& o, const vec3& d, real t_enter,
+                   real t_exit, int axis, interval ray_t, const ray& r, hit_record& rec) const {
+        const int bs = voxel_grid_data::brick_size;
+        int step[3], cell[3];
+        real t_next[3], t_delta[3];
+        for (int a = 0; a < 3; a++) {
+            step[a] = d[a] >= 0 ? 1 : -1;
+            int lo = brick[a] * bs;
+            cell[a] = std::clamp(int(std::floor(o[a] + t_enter * d[a])), lo, lo + bs - 1);
+            t_delta[a] = d[a] != 0 ? 1 / std::fabs(d[a]) : infinity;
+            t_next[a] = d[a] != 0 ? ((step[a] > 0 ? cell[a] + 1 : cell[a]) - o[a]) / d[a] : infinity;
+        }
+
+        real t = t_enter;
+        while (true) {
+            uint8_t value = voxels[voxel_grid_data::voxel_in_brick(cell[0], cell[1], cell[2])];
+            // The voxel the ray starts in does not count, so secondary rays leave the surface
+            if (value != 0 && axis >= 0 && ray_t.surrounds(t)) {
+                rec.t = t;
+                rec.p = r.at(t);
+                vec3 normal(0, 0, 0);
+                normal[axis] = real(-step[axis]);
+                rec.set_face_normal(r, normal);
+                // Face coordinates within the voxel
+                const int ua = axis == 0 ? 1 : 0, va = axis == 2 ? 1 : 2;
+                rec.u = o[ua] + t * d[ua] - cell[ua];
+                rec.v = o[va] + t * d[va] - cell[va];
+                rec.mat = value <= palette.size() && palette[value - 1] ? palette[value - 1] : mat;
+                return true;
+            }
+
+            axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+            t = t_next[axis];
+            if (t >= t_exit) return false;
+            cell[axis] += step[axis];
+            int lo = brick[axis] * bs;
+            if (cell[axis] < lo || cell[axis] >= lo + bs) return false;
+            t_next[axis] += t_delta[axis];
+        }
+    }
+};
+
+#endif
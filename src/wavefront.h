@@ -0,0 +1,323 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "render_world.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Path tracer that advances a large batch of paths one stage at a time, instead of following
+// each path to its end as camera::ray_color does. Path and hit data live in SoA arrays
+// indexed by path, and every stage is a data-parallel loop over the thread pool:
+//
+//   generate  camera rays for a wave of pixel samples
+//   extend    nearest hit of every live path
+//   sort      live paths grouped by material type, then by material
+//   shade     one loop per material type, calling that type's scatter() without the vtable
+//   connect   misses resolved against the background, finished paths retired and the
+//             survivors compacted into the next queue
+//
+// The scene has no light list, so there are no shadow rays to connect; the estimator is the
+// same as ray_color's and both converge to the same image.
+class wavefront_integrator {
+  public:
+    // Paths in flight at once; larger frames are rendered in several waves.
+    static constexpr size_t max_paths = size_t(1) << 18;
+
+    // Adds the radiance of `samples` paths per pixel to accum[j * width + i]. `generate(i, j)`
+    // returns a camera ray for pixel (i, j) and `miss(r)` the radiance of a ray that leaves
+    // the scene.
+    template <typename Generate, typename Miss>
+    void render(const render_world& world, ThreadPool& pool, int width, int height, int samples, int max_depth,
+                real t_min, Generate&& generate, Miss&& miss, std::vector<color>& accum) {
+        if (width <= 0 || height <= 0 || samples <= 0 || max_depth <= 0) return;
+
+        size_t pixels = size_t(width) * height;
+        size_t pixels_per_wave = std::max<size_t>(1, max_paths / samples);
+        for (size_t first = 0; first < pixels; first += pixels_per_wave) {
+            size_t count = std::min(pixels_per_wave, pixels - first);
+            size_t path_count = count * samples;
+            resize(path_count);
+
+            generate_stage(pool, width, first, samples, path_count, generate);
+            for (int bounce = 0; bounce < max_depth && !queue.empty(); bounce++) {
+                extend_stage(world, pool, t_min);
+                sort_stage();
+                shade_stage(pool);
+                connect_stage(pool, miss);
+            }
+
+            pool.parallel_for(count, grain / samples + 1, [&](size_t begin, size_t end) {
+                for (size_t p = begin; p < end; p++) {
+                    color sum(0, 0, 0);
+                    for (size_t s = p * samples; s < (p + 1) * samples; s++)
+                        sum += color(paths.lr[s], paths.lg[s], paths.lb[s]);
+                    accum[first + p] += sum;
+                }
+            });
+        }
+    }
+
+  private:
+    static constexpr size_t grain = 4096;
+    static constexpr size_t texture_batch_size = 256; // Hits per texture evaluation
+    static constexpr int bucket_count = static_cast<int>(material_kind::Count) + 1; // + misses
+    static constexpr int miss_bucket = bucket_count - 1;
+
+    struct path_arrays {
+        std::vector<real> ox, oy, oz, dx, dy, dz, time;
+        std::vector<real> tr, tg, tb; // Throughput
+        std::vector<real> lr, lg, lb; // Radiance gathered so far
+
+        void resize(size_t n) {
+            for (auto* a : { &ox, &oy, &oz, &dx, &dy, &dz, &time, &tr, &tg, &tb, &lr, &lg, &lb })
+                a->resize(n);
+        }
+
+        ray get_ray(uint32_t p) const {
+            return ray(point3(ox[p], oy[p], oz[p]), vec3(dx[p], dy[p], dz[p]), time[p]);
+        }
+
+        void set_ray(uint32_t p, const ray& r) {
+            ox[p] = r.origin().x; oy[p] = r.origin().y; oz[p] = r.origin().z;
+            dx[p] = r.direction().x; dy[p] = r.direction().y; dz[p] = r.direction().z;
+            time[p] = r.time();
+        }
+
+        void add_radiance(uint32_t p, const color& c) {
+            lr[p] += tr[p] * c.x;
+            lg[p] += tg[p] * c.y;
+            lb[p] += tb[p] * c.z;
+        }
+    };
+
+    struct hit_arrays {
+        std::vector<real> t, px, py, pz, nx, ny, nz, u, v;
+        std::vector<uint8_t> front_face;
+        std::vector<uint8_t> bucket;
+        std::vector<const material*> mat; // Owned by the render world
+
+        void resize(size_t n) {
+            for (auto* a : { &t, &px, &py, &pz, &nx, &ny, &nz, &u, &v })
+                a->resize(n);
+            front_face.resize(n);
+            bucket.resize(n);
+            mat.resize(n);
+        }
+
+        hit_record get(uint32_t p) const {
+            hit_record rec;
+            rec.t = t[p];
+            rec.p = point3(px[p], py[p], pz[p]);
+            rec.normal = vec3(nx[p], ny[p], nz[p]);
+            rec.u = u[p];
+            rec.v = v[p];
+            rec.front_face = front_face[p] != 0;
+            return rec;
+        }
+    };
+
+    path_arrays paths;
+    hit_arrays hits;
+    std::vector<uint8_t> alive;
+    std::vector<uint32_t> queue;  // Live paths
+    std::vector<uint32_t> sorted; // Live paths grouped by bucket
+    std::array<size_t, bucket_count + 1> bucket_start{};
+
+    void resize(size_t n) {
+        paths.resize(n);
+        hits.resize(n);
+        alive.resize(n);
+        queue.resize(n);
+        sorted.resize(n);
+    }
+
+    template <typename Generate>
+    void generate_stage(ThreadPool& pool, int width, size_t first_pixel, int samples, size_t path_count, Generate& generate) {
+        pool.parallel_for(path_count, grain, [&](size_t begin, size_t end) {
+            for (size_t p = begin; p < end; p++) {
+                size_t pixel = first_pixel + p / samples;
+                uint32_t id = static_cast<uint32_t>(p);
+                paths.set_ray(id, generate(int(pixel % width), int(pixel / width)));
+                paths.tr[p] = paths.tg[p] = paths.tb[p] = 1;
+                paths.lr[p] = paths.lg[p] = paths.lb[p] = 0;
+                queue[p] = id;
+            }
+        });
+    }
+
+    void extend_stage(const render_world& world, ThreadPool& pool, real t_min) {
+        pool.parallel_for(queue.size(), grain, [&](size_t begin, size_t end) {
+            hit_record rec;
+            for (size_t q = begin; q < end; q++) {
+                uint32_t p = queue[q];
+                if (!world.hit(paths.get_ray(p), interval(t_min, infinity), rec)) {
+                    hits.mat[p] = nullptr;
+                    hits.bucket[p] = miss_bucket;
+                    continue;
+                }
+                hits.t[p] = rec.t;
+                hits.px[p] = rec.p.x; hits.py[p] = rec.p.y; hits.pz[p] = rec.p.z;
+                hits.nx[p] = rec.normal.x; hits.ny[p] = rec.normal.y; hits.nz[p] = rec.normal.z;
+                hits.u[p] = rec.u;
+                hits.v[p] = rec.v;
+                hits.front_face[p] = rec.front_face;
+                hits.mat[p] = rec.mat.get();
+                hits.bucket[p] = static_cast<uint8_t>(rec.mat->kind());
+            }
+        });
+    }
+
+    // Counting sort by bucket, then by material inside each bucket so that paths sharing a
+    // material, and so its texture, are shaded together.
+    void sort_stage() {
+        std::array<size_t, bucket_count> counts{};
+        for (uint32_t p : queue) counts[hits.bucket[p]]++;
+        bucket_start[0] = 0;
+        for (int b = 0; b < bucket_count; b++)
+            bucket_start[b + 1] = bucket_start[b] + counts[b];
+
+        std::array<size_t, bucket_count> next;
+        std::copy(bucket_start.begin(), bucket_start.end() - 1, next.begin());
+        sorted.resize(queue.size());
+        for (uint32_t p : queue) sorted[next[hits.bucket[p]]++] = p;
+
+        for (int b = 0; b < miss_bucket; b++) {
+            std::sort(sorted.begin() + bucket_start[b], sorted.begin() + bucket_start[b + 1],
+                [this](uint32_t a, uint32_t c) { return hits.mat[a] < hits.mat[c]; });
+        }
+    }
+
+    void shade_stage(ThreadPool& pool) {
+        auto each = [&](int bucket, auto&& fn) {
+            size_t first = bucket_start[bucket], count = bucket_start[bucket + 1] - first;
+            pool.parallel_for(count, grain, [&](size_t begin, size_t end) {
+                fn(sorted.data() + first + begin, sorted.data() + first + end);
+            });
+        };
+        auto bucket = [](material_kind k) { return static_cast<int>(k); };
+
+        each(bucket(material_kind::Lambertian), [&](const uint32_t* b, const uint32_t* e) { shade_range<lambertian>(b, e); });
+        each(bucket(material_kind::Metal), [&](const uint32_t* b, const uint32_t* e) { shade_range<metal>(b, e); });
+        each(bucket(material_kind::Dielectric), [&](const uint32_t* b, const uint32_t* e) { shade_range<dielectric>(b, e); });
+        each(bucket(material_kind::DiffuseLight), [&](const uint32_t* b, const uint32_t* e) { shade_range<diffuse_light>(b, e); });
+        each(bucket(material_kind::Isotropic), [&](const uint32_t* b, const uint32_t* e) { shade_range<isotropic>(b, e); });
+        each(bucket(material_kind::Other), [&](const uint32_t* b, const uint32_t* e) { shade_range<material>(b, e); });
+    }
+
+    // Shades paths that all hit a material of type M. The qualified calls bind statically,
+    // so the loop has no virtual dispatch except for the catch-all M = material. Materials
+    // whose scattering takes the texture's value as is have it evaluated for a whole run of
+    // paths at once, the sort having put paths that share a material next to each other.
+    template <typename M>
+    void shade_range(const uint32_t* begin, const uint32_t* end) {
+        if constexpr (std::is_same_v<M, lambertian> || std::is_same_v<M, metal> || std::is_same_v<M, isotropic>
+                      || std::is_same_v<M, diffuse_light>) {
+            for (const uint32_t* run = begin; run != end;) {
+                const uint32_t* run_end = run + 1;
+                while (run_end != end && size_t(run_end - run) < texture_batch_size && hits.mat[*run_end] == hits.mat[*run])
+                    ++run_end;
+                shade_textured<M>(run, run_end);
+                run = run_end;
+            }
+            return;
+        }
+
+        for (const uint32_t* it = begin; it != end; ++it) {
+            uint32_t p = *it;
+            const M* m = static_cast<const M*>(hits.mat[p]);
+            ray r_in = paths.get_ray(p);
+            hit_record rec = hits.get(p);
+
+            color emitted, attenuation;
+            ray scattered;
+            bool scatters;
+            if constexpr (std::is_same_v<M, material>) {
+                emitted = m->emitted(rec.u, rec.v, rec.p);
+                scatters = m->scatter(r_in, rec, attenuation, scattered);
+            } else {
+                emitted = m->M::emitted(rec.u, rec.v, rec.p);
+                scatters = m->M::scatter(r_in, rec, attenuation, scattered);
+            }
+
+            paths.add_radiance(p, emitted);
+            alive[p] = scatters;
+            if (!scatters) continue;
+            paths.tr[p] *= attenuation.x;
+            paths.tg[p] *= attenuation.y;
+            paths.tb[p] *= attenuation.z;
+            paths.set_ray(p, scattered);
+        }
+    }
+
+    // Paths sharing one material of type M: its texture program runs over all their hits as
+    // one batch, then each path scatters with its value. Wavefront rays carry no
+    // differentials, so the textures are sampled unfiltered, as scatter() would.
+    template <typename M>
+    void shade_textured(const uint32_t* begin, const uint32_t* end) {
+        const M* m = static_cast<const M*>(hits.mat[*begin]);
+        size_t n = end - begin;
+        std::array<real, texture_batch_size> u, v, x, y, z, r, g, b;
+        for (size_t k = 0; k < n; k++) {
+            uint32_t p = begin[k];
+            u[k] = hits.u[p];
+            v[k] = hits.v[p];
+            x[k] = hits.px[p];
+            y[k] = hits.py[p];
+            z[k] = hits.pz[p];
+        }
+        texture_batch batch;
+        batch.size = n;
+        batch.u = u.data();
+        batch.v = v.data();
+        batch.x = x.data();
+        batch.y = y.data();
+        batch.z = z.data();
+        batch.r = r.data();
+        batch.g = g.data();
+        batch.b = b.data();
+        m->get_texture_program().value(batch);
+
+        for (size_t k = 0; k < n; k++) {
+            uint32_t p = begin[k];
+            color albedo(r[k], g[k], b[k]);
+            if constexpr (std::is_same_v<M, diffuse_light>) {
+                paths.add_radiance(p, albedo);
+                alive[p] = 0;
+                continue;
+            } else {
+                color attenuation;
+                ray scattered;
+                bool scatters = m->M::scatter(paths.get_ray(p), hits.get(p), albedo, attenuation, scattered);
+                alive[p] = scatters;
+                if (!scatters) continue;
+                paths.tr[p] *= attenuation.x;
+                paths.tg[p] *= attenuation.y;
+                paths.tb[p] *= attenuation.z;
+                paths.set_ray(p, scattered);
+            }
+        }
+    }
+
+    template <typename Miss>
+    void connect_stage(ThreadPool& pool, Miss& miss) {
+        size_t first_miss = bucket_start[miss_bucket];
+        pool.parallel_for(sorted.size() - first_miss, grain, [&](size_t begin, size_t end) {
+            for (size_t q = first_miss + begin; q < first_miss + end; q++) {
+                uint32_t p = sorted[q];
+                paths.add_radiance(p, miss(paths.get_ray(p)));
+            }
+        });
+
+        size_t n = 0;
+        for (size_t q = 0; q < first_miss; q++) {
+            if (alive[sorted[q]]) queue[n++] = sorted[q];
+        }
+        queue.resize(n);
+    }
+};
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "flat_bvh.h"
+#include "batch_kernels.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// BVH with N children per node, collapsed from a binary flat_bvh. The node layout lives in
+// simd/kernel_types.h so the per-ISA box test kernels can read it.
+
+// Eight children per node: the box test is one AVX2 instruction sequence or two SSE halves,
+// and the shallower tree measured no slower than 4-wide nodes even on the SSE kernels.
+constexpr int wide_bvh_width = 8;
+
+// Builds the wide tree by repeatedly opening the interior child with the largest surface
+// area until the node is full, so the children kept together are the ones most likely to be
+// tested together. Primitive ranges are the ones of the binary tree.
+template <int N>
+std::vector<wide_bvh_node<N>> wide_bvh_collapse(const flat_bvh_node* binary, size_t binary_count) {
+    static_assert(N >= 2, "a wide BVH node needs at least two children");
+    std::vector<wide_bvh_node<N>> nodes;
+    if (binary_count == 0) return nodes;
+    nodes.reserve(binary_count / (N - 1) + 1);
+
+    struct collapser {
+        const flat_bvh_node* binary;
+        std::vector<wide_bvh_node<N>>& nodes;
+
+        static float area(const flat_bvh_node& n) {
+            float dx = n.bmax[0] - n.bmin[0], dy = n.bmax[1] - n.bmin[1], dz = n.bmax[2] - n.bmin[2];
+            return dx * dy + dy * dz + dz * dx;
+        }
+
+        uint32_t collapse(uint32_t root) {
+            uint32_t index = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+
+            uint32_t kids[N];
+            int kid_count = 0;
+            if (binary[root].is_leaf()) {
+                kids[kid_count++] = root;
+            } else {
+                kids[kid_count++] = root + 1;
+                kids[kid_count++] = binary[root].offset;
+            }
+
+            while (kid_count < N) {
+                int open = -1;
+                float best = -1;
+                for (int k = 0; k < kid_count; k++) {
+                    const flat_bvh_node& n = binary[kids[k]];
+                    if (!n.is_leaf() && area(n) > best) {
+                        best = area(n);
+                        open = k;
+                    }
+                }
+                if (open < 0) break;
+                uint32_t opened = kids[open];
+                kids[open] = opened + 1;
+                kids[kid_count++] = binary[opened].offset;
+            }
+
+            // Children are collapsed first: they may grow `nodes` and move this node.
+            uint32_t child[N] = {};
+            for (int k = 0; k < kid_count; k++) {
+                const flat_bvh_node& n = binary[kids[k]];
+                child[k] = n.is_leaf() ? n.offset : collapse(kids[k]);
+            }
+
+            wide_bvh_node<N>& node = nodes[index];
+            const float inf = std::numeric_limits<float>::infinity();
+            for (int k = 0; k < N; k++) {
+                if (k >= kid_count) {
+                    node.bmin_x[k] = node.bmin_y[k] = node.bmin_z[k] = inf;
+                    node.bmax_x[k] = node.bmax_y[k] = node.bmax_z[k] = -inf;
+                    node.child[k] = 0;
+                    node.count[k] = 0;
+                    continue;
+                }
+                const flat_bvh_node& n = binary[kids[k]];
+                node.bmin_x[k] = n.bmin[0];
+                node.bmin_y[k] = n.bmin[1];
+                node.bmin_z[k] = n.bmin[2];
+                node.bmax_x[k] = n.bmax[0];
+                node.bmax_y[k] = n.bmax[1];
+                node.bmax_z[k] = n.bmax[2];
+                node.child[k] = child[k];
+                node.count[k] = n.count;
+            }
+            return index;
+        }
+    };
+
+    collapser{ binary, nodes }.collapse(0);
+    return nodes;
+}
+
+// Slab test of one ray against every child of a node. The near plane of each axis is picked
+// from the sign of the inverse direction, so no min/max is needed per axis and NaNs from
+// 0 * inf leave the interval unchanged, as in flat_bvh_box_hit. Returns a bit per child hit
+// and writes the entry distances.
+template <int N>
+unsigned wide_bvh_children_hit(const wide_bvh_node<N>& node, const float org[3], const float inv_dir[3],
+                               const bool neg[3], float t_min, float t_max, float t_entry[N]) {
+    static_assert(N == wide_bvh_width, "the box test kernels handle 8-wide nodes");
+    return simd_active.box_hit8(node, org, inv_dir, neg, t_min, t_max, t_entry);
+}
+
+// Same contract as flat_bvh_traverse. The children hit at a node are pushed farthest first,
+// and entries whose box is entered beyond a t_max shortened since they were pushed are
+// dropped without being fetched. `root` starts the walk inside a subtree.
+template <int N, typename LeafFn>
+bool wide_bvh_traverse(const wide_bvh_node<N>* nodes, size_t node_count, const float org[3],
+                       const float dir[3], float t_min, float& t_max, LeafFn&& leaf, uint32_t root = 0) {
+    if (node_count == 0) return false;
+
+    float inv_dir[3] = { 1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2] };
+    bool neg[3] = { std::signbit(inv_dir[0]), std::signbit(inv_dir[1]), std::signbit(inv_dir[2]) };
+
+    struct entry {
+        uint32_t child;
+        uint32_t count;
+        float t;
+    };
+    // Each visit replaces one entry with at most N, within the depth flat_bvh_traverse allows.
+    entry stack[128 * (N - 1) + 1];
+    int top = 0;
+    stack[top++] = { root, 0, t_min };
+    bool hit_anything = false;
+
+    while (top > 0) {
+        entry e = stack[--top];
+        if (e.t > t_max) continue;
+
+        if (e.count != 0) {
+            if (leaf(e.child, e.count, t_max))
+                hit_anything = true;
+            continue;
+        }
+
+        const wide_bvh_node<N>& node = nodes[e.child];
+        float t_entry[N];
+        unsigned mask = wide_bvh_children_hit(node, org, inv_dir, neg, t_min, t_max, t_entry);
+        if (mask == 0) continue;
+
+        // Insertion sort by decreasing distance; at most N entries.
+        entry hits[N];
+        int hit_count = 0;
+        for (int k = 0; k < N; k++) {
+            if (!(mask & (1u << k))) continue;
+            entry h{ node.child[k], node.count[k], t_entry[k] };
+            int j = hit_count++;
+            while (j > 0 && hits[j - 1].t < h.t) {
+                hits[j] = hits[j - 1];
+                j--;
+            }
+            hits[j] = h;
+        }
+        for (int k = 0; k < hit_count; k++)
+            stack[top++] = hits[k];
+    }
+    return hit_anything;
+}
+
+// Packet of P rays traced together, one lane per ray.
+template <int P>
+struct wide_bvh_packet {
+    float org[P][3];
+    float dir[P][3];
+};
+
+// Slab test of the children of `node` in the `children` mask against every lane of a packet.
+// Writes per child a bit for each lane hitting it within [t_min, t_max[lane]] and the
+// nearest entry distance over those lanes.
+template <int N, int P>
+void wide_bvh_children_hit_packet(const wide_bvh_node<N>& node, unsigned children, const wide_bvh_packet_lanes<P>& lanes,
+                                  const bool neg[3], float t_min, const float t_max[P], uint32_t hits[N], float t_entry[N]) {
+    static_assert(N == wide_bvh_width && P == 8, "the packet box test kernels handle 8-wide nodes and 8-ray packets");
+    simd_active.box_hit_packet8(node, children, lanes, neg, t_min, t_max, hits, t_entry);
+}
+
+// Traces the `active` lanes of a packet through the tree at once, so each node is fetched
+// once for every ray that reaches it. A child is first tested against the interval spanned
+// by all the origins and inverse directions of the packet, which culls it for the whole
+// packet with one conservative test; the children left are tested against all the rays at
+// once. A subtree reached by a single ray is finished with wide_bvh_traverse.
+//
+// `leaf` is called as leaf(first, count, lanes) and shortens t_max[lane] for the lanes it
+// hits. Returns false without tracing anything when the rays do not share the sign of
+// every direction component: the interval test needs it, and such packets are not coherent
+// enough to gain from sharing nodes anyway.
+template <int N, int P, typename LeafFn>
+bool wide_bvh_traverse_packet(const wide_bvh_node<N>* nodes, size_t node_count, const wide_bvh_packet<P>& packet,
+                              uint32_t active, float t_min, float t_max[P], LeafFn&& leaf) {
+    static_assert(P <= 32, "lane masks are 32 bits");
+    if (node_count == 0 || active == 0) return true;
+
+    // Inactive lanes get the first active ray, so they never widen the intervals; their bit
+    // is masked off the results.
+    int first_lane = std::countr_zero(active);
+    wide_bvh_packet_lanes<P> lanes;
+    bool neg[3];
+    float org_lo[3], org_hi[3], inv_lo[3], inv_hi[3];
+    for (int a = 0; a < 3; a++) {
+        float inv0 = 1.0f / packet.dir[first_lane][a];
+        if (!std::isfinite(inv0)) return false;
+        neg[a] = std::signbit(inv0);
+        org_lo[a] = org_hi[a] = packet.org[first_lane][a];
+        inv_lo[a] = inv_hi[a] = inv0;
+        for (int l = 0; l < P; l++) {
+            int src = (active & (1u << l)) ? l : first_lane;
+            float inv = 1.0f / packet.dir[src][a];
+            if (!std::isfinite(inv) || std::signbit(inv) != neg[a]) return false;
+            lanes.org[a][l] = packet.org[src][a];
+            lanes.inv_dir[a][l] = inv;
+            org_lo[a] = std::min(org_lo[a], lanes.org[a][l]);
+            org_hi[a] = std::max(org_hi[a], lanes.org[a][l]);
+            inv_lo[a] = std::min(inv_lo[a], inv);
+            inv_hi[a] = std::max(inv_hi[a], inv);
+        }
+    }
+
+    struct entry {
+        uint32_t child;
+        uint32_t count;
+        uint32_t lanes;
+        float t; // Nearest entry over the lanes
+    };
+    entry stack[128 * (N - 1) + 1];
+    int top = 0;
+    stack[top++] = { 0, 0, active, t_min };
+
+    while (top > 0) {
+        entry e = stack[--top];
+        uint32_t live = 0;
+        float packet_t_max = t_min;
+        for (uint32_t m = e.lanes; m; m &= m - 1) {
+            int l = std::countr_zero(m);
+            if (e.t > t_max[l]) continue;
+            live |= 1u << l;
+            packet_t_max = std::max(packet_t_max, t_max[l]);
+        }
+        if (live == 0) continue;
+
+        if (e.count != 0) {
+            leaf(e.child, e.count, live);
+            continue;
+        }
+
+        if ((live & (live - 1)) == 0) {
+            int l = std::countr_zero(live);
+            auto single = [&](uint32_t first, uint32_t count, float& lane_t_max) {
+                float before = lane_t_max; // Aliases t_max[l], which `leaf` updates
+                leaf(first, count, live);
+                return lane_t_max < before;
+            };
+            wide_bvh_traverse(nodes, node_count, packet.org[l], packet.dir[l], t_min, t_max[l], single, e.child);
+            continue;
+        }
+
+        const wide_bvh_node<N>& node = nodes[e.child];
+        const float* near_planes[3] = { neg[0] ? node.bmax_x : node.bmin_x,
+                                        neg[1] ? node.bmax_y : node.bmin_y,
+                                        neg[2] ? node.bmax_z : node.bmin_z };
+        const float* far_planes[3] = { neg[0] ? node.bmin_x : node.bmax_x,
+                                       neg[1] ? node.bmin_y : node.bmax_y,
+                                       neg[2] ? node.bmin_z : node.bmax_z };
+
+        // Bounds of the entry and exit distances over every ray of the packet. With the sign
+        // of the inverse direction fixed per axis, each bound comes from one corner of the
+        // origin and inverse direction intervals.
+        unsigned children = 0;
+        for (int k = 0; k < N; k++) {
+            float enter = t_min, leave = packet_t_max;
+            for (int a = 0; a < 3; a++) {
+                float d0 = near_planes[a][k] - (neg[a] ? org_lo[a] : org_hi[a]);
+                float d1 = far_planes[a][k] - (neg[a] ? org_hi[a] : org_lo[a]);
+                enter = std::max(enter, d0 * (d0 >= 0 ? inv_lo[a] : inv_hi[a]));
+                leave = std::min(leave, d1 * (d1 >= 0 ? inv_hi[a] : inv_lo[a]));
+            }
+            if (enter <= leave) children |= 1u << k;
+        }
+        if (children == 0) continue;
+
+        uint32_t lane_hits[N];
+        float t_entry[N];
+        wide_bvh_children_hit_packet(node, children, lanes, neg, t_min, t_max, lane_hits, t_entry);
+
+        entry hits[N];
+        int hit_count = 0;
+        for (int k = 0; k < N; k++) {
+            uint32_t hit = live & lane_hits[k];
+            if (hit == 0) continue;
+
+            // Insertion sort by decreasing distance; at most N entries.
+            entry h{ node.child[k], node.count[k], hit, t_entry[k] };
+            int j = hit_count++;
+            while (j > 0 && hits[j - 1].t < h.t) {
+                hits[j] = hits[j - 1];
+                j--;
+            }
+            hits[j] = h;
+        }
+        for (int k = 0; k < hit_count; k++)
+            stack[top++] = hits[k];
+    }
+    return true;
+}
+
+#endif